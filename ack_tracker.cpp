@@ -0,0 +1,77 @@
+/* This file is part of Equine Monitor
+ *
+ * Equine Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Equine Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Equine Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Konke Radlow <koradlow@gmail.com>
+ */
+
+#include "ack_tracker.h"
+#include "logger.h"
+#include <gbee.h>
+
+/** Ack_Tracker Class implementation */
+Ack_Tracker::Ack_Tracker() {}
+
+void Ack_Tracker::committed(XBee_Message **msgs, uint16_t count) {
+	std::lock_guard<std::mutex> guard(lock);
+	for (uint16_t i = 0; i < count; i++) {
+		const XBee_Address &address = msgs[i]->get_address();
+		uint8_t sequence = msgs[i]->get_sequence();
+		Node &node = pending[address.get_addr64()];
+		/* the 16bit address of the sender might have changed */
+		node.address = address;
+		if (!node.ranges.empty()) {
+			AckRange &last = node.ranges.back();
+			if ((uint8_t)(last.sequence + 1) == sequence && last.count < UINT8_MAX) {
+				last.sequence = sequence;
+				last.count++;
+				continue;
+			}
+		}
+		AckRange range = {sequence, 1};
+		node.ranges.push_back(range);
+	}
+	committed_msgs.add(count);
+}
+
+void Ack_Tracker::send(XBee &interface) {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		pending.swap(sending);
+	}
+	for (std::unordered_map<uint64_t, Node>::iterator it = sending.begin();
+	     it != sending.end(); ++it) {
+		const std::vector<AckRange> &ranges = it->second.ranges;
+		/* nodes with many gaps get several acknowledgements */
+		for (size_t i = 0; i < ranges.size(); i += MSG_MAX_ACK_RANGES) {
+			size_t range_cnt = ranges.size() - i;
+			if (range_cnt > MSG_MAX_ACK_RANGES)
+				range_cnt = MSG_MAX_ACK_RANGES;
+			if (interface.xbee_send_ackn(it->second.address, &ranges[i], range_cnt) ==
+			    GBEE_NO_ERROR)
+				sent_acks.add(1);
+			else
+				failed_acks.add(1);
+		}
+	}
+	sending.clear();
+}
+
+void Ack_Tracker::register_metrics(Metrics_Registry &registry) const {
+	registry.add_counter("ehm_ack_messages_total",
+		"Committed messages that are acknowledged to their sender", &committed_msgs);
+	registry.add_counter("ehm_ack_sent_total", "Acknowledgements sent", &sent_acks);
+	registry.add_counter("ehm_ack_failed_total",
+		"Acknowledgements that could not be sent", &failed_acks);
+}
@@ -0,0 +1,66 @@
+/* This file is part of Equine Monitor
+ *
+ * Equine Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Equine Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Equine Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Konke Radlow <koradlow@gmail.com>
+ */
+
+#ifndef ACK_TRACKER_H
+#define ACK_TRACKER_H
+
+#include "xbee_if.h"
+#include "metrics.h"
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <inttypes.h>
+
+/* collects the messages that were committed to the database, and sends
+ * batched acknowledgements to their senders. The writer thread reports each
+ * committed batch, the acknowledgements are sent by the thread that owns the
+ * XBee interface. Consecutive sequence numbers of a node are merged into one
+ * AckRange, a gap (a message that was dropped before it was stored) starts a
+ * new range, so a dropped message is never acknowledged */
+class Ack_Tracker {
+public:
+	Ack_Tracker();
+
+	/* records the messages of a committed batch */
+	void committed(XBee_Message **msgs, uint16_t count);
+	/* sends one acknowledgement per node with the ranges committed since
+	 * the last call */
+	void send(XBee &interface);
+	/* adds the committed and sent counters to the registry */
+	void register_metrics(Metrics_Registry &registry) const;
+private:
+	Ack_Tracker(const Ack_Tracker&);
+	Ack_Tracker& operator=(const Ack_Tracker&);
+
+	typedef struct {
+		XBee_Address address;
+		std::vector<AckRange> ranges;
+	} Node;
+
+	/* the nodes are swapped with the sending map, so the writer thread
+	 * isn't blocked while the acknowledgements are sent */
+	std::unordered_map<uint64_t, Node> pending;
+	std::unordered_map<uint64_t, Node> sending;
+	std::mutex lock;
+
+	Metrics_Counter committed_msgs;
+	Metrics_Counter sent_acks;
+	Metrics_Counter failed_acks;
+};
+
+#endif
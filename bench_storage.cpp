@@ -0,0 +1,489 @@
+/* This file is part of Equine Monitor
+ *
+ * Equine Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Equine Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Equine Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Konke Radlow <koradlow@gmail.com>
+ */
+
+/* micro benchmark of the hot paths between the serial port and the db:
+ * 	- MessageStorage::serialize and deserialize of each sensor type
+ * 	- reassembly of multipart messages with XBee_Reassembly::add_part at
+ * 	  different part counts
+ * 	- calculate_gps_position, calculate_temperature and the batch kernel
+ * 	- Message_Storage::store_msg and store_msgs on an in-memory SQLite db
+ * 	- time range scans of accelerometer samples stored as rows and blocks
+ * 	- the ingest of a received message from its frames to the db, with
+ * 	  messages from the heap and from the XBee_Message_Pool
+ * Each case is repeated until it ran for the minimum time. The time per
+ * operation, the heap allocations per operation (operator new and the
+ * allocator of SQLite, counted separately) and the throughput are reported. The log
+ * messages are printed to stdout, stdout is redirected to /dev/null while
+ * the cases run and the results are printed to stderr.
+ * usage: bench_storage [-t min_time_ms] [-n samples per message] [-f filter]
+ * build: g++ -std=gnu++0x -O2 -I. -Iehm-common -Ixbee_if -DEHM_BASE_STATION
+ * 	bench_storage.cpp sqlite_helper.cpp node_registry.cpp sensor_registry.cpp
+ * 	sensor_rollup.cpp sample_block_store.cpp temperature.cpp metrics.cpp xbee_if/xbee_if.cpp
+ * 	xbee_if/xbee_frame_parser.cpp xbee_if/xbee_capture.cpp xbee_if/logger.cpp
+ * 	ehm-common/messagestorage.cpp -lgbee -lsqlite3 -lpthread */
+
+#include "controller.h"
+#include "sqlite_helper.h"
+#include "xbee_if.h"
+#include "messagetypes.h"
+#include "messagestorage.h"
+#include <gbee.h>
+#include <sqlite3.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <functional>
+#include <new>
+#include <string>
+#include <vector>
+
+#define BENCH_MIN_TIME_MS 500
+#define BENCH_SAMPLE_CNT 60
+#define BENCH_BATCH_SIZE 32
+/* number of messages in the db of the scan cases */
+#define BENCH_SCAN_MSG_CNT 1000
+/* part counts of the reassembly cases */
+static const uint8_t bench_part_cnts[] = {1, 4, 16, 64, MSG_MAX_PART_CNT};
+
+/* heap allocations of the process, counted by the replaced operator new and
+ * the allocator that is installed in SQLite */
+static uint64_t alloc_cnt;
+static uint64_t sqlite_alloc_cnt;
+static sqlite3_mem_methods sqlite_mem;
+/* keeps the results of the conversions from being optimized away */
+volatile double bench_sink;
+
+/* the replacements of operator new and delete share these functions. They
+ * are not inlined, otherwise the compiler sees the pointers of operator new
+ * released with free and warns about mismatched allocation functions */
+static __attribute__((noinline)) void* bench_alloc(size_t size) {
+	alloc_cnt++;
+	return malloc(size ? size : 1);
+}
+
+static __attribute__((noinline)) void bench_free(void *ptr) {
+	free(ptr);
+}
+
+void* operator new(size_t size) {
+	void *ptr = bench_alloc(size);
+	if (!ptr)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void* operator new[](size_t size) {
+	return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+	return bench_alloc(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+	return bench_alloc(size);
+}
+
+void operator delete(void *ptr) noexcept {
+	bench_free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept {
+	bench_free(ptr);
+}
+
+void operator delete(void *ptr, const std::nothrow_t&) noexcept {
+	bench_free(ptr);
+}
+
+void operator delete[](void *ptr, const std::nothrow_t&) noexcept {
+	bench_free(ptr);
+}
+
+static void* bench_sqlite_malloc(int size) {
+	sqlite_alloc_cnt++;
+	return sqlite_mem.xMalloc(size);
+}
+
+static void* bench_sqlite_realloc(void *ptr, int size) {
+	sqlite_alloc_cnt++;
+	return sqlite_mem.xRealloc(ptr, size);
+}
+
+/* wraps the default allocator of SQLite, this has to be done before the
+ * library is initialized */
+static void count_sqlite_allocations() {
+	sqlite3_mem_methods methods;
+	sqlite3_config(SQLITE_CONFIG_GETMALLOC, &sqlite_mem);
+	methods = sqlite_mem;
+	methods.xMalloc = bench_sqlite_malloc;
+	methods.xRealloc = bench_sqlite_realloc;
+	sqlite3_config(SQLITE_CONFIG_MALLOC, &methods);
+}
+
+/* gives the benchmark access to the private reassembly of XBee_Message */
+typedef struct {
+	std::string name;
+	std::function<void()> op;
+	double items;		/* items processed by one operation */
+	const char *unit;	/* unit of the items, for the throughput */
+} Bench_Case;
+
+static double now_s() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* fills a serialized sensor message with sample_cnt samples of the type,
+ * returns the serialized length */
+static uint16_t build_sensor_msg(DeviceType type, uint8_t sample_cnt, uint8_t *data) {
+	uint8_t samples[UINT8_MAX * sizeof(AccelerometerMessage)];
+	SensorMessage sensor;
+	MessagePacket packet;
+
+	packet.mainType = msgSensorData;
+	packet.relTimestampS = 1000;
+	packet.payload = (uint8_t*) &sensor;
+	sensor.sensorType = type;
+	sensor.endTimestampS = 990;
+	sensor.sampleIntervalMs = 1000;
+	sensor.arrayLength = sample_cnt;
+	sensor.sensorMsgArray = samples;
+	for (uint8_t i = 0; i < sample_cnt; i++) {
+		switch (type) {
+		case typeHeartRate:
+			((HeartRateMessage*) samples)[i].bpm = 60 + rand() % 20;
+			break;
+		case typeRawTemperature:
+			((RawTemperatureMessage*) samples)[i].Vobj = rand() % 400 - 200;
+			((RawTemperatureMessage*) samples)[i].Tenv = 11000 + rand() % 2000;
+			break;
+		case typeAccelerometer:
+			((AccelerometerMessage*) samples)[i].x = rand() % 1024 - 512;
+			((AccelerometerMessage*) samples)[i].y = rand() % 1024 - 512;
+			((AccelerometerMessage*) samples)[i].z = rand() % 1024 - 512;
+			break;
+		default: {
+			GPSMessage *gps = &((GPSMessage*) samples)[i];
+			memset(gps, 0, sizeof(*gps));
+			gps->latitude.degree = 52;
+			gps->latitude.minute = rand() % 60;
+			gps->latitude.second = rand() % 60;
+			gps->latitudeNorth = true;
+			gps->longitude.degree = 13;
+			gps->longitude.minute = rand() % 60;
+			gps->longitude.second = rand() % 60;
+			gps->validPosFix = true;
+		}
+		}
+	}
+	return MessageStorage::serialize(&packet, data);
+}
+
+/* splits a payload of part_cnt full parts into RxPacket frames */
+static void build_parts(uint8_t part_cnt, std::vector<GBeeRxPacket> &parts) {
+	parts.resize(part_cnt);
+	for (uint16_t part = 1; part <= part_cnt; part++) {
+		GBeeRxPacket &rx = parts[part - 1];
+		memset(&rx, 0, sizeof(rx));
+		rx.ident = GBEE_RX_PACKET;
+		rx.srcAddr64h = 0x0013A200;
+		rx.srcAddr64l = 0x40000001;
+		rx.srcAddr16 = 0x1000;
+		rx.options = 0x01;
+		rx.data[MSG_PART] = part;
+		rx.data[MSG_PART_CNT] = part_cnt;
+		rx.data[MSG_PAYLOAD_LENGTH] = MSG_PART_PAYLOAD_LENGTH;
+		for (uint8_t i = 0; i < MSG_PART_PAYLOAD_LENGTH; i++)
+			rx.data[MSG_HEADER_LENGTH + i] = part + i;
+	}
+}
+
+/* gives the parts the next sequence number, the reassembly drops parts of
+ * a message that was completed within the timeout */
+static void next_sequence(std::vector<GBeeRxPacket> &parts) {
+	for (size_t i = 0; i < parts.size(); i++)
+		parts[i].data[MSG_SEQUENCE]++;
+}
+
+/* splits a serialized message into RxPacket frames */
+static void split_message(const uint8_t *data, uint16_t length, std::vector<GBeeRxPacket> &parts) {
+	uint8_t part_cnt = (length + MSG_PART_PAYLOAD_LENGTH - 1) / MSG_PART_PAYLOAD_LENGTH;
+	build_parts(part_cnt, parts);
+	for (uint16_t part = 1; part <= part_cnt; part++) {
+		uint16_t offset = (part - 1) * MSG_PART_PAYLOAD_LENGTH;
+		uint16_t part_len = part == part_cnt ? length - offset : MSG_PART_PAYLOAD_LENGTH;
+		parts[part - 1].data[MSG_PAYLOAD_LENGTH] = part_len;
+		memcpy(&parts[part - 1].data[MSG_HEADER_LENGTH], &data[offset], part_len);
+	}
+}
+
+/* runs the operation until the minimum time is reached, doubling the number
+ * of iterations per round, and prints the results of the last round */
+static void run_case(FILE *out, const Bench_Case &bench, double min_time_s) {
+	uint64_t iterations = 1;
+	uint64_t allocs, sqlite_allocs;
+	double elapsed;
+
+	/* the first call fills caches and prepares statements */
+	bench.op();
+	for (;;) {
+		allocs = alloc_cnt;
+		sqlite_allocs = sqlite_alloc_cnt;
+		double start = now_s();
+		for (uint64_t i = 0; i < iterations; i++)
+			bench.op();
+		elapsed = now_s() - start;
+		allocs = alloc_cnt - allocs;
+		sqlite_allocs = sqlite_alloc_cnt - sqlite_allocs;
+		if (elapsed >= min_time_s)
+			break;
+		/* aim for the minimum time in the next round */
+		uint64_t next = elapsed > 0 ? iterations * 1.2 * min_time_s / elapsed : iterations * 100;
+		iterations = next > iterations * 100 ? iterations * 100 : next > iterations ? next : iterations * 2;
+	}
+
+	double items_s = bench.items * iterations / elapsed;
+	const char *scale = "";
+	if (items_s >= 1e6) {
+		items_s /= 1e6;
+		scale = "M";
+	} else if (items_s >= 1e3) {
+		items_s /= 1e3;
+		scale = "k";
+	}
+	fprintf(out, "%-32s %12.1f %10.2f %10.2f %10.2f %s%s/s\n", bench.name.c_str(),
+		elapsed * 1e9 / iterations, (double) allocs / iterations,
+		(double) sqlite_allocs / iterations, items_s, scale, bench.unit);
+}
+
+int main(int argc, char **argv) {
+	uint32_t min_time_ms = BENCH_MIN_TIME_MS;
+	uint8_t sample_cnt = BENCH_SAMPLE_CNT;
+	const char *filter = NULL;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "t:n:f:")) != -1) {
+		switch (opt) {
+		case 't': min_time_ms = strtoul(optarg, NULL, 0); break;
+		case 'n': sample_cnt = strtoul(optarg, NULL, 0); break;
+		case 'f': filter = optarg; break;
+		default:
+			fprintf(stderr, "usage: %s [-t min_time_ms] [-n samples per message] [-f filter]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (!sample_cnt)
+		sample_cnt = 1;
+	srand(1);
+	count_sqlite_allocations();
+
+	/* the results go to stderr, the status messages of the measured
+	 * functions are discarded */
+	fflush(stdout);
+	int null_fd = open("/dev/null", O_WRONLY);
+	if (null_fd >= 0) {
+		dup2(null_fd, STDOUT_FILENO);
+		close(null_fd);
+	}
+
+	const DeviceType types[] = {typeGPS, typeAccelerometer, typeRawTemperature, typeHeartRate};
+	const char *type_names[] = {"gps", "accelerometer", "temperature", "heart_rate"};
+	const uint8_t type_cnt = sizeof(types) / sizeof(types[0]);
+	std::vector<Bench_Case> cases;
+
+	/* serialized messages and the source packets of each sensor type */
+	static uint8_t serialized[type_cnt][UINT8_MAX * sizeof(AccelerometerMessage) + 64];
+	static uint8_t deserialized[sizeof(MessagePacket) + sizeof(SensorMessage) +
+		UINT8_MAX * sizeof(AccelerometerMessage) + 64];
+	uint16_t lengths[type_cnt];
+	for (uint8_t t = 0; t < type_cnt; t++)
+		lengths[t] = build_sensor_msg(types[t], sample_cnt, serialized[t]);
+
+	/* serialize and deserialize */
+	for (uint8_t t = 0; t < type_cnt; t++) {
+		uint8_t *data = serialized[t];
+		cases.push_back({string("deserialize/") + type_names[t], [data]() {
+			MessageStorage::deserialize(data, (MessagePacket*) deserialized);
+		}, (double) lengths[t], "B"});
+	}
+	/* serialize the packets that deserialize produces, they are
+	 * deserialized once before the cases run */
+	static uint8_t packets[type_cnt][sizeof(deserialized)];
+	for (uint8_t t = 0; t < type_cnt; t++) {
+		MessagePacket *packet = (MessagePacket*) packets[t];
+		MessageStorage::deserialize(serialized[t], packet);
+		cases.push_back({string("serialize/") + type_names[t], [packet]() {
+			static uint8_t out[sizeof(serialized[0])];
+			MessageStorage::serialize(packet, out);
+		}, (double) lengths[t], "B"});
+	}
+
+	/* reassembly of multipart messages */
+	static std::vector<GBeeRxPacket> parts[sizeof(bench_part_cnts)];
+	static XBee_Reassembly reassembly(1, XBEE_REASSEMBLY_TIMEOUT_MS);
+	for (uint8_t p = 0; p < sizeof(bench_part_cnts); p++) {
+		build_parts(bench_part_cnts[p], parts[p]);
+		std::vector<GBeeRxPacket> *rx = &parts[p];
+		char name[32];
+		snprintf(name, sizeof(name), "add_part/%u", bench_part_cnts[p]);
+		cases.push_back({name, [rx]() {
+			uint16_t length = XBEE_RX_PACKET_OVERHEAD + XBEE_MSG_LENGTH;
+			next_sequence(*rx);
+			for (size_t i = 0; i < rx->size(); i++)
+				xbee_free_message(reassembly.add_part(&(*rx)[i], length));
+		}, (double) bench_part_cnts[p] * MSG_PART_PAYLOAD_LENGTH, "B"});
+	}
+
+	/* sensor value conversions, the samples are taken from the serialized
+	 * messages */
+	const uint16_t sample_offset = 5 + sizeof(SensorMessage) - sizeof(void*);
+	const GPSMessage *gps = (const GPSMessage*) &serialized[0][sample_offset];
+	const RawTemperatureMessage *temps = (const RawTemperatureMessage*) &serialized[2][sample_offset];
+	cases.push_back({"calculate_gps_position", [gps, sample_cnt]() {
+		for (uint8_t i = 0; i < sample_cnt; i++)
+			bench_sink = calculate_gps_position(&gps[i]).latitude;
+	}, (double) sample_cnt, "samples"});
+	cases.push_back({"calculate_temperature", [temps, sample_cnt]() {
+		for (uint8_t i = 0; i < sample_cnt; i++)
+			bench_sink = calculate_temperature(temps[i].Tenv, temps[i].Vobj);
+	}, (double) sample_cnt, "samples"});
+	cases.push_back({"calculate_temperatures", [temps, sample_cnt]() {
+		double values[UINT8_MAX];
+		calculate_temperatures(temps, sample_cnt, values);
+		bench_sink = values[0];
+	}, (double) sample_cnt, "samples"});
+
+	/* store path on an in-memory db */
+	sqlite3 *db;
+	if (sqlite3_open(":memory:", &db) != SQLITE_OK) {
+		fprintf(stderr, "Error opening in-memory db: %s\n", sqlite3_errmsg(db));
+		return 1;
+	}
+	create_db_tables(db);
+	Message_Storage *storage = new Message_Storage(db);
+	XBee_Address address("bench", 0x1000, 0x0013A200, 0x40000001);
+	static XBee_Message *msgs[type_cnt];
+	for (uint8_t t = 0; t < type_cnt; t++) {
+		msgs[t] = new XBee_Message(address, serialized[t], lengths[t]);
+		XBee_Message *msg = msgs[t];
+		cases.push_back({string("store_msg/") + type_names[t], [storage, msg]() {
+			storage->store_msg(msg);
+		}, (double) sample_cnt, "rows"});
+	}
+	static XBee_Message *batch[BENCH_BATCH_SIZE];
+	for (uint8_t i = 0; i < BENCH_BATCH_SIZE; i++)
+		batch[i] = msgs[i % type_cnt];
+	char name[32];
+	snprintf(name, sizeof(name), "store_msgs/%u", BENCH_BATCH_SIZE);
+	cases.push_back({name, [storage]() {
+		storage->store_msgs(batch, BENCH_BATCH_SIZE);
+	}, (double) sample_cnt * BENCH_BATCH_SIZE, "rows"});
+
+	/* accelerometer samples stored in blocks instead of rows */
+	sqlite3 *block_db;
+	sqlite3_open(":memory:", &block_db);
+	create_db_tables(block_db);
+	Sensor_Storage_Options block_options;
+	block_options.block_tables.insert(TABLE_SENSOR_ACCEL);
+	Message_Storage *block_storage = new Message_Storage(block_db, NODE_FLUSH_INTERVAL_MS,
+			block_options);
+	cases.push_back({"store_msg/accelerometer_blocks", [block_storage]() {
+		block_storage->store_msg(msgs[1]);
+	}, (double) sample_cnt, "samples"});
+
+	/* time range scans over BENCH_SCAN_MSG_CNT consecutive accelerometer
+	 * messages, stored as rows and as blocks in their own dbs */
+	static sqlite3 *scan_dbs[2];
+	Message_Storage *scan_storages[2];
+	for (uint8_t d = 0; d < 2; d++) {
+		sqlite3_open(":memory:", &scan_dbs[d]);
+		create_db_tables(scan_dbs[d]);
+		scan_storages[d] = new Message_Storage(scan_dbs[d], NODE_FLUSH_INTERVAL_MS,
+				d ? block_options : Sensor_Storage_Options());
+		for (uint32_t m = 0; m < BENCH_SCAN_MSG_CNT; m++) {
+			scan_storages[d]->set_receive_time(1000000 + m * sample_cnt);
+			scan_storages[d]->store_msg(msgs[1]);
+		}
+		/* the destructor writes the incomplete blocks */
+		delete scan_storages[d];
+	}
+	static sqlite3_stmt *scan_stmt;
+	sqlite3_prepare_v2(scan_dbs[0], "SELECT timestamp, offset_ms, x, y, z FROM "
+		TABLE_SENSOR_ACCEL " WHERE addr64 = ?1", -1, &scan_stmt, NULL);
+	uint64_t addr64 = address.get_addr64();
+	const double scan_cnt = (double) sample_cnt * BENCH_SCAN_MSG_CNT;
+	cases.push_back({"scan/accelerometer_rows", [addr64]() {
+		sqlite3_bind_int64(scan_stmt, 1, addr64);
+		while (sqlite3_step(scan_stmt) == SQLITE_ROW)
+			bench_sink = sqlite3_column_int(scan_stmt, 2);
+		sqlite3_reset(scan_stmt);
+	}, scan_cnt, "samples"});
+	static Sample_Block_Store scan_blocks(scan_dbs[1], TABLE_SENSOR_ACCEL);
+	cases.push_back({"scan/accelerometer_blocks", [addr64]() {
+		scan_blocks.read(addr64, 0, UINT64_MAX, [](uint64_t time_ms,
+				const int32_t *values) {
+			bench_sink = values[0];
+		});
+	}, scan_cnt, "samples"});
+
+	/* ingest of a received accelerometer message: reassembly, storage and
+	 * release of the message */
+	static std::vector<GBeeRxPacket> msg_parts;
+	split_message(serialized[1], lengths[1], msg_parts);
+	static XBee_Reassembly heap_reassembly(1, XBEE_REASSEMBLY_TIMEOUT_MS);
+	static XBee_Message_Pool pool(BENCH_BATCH_SIZE);
+	static XBee_Reassembly pool_reassembly(1, XBEE_REASSEMBLY_TIMEOUT_MS, &pool);
+	XBee_Reassembly *reassemblies[] = {&heap_reassembly, &pool_reassembly};
+	const char *reassembly_names[] = {"ingest/heap", "ingest/pooled"};
+	for (uint8_t r = 0; r < 2; r++) {
+		XBee_Reassembly *reassembly = reassemblies[r];
+		cases.push_back({reassembly_names[r], [storage, reassembly]() {
+			uint16_t length = XBEE_RX_PACKET_OVERHEAD + XBEE_MSG_LENGTH;
+			XBee_Message *msg = NULL;
+			next_sequence(msg_parts);
+			for (size_t i = 0; i < msg_parts.size(); i++)
+				msg = reassembly->add_part(&msg_parts[i], length);
+			storage->store_msg(msg);
+			xbee_free_message(msg);
+		}, (double) sample_cnt, "rows"});
+	}
+
+	fprintf(stderr, "%u samples per message, minimum time %u ms\n", sample_cnt, min_time_ms);
+	fprintf(stderr, "%-32s %12s %10s %10s %10s\n", "case", "ns/op", "new/op", "sqlite/op",
+		"throughput");
+	for (size_t i = 0; i < cases.size(); i++) {
+		if (filter && !strstr(cases[i].name.c_str(), filter))
+			continue;
+		run_case(stderr, cases[i], min_time_ms / 1000.0);
+	}
+
+	delete storage;
+	delete block_storage;
+	for (uint8_t t = 0; t < type_cnt; t++)
+		delete msgs[t];
+	sqlite3_finalize(scan_stmt);
+	sqlite3_close(db);
+	sqlite3_close(block_db);
+	return 0;
+}
@@ -0,0 +1,78 @@
+/* This file is part of Equine Monitor
+ *
+ * Equine Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Equine Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Equine Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Konke Radlow <koradlow@gmail.com>
+ */
+
+/* checks the batch temperature kernel calculate_temperatures() against the
+ * reference calculate_temperature(): every 16bit object voltage is converted
+ * at each die temperature the sensor is specified for. Both have to be NaN
+ * for the same inputs (the root of a negative value). The exit status is 1 if
+ * the max absolute error exceeds CHECK_TEMP_TOLERANCE, or the NaNs differ.
+ * usage: check_temperature
+ * build: g++ -std=gnu++0x -O2 -I. -Iehm-common -Ixbee_if -DEHM_BASE_STATION
+ * 	check_temperature.cpp temperature.cpp */
+
+#include "controller.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+
+/* max absolute error in degree Celsius */
+#define CHECK_TEMP_TOLERANCE 1e-6
+/* raw die temperatures of the specified range of the TMP006 (-40 to 125
+ * degree Celsius, 1/128 degree per count), its lower 2 bits are always 0 */
+#define CHECK_TEMP_DIE_MIN (-40 * 128)
+#define CHECK_TEMP_DIE_MAX (125 * 128)
+#define CHECK_TEMP_DIE_STEP 4
+
+int main() {
+	RawTemperatureMessage samples[UINT8_MAX + 1];
+	double values[UINT8_MAX + 1];
+	double max_error = 0;
+	int max_die = 0, max_obj = 0;
+	uint64_t checked = 0, nan_mismatches = 0;
+
+	for (int die = CHECK_TEMP_DIE_MIN; die <= CHECK_TEMP_DIE_MAX; die += CHECK_TEMP_DIE_STEP) {
+		for (int obj = INT16_MIN; obj <= INT16_MAX; obj += UINT8_MAX + 1) {
+			for (int i = 0; i <= UINT8_MAX; i++) {
+				samples[i].Tenv = die;
+				samples[i].Vobj = obj + i;
+			}
+			calculate_temperatures(samples, UINT8_MAX + 1, values);
+			for (int i = 0; i <= UINT8_MAX; i++) {
+				double reference = calculate_temperature(die, obj + i);
+				checked++;
+				if (isnan(reference) || isnan(values[i])) {
+					if (isnan(reference) != isnan(values[i]))
+						nan_mismatches++;
+					continue;
+				}
+				double error = fabs(values[i] - reference);
+				if (error > max_error) {
+					max_error = error;
+					max_die = die;
+					max_obj = obj + i;
+				}
+			}
+		}
+	}
+	bool passed = max_error <= CHECK_TEMP_TOLERANCE && !nan_mismatches;
+	printf("calculate_temperatures: %llu samples checked, max error %g (Tenv %d, "
+		"Vobj %d), %llu NaN mismatches, tolerance %g: %s\n", (unsigned long long) checked,
+		max_error, max_die, max_obj, (unsigned long long) nan_mismatches,
+		CHECK_TEMP_TOLERANCE, passed ? "passed" : "FAILED");
+	return passed ? 0 : 1;
+}
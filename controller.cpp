@@ -22,75 +22,250 @@
 #include "messagetypes.h"
 #include "messagestorage.h"
 #include "sqlite_helper.h"
+#include "db_writer.h"
+#include "db_checkpoint.h"
+#include "event_loop.h"
+#include "metrics.h"
+#include "metrics_server.h"
+#include "message_trace.h"
+#include "ack_tracker.h"
+#include "logger.h"
 #include <gbee.h>
 #include <gbee-util.h>
 #include <array> 
 #include <string>
 #include <unistd.h>
+#include <strings.h>
 #include <sys/time.h>
 #include <signal.h>
-#include <sstream>
+#include <errno.h>
+#include <string.h>
 #include <time.h>		// Only for testing
 #include <math.h>
 
 using std::string;
-using std::stringstream;
+
+/* interval of the housekeeping timer of the main loop */
+#define CONTROLLER_HOUSEKEEPING_MS 1000
 
 static sqlite3 *db;
+static volatile sig_atomic_t running = 1;
+static volatile sig_atomic_t reload_log_levels = 0;
 
 static void signal_handler_interrupt(int signum);
+static void signal_handler_hangup(int signum);
+static void register_metrics(Metrics_Registry &registry, XBee &interface, DB_Writer &writer);
 
 
 int main(int argc, char** argv){
 	/* register signal handler for interrupt signal, to exit gracefully */
 	signal(SIGINT, signal_handler_interrupt);
+	/* the log levels are read from the config file again on SIGHUP */
+	signal(SIGHUP, signal_handler_hangup);
 	
 	/* try to load the settings from the config file */
 	Settings settings;
 	controller_parse_cl(argc, argv, &settings);
+	/* from here on the log messages are written by a background thread */
+	log_start(settings.log_file, settings.log_buffer_size);
 
 	/* setup XBee interface with settings from config file */
 	XBee_Config config(settings.tty_port, settings.identifier, settings.controller_mode,
-			settings.pan_id, settings.timeout, settings.baud_rate, settings.max_unicast_hops);
+			settings.pan_id, settings.timeout, settings.baud_rate, settings.max_unicast_hops,
+			settings.reassembly_slots, settings.reassembly_timeout_ms, settings.tx_window,
+			settings.address_cache_size, settings.address_cache_ttl_ms,
+			settings.message_pool_size, MSG_HEADER_V1, settings.nack_delay_ms);
 	XBee interface(config);
 	if (interface.xbee_init() != GBEE_NO_ERROR) {
-		printf("Error: unable to configure XBee device");
+		log_error(LOG_MODULE_CONTROLLER, "Error: unable to configure XBee device");
+		log_stop();
 		return -1;
 	}
 	while (interface.xbee_status());
-	printf("Successfully formed or joined ZigBee Network\n");
+	log_info(LOG_MODULE_CONTROLLER, "Successfully formed or joined ZigBee Network");
+
+	/* all received frames are appended to the capture, it can be replayed
+	 * to rebuild the database or for performance tests */
+	XBee_Capture *capture = NULL;
+	if (!settings.capture_path.empty()) {
+		capture = new XBee_Capture(settings.capture_path, settings.capture_segment_size);
+		interface.xbee_set_capture(capture);
+	}
 
 	/* connect to the database, and set it up */
 	int error_code;
-	sqlite3 *db;
 	error_code = sqlite3_open(settings.database_path.c_str(), &db);
 	if (error_code) {
-		printf("Error: cannot open database: %s\n", sqlite3_errmsg(db));
+		log_error(LOG_MODULE_CONTROLLER, "Error: cannot open database: %s",
+			sqlite3_errmsg(db));
 		sqlite3_close(db);
+		log_stop();
 		return -1;
 	}
+	/* acknowledged messages are not sent again by the devices, with acks
+	 * enabled every commit has to be synced to disk before it is acknowledged */
+	if (settings.ack_interval_ms && (!strcasecmp(settings.synchronous.c_str(), "OFF") ||
+			!strcasecmp(settings.synchronous.c_str(), "NORMAL"))) {
+		log_warn(LOG_MODULE_CONTROLLER, "synchronous = %s is not durable with acknowledgements"
+			" enabled, using FULL", settings.synchronous.c_str());
+		settings.synchronous = "FULL";
+	}
+	bool wal_mode = configure_db(db, settings.journal_mode, settings.synchronous,
+			settings.mmap_size);
 	create_db_tables(db);
 	
-	/* system initialization complete - start main control loop */
-	Message_Storage database;
+	/* system initialization complete - start the writer thread and the
+	 * main control loop. The main loop only receives messages and hands
+	 * them over to the writer thread, which stores them in the database */
+	Sensor_Storage_Options storage_options;
+	storage_options.rollup_flush_interval_ms = settings.rollup_flush_interval_ms;
+	storage_options.block_tables = settings.block_tables;
+	storage_options.block_samples = settings.block_samples;
+	storage_options.block_flush_interval_ms = settings.block_flush_interval_ms;
+	Message_Storage *database = new Message_Storage(db, settings.node_flush_interval_ms,
+			storage_options);
+	DB_Writer *writer = new DB_Writer(*database, settings.write_queue_size,
+			settings.write_batch_size);
+	/* sampled messages are timestamped in each stage of the pipeline */
+	Message_Tracer *tracer = NULL;
+	if (!settings.trace_path.empty()) {
+		tracer = new Message_Tracer(settings.trace_path, settings.trace_sample_interval);
+		if (tracer->open()) {
+			writer->set_tracer(tracer);
+		} else {
+			delete tracer;
+			tracer = NULL;
+		}
+	}
+	/* the committed messages are acknowledged to their senders in batches */
+	Ack_Tracker *acks = NULL;
+	if (settings.ack_interval_ms) {
+		acks = new Ack_Tracker();
+		writer->set_ack_tracker(acks);
+	}
+	writer->start();
+	/* in WAL mode the checkpoints are run from a background thread */
+	DB_Checkpointer *checkpointer = NULL;
+	if (wal_mode) {
+		checkpointer = new DB_Checkpointer(settings.database_path, *writer, *database,
+				settings.checkpoint_idle_ms, settings.checkpoint_max_delay_ms);
+		checkpointer->start();
+	}
 	
-	printf("Waiting for messages\n");
-	while (1) {
-		XBee_Message *msg = NULL;
-		/* try to decode a message if there's data in the receive buffer */
-		if (interface.xbee_bytes_available()) {
-			msg = interface.xbee_receive_message();
-			/* if a message was decoded, store it in the database */
-			if (msg->is_complete()) {
-				database.store_msg(db, msg);
+	/* the main loop sleeps until data arrives on the serial device. The
+	 * housekeeping timer makes sure the loop checks the running flag
+	 * regularly, even if no data arrives */
+	Event_Loop event_loop;
+	event_loop.add_fd(interface.xbee_get_fd(), [&]() {
+		/* decode messages while there's data in the receive buffer */
+		do {
+			XBee_Message *msg = interface.xbee_receive_message();
+			/* if a message was decoded, pass it on to the writer thread */
+			if (!msg->is_complete()) {
+				xbee_free_message(msg);
+				break;
+			}
+			if (tracer)
+				tracer->sample(msg);
+			if (!writer->enqueue(msg)) {
+				log_error(LOG_MODULE_CONTROLLER, "Error: write queue full, dropping message");
+				if (tracer)
+					tracer->discard(msg);
+				xbee_free_message(msg);
 			}
-			delete msg;
+		} while (interface.xbee_bytes_available() > 0);
+	});
+	event_loop.add_timer(CONTROLLER_HOUSEKEEPING_MS, [&]() {
+		/* incomplete messages time out and their missing parts are
+		 * requested even if nothing is received */
+		interface.xbee_housekeeping();
+		if (reload_log_levels) {
+			reload_log_levels = 0;
+			log_info(LOG_MODULE_CONTROLLER, "Reloading log levels from %s",
+				settings.config_file_path.c_str());
+			ini_parse(settings.config_file_path.c_str(), controller_log_ini_cb, NULL);
+		}
+	});
+	if (acks)
+		event_loop.add_timer(settings.ack_interval_ms, [&]() {
+			acks->send(interface);
+		});
+
+	/* the metrics are formatted in the event loop, the counters of the
+	 * XBee interface are read in the thread that updates them */
+	Metrics_Registry metrics;
+	register_metrics(metrics, interface, *writer);
+	database->register_metrics(metrics);
+	if (acks)
+		acks->register_metrics(metrics);
+	Metrics_Server metrics_server(metrics, event_loop);
+	if (!settings.metrics_address.empty())
+		metrics_server.start(settings.metrics_address);
+
+	log_info(LOG_MODULE_CONTROLLER, "Waiting for messages");
+	while (running) {
+		if (event_loop.run_once(-1) < 0) {
+			log_error(LOG_MODULE_CONTROLLER, "Error waiting for events: %s",
+				strerror(errno));
+			break;
 		}
-		
-		usleep(500);
 	}
 
+	/* store the queued messages and close the database connection */
+	metrics_server.stop();
+	writer->stop();
+	/* the messages stored after the last timer are acknowledged as well */
+	if (acks)
+		acks->send(interface);
+	if (checkpointer) {
+		checkpointer->stop();
+		log_info(LOG_MODULE_CONTROLLER, "WAL: %u checkpoints, %u busy",
+			checkpointer->get_checkpoint_cnt(), checkpointer->get_busy_cnt());
+		delete checkpointer;
+	}
+	log_info(LOG_MODULE_CONTROLLER, "Write queue: %u messages stored in %u transactions, "
+		"%u transactions failed, high water mark %u of %u, %u rejected",
+		writer->get_stored_cnt(), writer->get_batch_cnt(), writer->get_failed_batch_cnt(),
+		writer->get_queue_high_water_mark(), writer->get_queue_capacity(),
+		writer->get_rejected_cnt());
+	if (tracer) {
+		tracer->close();
+		log_info(LOG_MODULE_CONTROLLER, "Trace: %u messages traced to %s",
+			tracer->get_trace_cnt(), settings.trace_path.c_str());
+	}
+	const XBee_Reassembly_Stats &reassembly = interface.xbee_reassembly_stats();
+	log_info(LOG_MODULE_CONTROLLER, "Reassembly: %u messages completed, %u expired, "
+		"%u parts rejected, %u NACKs for %u parts",
+		reassembly.completed, reassembly.expired, reassembly.rejected, reassembly.nacks,
+		reassembly.nacked_parts);
+	const XBee_Address_Cache_Stats &addresses = interface.xbee_address_cache_stats();
+	log_info(LOG_MODULE_CONTROLLER, "Address cache: %u hits, %u misses, %u evicted, "
+		"%u expired, %u updated",
+		addresses.hits, addresses.misses, addresses.evicted, addresses.expired,
+		addresses.updated);
+	XBee_Message_Pool_Stats pool = interface.xbee_message_pool_stats();
+	log_info(LOG_MODULE_CONTROLLER, "Message pool: %u acquired, %u released, "
+		"%u heap allocations, %u buffer allocations", pool.acquired, pool.released, pool.heap_allocs,
+		pool.buffer_allocs);
+	if (capture) {
+		const XBee_Capture_Stats &captured = capture->get_stats();
+		log_info(LOG_MODULE_CONTROLLER, "Capture: %u frames, %llu bytes in %u segments, "
+			"%u errors",
+			captured.frames, (unsigned long long) captured.bytes, captured.segments,
+			captured.errors);
+		interface.xbee_set_capture(NULL);
+		delete capture;
+	}
+	delete writer;
+	delete tracer;
+	delete acks;
+	delete database;
 	sqlite3_close(db);
+
+	Log_Stats log_stats = log_get_stats();
+	log_info(LOG_MODULE_CONTROLLER, "Log: %llu messages written, %llu dropped",
+		(unsigned long long) log_stats.written, (unsigned long long) log_stats.dropped);
+	log_stop();
 	return 0;
 }
 
@@ -104,11 +279,45 @@ int controller_ini_cb(void* buffer, const char* section, const char* name, const
 
 	/* Controller Settings */
 	if (MATCH("CONTROLLER", "database")) {
-		printf("db file: %s\n", value);
+		log_info(LOG_MODULE_CONTROLLER, "db file: %s", value);
 		settings->database_path = string(value);
 		if (access(value, F_OK) == -1)
-			printf("DB file not found\n");
+			log_warn(LOG_MODULE_CONTROLLER, "DB file not found");
 	}
+	else if (MATCH("CONTROLLER", "write_queue_size"))
+		settings->write_queue_size = strtol(value, 0L, 0);
+	else if (MATCH("CONTROLLER", "write_batch_size"))
+		settings->write_batch_size = strtol(value, 0L, 0);
+	else if (MATCH("CONTROLLER", "journal_mode"))
+		settings->journal_mode = string(value);
+	else if (MATCH("CONTROLLER", "synchronous"))
+		settings->synchronous = string(value);
+	else if (MATCH("CONTROLLER", "mmap_size"))
+		settings->mmap_size = strtoll(value, 0L, 0);
+	else if (MATCH("CONTROLLER", "checkpoint_idle"))
+		settings->checkpoint_idle_ms = strtol(value, 0L, 0);
+	else if (MATCH("CONTROLLER", "checkpoint_max_delay"))
+		settings->checkpoint_max_delay_ms = strtol(value, 0L, 0);
+	else if (MATCH("CONTROLLER", "node_flush_interval"))
+		settings->node_flush_interval_ms = strtol(value, 0L, 0);
+	else if (MATCH("CONTROLLER", "rollup_flush_interval"))
+		settings->rollup_flush_interval_ms = strtol(value, 0L, 0);
+	else if (MATCH("CONTROLLER", "block_tables"))
+		controller_parse_tables(&settings->block_tables, value);
+	else if (MATCH("CONTROLLER", "block_samples"))
+		settings->block_samples = strtol(value, 0L, 0);
+	else if (MATCH("CONTROLLER", "block_flush_interval"))
+		settings->block_flush_interval_ms = strtol(value, 0L, 0);
+	else if (MATCH("CONTROLLER", "capture"))
+		settings->capture_path = string(value);
+	else if (MATCH("CONTROLLER", "capture_segment_size"))
+		settings->capture_segment_size = strtol(value, 0L, 0);
+	else if (MATCH("CONTROLLER", "metrics"))
+		settings->metrics_address = string(value);
+	else if (MATCH("CONTROLLER", "trace"))
+		settings->trace_path = string(value);
+	else if (MATCH("CONTROLLER", "trace_sample_interval"))
+		settings->trace_sample_interval = strtol(value, 0L, 0);
 	
 	/* ZigBee Settings */
 	if (MATCH("ZIGBEE", "identifier")) 
@@ -121,11 +330,51 @@ int controller_ini_cb(void* buffer, const char* section, const char* name, const
 		settings->timeout = strtol(value, 0L, 0);
 	else if (MATCH("ZIGBEE", "max_unicast_hops"))
 		settings->max_unicast_hops = strtol(value, 0L, 0);
+	else if (MATCH("ZIGBEE", "reassembly_slots"))
+		settings->reassembly_slots = strtol(value, 0L, 0);
+	else if (MATCH("ZIGBEE", "reassembly_timeout"))
+		settings->reassembly_timeout_ms = strtol(value, 0L, 0);
+	else if (MATCH("ZIGBEE", "tx_window"))
+		settings->tx_window = strtol(value, 0L, 0);
+	else if (MATCH("ZIGBEE", "address_cache_size"))
+		settings->address_cache_size = strtol(value, 0L, 0);
+	else if (MATCH("ZIGBEE", "address_cache_ttl"))
+		settings->address_cache_ttl_ms = strtol(value, 0L, 0);
+	else if (MATCH("ZIGBEE", "message_pool_size"))
+		settings->message_pool_size = strtol(value, 0L, 0);
+	else if (MATCH("ZIGBEE", "ack_interval"))
+		settings->ack_interval_ms = strtol(value, 0L, 0);
+	else if (MATCH("ZIGBEE", "nack_delay"))
+		settings->nack_delay_ms = strtol(value, 0L, 0);
 	else if (MATCH("ZIGBEE", "baudrate"))
 		settings->baud_rate = (xbee_baud_rate) strtol(value, 0l, 0);
 	else if (MATCH("ZIGBEE", "pan_id")) {
 		controller_parse_pan(settings, value);
 	}
+
+	/* Log Settings */
+	if (MATCH("LOG", "file"))
+		settings->log_file = string(value);
+	else if (MATCH("LOG", "buffer_size"))
+		settings->log_buffer_size = strtol(value, 0L, 0);
+	else
+		controller_log_ini_cb(NULL, section, name, value);
+	return 0;
+}
+
+/* sets the log levels, the levels are also read while the controller runs */
+int controller_log_ini_cb(void* buffer, const char* section, const char* name, const char* value) {
+	Log_Level level;
+	Log_Module module;
+
+	if (strcmp(section, "LOG"))
+		return 0;
+	if (!strcmp(name, "level") && log_parse_level(value, &level))
+		log_set_level(level);
+	else if (log_parse_module(name, &module) && log_parse_level(value, &level))
+		log_set_level(module, level);
+	else if (strcmp(name, "file") && strcmp(name, "buffer_size"))
+		log_warn(LOG_MODULE_CONTROLLER, "Unknown log setting %s = %s", name, value);
 	return 0;
 }
 
@@ -159,7 +408,20 @@ void controller_parse_pan(Settings *settings, const char *value)
 	memset(settings->pan_id, 0, PAN_SIZE*sizeof(uint8_t));
 	for (uint8_t i = 0; i < size; i++)
 		settings->pan_id[i + PAN_SIZE - size] = pan_tmp[i];
-	printf("size: %u\n", size);
+	log_debug(LOG_MODULE_CONTROLLER, "PAN ID size: %u", size);
+}
+
+void controller_parse_tables(std::set<std::string> *tables, const char *value)
+{
+	/* table names are delimited by ',' or ' ' */
+	tables->clear();
+	while (*value) {
+		size_t length = strcspn(value, ", ");
+		if (length)
+			tables->insert(string(value, length));
+		value += length;
+		value += strspn(value, ", ");
+	}
 }
 
 void controller_parse_cl(int argc,char **argv, Settings *settings) {
@@ -172,384 +434,108 @@ void controller_parse_cl(int argc,char **argv, Settings *settings) {
 		fprintf(stderr, "Unable to open ini file: %s\n", argv[1]);
 		exit(1);
 	}
-	printf("config file: %s\n", argv[1]);
+	log_info(LOG_MODULE_CONTROLLER, "config file: %s", argv[1]);
 	/* store the config file path */
 	settings->config_file_path = string(argv[1]);
+	/* default values for optional settings */
+	settings->write_queue_size = 256;
+	settings->write_batch_size = 32;
+	settings->journal_mode = "WAL";
+	settings->synchronous = "NORMAL";
+	settings->mmap_size = 0;
+	settings->checkpoint_idle_ms = 1000;
+	settings->checkpoint_max_delay_ms = 30000;
+	settings->node_flush_interval_ms = NODE_FLUSH_INTERVAL_MS;
+	settings->rollup_flush_interval_ms = ROLLUP_FLUSH_INTERVAL_MS;
+	settings->block_samples = SAMPLE_BLOCK_SAMPLES;
+	settings->block_flush_interval_ms = SAMPLE_BLOCK_FLUSH_INTERVAL_MS;
+	settings->capture_segment_size = XBEE_CAPTURE_SEGMENT_SIZE;
+	settings->trace_sample_interval = TRACE_SAMPLE_INTERVAL;
+	settings->reassembly_slots = XBEE_REASSEMBLY_SLOTS;
+	settings->reassembly_timeout_ms = XBEE_REASSEMBLY_TIMEOUT_MS;
+	settings->tx_window = XBEE_TX_WINDOW;
+	settings->address_cache_size = XBEE_ADDR_CACHE_SIZE;
+	settings->address_cache_ttl_ms = XBEE_ADDR_CACHE_TTL_MS;
+	settings->message_pool_size = XBEE_MESSAGE_POOL_SIZE;
+	settings->ack_interval_ms = 0;
+	settings->nack_delay_ms = XBEE_NACK_DELAY_MS;
+	settings->log_buffer_size = LOG_BUFFER_SIZE;
 
 	/* parse the config file */
 	ini_parse(argv[1], controller_ini_cb, settings);
 }
 
-/* creates the neccessary tables for storing sensor data, node addresses and
- * configuration options in the database */
-void create_db_tables(sqlite3 *db) {
-	/* define common SQL command substrings */
-	string create = "CREATE TABLE IF NOT EXISTS ";
-	string common_sensor_columns = "(addr64 UNSIGNED BIGINT, "
-				"timestamp UNSIGNED INT, "
-				"offset_ms UNSIGNED INT,";
-	string common_debug_columns = "(addr64 UNSIGNED BIGINT, "
-				"timestamp UNSIGNED INT, ";
-	string common_node_columns = "(addr64 UNSIGNED BIGINT UNIQUE, "
-				"addr16 UNSIGNED INT, "
-				"identifier VARCHAR(20))";
-
-	/* create SQL command strings by concatenating the SQL command substrings
-	 * with the table name */
-	string table_heart = create + TABLE_SENSOR_HEART + common_sensor_columns;
-	string table_temperature = create + TABLE_SENSOR_TEMP + common_sensor_columns;
-	string table_accel = create + TABLE_SENSOR_ACCEL + common_sensor_columns;
-	string table_gps = create + TABLE_SENSOR_GPS + common_sensor_columns;
-	string table_gps_alt = create + TABLE_SENSOR_GPS_ALT + common_sensor_columns;
-	string table_debug = create + TABLE_DEBUG_MESSAGES + common_debug_columns;
-	string table_nodes = create + TABLE_MONITORING_NODES + common_node_columns;
-	
-	/* append the custom fields of each table to the SQL commands */
-	table_heart += "bmp INT)";
-	table_temperature += "temp DOUBLE)";
-	table_accel += 	"x INT, "
-			"y INT, "
-			"z INT)";
-	table_gps += 	"lat_h INT,"
-			"lat_min INT, "
-			"lat_s INT, "
-			"lat_north BOOL, "
-			"long_h INT, "
-			"long_min INT, "
-			"long_s INT, "
-			"long_west BOOL, "
-			"valid_pos_fix BOOL)";
-	table_gps_alt +="latitude REAL, "
-			"longitude REAL)";
-	table_debug +=	"message TEXT)";
-
-	// TODO: Remove debug print statements
-	printf("%s \n", table_heart.c_str());
-	printf("%s \n", table_temperature.c_str());
-	printf("%s \n", table_accel.c_str());
-	printf("%s \n", table_gps.c_str());
-	printf("%s \n", table_gps_alt.c_str());
-	printf("%s \n", table_debug.c_str());
-	printf("%s \n", table_nodes.c_str());
-	
-	/* create sth */
-	string unique_address_table;
-	unique_address_table = "CREATE UNIQUE INDEX address_ix ON " 
-				+ string(TABLE_MONITORING_NODES)
-				+ " (addr64)";
-				
-	/* try to create the tables */
-	CALL_SQLITE(exec(db, table_heart.c_str(), 0, 0, 0));
-	CALL_SQLITE(exec(db, table_temperature.c_str(), 0, 0, 0));
-	CALL_SQLITE(exec(db, table_accel.c_str(), 0, 0, 0));
-	CALL_SQLITE(exec(db, table_gps.c_str(), 0, 0, 0));
-	CALL_SQLITE(exec(db, table_gps_alt.c_str(), 0, 0, 0));
-	CALL_SQLITE(exec(db, table_debug.c_str(), 0, 0, 0));
-	CALL_SQLITE(exec(db, table_nodes.c_str(), 0, 0, 0));
-	CALL_SQLITE(exec(db, unique_address_table.c_str(), 0, 0, 0));
-}
-
-/* inserts one new row of data in the table identified by the table parameter.
- * db[in]: handle to an open sqlite3 db
- * table[in]: tablename of destination table for insert operation
- * value[in]: set of values that this table contains.
- * 		!expects the values to be delimited by brackets e.g "(val0, val1)" */
-void insert_into_table(sqlite3 *db, const string &table, const string &values) {
-	sqlite3_stmt *stmt;
-
-	/* compile the SQL insert statement */
-	string sql_insert = "INSERT INTO " + table +" VALUES" + values;
-	CALL_SQLITE(prepare_v2(db, sql_insert.c_str(), -1, &stmt, NULL));
-	/* execute the SQL query */
-	CALL_SQLITE_EXPECT(step(stmt), DONE);
-	/* destroy the SQL statement after execution */
-	CALL_SQLITE(finalize(stmt));
-}
-
-/* decodes the type of the network message and passes it on the appropriate 
- * decoder function */
-void Message_Storage::store_msg(sqlite3 *db, XBee_Message *msg) {
-	uint16_t length;
-	uint8_t *data;
-	MessagePacket *message_packet;
-
-	/* de-serialze the message */
-	data = msg->get_payload(&length);
-	message_packet = (MessagePacket *) new uint8_t[length+10];
-	MessageStorage::deserialize(data, message_packet);
-	
-	/* store messages into the appropriate db tables */
-	switch (message_packet->mainType) {
-	case msgSensorData:
-		printf("storing sensor message\n");
-		store_sensor_msg(db, msg);
-		break;
-	case msgSensorConfig:
-		printf("storing config message\n");
-		store_config_msg(db, msg);
-		break;
-	case msgDebug:
-		printf("storing debug message\n");
-		store_debug_msg(db, msg);
-		break;
-	default: 
-		printf("message with unknown mainType: %u\n", message_packet->mainType);
-	}
-	/* try to store the source address in the database */
-	store_address(db, msg->get_address());
-	
-	delete[] message_packet;
-}
-
-/* checks the type of sensor messages and passes them on the the correct store function */
-void Message_Storage::store_sensor_msg(sqlite3 *db, XBee_Message *msg) {
-	uint16_t length;
-	uint8_t *data;
-	MessagePacket *message_packet;
-	SensorMessage *sensor_msg;
-	DeviceType type;
-	uint64_t addr64;
-
-	/* de-serialze the message */
-	data = msg->get_payload(&length);
-	message_packet = (MessagePacket *) new uint8_t[length+10];
-	MessageStorage::deserialize(data, message_packet);
-	sensor_msg = (SensorMessage*) message_packet->payload;
-	type = sensor_msg->sensorType;
-	addr64 = msg->get_address().get_addr64();
-
-	/* the monitoring devices work with a relative timestamp, because
-	 * it cannot be guaranteed that they are synced with a proper RTC.
-	 * Calculate the absolute timestamp of the endTimestampS value and
-	 * update the SensorMessage object */
-	uint32_t absEndTimestampS = time(NULL) - (message_packet->relTimestampS - sensor_msg->endTimestampS);
-	sensor_msg->endTimestampS = absEndTimestampS;
-	
-	printf("Sensor Message: %u, %u , %u\n", sensor_msg->endTimestampS, sensor_msg->sampleIntervalMs, sensor_msg->arrayLength);
-	switch (type) {
-	case typeHeartRate:
-		printf("storing heart rate message\n");
-		store_sensor_heart(db, sensor_msg, addr64);
-		break;
-	case typeRawTemperature:
-		store_sensor_raw_temperature(db, sensor_msg, addr64);
-		break;
-	case typeAccelerometer:
-		store_sensor_accelerometer(db, sensor_msg, addr64);
-		break;
-	case typeGPS:
-		store_sensor_gps(db, sensor_msg, addr64);
-		store_sensor_gps_alt(db, sensor_msg, addr64);
-		break;
-	default:;
-	}
-
-	delete [] message_packet;
-}
-
-/* decodes messages containing configuration data */
-void Message_Storage::store_config_msg(sqlite3 *db, XBee_Message *msg) {
-	
-}
-
-/* decodes messages containing debug strings */
-void Message_Storage::store_debug_msg(sqlite3 *db, XBee_Message *msg) {
-	uint16_t length;
-	uint8_t *data;
-	MessagePacket *message_packet;
-	DebugMessage *debug_msg;
-	uint64_t addr64;
-
-	/* de-serialze the message */
-	data = msg->get_payload(&length);
-	message_packet = (MessagePacket *) new uint8_t[length+10];
-	MessageStorage::deserialize(data, message_packet);
-	debug_msg = (DebugMessage*) message_packet->payload;
-	addr64 = msg->get_address().get_addr64();
-	
-	/* the monitoring devices transmit a relative timestamp.
-	 * Calculate the absolute timestamp of the debug message before
-	 * storing it the db */
-	uint32_t timestampS = time(NULL) - (message_packet->relTimestampS - debug_msg->timestampS);
-	
-	string debug_string((char *)debug_msg->debugData);
-	stringstream command_data;
-	command_data << "("
-		<< addr64 <<", "
-		<< timestampS << ", "
-		<< "'" << debug_string << "'"
-		<< ")";
-	insert_into_table(db, TABLE_DEBUG_MESSAGES, command_data.str());
-	printf("%s \n", command_data.str().c_str());
-	
-	delete [] message_packet;
-}
-
-/* tries to store the source address of the message in the db */
-void Message_Storage::store_address(sqlite3 *db, const XBee_Address &addr) {
-	stringstream address64;
-	stringstream address16;
-
-	address64 << addr.get_addr64();
-	address16 << addr.addr16;
-	
-	/* compile an SQL statement for update/insert of the source address */
-	/* --> the 64bit address is unique and serves as an identifier,
-	 * the 16bit address can change, if a node reconnects. 
-	 * The goal is to update the 16bit address if the 64bit address already exists
-	 * (keeping the string identifier)
-	 * or inserting a new entry if the 64bit address is unknown */
-	string sql_update = "INSERT OR REPLACE INTO "+ string(TABLE_MONITORING_NODES) + 
-	" (addr64, addr16, identifier) VALUES ( " + address64.str() + ", " + address16.str() + 
-	", COALESCE(" 
-	"(SELECT identifier FROM "+ string(TABLE_MONITORING_NODES) + " WHERE addr64=" + address64.str() +")" +
-	", 'Undefined'))";
-
-	/* execute the statement */
-	CALL_SQLITE(exec(db, sql_update.c_str(), NULL, NULL, NULL));
-}
-
-void Message_Storage::store_sensor_heart(sqlite3 *db,
-		SensorMessage *sensor_msg, uint64_t addr64) {
-	HeartRateMessage *msg_array = (HeartRateMessage*) sensor_msg->sensorMsgArray;
-	for (uint8_t i = 0; i < sensor_msg->arrayLength; i++) {
-		stringstream command_data;
-		command_data << "(" 
-			<< addr64 <<", " 
-			<< sensor_msg->endTimestampS << ", "
-			<< (-i * sensor_msg->sampleIntervalMs) <<", " 
-			<< (int)msg_array[i].bpm 
-			<< ")";
-		insert_into_table(db, TABLE_SENSOR_HEART, command_data.str());
-		printf("%s \n", command_data.str().c_str());
-	} 
-}
-
-void Message_Storage::store_sensor_raw_temperature(sqlite3 *db,
-		SensorMessage *sensor_msg, uint64_t addr64) {
-	RawTemperatureMessage *msg_array = (RawTemperatureMessage *)sensor_msg->sensorMsgArray;
-
-	for (uint8_t i = 0; i < sensor_msg->arrayLength; i++) {
-		double temp = calculate_temperature((double)msg_array[i].Tenv, (double)msg_array[i].Vobj);
-		stringstream command_data;
-		command_data << "(" 
-			<< addr64 <<", " 
-			<< sensor_msg->endTimestampS << ", "
-			<< (-i * sensor_msg->sampleIntervalMs) <<", "
-			<< temp
-			<< ")";
-		insert_into_table(db, TABLE_SENSOR_TEMP, command_data.str());
-		printf("%s \n", command_data.str().c_str());
-	} 
-}
-
-void Message_Storage::store_sensor_accelerometer(sqlite3 *db,
-		SensorMessage *sensor_msg, uint64_t addr64) {
-	AccelerometerMessage *msg_array = (AccelerometerMessage *)sensor_msg->sensorMsgArray;
-	
-	for (uint8_t i = 0; i < sensor_msg->arrayLength; i++) {
-		stringstream command_data;
-		command_data << "(" 
-			<< addr64 << ", " 
-			<< sensor_msg->endTimestampS << ", "
-			<< (-i * sensor_msg->sampleIntervalMs) << ", " 
-			<< (int)msg_array[i].x << ", "
-			<< (int)msg_array[i].y << ", "
-			<< (int)msg_array[i].z
-			<< ")";
-		insert_into_table(db, TABLE_SENSOR_ACCEL, command_data.str());
-		printf("%s \n", command_data.str().c_str());
-	}
-}
-
-void Message_Storage::store_sensor_gps(sqlite3 *db, 
-		SensorMessage *sensor_msg, uint64_t addr64) {
-	GPSMessage *msg_array = (GPSMessage *)sensor_msg->sensorMsgArray;
-	
-	for (uint8_t i = 0; i < sensor_msg->arrayLength; i++) {
-		stringstream command_data;
-		command_data << "(" 
-			<< addr64 << ", " 
-			<< sensor_msg->endTimestampS << ", "
-			<< (-i * sensor_msg->sampleIntervalMs) << ", " 
-			<< (int)msg_array[i].latitude.degree << ", "
-			<< (int)msg_array[i].latitude.minute << ", "
-			<< (int)msg_array[i].latitude.second << ", "
-			<< (int)msg_array[i].latitudeNorth << ", "
-			<< (int)msg_array[i].longitude.degree << ", "
-			<< (int)msg_array[i].longitude.minute << ", "
-			<< (int)msg_array[i].longitude.second << ", "
-			<< (int)msg_array[i].longitudeWest << ", "
-			<< (int)msg_array[i].validPosFix
-			<< ")";
-		insert_into_table(db, TABLE_SENSOR_GPS, command_data.str());
-		printf("%s \n", command_data.str().c_str());
-	}
-}
-
-/* calculates the latitude and longitude values before storing the data into the db */
-void Message_Storage::store_sensor_gps_alt(sqlite3 *db, 
-		SensorMessage *sensor_msg, uint64_t addr64) {
-	GPSMessage *msg_array = (GPSMessage *)sensor_msg->sensorMsgArray;
-	
-	for (uint8_t i = 0; i < sensor_msg->arrayLength; i++) {
-		stringstream command_data;
-		GPSPosition position = calculate_gps_position(&msg_array[i]);
-		command_data << "(" 
-			<< addr64 << ", " 
-			<< sensor_msg->endTimestampS << ", "
-			<< (-i * sensor_msg->sampleIntervalMs) << ", " 
-			<< position.latitude << ", "
-			<< position.longitude
-			<< ")";
-		insert_into_table(db, TABLE_SENSOR_GPS_ALT, command_data.str());
-		printf("%s \n", command_data.str().c_str());
-	}
-}
-
-GPSPosition calculate_gps_position(const GPSMessage* gps) {
-	GPSPosition position;
-	/* calculate latitude */
-	position.latitude = gps->latitude.degree +  gps->latitude.minute / 60.0 +
-			 gps->latitude.second / 3600.0;
-	position.latitude = (gps->latitudeNorth)? position.latitude : -(position.latitude);
-
-	/* calculte longitude */
-	position.longitude = gps->longitude.degree +  gps->longitude.minute / 60.0 +
-			 gps->longitude.second / 3600.0;
-	position.longitude = (gps->longitudeWest)? -position.longitude : (position.longitude);
-
-	return position;
-}
-
-double calculate_temperature(double tDieUF, double vObjUF)
+/* a signal handler for the ctrl+c interrupt, in order to end the program
+ * gracefully (storing queued messages and closing the db connection).
+ * The main loop checks the flag and shuts down the writer thread */
+static void signal_handler_interrupt(int signum)
 {
-	double vObj = 0, tDie = 0;
-	tDie= ( (tDieUF / 4)  * .03125) + 273.15;
-	vObj =  vObjUF * .00000015625;
+	running = 0;
+}
 
-	// Calculate Tobj, based on data/formula from TI
-	double S0 = 0.00000000000006;       
-	double a1 = 0.00175; 
-	double a2 = -0.00001678; 
-	double b0 = -0.0000294; 
-	double b1 = -0.00000057;  
-	double b2 = 0.00000000463; 
-	double c2 = 13.4;
-	double Tref = 298.15;
-	double S = S0*(1+a1*(tDie - Tref)+a2*pow((tDie - Tref),2));
-	double Vos = b0 + b1*(tDie - Tref) + b2*pow((tDie - Tref),2);
-	double fObj = (vObj - Vos) + c2*pow((vObj - Vos),2);
-	double Tobj = pow(pow(tDie,4) + (fObj/S), (double).25) - 273.15;
-	
-	return Tobj;
+/* adds the counters of the receive and transmit path, the write queue and
+ * the logger to the registry */
+static void register_metrics(Metrics_Registry &registry, XBee &interface, DB_Writer &writer) {
+	const XBee_Frame_Parser_Stats &frames = interface.xbee_frame_stats();
+	const XBee_Reassembly_Stats &reassembly = interface.xbee_reassembly_stats();
+	const XBee_Tx_Stats &tx = interface.xbee_tx_stats();
+
+	registry.add_counter("ehm_xbee_frames_received_total",
+		"API frames with a valid checksum", [&frames]() { return frames.frames; });
+	registry.add_counter("ehm_xbee_frame_checksum_errors_total",
+		"API frames with a wrong checksum", [&frames]() { return frames.checksum_errors; });
+	registry.add_counter("ehm_xbee_frame_errors_total",
+		"API frames that were interrupted or too long",
+		[&frames]() { return frames.framing_errors; });
+	registry.add_counter("ehm_xbee_received_bytes_total",
+		"Bytes read from the XBee device", [&frames]() { return frames.bytes; });
+	registry.add_counter("ehm_xbee_reassembly_completed_total",
+		"Multipart messages that were put together completely",
+		[&reassembly]() { return reassembly.completed; });
+	registry.add_counter("ehm_xbee_reassembly_timeouts_total",
+		"Incomplete multipart messages that were discarded",
+		[&reassembly]() { return reassembly.expired; });
+	registry.add_counter("ehm_xbee_reassembly_rejected_total",
+		"Message parts that did not fit into a message",
+		[&reassembly]() { return reassembly.rejected; });
+	registry.add_counter("ehm_xbee_reassembly_nacks_total",
+		"NACKs sent for missing parts of version 2 messages",
+		[&reassembly]() { return reassembly.nacks; });
+	registry.add_counter("ehm_xbee_reassembly_nacked_parts_total",
+		"Missing message parts that were requested again",
+		[&reassembly]() { return reassembly.nacked_parts; });
+	registry.add_counter("ehm_xbee_tx_messages_total", "Messages that were delivered",
+		[&tx]() { return tx.messages; });
+	registry.add_counter("ehm_xbee_tx_failed_total", "Messages that could not be delivered",
+		[&tx]() { return tx.failed; });
+	registry.add_counter("ehm_xbee_tx_parts_total", "Message parts that were sent",
+		[&tx]() { return tx.parts; });
+	registry.add_counter("ehm_xbee_tx_retries_total", "Message parts that were sent again",
+		[&tx]() { return tx.retries; });
+	registry.add_counter("ehm_xbee_tx_nacked_parts_total",
+		"Message parts that were sent again on a NACK", [&tx]() { return tx.nacked_parts; });
+
+	registry.add_gauge("ehm_write_queue_depth", "Messages waiting to be stored",
+		[&writer]() { return writer.get_queue_depth(); });
+	registry.add_counter("ehm_write_queue_rejected_total",
+		"Messages dropped because the write queue was full",
+		[&writer]() { return writer.get_rejected_cnt(); });
+	registry.add_counter("ehm_messages_stored_total", "Messages stored in the database",
+		[&writer]() { return writer.get_stored_cnt(); });
+	registry.add_counter("ehm_write_batches_total", "Transactions of the writer thread",
+		[&writer]() { return writer.get_batch_cnt(); });
+	registry.add_counter("ehm_write_batches_failed_total",
+		"Transactions of the writer thread that were rolled back",
+		[&writer]() { return writer.get_failed_batch_cnt(); });
+
+	registry.add_counter("ehm_log_messages_total", "Log messages that were written",
+		[]() { return log_get_stats().written; });
+	registry.add_counter("ehm_log_dropped_total", "Log messages dropped because the "
+		"log buffer was full", []() { return log_get_stats().dropped; });
 }
 
-/* a signal handler for the ctrl+c interrupt, in order to end the program
- * gracefully (restoring terminal settings and closing fd) */
-static void signal_handler_interrupt(int signum)
+/* a signal handler for SIGHUP, the main loop reloads the log levels */
+static void signal_handler_hangup(int signum)
 {
-	fprintf(stderr, "Interrupt received: Closing DB connection & Terminating program\n");
-	sqlite3_close(db);
-	exit(1);
+	reload_log_levels = 1;
 }
@@ -21,6 +21,7 @@
 
 #include "xbee_if.h"
 #include "messagetypes.h"
+#include <set>
 #include <string>
 #include <sqlite3.h>
 
@@ -29,6 +30,23 @@ typedef struct {
 	/* Controller Configuration */
 	std::string database_path;
 	std::string config_file_path;
+	uint32_t write_queue_size;
+	uint16_t write_batch_size;
+	std::string journal_mode;
+	std::string synchronous;
+	int64_t mmap_size;
+	uint32_t checkpoint_idle_ms;
+	uint32_t checkpoint_max_delay_ms;
+	uint32_t node_flush_interval_ms;
+	uint32_t rollup_flush_interval_ms;
+	std::set<std::string> block_tables;
+	uint16_t block_samples;
+	uint32_t block_flush_interval_ms;
+	std::string capture_path;
+	uint32_t capture_segment_size;
+	std::string metrics_address;
+	std::string trace_path;
+	uint32_t trace_sample_interval;
 
 	/* ZigBee Configuration */
 	std::string identifier;
@@ -38,6 +56,18 @@ typedef struct {
 	uint32_t timeout;
 	xbee_baud_rate baud_rate;
 	uint8_t max_unicast_hops;
+	uint16_t reassembly_slots;
+	uint32_t reassembly_timeout_ms;
+	uint8_t tx_window;
+	uint16_t address_cache_size;
+	uint32_t address_cache_ttl_ms;
+	uint16_t message_pool_size;
+	uint32_t ack_interval_ms;
+	uint32_t nack_delay_ms;
+
+	/* Log Configuration */
+	std::string log_file;
+	uint32_t log_buffer_size;
 } Settings;
 
 /*** struct to capsule a gps position ***/
@@ -50,9 +80,15 @@ typedef struct {
 /* parse the config file to set up the program settings */
 void controller_parse_cl(int argc,char **argv, Settings *settings);
 
+/* sets the log levels of the LOG section of the config file */
+int controller_log_ini_cb(void* buffer, const char* section, const char* name, const char* value);
+
 /* parse the PAN ID field of the config file */
 void controller_parse_pan( Settings *settings, const char *value);
 
+/* parse the list of tables that store their samples in blocks */
+void controller_parse_tables(std::set<std::string> *tables, const char *value);
+
 /* print an explanation of how to use the program to the command line */
 void controller_usage_hint();
 
@@ -65,4 +101,9 @@ GPSPosition calculate_gps_position(const GPSMessage* gps);
 /* calculate the actual temperature from the raw sensor readings */
 double calculate_temperature(double tDieUF, double vObjUF);
 
+/* calculate the temperatures of an array of raw sensor readings at once,
+ * using SIMD instructions where available */
+void calculate_temperatures(const RawTemperatureMessage *samples, uint16_t count,
+		double *temperatures);
+
  #endif 
@@ -0,0 +1,131 @@
+/* This file is part of Equine Monitor
+ *
+ * Equine Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Equine Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Equine Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Konke Radlow <koradlow@gmail.com>
+ */
+
+#include "db_checkpoint.h"
+#include "db_writer.h"
+#include "sqlite_helper.h"
+#include "logger.h"
+#include <chrono>
+#include <stdio.h>
+
+/* interval in which the checkpoint thread checks if the writer is idle */
+#define DB_CHECKPOINT_POLL_MS 250
+
+/** DB_Checkpointer Class implementation */
+DB_Checkpointer::DB_Checkpointer(const std::string &database_path, const DB_Writer &writer,
+		const Message_Storage &storage, uint32_t idle_ms, uint32_t max_delay_ms) :
+	database_path(database_path),
+	writer(writer),
+	storage(storage),
+	idle_ms(idle_ms),
+	max_delay_ms(max_delay_ms),
+	db(NULL),
+	running(false),
+	checkpoint_cnt(0),
+	busy_cnt(0)
+{}
+
+DB_Checkpointer::~DB_Checkpointer() {
+	stop();
+}
+
+/* opens the checkpoint connection and starts the checkpoint thread */
+bool DB_Checkpointer::start() {
+	if (running.load())
+		return true;
+	if (sqlite3_open(database_path.c_str(), &db) != SQLITE_OK) {
+		log_error(LOG_MODULE_STORAGE, "Error: cannot open checkpoint connection: %s",
+			sqlite3_errmsg(db));
+		sqlite3_close(db);
+		db = NULL;
+		return false;
+	}
+	running = true;
+	checkpoint_thread = std::thread(&DB_Checkpointer::run, this);
+	return true;
+}
+
+/* stops the checkpoint thread, and runs a last checkpoint */
+void DB_Checkpointer::stop() {
+	if (!running.exchange(false))
+		return;
+	{
+		std::lock_guard<std::mutex> lock(wakeup_mutex);
+		wakeup.notify_one();
+	}
+	checkpoint_thread.join();
+	checkpoint();
+	sqlite3_close(db);
+	db = NULL;
+}
+
+/* main function of the checkpoint thread */
+void DB_Checkpointer::run() {
+	uint32_t last_commit_cnt = storage.get_commit_cnt();
+	uint32_t since_checkpoint_ms = 0;
+
+	while (running.load()) {
+		{
+			std::unique_lock<std::mutex> lock(wakeup_mutex);
+			wakeup.wait_for(lock, std::chrono::milliseconds(DB_CHECKPOINT_POLL_MS),
+				[this]{ return !running.load(); });
+		}
+		if (!running.load())
+			break;
+
+		/* nothing to do, if nothing was written since the last checkpoint */
+		uint32_t commit_cnt = storage.get_commit_cnt();
+		if (commit_cnt == last_commit_cnt)
+			continue;
+		since_checkpoint_ms += DB_CHECKPOINT_POLL_MS;
+
+		if (writer.get_idle_time_ms() >= idle_ms || since_checkpoint_ms >= max_delay_ms) {
+			checkpoint();
+			last_commit_cnt = commit_cnt;
+			since_checkpoint_ms = 0;
+		}
+	}
+}
+
+/* runs a passive checkpoint, which copies as many frames as possible from
+ * the WAL into the database without waiting for readers or writers */
+void DB_Checkpointer::checkpoint() {
+	int log_frames = 0;
+	int checkpointed_frames = 0;
+	int error_code;
+
+	error_code = sqlite3_wal_checkpoint_v2(db, NULL, SQLITE_CHECKPOINT_PASSIVE,
+		&log_frames, &checkpointed_frames);
+	if (error_code == SQLITE_BUSY) {
+		busy_cnt++;
+		return;
+	} else if (error_code != SQLITE_OK) {
+		log_error(LOG_MODULE_STORAGE, "wal_checkpoint failed with status %d: %s",
+			error_code, sqlite3_errmsg(db));
+		return;
+	}
+	checkpoint_cnt++;
+}
+
+uint32_t DB_Checkpointer::get_checkpoint_cnt() const {
+	return checkpoint_cnt.load();
+}
+
+uint32_t DB_Checkpointer::get_busy_cnt() const {
+	return busy_cnt.load();
+}
@@ -0,0 +1,76 @@
+/* This file is part of Equine Monitor
+ *
+ * Equine Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Equine Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Equine Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Konke Radlow <koradlow@gmail.com>
+ */
+
+#ifndef DB_CHECKPOINT_H
+#define DB_CHECKPOINT_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <inttypes.h>
+#include <sqlite3.h>
+
+class DB_Writer;
+class Message_Storage;
+
+/* runs passive WAL checkpoints from a background thread. The automatic
+ * checkpoint of sqlite is disabled on the writer connection, so the cost of
+ * copying the WAL back into the database is not added to the latency of a
+ * commit. Checkpoints are scheduled while the writer thread is idle; if
+ * ingest is never idle for long enough a checkpoint is forced after
+ * max_delay_ms, so the WAL file does not grow without bounds.
+ * A checkpoint is only due if the storage committed a transaction since the
+ * last one, the writes of the idle flushes included.
+ * The checkpoints are run on a separate database connection */
+class DB_Checkpointer {
+public:
+	DB_Checkpointer(const std::string &database_path, const DB_Writer &writer,
+		const Message_Storage &storage, uint32_t idle_ms, uint32_t max_delay_ms);
+	~DB_Checkpointer();
+
+	bool start();
+	void stop();
+
+	uint32_t get_checkpoint_cnt() const;
+	uint32_t get_busy_cnt() const;
+private:
+	DB_Checkpointer(const DB_Checkpointer&);
+	DB_Checkpointer& operator=(const DB_Checkpointer&);
+
+	void run();
+	void checkpoint();
+
+	const std::string database_path;
+	const DB_Writer &writer;
+	const Message_Storage &storage;
+	const uint32_t idle_ms;
+	const uint32_t max_delay_ms;
+	sqlite3 *db;
+
+	std::thread checkpoint_thread;
+	std::atomic<bool> running;
+	std::mutex wakeup_mutex;
+	std::condition_variable wakeup;
+
+	std::atomic<uint32_t> checkpoint_cnt;
+	std::atomic<uint32_t> busy_cnt;
+};
+
+#endif
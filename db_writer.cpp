@@ -0,0 +1,176 @@
+/* This file is part of Equine Monitor
+ *
+ * Equine Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Equine Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Equine Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Konke Radlow <koradlow@gmail.com>
+ */
+
+#include "db_writer.h"
+#include "sqlite_helper.h"
+#include "message_trace.h"
+#include "ack_tracker.h"
+#include <chrono>
+
+/* time the writer thread sleeps if the queue is empty and it was not woken
+ * up by the producer */
+#define DB_WRITER_IDLE_TIMEOUT_MS 100
+
+/* returns a monotonic timestamp in milliseconds */
+static int64_t monotonic_ms() {
+	return std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/** DB_Writer Class implementation */
+DB_Writer::DB_Writer(Message_Storage &storage, uint32_t queue_size, uint16_t max_batch_size) :
+	storage(storage),
+	queue(queue_size),
+	max_batch_size(max_batch_size ? max_batch_size : 1),
+	tracer(NULL),
+	acks(NULL),
+	running(false),
+	rejected_cnt(0),
+	stored_cnt(0),
+	batch_cnt(0),
+	failed_batch_cnt(0),
+	last_batch_ms(monotonic_ms())
+{
+	batch = new XBee_Message*[this->max_batch_size];
+}
+
+DB_Writer::~DB_Writer() {
+	stop();
+	delete[] batch;
+}
+
+/* starts the writer thread */
+void DB_Writer::start() {
+	if (running.exchange(true))
+		return;
+	writer_thread = std::thread(&DB_Writer::run, this);
+}
+
+/* stops the writer thread after all queued messages are stored */
+void DB_Writer::stop() {
+	if (!running.exchange(false))
+		return;
+	{
+		std::lock_guard<std::mutex> lock(wakeup_mutex);
+		wakeup.notify_one();
+	}
+	writer_thread.join();
+}
+
+bool DB_Writer::enqueue(XBee_Message *msg) {
+	if (!queue.push(msg)) {
+		rejected_cnt++;
+		return false;
+	}
+	/* wake up the writer thread, the notification is cheap if the writer is
+	 * still busy with the previous batch and does not wait */
+	wakeup.notify_one();
+	return true;
+}
+
+void DB_Writer::set_tracer(Message_Tracer *tracer) {
+	this->tracer = tracer;
+}
+
+void DB_Writer::set_ack_tracker(Ack_Tracker *acks) {
+	this->acks = acks;
+}
+
+/* main function of the writer thread, the thread is sleeping while the
+ * queue is empty and stores the queued messages in batches otherwise */
+void DB_Writer::run() {
+	while (running.load()) {
+		if (drain_queue())
+			continue;
+		/* the node statistics and rollups of the last batches are written while idle */
+		storage.flush();
+		std::unique_lock<std::mutex> lock(wakeup_mutex);
+		wakeup.wait_for(lock, std::chrono::milliseconds(DB_WRITER_IDLE_TIMEOUT_MS),
+			[this]{ return queue.size() > 0 || !running.load(); });
+	}
+	/* store the messages that were queued before stop() was called */
+	while (drain_queue());
+}
+
+/* takes up to max_batch_size messages from the queue and stores them in one
+ * transaction, returns the number of messages taken from the queue. Only the
+ * messages of a committed batch are counted as stored */
+uint16_t DB_Writer::drain_queue() {
+	uint16_t batch_size = 0;
+	while (batch_size < max_batch_size && queue.pop(batch[batch_size])) {
+		trace_stamp(batch[batch_size]->get_trace(), TRACE_DEQUEUED);
+		batch_size++;
+	}
+	if (!batch_size)
+		return 0;
+
+	/* messages are only acknowledged once they are committed, a failed
+	 * commit is sent again by the devices. The controller enforces
+	 * synchronous=FULL with acks, so a committed batch survives a power loss */
+	bool stored = storage.store_msgs(batch, batch_size);
+	if (stored && acks)
+		acks->committed(batch, batch_size);
+	for (uint16_t i = 0; i < batch_size; i++) {
+		if (batch[i]->get_trace()) {
+			trace_stamp(batch[i]->get_trace(), TRACE_COMMITTED);
+			tracer->finish(batch[i]);
+		}
+		xbee_free_message(batch[i]);
+	}
+
+	if (stored) {
+		stored_cnt += batch_size;
+		batch_cnt++;
+	} else {
+		failed_batch_cnt++;
+	}
+	last_batch_ms = monotonic_ms();
+	return batch_size;
+}
+
+uint32_t DB_Writer::get_queue_depth() const {
+	return queue.size();
+}
+
+uint32_t DB_Writer::get_queue_high_water_mark() const {
+	return queue.get_high_water_mark();
+}
+
+uint32_t DB_Writer::get_queue_capacity() const {
+	return queue.get_capacity();
+}
+
+uint32_t DB_Writer::get_rejected_cnt() const {
+	return rejected_cnt.load();
+}
+
+uint32_t DB_Writer::get_stored_cnt() const {
+	return stored_cnt.load();
+}
+
+uint32_t DB_Writer::get_batch_cnt() const {
+	return batch_cnt.load();
+}
+
+uint32_t DB_Writer::get_failed_batch_cnt() const {
+	return failed_batch_cnt.load();
+}
+
+uint32_t DB_Writer::get_idle_time_ms() const {
+	return monotonic_ms() - last_batch_ms.load();
+}
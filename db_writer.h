@@ -0,0 +1,90 @@
+/* This file is part of Equine Monitor
+ *
+ * Equine Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Equine Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Equine Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Konke Radlow <koradlow@gmail.com>
+ */
+
+#ifndef DB_WRITER_H
+#define DB_WRITER_H
+
+#include "xbee_if.h"
+#include "ring_buffer.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <inttypes.h>
+
+class Message_Storage;
+class Message_Tracer;
+class Ack_Tracker;
+
+/* decouples the reception of messages from storing them in the database.
+ * The radio thread hands complete messages over with enqueue(), a dedicated
+ * writer thread drains the queue and stores up to max_batch_size messages
+ * in one database transaction. */
+class DB_Writer {
+public:
+	DB_Writer(Message_Storage &storage, uint32_t queue_size, uint16_t max_batch_size);
+	~DB_Writer();
+
+	void start();
+	void stop();
+	/* passes the ownership of msg to the writer thread, returns false if
+	 * the queue is full (the caller keeps the ownership in that case) */
+	bool enqueue(XBee_Message *msg);
+	/* the traces of sampled messages are written after their commit */
+	void set_tracer(Message_Tracer *tracer);
+	/* the messages of each committed batch are reported for acknowledgement */
+	void set_ack_tracker(Ack_Tracker *acks);
+
+	uint32_t get_queue_depth() const;
+	uint32_t get_queue_high_water_mark() const;
+	uint32_t get_queue_capacity() const;
+	uint32_t get_rejected_cnt() const;
+	uint32_t get_stored_cnt() const;
+	uint32_t get_batch_cnt() const;
+	uint32_t get_failed_batch_cnt() const;
+	/* time since the last batch was stored */
+	uint32_t get_idle_time_ms() const;
+private:
+	DB_Writer(const DB_Writer&);
+	DB_Writer& operator=(const DB_Writer&);
+
+	void run();
+	uint16_t drain_queue();
+
+	Message_Storage &storage;
+	Ring_Buffer<XBee_Message*> queue;
+	XBee_Message **batch;
+	const uint16_t max_batch_size;
+	Message_Tracer *tracer;
+	Ack_Tracker *acks;
+
+	std::thread writer_thread;
+	std::atomic<bool> running;
+	/* the mutex and condition variable are only used to put the writer
+	 * thread to sleep while the queue is empty, the queue itself is lock free */
+	std::mutex wakeup_mutex;
+	std::condition_variable wakeup;
+
+	std::atomic<uint32_t> rejected_cnt;
+	std::atomic<uint32_t> stored_cnt;
+	std::atomic<uint32_t> batch_cnt;
+	std::atomic<uint32_t> failed_batch_cnt;
+	std::atomic<int64_t> last_batch_ms;
+};
+
+#endif
@@ -7,6 +7,13 @@ extern char mdMessageBuffer[255];
 
 void md_printf(int len);
 
+// On the base station the debug outputs are passed to the logger, their
+// level can be changed at runtime
+#ifdef EHM_BASE_STATION
+	#include "logger.h"
+	#define module_debug_xbee(fmt, ...)   log_debug(LOG_MODULE_XBEE, fmt, ##__VA_ARGS__)
+	#define module_debug_strg(fmt, ...)   log_debug(LOG_MODULE_STORAGE, fmt, ##__VA_ARGS__)
+#else
 
 #ifdef ENABLE_DEBUG_OUTPUT_XBEE
 	#define module_debug_xbee(fmt, ...)   printf("XBEE: "fmt"\n", ##__VA_ARGS__)
@@ -23,3 +30,5 @@ void md_printf(int len);
 #else
 	#define module_debug_strg(fmt, ...)   
 #endif
+
+#endif
@@ -6,7 +6,7 @@
 #ifdef EHM_MONITORING_DEVICE
 #include "alarmmanager.h"
 #include "debug_output_control.h"
-#elseif EHM_BASE_STATION
+#elif defined(EHM_BASE_STATION)
 #include "debug_output_control.h"
 #else
 #define module_debug_strg(fmt, ...)
@@ -19,6 +19,9 @@ MessageStorage::MessageStorage()
 	m_nextMessageSeqNumber = 1;
 	m_queueCount = 0;
 	m_queueCountMem = 0;
+	m_sentHead = m_sentTail = NULL;
+	m_sentCount = 0;
+	m_nextSendSequence = 0;
 }
 
 void MessageStorage::initialize(char * storageRoot)
@@ -67,6 +70,8 @@ void MessageStorage::deserialize(const uint8_t *data, MessagePacket *msg) {
 	SensorMessage *sensor_msg = NULL; 
 	ConfigMessage *config_msg = NULL;
 	DebugMessage *debug_msg = NULL;
+	AckMessage *ack_msg = NULL;
+	NackMessage *nack_msg = NULL;
 
 	switch (msg->mainType) {
 	case msgSensorData:
@@ -84,6 +89,16 @@ void MessageStorage::deserialize(const uint8_t *data, MessagePacket *msg) {
 		memcpy(msg->payload, &data[MESSAGE_PACKET_SIZE], sizeof(DebugMessage));
 		debug_msg->debugData = (uint8_t *)&debug_msg->debugData + sizeof(void *);
 		break;
+	case msgAck:
+		ack_msg = (AckMessage *)msg->payload;
+		memcpy(msg->payload, &data[MESSAGE_PACKET_SIZE], sizeof(AckMessage));
+		ack_msg->ackArray = (AckRange *)((uint8_t *)&ack_msg->ackArray + sizeof(void *));
+		break;
+	case msgNack:
+		nack_msg = (NackMessage *)msg->payload;
+		memcpy(msg->payload, &data[MESSAGE_PACKET_SIZE], sizeof(NackMessage));
+		nack_msg->bitmap = (uint8_t *)&nack_msg->bitmap + sizeof(void *);
+		break;
 	}
 
 	/* copy the message type specific payload */
@@ -133,6 +148,21 @@ void MessageStorage::deserialize(const uint8_t *data, MessagePacket *msg) {
 		 * for now the length of the copy operation is based the first
 		 * occurrence of a terminating null byte */
 		strcpy((char *)debug_msg->debugData, (const char *)&data[debugDataOffset]);
+	} else if (msg->mainType == msgAck) {
+		/* calculate the address offset for the ackArray in the
+		 * serialized data. See above for explanation */
+		int ackArrayOffset = MESSAGE_PACKET_SIZE + sizeof(AckMessage) - sizeof(void *);
+
+		/* copy the ackArray into the de-serialized data structure */
+		memcpy(ack_msg->ackArray, &data[ackArrayOffset],
+				ack_msg->arrayLength*sizeof(AckRange));
+	} else if (msg->mainType == msgNack) {
+		/* calculate the address offset for the bitmap in the
+		 * serialized data. See above for explanation */
+		int bitmapOffset = MESSAGE_PACKET_SIZE + sizeof(NackMessage) - sizeof(void *);
+
+		/* copy the bitmap into the de-serialized data structure */
+		memcpy(nack_msg->bitmap, &data[bitmapOffset], nack_msg->arrayLength);
 		}
 }
 
@@ -164,12 +194,20 @@ uint16_t MessageStorage::serialize(const MessagePacket *msg, uint8_t *data) {
 		memcpy(&data[size], msg->payload, sizeof(DebugMessage) - sizeof(void *));
 		size += sizeof(DebugMessage) - sizeof(void *);
 		break;
+	case msgAck:
+		memcpy(&data[size], msg->payload, sizeof(AckMessage) - sizeof(void *));
+		size += sizeof(AckMessage) - sizeof(void *);
+		break;
+	case msgNack:
+		memcpy(&data[size], msg->payload, sizeof(NackMessage) - sizeof(void *));
+		size += sizeof(NackMessage) - sizeof(void *);
+		break;
 	}
 	/* copy the message type specific payload */
 	if (msg->mainType == msgSensorData) {
 		const SensorMessage *sensor_msg = (const SensorMessage *)msg->payload;
 		
-		printf("SensorMsg: arrayLength %u\n", sensor_msg->arrayLength);
+		module_debug_strg("SensorMsg: arrayLength %u", sensor_msg->arrayLength);
 		/* copy the sensorMsgArray into the serialized data structure */
 		switch (sensor_msg->sensorType) {
 		case typeHeartRate:
@@ -210,6 +248,19 @@ uint16_t MessageStorage::serialize(const MessagePacket *msg, uint8_t *data) {
 		 * occurrence of a terminating null byte */
 		strcpy((char *)&data[size], (const char *)debug_msg->debugData);
 		size += strlen((const char *)debug_msg->debugData);
+	} else if (msg->mainType == msgAck) {
+		const AckMessage *ack_msg = (const AckMessage *)msg->payload;
+
+		/* copy the ackArray into the serialized data structure */
+		memcpy(&data[size], ack_msg->ackArray,
+				ack_msg->arrayLength*sizeof(AckRange));
+		size += ack_msg->arrayLength*sizeof(AckRange);
+	} else if (msg->mainType == msgNack) {
+		const NackMessage *nack_msg = (const NackMessage *)msg->payload;
+
+		/* copy the bitmap into the serialized data structure */
+		memcpy(&data[size], nack_msg->bitmap, nack_msg->arrayLength);
+		size += nack_msg->arrayLength;
 	}
 	return size;
 }
@@ -309,6 +360,123 @@ MessagePacket *  MessageStorage::getFromStorageQueue()
 	return out_msg;
 }
 
+char * MessageStorage::sendFromStorageQueueRaw(unsigned short * size, unsigned char * sequence)
+{
+	if(m_sentCount >= STORAGE_MAX_UNACKNOWLEDGED)
+	{
+		module_debug_strg("too many unacknowledged messages!");
+		return NULL;
+	}
+	
+	// the entry moves from the queue to the list of sent messages
+	MessageEntry * headEntry = dequeue();
+	
+	if(!headEntry)
+	{
+		module_debug_strg("nothing to get from queue!");
+		return NULL;
+	}
+	
+	char * out_msg = readEntry(headEntry);
+	
+	*size = headEntry->size;
+	*sequence = headEntry->sequence = m_nextSendSequence++;
+	
+	headEntry->nextEntry = NULL;
+	if(m_sentHead == NULL)
+		m_sentHead = m_sentTail = headEntry;
+	else {
+		m_sentTail->nextEntry = headEntry;
+		m_sentTail = headEntry;
+	}
+	m_sentCount++;
+	
+	return out_msg;
+}
+
+// the acknowledgements of the base station are batched, one AckRange
+// covers all consecutive messages that were stored since the last
+// acknowledgement. All entries in the range are dropped in one pass
+unsigned int MessageStorage::acknowledge(unsigned char sequence, unsigned char count)
+{
+	MessageEntry * entry = m_sentHead;
+	MessageEntry * prev = NULL;
+	unsigned int dropped = 0;
+	
+	while(entry != NULL)
+	{
+		MessageEntry * next = entry->nextEntry;
+		
+		// distance to the newest acknowledged message, modulo 256
+		if((unsigned char)(sequence - entry->sequence) < count)
+		{
+			if(prev)
+				prev->nextEntry = next;
+			else
+				m_sentHead = next;
+			if(m_sentTail == entry)
+				m_sentTail = prev;
+			if(entry->memPtr)
+				m_queueCountMem--;
+			freeMessageEntry(entry);
+			m_sentCount--;
+			dropped++;
+		} else {
+			prev = entry;
+		}
+		entry = next;
+	}
+	module_debug_strg("acknowledged %d messages, %d unacknowledged", dropped, m_sentCount);
+	return dropped;
+}
+
+void MessageStorage::resendUnacknowledged()
+{
+	if(m_sentHead == NULL)
+		return;
+	
+	// the sent messages are older than the queued ones, they go first
+	m_sentTail->nextEntry = m_queueHead;
+	if(m_queueHead == NULL)
+		m_queueTail = m_sentTail;
+	m_queueHead = m_sentHead;
+	m_queueCount += m_sentCount;
+	
+	m_sentHead = m_sentTail = NULL;
+	m_sentCount = 0;
+}
+
+unsigned int MessageStorage::getUnacknowledgedCount()
+{
+	return m_sentCount;
+}
+
+// returns a copy of the serialized data of an entry, either from memory
+// or from its file
+char * MessageStorage::readEntry(MessageEntry * entry)
+{
+	char * out_msg = (char*) malloc(entry->size);
+	
+	if(!out_msg)
+	{
+		module_debug_strg("failed to allocate entry copy!");
+		return NULL;
+	}
+	
+	if(entry->fileName)
+	{
+		char fnBuffer[13];
+		sprintf(fnBuffer, "%d", entry->fileName);
+		openFile(fnBuffer, false, true);
+		readFromFile(out_msg, entry->size);
+		closeFile();
+	} else {
+		memcpy(out_msg, entry->memPtr, entry->size);
+	}
+	
+	return out_msg;
+}
+
 // TODO also serialize message queue structure for long time ZigBee-less
 // operation!
 
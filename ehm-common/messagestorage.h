@@ -15,6 +15,10 @@
 // TODO insert BS-specific includes here
 #endif
 
+// max number of sent messages waiting for their acknowledgement. The
+// sequence numbers have 8 bits, a larger window would make them ambiguous
+#define STORAGE_MAX_UNACKNOWLEDGED 128
+
 class MessageStorage  {
   public:
 	static MessageStorage* getInstance()
@@ -30,6 +34,17 @@ class MessageStorage  {
 	unsigned int getStorageQueueCount();
 	void flushAllToDisk();
 	
+	// acknowledged transmission: a sent message is kept until the base
+	// station acknowledged it, the returned sequence number has to be put
+	// into the header of the XBee message. Returns NULL if the queue is
+	// empty or STORAGE_MAX_UNACKNOWLEDGED messages wait for acknowledgement
+	char * sendFromStorageQueueRaw(unsigned short * size, unsigned char * sequence);
+	// drops the sent messages acknowledged by an AckRange, returns their count
+	unsigned int acknowledge(unsigned char sequence, unsigned char count);
+	// puts the messages that were not acknowledged back to the queue head
+	void resendUnacknowledged();
+	unsigned int getUnacknowledgedCount();
+	
 	// RTC storage functions
 	unsigned int readRTCStorage();
 	void writeRTCStorage(unsigned int rtcValue);
@@ -53,6 +68,7 @@ private:
 	  void * memPtr;	// NULL if entry has already been saved to disk
 	  unsigned int fileName; 	// 0 if entry is yet in memory
 	  unsigned short size;	// size of message data, either on disk or in mem
+	  unsigned char sequence;	// sequence number of a sent message
 	  MessageEntry * nextEntry;	// linked list structure, NULL if last member
   } MessageEntry;
   
@@ -61,9 +77,16 @@ private:
   unsigned int m_queueCountMem;
   unsigned int m_nextMessageSeqNumber;
   
+  // messages that were sent and wait for their acknowledgement, in the
+  // order they were sent
+  MessageEntry * m_sentHead, * m_sentTail;
+  unsigned int m_sentCount;
+  unsigned char m_nextSendSequence;
+  
   // internal queue management functions
   void enqueue(void * memPtr, unsigned int fileName, unsigned short size);
   MessageEntry * dequeue();
+  char * readEntry(MessageEntry * entry);
   void freeMessageEntry(MessageEntry * entry);
   void flushEntryToDisk(MessageEntry * entry);
   
@@ -22,7 +22,9 @@
 typedef enum {
 	msgSensorData,
 	msgSensorConfig,
-	msgDebug
+	msgDebug,
+	msgAck,
+	msgNack
 } MessageType;
 
 typedef enum  {
@@ -65,6 +67,30 @@ typedef PACKEDSTRUCT {
 	uint8_t *debugData;
 } DebugMessage;
 
+// sent by the base station after messages were stored. It acknowledges
+// the count messages with the sequence numbers up to and including
+// sequence (the sequence numbers of the XBee message header), several
+// acknowledgements can be sent in one message
+typedef PACKEDSTRUCT {
+	uint8_t sequence;
+	uint8_t count;
+} AckRange;
+
+typedef PACKEDSTRUCT {
+	uint8_t arrayLength;
+	AckRange *ackArray;
+} AckMessage;
+
+// sent by the receiver of a multipart message with a version 2 header if
+// parts are missing, only these parts are sent again. Bit i of the bitmap
+// (LSB first) is set if part firstPart + i is missing
+typedef PACKEDSTRUCT {
+	uint8_t sequence;
+	uint16_t firstPart;
+	uint8_t arrayLength;	// bytes in the bitmap
+	uint8_t *bitmap;
+} NackMessage;
+
 // definition of subtypes for ConfigMessages
 typedef PACKEDSTRUCT {
 	DeviceType sensorType;
@@ -0,0 +1,115 @@
+/* This file is part of Equine Monitor
+ *
+ * Equine Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Equine Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Equine Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Konke Radlow <koradlow@gmail.com>
+ */
+
+#include "event_loop.h"
+#include "logger.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#define EVENT_LOOP_MAX_EVENTS 8
+
+/** Event_Loop Class implementation */
+Event_Loop::Event_Loop() :
+	dispatched_fd(-1),
+	dispatched_removed(false)
+{
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd < 0)
+		log_error(LOG_MODULE_CONTROLLER, "Error creating epoll instance: %s", strerror(errno));
+}
+
+Event_Loop::~Event_Loop() {
+	std::set<int>::iterator it;
+	for (it = timers.begin(); it != timers.end(); ++it)
+		close(*it);
+	if (epoll_fd >= 0)
+		close(epoll_fd);
+}
+
+bool Event_Loop::add_fd(int fd, const Handler &handler) {
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.fd = fd;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+		log_error(LOG_MODULE_CONTROLLER, "Error adding fd %d to event loop: %s", fd, strerror(errno));
+		return false;
+	}
+	handlers[fd] = handler;
+	return true;
+}
+
+int Event_Loop::add_timer(uint32_t interval_ms, const Handler &handler) {
+	struct itimerspec interval;
+	int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (timer_fd < 0) {
+		log_error(LOG_MODULE_CONTROLLER, "Error creating timer: %s", strerror(errno));
+		return -1;
+	}
+	interval.it_interval.tv_sec = interval_ms / 1000;
+	interval.it_interval.tv_nsec = (interval_ms % 1000) * 1000000;
+	interval.it_value = interval.it_interval;
+	if (timerfd_settime(timer_fd, 0, &interval, NULL) < 0 || !add_fd(timer_fd, handler)) {
+		close(timer_fd);
+		return -1;
+	}
+	timers.insert(timer_fd);
+	return timer_fd;
+}
+
+void Event_Loop::remove(int fd) {
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+	if (fd == dispatched_fd)
+		dispatched_removed = true;
+	else
+		handlers.erase(fd);
+	if (timers.erase(fd))
+		close(fd);
+}
+
+int Event_Loop::run_once(int timeout_ms) {
+	struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+	int event_cnt = epoll_wait(epoll_fd, events, EVENT_LOOP_MAX_EVENTS, timeout_ms);
+	if (event_cnt < 0)
+		return (errno == EINTR) ? 0 : -1;
+
+	for (int i = 0; i < event_cnt; i++) {
+		int fd = events[i].data.fd;
+		/* timers have to be read to acknowledge the expiration */
+		if (timers.count(fd)) {
+			uint64_t expirations;
+			if (read(fd, &expirations, sizeof(expirations)) < 0)
+				continue;
+		}
+		std::map<int, Handler>::iterator it = handlers.find(fd);
+		if (it == handlers.end())
+			continue;
+		dispatched_fd = fd;
+		it->second();
+		dispatched_fd = -1;
+		if (dispatched_removed) {
+			handlers.erase(fd);
+			dispatched_removed = false;
+		}
+	}
+	return event_cnt;
+}
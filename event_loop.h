@@ -0,0 +1,62 @@
+/* This file is part of Equine Monitor
+ *
+ * Equine Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Equine Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Equine Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Konke Radlow <koradlow@gmail.com>
+ */
+
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <functional>
+#include <map>
+#include <set>
+#include <inttypes.h>
+
+/* minimal epoll based event loop. The loop sleeps until one of the
+ * registered file descriptors becomes readable or a timer (timerfd) expires,
+ * and calls the handler of the event. It replaces polling the serial device
+ * in short sleep intervals. Handlers are called from the thread that runs
+ * the loop, a handler can remove its own fd */
+class Event_Loop {
+public:
+	typedef std::function<void()> Handler;
+
+	Event_Loop();
+	~Event_Loop();
+
+	/* calls handler every time fd is readable, returns false on error */
+	bool add_fd(int fd, const Handler &handler);
+	/* calls handler every interval_ms milliseconds, returns the fd of the
+	 * timer, or -1 on error */
+	int add_timer(uint32_t interval_ms, const Handler &handler);
+	void remove(int fd);
+
+	/* waits for events and dispatches them. timeout_ms = -1 waits forever.
+	 * Returns the number of handled events, or -1 on error. A signal that
+	 * interrupts the wait is not an error */
+	int run_once(int timeout_ms);
+private:
+	Event_Loop(const Event_Loop&);
+	Event_Loop& operator=(const Event_Loop&);
+
+	int epoll_fd;
+	std::map<int, Handler> handlers;
+	std::set<int> timers;
+	/* the handler of the fd that is dispatched is erased after it returned */
+	int dispatched_fd;
+	bool dispatched_removed;
+};
+
+#endif
@@ -0,0 +1,69 @@
+/* This file is part of Equine Monitor
+ *
+ * Equine Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Equine Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Equine Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Konke Radlow <koradlow@gmail.com>
+ */
+
+/* exports the samples of a node from the block table of a sensor table as
+ * CSV, one line per sample with the time in ms and the sensor columns.
+ * The samples are decoded by Sample_Block_Store, only the blocks that
+ * overlap the time range are read.
+ * usage: export_blocks [-f from_ms] [-t to_ms] db table addr64
+ * 	table is the sensor table, e.g. sensorAccelerometer
+ * build: g++ -std=gnu++0x -O2 -I. -Iehm-common -Ixbee_if -DEHM_BASE_STATION
+ * 	export_blocks.cpp sample_block_store.cpp xbee_if/logger.cpp -lsqlite3 -lpthread */
+
+#include "sample_block_store.h"
+#include <sqlite3.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+int main(int argc, char **argv) {
+	uint64_t from_ms = 0;
+	uint64_t to_ms = UINT64_MAX;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "f:t:")) != -1) {
+		switch (opt) {
+		case 'f': from_ms = strtoull(optarg, NULL, 0); break;
+		case 't': to_ms = strtoull(optarg, NULL, 0); break;
+		default:
+			optind = argc;
+		}
+	}
+	if (argc - optind != 3) {
+		fprintf(stderr, "usage: %s [-f from_ms] [-t to_ms] db table addr64\n", argv[0]);
+		return 1;
+	}
+
+	sqlite3 *db;
+	if (sqlite3_open_v2(argv[optind], &db, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK) {
+		fprintf(stderr, "Error: cannot open database: %s\n", sqlite3_errmsg(db));
+		sqlite3_close(db);
+		return 1;
+	}
+
+	Sample_Block_Store *blocks = new Sample_Block_Store(db, argv[optind + 1]);
+	uint32_t sample_cnt = 0;
+	if (blocks->get_column_cnt())
+		sample_cnt = blocks->export_csv(stdout, strtoull(argv[optind + 2], NULL, 0),
+				from_ms, to_ms);
+	fprintf(stderr, "Exported %u samples\n", sample_cnt);
+
+	delete blocks;
+	sqlite3_close(db);
+	return 0;
+}
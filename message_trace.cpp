@@ -0,0 +1,137 @@
+/* This file is part of Equine Monitor
+ *
+ * Equine Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Equine Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Equine Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Konke Radlow <koradlow@gmail.com>
+ */
+
+#include "message_trace.h"
+#include "xbee_if.h"
+#include "logger.h"
+#include <errno.h>
+#include <string.h>
+
+/* names of the intervals between two stages, the interval is named after
+ * the stage it ends with */
+static const char *interval_names[TRACE_STAGE_CNT] = {
+	NULL, "reassembly", "write queue", "batch", "decode", "bind + insert", "commit"
+};
+
+/** Message_Tracer Class implementation */
+Message_Tracer::Message_Tracer(const std::string &path, uint32_t sample_interval) :
+	path(path),
+	sample_interval(sample_interval ? sample_interval : 1),
+	file(NULL),
+	first_event(true),
+	message_cnt(0),
+	next_id(1),
+	trace_cnt(0)
+{}
+
+Message_Tracer::~Message_Tracer() {
+	close();
+}
+
+bool Message_Tracer::open() {
+	std::lock_guard<std::mutex> guard(lock);
+	if (file)
+		return true;
+	file = fopen(path.c_str(), "w");
+	if (!file) {
+		log_error(LOG_MODULE_CONTROLLER, "Error creating trace file %s: %s", path.c_str(),
+			strerror(errno));
+		return false;
+	}
+	fprintf(file, "[\n");
+	first_event = true;
+	log_info(LOG_MODULE_CONTROLLER, "Tracing every %u. message to %s", sample_interval,
+		path.c_str());
+	return true;
+}
+
+void Message_Tracer::close() {
+	std::lock_guard<std::mutex> guard(lock);
+	if (!file)
+		return;
+	fprintf(file, "\n]\n");
+	fclose(file);
+	file = NULL;
+}
+
+void Message_Tracer::sample(XBee_Message *msg) {
+	if (message_cnt++ % sample_interval)
+		return;
+	uint16_t length;
+	msg->get_payload(&length);
+
+	Message_Trace *trace = new Message_Trace;
+	memset(trace, 0, sizeof(*trace));
+	trace->id = next_id++;
+	trace->addr64 = msg->get_address().get_addr64();
+	trace->length = length;
+	trace->stage_us[TRACE_FIRST_FRAME] = msg->get_receive_time_us();
+	trace->stage_us[TRACE_REASSEMBLED] = trace_now_us();
+	msg->set_trace(trace);
+}
+
+/* the stages that were skipped (e.g. a malformed message is not stored)
+ * get the time of the previous stage, so the intervals are never negative */
+void Message_Tracer::finish(XBee_Message *msg) {
+	Message_Trace *trace = msg->get_trace();
+	if (!trace)
+		return;
+	msg->set_trace(NULL);
+	for (uint8_t i = 1; i < TRACE_STAGE_CNT; i++) {
+		if (trace->stage_us[i] < trace->stage_us[i - 1])
+			trace->stage_us[i] = trace->stage_us[i - 1];
+	}
+
+	char args[96];
+	snprintf(args, sizeof(args), "{\"node\":\"%016llx\",\"length\":%u}",
+		(unsigned long long) trace->addr64, trace->length);
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if (file) {
+			write_event("message", 'b', trace->id, trace->stage_us[TRACE_FIRST_FRAME], args);
+			for (uint8_t i = 1; i < TRACE_STAGE_CNT; i++) {
+				write_event(interval_names[i], 'b', trace->id, trace->stage_us[i - 1]);
+				write_event(interval_names[i], 'e', trace->id, trace->stage_us[i]);
+			}
+			write_event("message", 'e', trace->id, trace->stage_us[TRACE_COMMITTED]);
+			/* the traces are rare, a trace is complete in the file even if
+			 * the controller is killed */
+			fflush(file);
+		}
+	}
+	trace_cnt++;
+	delete trace;
+}
+
+void Message_Tracer::discard(XBee_Message *msg) {
+	delete msg->get_trace();
+	msg->set_trace(NULL);
+}
+
+uint32_t Message_Tracer::get_trace_cnt() const {
+	return trace_cnt.load();
+}
+
+/* writes a nestable async event, the events of a message share its id */
+void Message_Tracer::write_event(const char *name, char phase, uint32_t id, int64_t ts,
+		const char *args) {
+	fprintf(file, "%s{\"name\":\"%s\",\"cat\":\"message\",\"ph\":\"%c\",\"id\":%u,"
+		"\"ts\":%lld,\"pid\":1,\"tid\":1%s%s}", first_event ? "" : ",\n", name, phase, id,
+		(long long) ts, args ? ",\"args\":" : "", args ? args : "");
+	first_event = false;
+}
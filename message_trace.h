@@ -0,0 +1,111 @@
+/* This file is part of Equine Monitor
+ *
+ * Equine Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Equine Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Equine Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Konke Radlow <koradlow@gmail.com>
+ */
+
+#ifndef MESSAGE_TRACE_H
+#define MESSAGE_TRACE_H
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <inttypes.h>
+#include <stdio.h>
+#include <time.h>
+
+class XBee_Message;
+
+/* every x-th received message is traced by default */
+#define TRACE_SAMPLE_INTERVAL 100
+
+/* stages of the receive pipeline, a traced message gets a timestamp at the
+ * end of each stage */
+typedef enum {
+	TRACE_FIRST_FRAME,	/* the first part of the message was received */
+	TRACE_REASSEMBLED,	/* all parts were received, the message is queued */
+	TRACE_DEQUEUED,		/* the writer thread took the message from the queue */
+	TRACE_STARTED,		/* the messages before it in the batch are stored */
+	TRACE_DECODED,		/* the payload was decoded and validated */
+	TRACE_STORED,		/* the rows were bound and inserted */
+	TRACE_COMMITTED,	/* the rest of the batch was stored and committed */
+	TRACE_STAGE_CNT
+} Trace_Stage;
+
+struct Message_Trace {
+	uint32_t id;
+	uint64_t addr64;
+	uint16_t length;
+	int64_t stage_us[TRACE_STAGE_CNT];	/* CLOCK_MONOTONIC, 0 = not reached */
+};
+
+/* returns a monotonic timestamp in microseconds, the same clock is used for
+ * the receive time of the XBee messages */
+inline int64_t trace_now_us() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/* sets the time of a stage, messages without trace are not timestamped */
+inline void trace_stamp(Message_Trace *trace, Trace_Stage stage) {
+	if (trace)
+		trace->stage_us[stage] = trace_now_us();
+}
+
+/* samples received messages and writes the time they spent in each stage of
+ * the receive pipeline as Chrome trace events (JSON array format, can be
+ * loaded in chrome://tracing or Perfetto). Each message is an async event
+ * with one nested event per stage, so messages that overlap in time are
+ * shown next to each other. Only the sampled messages carry a trace, the
+ * other messages only pay for the check of the trace pointer */
+class Message_Tracer {
+public:
+	Message_Tracer(const std::string &path, uint32_t sample_interval = TRACE_SAMPLE_INTERVAL);
+	~Message_Tracer();
+
+	/* creates the trace file, returns false on error */
+	bool open();
+	/* terminates the JSON array and closes the file */
+	void close();
+	/* called for every complete message in the receive thread, every
+	 * sample_interval-th message gets a trace */
+	void sample(XBee_Message *msg);
+	/* writes the trace of a stored message and frees it, called from
+	 * the writer thread after the commit */
+	void finish(XBee_Message *msg);
+	/* frees the trace of a message that was dropped */
+	void discard(XBee_Message *msg);
+	uint32_t get_trace_cnt() const;
+private:
+	Message_Tracer(const Message_Tracer&);
+	Message_Tracer& operator=(const Message_Tracer&);
+
+	void write_event(const char *name, char phase, uint32_t id, int64_t ts,
+		const char *args = NULL);
+
+	const std::string path;
+	const uint32_t sample_interval;
+	FILE *file;
+	bool first_event;
+	uint32_t message_cnt;
+	uint32_t next_id;
+	/* the traces are written by the writer thread, the file is closed by
+	 * the main thread */
+	std::mutex lock;
+	std::atomic<uint32_t> trace_cnt;
+};
+
+#endif
@@ -0,0 +1,175 @@
+/* This file is part of Equine Monitor
+ *
+ * Equine Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Equine Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Equine Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Konke Radlow <koradlow@gmail.com>
+ */
+
+#include "metrics.h"
+#include <stdio.h>
+
+/** Metrics_Histogram Class implementation */
+Metrics_Histogram::Metrics_Histogram() :
+	count(0),
+	sum(0)
+{
+	for (uint16_t i = 0; i < METRICS_BUCKET_CNT; i++)
+		buckets[i].store(0, std::memory_order_relaxed);
+}
+
+void Metrics_Histogram::record(uint64_t value) {
+	buckets[bucket_index(value)].fetch_add(1, std::memory_order_relaxed);
+	count.fetch_add(1, std::memory_order_relaxed);
+	sum.fetch_add(value, std::memory_order_relaxed);
+}
+
+uint64_t Metrics_Histogram::get_count() const {
+	return count.load(std::memory_order_relaxed);
+}
+
+uint64_t Metrics_Histogram::get_sum() const {
+	return sum.load(std::memory_order_relaxed);
+}
+
+uint64_t Metrics_Histogram::get_bucket_count(uint16_t bucket) const {
+	return buckets[bucket].load(std::memory_order_relaxed);
+}
+
+/* values below METRICS_SUB_BUCKET_CNT have a bucket each, larger values
+ * are sorted into the sub bucket of their highest bit */
+uint16_t Metrics_Histogram::bucket_index(uint64_t value) {
+	if (value < METRICS_SUB_BUCKET_CNT)
+		return value;
+	uint8_t exponent = 63 - __builtin_clzll(value);
+	uint8_t shift = exponent - METRICS_SUB_BUCKET_BITS;
+	uint16_t sub_bucket = (value >> shift) & (METRICS_SUB_BUCKET_CNT - 1);
+	return (shift + 1) * METRICS_SUB_BUCKET_CNT + sub_bucket;
+}
+
+uint64_t Metrics_Histogram::bucket_max(uint16_t bucket) {
+	if (bucket < METRICS_SUB_BUCKET_CNT)
+		return bucket;
+	/* the limit of the last bucket does not fit into 64bit */
+	if (bucket >= METRICS_BUCKET_CNT - 1)
+		return UINT64_MAX;
+	uint8_t shift = bucket / METRICS_SUB_BUCKET_CNT - 1;
+	uint64_t sub_bucket = bucket % METRICS_SUB_BUCKET_CNT;
+	return ((METRICS_SUB_BUCKET_CNT + sub_bucket + 1) << shift) - 1;
+}
+
+/** Metrics_Registry Class implementation */
+void Metrics_Registry::add_counter(const std::string &name, const std::string &help,
+		const Metrics_Counter *counter, const std::string &labels) {
+	add(name, help, labels, "counter", [counter]() { return (double) counter->get(); },
+		NULL, 1.0);
+}
+
+void Metrics_Registry::add_counter(const std::string &name, const std::string &help,
+		const Reader &reader, const std::string &labels) {
+	add(name, help, labels, "counter", reader, NULL, 1.0);
+}
+
+void Metrics_Registry::add_gauge(const std::string &name, const std::string &help,
+		const Reader &reader, const std::string &labels) {
+	add(name, help, labels, "gauge", reader, NULL, 1.0);
+}
+
+void Metrics_Registry::add_histogram(const std::string &name, const std::string &help,
+		const Metrics_Histogram *histogram, double scale, const std::string &labels) {
+	add(name, help, labels, "histogram", Reader(), histogram, scale);
+}
+
+void Metrics_Registry::add(const std::string &name, const std::string &help,
+		const std::string &labels, const char *type, const Reader &reader,
+		const Metrics_Histogram *histogram, double scale) {
+	Metric metric;
+	metric.name = name;
+	metric.help = help;
+	metric.labels = labels;
+	metric.type = type;
+	metric.reader = reader;
+	metric.histogram = histogram;
+	metric.scale = scale;
+	metrics.push_back(metric);
+}
+
+/* the metrics are grouped by their name, the HELP and TYPE lines are written
+ * once for each name */
+std::string Metrics_Registry::format() const {
+	std::string text;
+	char line[256];
+	std::vector<bool> formatted(metrics.size(), false);
+
+	for (size_t i = 0; i < metrics.size(); i++) {
+		if (formatted[i])
+			continue;
+		text += "# HELP " + metrics[i].name + " " + metrics[i].help + "\n";
+		text += "# TYPE " + metrics[i].name + " " + metrics[i].type + "\n";
+		for (size_t j = i; j < metrics.size(); j++) {
+			const Metric &metric = metrics[j];
+			if (formatted[j] || metric.name != metrics[i].name)
+				continue;
+			formatted[j] = true;
+			if (metric.histogram) {
+				format_histogram(metric, &text);
+				continue;
+			}
+			snprintf(line, sizeof(line), " %.17g\n", metric.reader());
+			text += metric.name;
+			if (!metric.labels.empty())
+				text += "{" + metric.labels + "}";
+			text += line;
+		}
+	}
+	return text;
+}
+
+/* writes the cumulative buckets of a histogram. Only the buckets up to the
+ * highest bucket with a value are written, the counts never decrease, so
+ * buckets are added over time but never disappear */
+void Metrics_Registry::format_histogram(const Metric &metric, std::string *text) const {
+	const Metrics_Histogram *histogram = metric.histogram;
+	std::string bucket_labels = metric.labels.empty() ? "" : metric.labels + ",";
+	std::string labels = metric.labels.empty() ? "" : "{" + metric.labels + "}";
+	uint64_t counts[METRICS_BUCKET_CNT];
+	uint64_t cumulative = 0;
+	int16_t first = -1, last = -1;
+	char line[256];
+
+	/* the buckets are copied first and the count is the sum of the copied
+	 * buckets, so the output is consistent while values are recorded */
+	for (uint16_t i = 0; i < METRICS_BUCKET_CNT; i++) {
+		counts[i] = histogram->get_bucket_count(i);
+		if (!counts[i])
+			continue;
+		if (first < 0)
+			first = i;
+		last = i;
+	}
+	for (int16_t i = first; i >= 0 && i <= last; i++) {
+		cumulative += counts[i];
+		snprintf(line, sizeof(line), "%s_bucket{%sle=\"%.9g\"} %llu\n",
+			metric.name.c_str(), bucket_labels.c_str(),
+			Metrics_Histogram::bucket_max(i) * metric.scale,
+			(unsigned long long) cumulative);
+		*text += line;
+	}
+	snprintf(line, sizeof(line), "%s_bucket{%sle=\"+Inf\"} %llu\n",
+		metric.name.c_str(), bucket_labels.c_str(), (unsigned long long) cumulative);
+	*text += line;
+	snprintf(line, sizeof(line), "%s_sum%s %.9g\n%s_count%s %llu\n",
+		metric.name.c_str(), labels.c_str(), histogram->get_sum() * metric.scale,
+		metric.name.c_str(), labels.c_str(), (unsigned long long) cumulative);
+	*text += line;
+}
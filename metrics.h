@@ -0,0 +1,120 @@
+/* This file is part of Equine Monitor
+ *
+ * Equine Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Equine Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Equine Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Konke Radlow <koradlow@gmail.com>
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+#include <inttypes.h>
+
+/* number of linear sub buckets per power of two of a histogram, 4 sub
+ * buckets limit the error of a recorded value to 25% */
+#define METRICS_SUB_BUCKET_BITS 2
+#define METRICS_SUB_BUCKET_CNT (1 << METRICS_SUB_BUCKET_BITS)
+#define METRICS_BUCKET_CNT ((64 - METRICS_SUB_BUCKET_BITS + 1) * METRICS_SUB_BUCKET_CNT)
+
+/* monotonic counter that can be updated from any thread. The update is a
+ * single relaxed atomic add, cheap enough for the receive and store path */
+class Metrics_Counter {
+public:
+	Metrics_Counter() : value(0) {}
+
+	void add(uint64_t n = 1) { value.fetch_add(n, std::memory_order_relaxed); }
+	uint64_t get() const { return value.load(std::memory_order_relaxed); }
+private:
+	Metrics_Counter(const Metrics_Counter&);
+	Metrics_Counter& operator=(const Metrics_Counter&);
+
+	std::atomic<uint64_t> value;
+};
+
+/* histogram of integer values (e.g. latencies in microseconds) with
+ * logarithmic buckets, like a HDR histogram. Each power of two is split into
+ * METRICS_SUB_BUCKET_CNT linear buckets, so the relative error is the same
+ * for small and large values and no range has to be configured. Recording
+ * a value takes three relaxed atomic adds */
+class Metrics_Histogram {
+public:
+	Metrics_Histogram();
+
+	void record(uint64_t value);
+	uint64_t get_count() const;
+	uint64_t get_sum() const;
+	uint64_t get_bucket_count(uint16_t bucket) const;
+	/* returns the largest value that is counted in the bucket */
+	static uint64_t bucket_max(uint16_t bucket);
+	static uint16_t bucket_index(uint64_t value);
+private:
+	Metrics_Histogram(const Metrics_Histogram&);
+	Metrics_Histogram& operator=(const Metrics_Histogram&);
+
+	std::atomic<uint64_t> buckets[METRICS_BUCKET_CNT];
+	std::atomic<uint64_t> count;
+	std::atomic<uint64_t> sum;
+};
+
+/* registry of the metrics of the controller, formatted in the Prometheus
+ * text format. The registry only keeps pointers to the counters and
+ * histograms, they are owned by the modules that update them. Values that
+ * a module already counts (e.g. the frame parser statistics) are added with
+ * a reader function that is called while the metrics are formatted, so the
+ * module needs no changes. The readers are called from the thread that
+ * formats the metrics */
+class Metrics_Registry {
+public:
+	typedef std::function<double()> Reader;
+
+	/* labels are passed in the Prometheus format, e.g. table="sensorHeart".
+	 * Metrics with the same name have to differ in their labels */
+	void add_counter(const std::string &name, const std::string &help,
+		const Metrics_Counter *counter, const std::string &labels = "");
+	void add_counter(const std::string &name, const std::string &help,
+		const Reader &reader, const std::string &labels = "");
+	void add_gauge(const std::string &name, const std::string &help,
+		const Reader &reader, const std::string &labels = "");
+	/* the recorded values are multiplied by scale, e.g. 1e-6 to report
+	 * microseconds in seconds */
+	void add_histogram(const std::string &name, const std::string &help,
+		const Metrics_Histogram *histogram, double scale = 1.0,
+		const std::string &labels = "");
+
+	/* returns all metrics in the Prometheus text exposition format */
+	std::string format() const;
+private:
+	typedef struct {
+		std::string name;
+		std::string help;
+		std::string labels;
+		const char *type;
+		Reader reader;
+		const Metrics_Histogram *histogram;
+		double scale;
+	} Metric;
+
+	void add(const std::string &name, const std::string &help, const std::string &labels,
+		const char *type, const Reader &reader, const Metrics_Histogram *histogram,
+		double scale);
+	void format_histogram(const Metric &metric, std::string *text) const;
+
+	std::vector<Metric> metrics;
+};
+
+#endif
@@ -0,0 +1,231 @@
+/* This file is part of Equine Monitor
+ *
+ * Equine Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Equine Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Equine Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Konke Radlow <koradlow@gmail.com>
+ */
+
+#include "metrics_server.h"
+#include "metrics.h"
+#include "event_loop.h"
+#include "logger.h"
+#include <chrono>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define METRICS_LISTEN_BACKLOG 8
+
+/* returns a monotonic timestamp in milliseconds */
+static int64_t monotonic_ms() {
+	return std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/** Metrics_Server Class implementation */
+Metrics_Server::Metrics_Server(const Metrics_Registry &registry, Event_Loop &event_loop) :
+	registry(registry),
+	event_loop(event_loop),
+	listen_fd(-1),
+	request_cnt(0)
+{}
+
+Metrics_Server::~Metrics_Server() {
+	stop();
+}
+
+bool Metrics_Server::start(const std::string &address) {
+	if (listen_fd >= 0)
+		return true;
+	if (address.find('/') != std::string::npos)
+		listen_fd = listen_unix(address);
+	else
+		listen_fd = listen_tcp(address);
+	if (listen_fd < 0)
+		return false;
+
+	if (!event_loop.add_fd(listen_fd, [this]() { accept_client(); })) {
+		stop();
+		return false;
+	}
+	log_info(LOG_MODULE_CONTROLLER, "Serving metrics on %s", address.c_str());
+	return true;
+}
+
+void Metrics_Server::stop() {
+	while (!clients.empty())
+		close_client(clients.begin()->first);
+	if (listen_fd < 0)
+		return;
+	event_loop.remove(listen_fd);
+	close(listen_fd);
+	listen_fd = -1;
+	if (!unix_path.empty())
+		unlink(unix_path.c_str());
+	unix_path.clear();
+}
+
+uint32_t Metrics_Server::get_request_cnt() const {
+	return request_cnt;
+}
+
+/* a stale socket file of a previous run is replaced */
+int Metrics_Server::listen_unix(const std::string &path) {
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (path.length() >= sizeof(addr.sun_path)) {
+		log_error(LOG_MODULE_CONTROLLER, "Metrics socket path too long: %s", path.c_str());
+		return -1;
+	}
+	strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		log_error(LOG_MODULE_CONTROLLER, "Error creating metrics socket: %s", strerror(errno));
+		return -1;
+	}
+	unlink(path.c_str());
+	if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0 ||
+	    listen(fd, METRICS_LISTEN_BACKLOG) < 0) {
+		log_error(LOG_MODULE_CONTROLLER, "Error listening on %s: %s", path.c_str(),
+			strerror(errno));
+		close(fd);
+		return -1;
+	}
+	unix_path = path;
+	return fd;
+}
+
+int Metrics_Server::listen_tcp(const std::string &address) {
+	std::string host = "127.0.0.1", port = address;
+	size_t separator = address.rfind(':');
+	if (separator != std::string::npos) {
+		host = address.substr(0, separator);
+		port = address.substr(separator + 1);
+	}
+
+	struct addrinfo hints, *result;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	int error_code = getaddrinfo(host.empty() ? NULL : host.c_str(), port.c_str(),
+		&hints, &result);
+	if (error_code) {
+		log_error(LOG_MODULE_CONTROLLER, "Invalid metrics address %s: %s", address.c_str(),
+			gai_strerror(error_code));
+		return -1;
+	}
+
+	int fd = socket(result->ai_family, result->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+		result->ai_protocol);
+	int reuse = 1;
+	if (fd < 0 || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0 ||
+	    bind(fd, result->ai_addr, result->ai_addrlen) < 0 ||
+	    listen(fd, METRICS_LISTEN_BACKLOG) < 0) {
+		log_error(LOG_MODULE_CONTROLLER, "Error listening on %s: %s", address.c_str(),
+			strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(result);
+	return fd;
+}
+
+/* the request is read when the client sends it, a client that connected
+ * does not block the event loop */
+void Metrics_Server::accept_client() {
+	int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd < 0)
+		return;
+	/* the oldest client is disconnected if the clients that did not send
+	 * their request yet use up all places */
+	close_expired_clients();
+	if (clients.size() >= METRICS_MAX_CLIENTS)
+		close_client(oldest_client());
+	if (!event_loop.add_fd(fd, [this, fd]() { read_request(fd); })) {
+		close(fd);
+		return;
+	}
+	clients[fd].connect_ms = monotonic_ms();
+}
+
+/* collects the request until the empty line at the end of the HTTP header,
+ * and answers it with the formatted metrics */
+void Metrics_Server::read_request(int fd) {
+	std::map<int, Client>::iterator it = clients.find(fd);
+	if (it == clients.end())
+		return;
+	Client &client = it->second;
+	char buffer[512];
+	ssize_t length = read(fd, buffer, sizeof(buffer));
+	if (length < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+	if (length <= 0) {
+		close_client(fd);
+		return;
+	}
+	client.request.append(buffer, length);
+	if (client.request.find("\r\n\r\n") == std::string::npos &&
+	    client.request.find("\n\n") == std::string::npos &&
+	    client.request.length() < METRICS_MAX_REQUEST_LEN)
+		return;
+
+	std::string body = registry.format();
+	char header[128];
+	snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\n"
+		"Content-Type: text/plain; version=0.0.4\r\n"
+		"Content-Length: %zu\r\n\r\n", body.length());
+	std::string response = header + body;
+	/* the response fits into the socket buffer, a client that does not
+	 * read it gets a truncated response instead of blocking the loop */
+	if (write(fd, response.data(), response.length()) < (ssize_t) response.length())
+		log_warn(LOG_MODULE_CONTROLLER, "Metrics response truncated");
+	request_cnt++;
+	close_client(fd);
+}
+
+void Metrics_Server::close_client(int fd) {
+	event_loop.remove(fd);
+	close(fd);
+	clients.erase(fd);
+}
+
+void Metrics_Server::close_expired_clients() {
+	int64_t now_ms = monotonic_ms();
+	std::map<int, Client>::iterator it = clients.begin();
+	while (it != clients.end()) {
+		int fd = it->first;
+		int64_t connect_ms = it->second.connect_ms;
+		++it;
+		if (now_ms - connect_ms >= METRICS_CLIENT_TIMEOUT_MS)
+			close_client(fd);
+	}
+}
+
+int Metrics_Server::oldest_client() const {
+	std::map<int, Client>::const_iterator it, oldest = clients.begin();
+	for (it = clients.begin(); it != clients.end(); ++it) {
+		if (it->second.connect_ms < oldest->second.connect_ms)
+			oldest = it;
+	}
+	return oldest->first;
+}
@@ -0,0 +1,76 @@
+/* This file is part of Equine Monitor
+ *
+ * Equine Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Equine Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Equine Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Konke Radlow <koradlow@gmail.com>
+ */
+
+#ifndef METRICS_SERVER_H
+#define METRICS_SERVER_H
+
+#include <map>
+#include <string>
+#include <inttypes.h>
+
+class Event_Loop;
+class Metrics_Registry;
+
+/* max number of clients that are connected at the same time */
+#define METRICS_MAX_CLIENTS 8
+/* clients that did not send their request within this time are disconnected */
+#define METRICS_CLIENT_TIMEOUT_MS 5000
+/* max length of a request, longer requests are answered after this length */
+#define METRICS_MAX_REQUEST_LEN 4096
+
+/* serves the metrics of a registry over HTTP, e.g. for a Prometheus
+ * scrape. The server listens on a Unix socket (address is a path) or a TCP
+ * socket (address is [host:]port, the host defaults to 127.0.0.1) and runs
+ * in the event loop of the controller, so the metrics are formatted in the
+ * thread that receives the messages. Every request gets the complete
+ * metrics, independent of the path */
+class Metrics_Server {
+public:
+	Metrics_Server(const Metrics_Registry &registry, Event_Loop &event_loop);
+	~Metrics_Server();
+
+	/* opens the socket and adds it to the event loop, returns false on error */
+	bool start(const std::string &address);
+	void stop();
+	uint32_t get_request_cnt() const;
+private:
+	Metrics_Server(const Metrics_Server&);
+	Metrics_Server& operator=(const Metrics_Server&);
+
+	typedef struct {
+		std::string request;
+		int64_t connect_ms;
+	} Client;
+
+	int listen_unix(const std::string &path);
+	int listen_tcp(const std::string &address);
+	void accept_client();
+	void read_request(int fd);
+	void close_client(int fd);
+	void close_expired_clients();
+	int oldest_client() const;
+
+	const Metrics_Registry &registry;
+	Event_Loop &event_loop;
+	int listen_fd;
+	std::string unix_path;
+	std::map<int, Client> clients;
+	uint32_t request_cnt;
+};
+
+#endif
@@ -0,0 +1,250 @@
+/* This file is part of Equine Monitor
+ *
+ * Equine Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Equine Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Equine Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Konke Radlow <koradlow@gmail.com>
+ */
+
+#include "node_registry.h"
+#include "sqlite_helper.h"
+#include <set>
+#include <time.h>
+
+/* columns of the node table, the statistic columns were added later and are
+ * appended to existing tables */
+static const struct {
+	const char *name;
+	const char *type;
+} node_columns[] = {
+	{"addr64", "UNSIGNED BIGINT UNIQUE"},
+	{"addr16", "UNSIGNED INT"},
+	{"identifier", "VARCHAR(20)"},
+	{"last_seen", "UNSIGNED INT"},
+	{"message_cnt", "UNSIGNED BIGINT"},
+	{"byte_cnt", "UNSIGNED BIGINT"}
+};
+#define NODE_COLUMN_CNT (sizeof(node_columns) / sizeof(node_columns[0]))
+
+/** Node_Registry Class implementation */
+Node_Registry::Node_Registry(sqlite3 *db, uint32_t flush_interval_ms) :
+	db(db),
+	insert_stmt(NULL),
+	identifier_stmt(NULL),
+	write_stmt(NULL),
+	flush_interval_ms(flush_interval_ms),
+	last_flush_ms(now_ms()),
+	dirty_cnt(0),
+	write_cnt(0)
+{
+	/* a row that exists already is not replaced, its identifier might have
+	 * been set by the user */
+	string sql_insert = "INSERT OR IGNORE INTO " + string(TABLE_MONITORING_NODES) + " (";
+	for (unsigned i = 0; i < NODE_COLUMN_CNT; i++)
+		sql_insert += string(i ? ", " : "") + node_columns[i].name;
+	sql_insert += ") VALUES (?1, ?2, ?3, ?4, ?5, ?6)";
+	CALL_SQLITE(prepare_v2(db, sql_insert.c_str(), -1, &insert_stmt, NULL));
+
+	string sql_identifier = "UPDATE " + string(TABLE_MONITORING_NODES) +
+		" SET identifier = ?2 WHERE addr64 = ?1";
+	CALL_SQLITE(prepare_v2(db, sql_identifier.c_str(), -1, &identifier_stmt, NULL));
+
+	string sql_write = "UPDATE " + string(TABLE_MONITORING_NODES) + " SET addr16 = ?2, "
+		"last_seen = ?3, message_cnt = ?4, byte_cnt = ?5 WHERE addr64 = ?1";
+	CALL_SQLITE(prepare_v2(db, sql_write.c_str(), -1, &write_stmt, NULL));
+}
+
+Node_Registry::~Node_Registry() {
+	sqlite3_finalize(insert_stmt);
+	sqlite3_finalize(identifier_stmt);
+	sqlite3_finalize(write_stmt);
+}
+
+/* returns a monotonic timestamp in milliseconds */
+uint32_t Node_Registry::now_ms() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+void Node_Registry::create_table(sqlite3 *db) {
+	string sql_create = "CREATE TABLE IF NOT EXISTS " + string(TABLE_MONITORING_NODES) + " (";
+	for (unsigned i = 0; i < NODE_COLUMN_CNT; i++)
+		sql_create += string(i ? ", " : "") + node_columns[i].name + " " + node_columns[i].type;
+	sql_create += ")";
+	CALL_SQLITE(exec(db, sql_create.c_str(), 0, 0, 0));
+
+	/* tables created by older versions lack the statistic columns */
+	std::set<string> existing;
+	sqlite3_stmt *stmt = NULL;
+	string sql_info = "PRAGMA table_info(" + string(TABLE_MONITORING_NODES) + ")";
+	CALL_SQLITE(prepare_v2(db, sql_info.c_str(), -1, &stmt, NULL));
+	while (sqlite3_step(stmt) == SQLITE_ROW)
+		existing.insert((const char*) sqlite3_column_text(stmt, 1));
+	sqlite3_finalize(stmt);
+
+	for (unsigned i = 0; i < NODE_COLUMN_CNT; i++) {
+		if (existing.count(node_columns[i].name))
+			continue;
+		string sql_alter = "ALTER TABLE " + string(TABLE_MONITORING_NODES) +
+			" ADD COLUMN " + node_columns[i].name + " " + node_columns[i].type;
+		CALL_SQLITE(exec(db, sql_alter.c_str(), 0, 0, 0));
+	}
+
+	string sql_index = "CREATE UNIQUE INDEX IF NOT EXISTS address_ix ON "
+				+ string(TABLE_MONITORING_NODES) + " (addr64)";
+	CALL_SQLITE(exec(db, sql_index.c_str(), 0, 0, 0));
+}
+
+void Node_Registry::load() {
+	sqlite3_stmt *stmt = NULL;
+	string sql_select = "SELECT addr64, addr16, identifier, last_seen, message_cnt, "
+		"byte_cnt FROM " + string(TABLE_MONITORING_NODES);
+
+	CALL_SQLITE(prepare_v2(db, sql_select.c_str(), -1, &stmt, NULL));
+	while (sqlite3_step(stmt) == SQLITE_ROW) {
+		Node &node = nodes[sqlite3_column_int64(stmt, 0)];
+		const unsigned char *identifier = sqlite3_column_text(stmt, 2);
+		node.addr16 = sqlite3_column_int(stmt, 1);
+		node.identifier = identifier ? (const char*) identifier : "Undefined";
+		node.last_seen = sqlite3_column_int64(stmt, 3);
+		node.message_cnt = sqlite3_column_int64(stmt, 4);
+		node.byte_cnt = sqlite3_column_int64(stmt, 5);
+		node.dirty = false;
+	}
+	sqlite3_finalize(stmt);
+}
+
+/* the 64bit address is unique and serves as an identifier, the 16bit address
+ * can change if a node reconnects. The identifier is kept, unless the
+ * address carries a new one */
+bool Node_Registry::update(const XBee_Address &addr, uint16_t length) {
+	uint64_t addr64 = addr.get_addr64();
+	std::unordered_map<uint64_t, Node>::iterator it = nodes.find(addr64);
+	bool changed = false;
+	bool written = true;
+
+	if (it == nodes.end()) {
+		it = nodes.insert(std::make_pair(addr64, Node())).first;
+		it->second.addr16 = addr.addr16;
+		it->second.identifier = addr.node.empty() ? "Undefined" : addr.node;
+		it->second.last_seen = time(NULL);
+		it->second.message_cnt = 0;
+		it->second.byte_cnt = 0;
+		it->second.dirty = false;
+		written = insert_node(addr64, it->second);
+		/* the row might have existed with another identifier */
+		if (written && !addr.node.empty())
+			written = write_identifier(addr64, it->second);
+		changed = true;
+	} else {
+		/* received addresses only carry an identifier if it was
+		 * discovered */
+		if (!addr.node.empty() && it->second.identifier != addr.node) {
+			it->second.identifier = addr.node;
+			written = write_identifier(addr64, it->second);
+		}
+		if (it->second.addr16 != addr.addr16)
+			changed = true;
+	}
+
+	Node &node = it->second;
+	node.addr16 = addr.addr16;
+	node.last_seen = time(NULL);
+	node.message_cnt++;
+	node.byte_cnt += length;
+	/* a node whose row could not be written is written by the next flush */
+	if (changed && written && write_node(addr64, node))
+		return true;
+	if (!node.dirty) {
+		node.dirty = true;
+		dirty_cnt++;
+	}
+	return written && !changed;
+}
+
+bool Node_Registry::flush_due() const {
+	return dirty_cnt && now_ms() - last_flush_ms >= flush_interval_ms;
+}
+
+bool Node_Registry::flush() {
+	std::unordered_map<uint64_t, Node>::iterator it;
+	bool written = true;
+	for (it = nodes.begin(); dirty_cnt && it != nodes.end(); ++it) {
+		if (it->second.dirty && !write_node(it->first, it->second))
+			written = false;
+	}
+	last_flush_ms = now_ms();
+	return written;
+}
+
+void Node_Registry::invalidate() {
+	std::unordered_map<uint64_t, Node>::iterator it;
+	for (it = nodes.begin(); it != nodes.end(); ++it) {
+		if (!it->second.dirty) {
+			it->second.dirty = true;
+			dirty_cnt++;
+		}
+	}
+}
+
+/* adds the row of a node that was not loaded, a row that was added to the
+ * table in the meantime is kept */
+bool Node_Registry::insert_node(uint64_t addr64, const Node &node) {
+	sqlite3_bind_int64(insert_stmt, 1, addr64);
+	sqlite3_bind_int(insert_stmt, 2, node.addr16);
+	sqlite3_bind_text(insert_stmt, 3, node.identifier.c_str(), -1, SQLITE_STATIC);
+	sqlite3_bind_int64(insert_stmt, 4, node.last_seen);
+	sqlite3_bind_int64(insert_stmt, 5, node.message_cnt);
+	sqlite3_bind_int64(insert_stmt, 6, node.byte_cnt);
+	return step_statement(insert_stmt);
+}
+
+bool Node_Registry::write_identifier(uint64_t addr64, const Node &node) {
+	sqlite3_bind_int64(identifier_stmt, 1, addr64);
+	sqlite3_bind_text(identifier_stmt, 2, node.identifier.c_str(), -1, SQLITE_STATIC);
+	if (!step_statement(identifier_stmt))
+		return false;
+	write_cnt++;
+	return true;
+}
+
+/* writes the 16bit address and the statistics of the node, the statistics
+ * are up to date after. The row is added again if it is missing, because
+ * the transaction that added it was rolled back */
+bool Node_Registry::write_node(uint64_t addr64, Node &node) {
+	sqlite3_bind_int64(write_stmt, 1, addr64);
+	sqlite3_bind_int(write_stmt, 2, node.addr16);
+	sqlite3_bind_int64(write_stmt, 3, node.last_seen);
+	sqlite3_bind_int64(write_stmt, 4, node.message_cnt);
+	sqlite3_bind_int64(write_stmt, 5, node.byte_cnt);
+	if (!step_statement(write_stmt))
+		return false;
+	if (!sqlite3_changes(db) && !insert_node(addr64, node))
+		return false;
+
+	if (node.dirty) {
+		node.dirty = false;
+		dirty_cnt--;
+	}
+	write_cnt++;
+	return true;
+}
+
+uint32_t Node_Registry::get_node_cnt() const {
+	return nodes.size();
+}
+
+uint32_t Node_Registry::get_write_cnt() const {
+	return write_cnt;
+}
@@ -0,0 +1,94 @@
+/* This file is part of Equine Monitor
+ *
+ * Equine Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Equine Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Equine Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Konke Radlow <koradlow@gmail.com>
+ */
+
+#ifndef NODE_REGISTRY_H
+#define NODE_REGISTRY_H
+
+#include "xbee_if.h"
+#include <string>
+#include <unordered_map>
+#include <inttypes.h>
+#include <sqlite3.h>
+
+#define TABLE_MONITORING_NODES "monitoringNodes"
+/* default interval for writing the node statistics to the db */
+#define NODE_FLUSH_INTERVAL_MS 60000
+
+/* keeps the rows of the node table in memory, so the table doesn't have to
+ * be written for each received message. A row is written immediately if a
+ * node is new or its 16bit address or identifier changed. The statistics
+ * (last seen, message and byte count) are only updated in memory and
+ * written by flush() for the nodes that changed since the last flush.
+ * The identifier is only written if a received address carries one, names
+ * that are set in the table while the controller runs are kept.
+ * The registry is used by the thread that owns the db connection */
+class Node_Registry {
+public:
+	Node_Registry(sqlite3 *db, uint32_t flush_interval_ms);
+	~Node_Registry();
+
+	/* creates the node table, or adds missing columns to an older table */
+	static void create_table(sqlite3 *db);
+
+	/* loads the known nodes from the db */
+	void load();
+	/* counts a message of length bytes from the node, returns false if the
+	 * row of a new or changed node could not be written */
+	bool update(const XBee_Address &addr, uint16_t length);
+	/* returns true if there are changed statistics and the flush interval
+	 * has passed since the last flush */
+	bool flush_due() const;
+	/* writes the changed statistics to the db, returns false if a row
+	 * could not be written */
+	bool flush();
+	/* marks all nodes as changed, their rows are written again by the next
+	 * flush. Used after the transaction of a write was rolled back */
+	void invalidate();
+
+	uint32_t get_node_cnt() const;
+	uint32_t get_write_cnt() const;
+private:
+	Node_Registry(const Node_Registry&);
+	Node_Registry& operator=(const Node_Registry&);
+
+	typedef struct {
+		uint16_t addr16;
+		std::string identifier;
+		uint32_t last_seen;	/* unix timestamp of the last message */
+		uint64_t message_cnt;
+		uint64_t byte_cnt;
+		bool dirty;		/* statistics changed since the last flush */
+	} Node;
+
+	bool insert_node(uint64_t addr64, const Node &node);
+	bool write_identifier(uint64_t addr64, const Node &node);
+	bool write_node(uint64_t addr64, Node &node);
+	static uint32_t now_ms();
+
+	sqlite3 *db;
+	sqlite3_stmt *insert_stmt;
+	sqlite3_stmt *identifier_stmt;
+	sqlite3_stmt *write_stmt;
+	std::unordered_map<uint64_t, Node> nodes;
+	const uint32_t flush_interval_ms;
+	uint32_t last_flush_ms;
+	uint32_t dirty_cnt;
+	uint32_t write_cnt;
+};
+
+#endif
@@ -0,0 +1,178 @@
+/* This file is part of Equine Monitor
+ *
+ * Equine Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Equine Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Equine Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Konke Radlow <koradlow@gmail.com>
+ */
+
+#ifndef PACKET_VIEW_H
+#define PACKET_VIEW_H
+
+#include "messagetypes.h"
+#include <stddef.h>
+#include <string.h>
+#include <inttypes.h>
+
+/* the serialized layout of a MessagePacket (see MessageStorage::serialize):
+ * the mainType is packed into 1 byte, followed by the relTimestampS and the
+ * header of the message group. Pointer members are not serialized */
+#define PACKET_HEADER_SIZE 5
+#define SENSOR_HEADER_SIZE (sizeof(SensorMessage) - sizeof(uint8_t *))
+#define CONFIG_HEADER_SIZE (sizeof(ConfigMessage) - sizeof(uint8_t *))
+#define DEBUG_HEADER_SIZE (sizeof(DebugMessage) - sizeof(uint8_t *))
+
+/* read-only view of a serialized MessagePacket. The view does not copy or
+ * allocate anything, it only decodes the header fields on access and
+ * validates that the headers fit into the received data. The data has to
+ * outlive the view.
+ * All accessors of a message group may only be used if is_valid() returned
+ * true and get_main_type() matches the group */
+class Packet_View {
+public:
+	Packet_View(const uint8_t *data, uint16_t length) :
+		data(data),
+		length(length)
+	{}
+
+	/* checks that the packet header and the header of the message group fit
+	 * into the data */
+	bool is_valid() const {
+		if (!data || length < PACKET_HEADER_SIZE)
+			return false;
+		switch (get_main_type()) {
+		case msgSensorData:
+			return length >= PACKET_HEADER_SIZE + SENSOR_HEADER_SIZE;
+		case msgSensorConfig:
+			return length >= PACKET_HEADER_SIZE + CONFIG_HEADER_SIZE;
+		case msgDebug:
+			return length >= PACKET_HEADER_SIZE + DEBUG_HEADER_SIZE;
+		default:
+			return false;
+		}
+	}
+
+	MessageType get_main_type() const {
+		return (MessageType)data[0];
+	}
+
+	uint32_t get_rel_timestamp() const {
+		return read<uint32_t>(1);
+	}
+
+	/* accessors for sensor messages */
+	DeviceType get_sensor_type() const {
+		return read<DeviceType>(PACKET_HEADER_SIZE + offsetof(SensorMessage, sensorType));
+	}
+
+	uint32_t get_end_timestamp() const {
+		return read<uint32_t>(PACKET_HEADER_SIZE + offsetof(SensorMessage, endTimestampS));
+	}
+
+	uint16_t get_sample_interval() const {
+		return read<uint16_t>(PACKET_HEADER_SIZE + offsetof(SensorMessage, sampleIntervalMs));
+	}
+
+	uint8_t get_array_length() const {
+		return read<uint8_t>(PACKET_HEADER_SIZE + offsetof(SensorMessage, arrayLength));
+	}
+
+	/* returns a pointer to the sample array and the number of bytes that
+	 * were received for it */
+	const uint8_t* get_array(uint16_t *array_length) const {
+		*array_length = length - (PACKET_HEADER_SIZE + SENSOR_HEADER_SIZE);
+		return &data[PACKET_HEADER_SIZE + SENSOR_HEADER_SIZE];
+	}
+
+	/* accessors for debug messages */
+	uint32_t get_debug_timestamp() const {
+		return read<uint32_t>(PACKET_HEADER_SIZE + offsetof(DebugMessage, timestampS));
+	}
+
+	/* returns a pointer to the debug string. The serialized string is not
+	 * necessarily terminated by a null byte, the length is limited by the
+	 * end of the data or the first null byte */
+	const char* get_debug_string(uint16_t *string_length) const {
+		const char *debug_string = (const char *)&data[PACKET_HEADER_SIZE + DEBUG_HEADER_SIZE];
+		uint16_t max_length = length - (PACKET_HEADER_SIZE + DEBUG_HEADER_SIZE);
+		const void *end = memchr(debug_string, '\0', max_length);
+		*string_length = end ? (const char *)end - debug_string : max_length;
+		return debug_string;
+	}
+private:
+	/* the serialized data is packed, so the fields have to be read with
+	 * memcpy to avoid unaligned access */
+	template <typename T>
+	T read(uint16_t offset) const {
+		T value;
+		memcpy(&value, &data[offset], sizeof(T));
+		return value;
+	}
+
+	const uint8_t *data;
+	uint16_t length;
+};
+
+/* typed view of the sample array of a sensor message. The samples are not
+ * copied, they are accessed in place. The sample structs are packed, so a
+ * reference to a sample in the received data is always correctly aligned.
+ * The array length from the header is validated against the received data
+ * at construction, a view of a truncated packet is empty */
+template <typename T>
+class Sensor_View {
+public:
+	Sensor_View(const Packet_View &packet) :
+		samples(NULL),
+		sample_cnt(0)
+	{
+		uint16_t array_length;
+		if (!packet.is_valid() || packet.get_main_type() != msgSensorData)
+			return;
+		const uint8_t *array = packet.get_array(&array_length);
+		if (packet.get_array_length() * sizeof(T) > array_length)
+			return;
+		samples = (const T *)array;
+		sample_cnt = packet.get_array_length();
+	}
+
+	bool is_valid() const {
+		return samples != NULL;
+	}
+
+	uint8_t size() const {
+		return sample_cnt;
+	}
+
+	/* unchecked access, index has to be smaller than size() */
+	const T& operator[](uint8_t i) const {
+		return samples[i];
+	}
+
+	/* checked access, returns NULL if the index is out of bounds */
+	const T* at(uint8_t i) const {
+		return (i < sample_cnt) ? &samples[i] : NULL;
+	}
+
+	const T* begin() const {
+		return samples;
+	}
+
+	const T* end() const {
+		return samples + sample_cnt;
+	}
+private:
+	const T *samples;
+	uint8_t sample_cnt;
+};
+
+#endif
@@ -0,0 +1,184 @@
+/* This file is part of Equine Monitor
+ *
+ * Equine Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Equine Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Equine Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Konke Radlow <koradlow@gmail.com>
+ */
+
+/* replays a raw frame capture of the controller through the same pipeline
+ * as the received frames: the RxPacket frames are put together by the
+ * XBee_Reassembly and the messages are stored by Message_Storage, in
+ * batches like the DB_Writer does. The frames are replayed with the timing
+ * of the capture, accelerated by the speed factor, or as fast as possible.
+ * By default the messages are stored with the time they were received at,
+ * so the replay can rebuild a database from the capture.
+ * usage: replay_capture [-s speed (default 1, 0 = max speed)] [-g max_gap_ms]
+ * 	[-b batch_size] [-n (store with the current time)] db capture_path
+ * build: g++ -std=gnu++0x -O2 -I. -Iehm-common -Ixbee_if -DEHM_BASE_STATION
+ * 	replay_capture.cpp sqlite_helper.cpp node_registry.cpp sensor_registry.cpp
+ * 	sensor_rollup.cpp sample_block_store.cpp temperature.cpp metrics.cpp xbee_if/xbee_if.cpp
+ * 	xbee_if/xbee_frame_parser.cpp xbee_if/xbee_capture.cpp xbee_if/logger.cpp
+ * 	ehm-common/messagestorage.cpp
+ * 	-lgbee -lsqlite3 -lpthread */
+
+#include "controller.h"
+#include "sqlite_helper.h"
+#include "xbee_if.h"
+#include "xbee_capture.h"
+#include <gbee.h>
+#include <sqlite3.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <vector>
+
+#define REPLAY_BATCH_SIZE 32
+/* number of WAL pages after which sqlite runs a checkpoint */
+#define REPLAY_WAL_AUTOCHECKPOINT 1000
+
+static uint64_t now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t time_ns) {
+	struct timespec ts;
+	ts.tv_sec = time_ns / 1000000000ULL;
+	ts.tv_nsec = time_ns % 1000000000ULL;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0);
+}
+
+/* stores the collected messages in one transaction, with the receive time
+ * of the batch */
+static void store_batch(Message_Storage &storage, std::vector<XBee_Message*> &batch,
+		time_t receive_time) {
+	if (batch.empty())
+		return;
+	storage.set_receive_time(receive_time);
+	storage.store_msgs(&batch[0], batch.size());
+	for (size_t i = 0; i < batch.size(); i++)
+		xbee_free_message(batch[i]);
+	batch.clear();
+}
+
+int main(int argc, char **argv) {
+	double speed = 1;
+	uint64_t max_gap_ns = 0;
+	uint16_t batch_size = REPLAY_BATCH_SIZE;
+	bool current_time = false;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:g:b:n")) != -1) {
+		switch (opt) {
+		case 's': speed = strtod(optarg, NULL); break;
+		case 'g': max_gap_ns = strtoull(optarg, NULL, 0) * 1000000ULL; break;
+		case 'b': batch_size = strtoul(optarg, NULL, 0); break;
+		case 'n': current_time = true; break;
+		default:
+			optind = argc;
+		}
+	}
+	if (argc - optind != 2) {
+		fprintf(stderr, "usage: %s [-s speed (0 = max speed)] [-g max_gap_ms] "
+			"[-b batch_size] [-n] db capture_path\n", argv[0]);
+		return 1;
+	}
+	if (!batch_size)
+		batch_size = 1;
+
+	XBee_Capture_Reader reader(argv[optind + 1]);
+	if (!reader.get_segment_cnt()) {
+		fprintf(stderr, "No capture segments found at %s\n", argv[optind + 1]);
+		return 1;
+	}
+
+	sqlite3 *db;
+	if (sqlite3_open(argv[optind], &db) != SQLITE_OK) {
+		fprintf(stderr, "Error: cannot open database: %s\n", sqlite3_errmsg(db));
+		sqlite3_close(db);
+		return 1;
+	}
+	/* there's no checkpointer thread, let sqlite run the checkpoints */
+	if (configure_db(db, "WAL", "NORMAL", 0))
+		sqlite3_wal_autocheckpoint(db, REPLAY_WAL_AUTOCHECKPOINT);
+	create_db_tables(db);
+
+	Message_Storage *storage = new Message_Storage(db);
+	/* a batch is stored before the next one is collected */
+	XBee_Message_Pool pool(batch_size);
+	XBee_Reassembly reassembly(XBEE_REASSEMBLY_SLOTS, XBEE_REASSEMBLY_TIMEOUT_MS, &pool);
+	std::vector<XBee_Message*> batch;
+	time_t batch_time = 0;
+	XBee_Frame frame;
+	uint64_t time_ns;
+	uint64_t first_real_ns = 0, last_real_ns = 0;
+	uint64_t replay_ns = 0;		/* capture time since the first frame */
+	uint32_t frame_cnt = 0, rx_cnt = 0;
+	uint64_t start_ns = now_ns();
+
+	while (reader.next_frame(&frame, &time_ns)) {
+		uint64_t real_ns = reader.get_real_time_ns(time_ns);
+		time_t receive_time = current_time ? 0 : real_ns / 1000000000ULL;
+
+		/* the capture can contain several sessions of the controller,
+		 * the time between them is skipped or limited to the max gap */
+		if (frame_cnt) {
+			uint64_t gap = real_ns > last_real_ns ? real_ns - last_real_ns : 0;
+			replay_ns += (max_gap_ns && gap > max_gap_ns) ? max_gap_ns : gap;
+		} else {
+			first_real_ns = real_ns;
+		}
+		last_real_ns = real_ns;
+		frame_cnt++;
+
+		if (speed > 0) {
+			uint64_t due_ns = start_ns + replay_ns / speed;
+			if (due_ns > now_ns()) {
+				/* store what was received before waiting */
+				store_batch(*storage, batch, batch_time);
+				reassembly.expire();
+				sleep_until(due_ns);
+			}
+		}
+
+		if (frame.data[0] != GBEE_RX_PACKET)
+			continue;
+		rx_cnt++;
+		XBee_Message *msg = reassembly.add_part((const GBeeRxPacket*) frame.data, frame.length);
+		if (!msg)
+			continue;
+		if (!batch.empty() && (batch.size() >= batch_size || receive_time != batch_time))
+			store_batch(*storage, batch, batch_time);
+		batch_time = receive_time;
+		batch.push_back(msg);
+	}
+	store_batch(*storage, batch, batch_time);
+
+	double elapsed_s = (now_ns() - start_ns) / 1e9;
+	const XBee_Reassembly_Stats &stats = reassembly.get_stats();
+	fprintf(stderr, "Replayed %u frames (%u RxPackets) from %u segments in %.2f s\n",
+		frame_cnt, rx_cnt, reader.get_segment_cnt(), elapsed_s);
+	fprintf(stderr, "Capture duration %.2f s, replayed %.2f s of it, %.1fx real time\n",
+		(last_real_ns - first_real_ns) / 1e9, replay_ns / 1e9,
+		elapsed_s > 0 ? replay_ns / 1e9 / elapsed_s : 0.0);
+	fprintf(stderr, "Messages: %u stored (%.0f msg/s), %u expired, %u parts rejected\n",
+		stats.completed, elapsed_s > 0 ? stats.completed / elapsed_s : 0.0,
+		stats.expired, stats.rejected);
+
+	delete storage;
+	sqlite3_close(db);
+	return 0;
+}
@@ -0,0 +1,120 @@
+/* This file is part of Equine Monitor
+ *
+ * Equine Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Equine Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Equine Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Konke Radlow <koradlow@gmail.com>
+ */
+
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <atomic>
+#include <inttypes.h>
+
+/* size of a cache line, the positions of the threads are kept this far apart */
+#define RING_BUFFER_CACHE_LINE 64
+
+/* bounded single producer / single consumer queue. push() may only be called
+ * by one thread and pop() only by one other thread, in that case no locking
+ * is required. The capacity is rounded up to the next power of two, so the
+ * read and write positions can be wrapped with a bit mask */
+template <typename T>
+class Ring_Buffer {
+public:
+	Ring_Buffer(uint32_t min_capacity) :
+		capacity(round_capacity(min_capacity)),
+		mask(capacity - 1),
+		read_pos(0),
+		write_pos(0),
+		high_water_mark(0)
+	{
+		buffer = new T[capacity];
+	}
+
+	~Ring_Buffer() {
+		delete[] buffer;
+	}
+
+	/* adds an element to the queue, returns false if the queue is full.
+	 * Only to be called by the producer thread */
+	bool push(const T &element) {
+		uint32_t write = write_pos.load(std::memory_order_relaxed);
+		uint32_t read = read_pos.load(std::memory_order_acquire);
+		if (write - read >= capacity)
+			return false;
+
+		buffer[write & mask] = element;
+		write_pos.store(write + 1, std::memory_order_release);
+
+		/* the high water mark is only written by the producer */
+		uint32_t depth = write + 1 - read;
+		if (depth > high_water_mark.load(std::memory_order_relaxed))
+			high_water_mark.store(depth, std::memory_order_relaxed);
+		return true;
+	}
+
+	/* removes the oldest element from the queue, returns false if the queue
+	 * is empty. Only to be called by the consumer thread */
+	bool pop(T &element) {
+		uint32_t read = read_pos.load(std::memory_order_relaxed);
+		uint32_t write = write_pos.load(std::memory_order_acquire);
+		if (read == write)
+			return false;
+
+		element = buffer[read & mask];
+		read_pos.store(read + 1, std::memory_order_release);
+		return true;
+	}
+
+	/* number of elements currently in the queue, can be called from any
+	 * thread, but the value is only a snapshot */
+	uint32_t size() const {
+		return write_pos.load(std::memory_order_acquire) -
+			read_pos.load(std::memory_order_acquire);
+	}
+
+	/* largest number of elements that have been in the queue at once */
+	uint32_t get_high_water_mark() const {
+		return high_water_mark.load(std::memory_order_relaxed);
+	}
+
+	uint32_t get_capacity() const {
+		return capacity;
+	}
+private:
+	Ring_Buffer(const Ring_Buffer&);
+	Ring_Buffer& operator=(const Ring_Buffer&);
+
+	static uint32_t round_capacity(uint32_t min_capacity) {
+		uint32_t size = 1;
+		while (size < min_capacity)
+			size <<= 1;
+		return size;
+	}
+
+	const uint32_t capacity;
+	const uint32_t mask;
+	T *buffer;
+	/* read and write positions are free running counters, they are kept
+	 * on separate cache lines to avoid false sharing between the threads.
+	 * The padding is explicit, operator new does not honour alignas */
+	char pad_read[RING_BUFFER_CACHE_LINE];
+	std::atomic<uint32_t> read_pos;
+	char pad_write[RING_BUFFER_CACHE_LINE - sizeof(std::atomic<uint32_t>)];
+	std::atomic<uint32_t> write_pos;
+	std::atomic<uint32_t> high_water_mark;
+	char pad_end[RING_BUFFER_CACHE_LINE - 2 * sizeof(std::atomic<uint32_t>)];
+};
+
+#endif
@@ -0,0 +1,307 @@
+/* This file is part of Equine Monitor
+ *
+ * Equine Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Equine Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Equine Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Konke Radlow <koradlow@gmail.com>
+ */
+
+#include "sample_block_store.h"
+#include "logger.h"
+#include "sqlite_helper.h"
+#include <time.h>
+
+using std::string;
+
+/* the first columns of the block table, followed by one BLOB per column */
+#define BLOCK_COMMON_COLUMNS "addr64 UNSIGNED BIGINT, start_ms UNSIGNED BIGINT, " \
+	"end_ms UNSIGNED BIGINT, count UNSIGNED INT, time BLOB"
+#define BLOCK_COMMON_COLUMN_CNT 5
+
+/* returns a monotonic timestamp in milliseconds */
+static uint32_t now_ms() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/* appends the difference to the previous value, small positive and negative
+ * differences are mapped to small unsigned numbers (zigzag encoding) and
+ * stored with 7 bits per byte, the msb marks that another byte follows */
+static void encode_delta(std::vector<uint8_t> &column, int64_t value, int64_t previous) {
+	int64_t delta = value - previous;
+	uint64_t zigzag = ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63);
+	while (zigzag >= 0x80) {
+		column.push_back((zigzag & 0x7F) | 0x80);
+		zigzag >>= 7;
+	}
+	column.push_back(zigzag);
+}
+
+/* decodes the next difference of a column and adds it to value, returns
+ * false if the column ends before the number is complete */
+static bool decode_delta(const uint8_t *&pos, const uint8_t *end, int64_t &value) {
+	uint64_t zigzag = 0;
+	for (uint8_t shift = 0; pos < end && shift < 64; shift += 7) {
+		uint8_t byte = *pos++;
+		zigzag |= (uint64_t)(byte & 0x7F) << shift;
+		if (!(byte & 0x80)) {
+			value += (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+			return true;
+		}
+	}
+	return false;
+}
+
+/** Sample_Block_Store Class implementation */
+Sample_Block_Store::Sample_Block_Store(sqlite3 *db, const char *sensor_table,
+		uint16_t block_samples, uint32_t flush_interval_ms) :
+	db(db),
+	table(string(sensor_table) + SAMPLE_BLOCK_TABLE_SUFFIX),
+	insert_stmt(NULL),
+	update_stmt(NULL),
+	read_stmt(NULL),
+	block_samples(block_samples ? block_samples : 1),
+	flush_interval_ms(flush_interval_ms),
+	last_flush_ms(now_ms()),
+	dirty_cnt(0),
+	block_write_cnt(0)
+{
+	/* the sensor columns follow the common columns of the table */
+	sqlite3_stmt *stmt = NULL;
+	string sql_info = "PRAGMA table_info(" + table + ")";
+	CALL_SQLITE(prepare_v2(db, sql_info.c_str(), -1, &stmt, NULL));
+	for (uint8_t i = 0; sqlite3_step(stmt) == SQLITE_ROW; i++) {
+		if (i >= BLOCK_COMMON_COLUMN_CNT && column_names.size() < SAMPLE_BLOCK_MAX_COLUMNS)
+			column_names.push_back((const char*) sqlite3_column_text(stmt, 1));
+	}
+	sqlite3_finalize(stmt);
+	if (column_names.empty()) {
+		log_error(LOG_MODULE_STORAGE, "block table %s has no sample columns", table.c_str());
+		return;
+	}
+
+	string sql_insert = "INSERT INTO " + table + " VALUES(?";
+	string sql_update = "UPDATE " + table + " SET start_ms = ?2, end_ms = ?3, "
+		"count = ?4, time = ?5";
+	for (uint8_t i = 1; i < BLOCK_COMMON_COLUMN_CNT + column_names.size(); i++)
+		sql_insert += ", ?";
+	sql_insert += ")";
+	for (uint8_t i = 0; i < column_names.size(); i++) {
+		char param[8];
+		snprintf(param, sizeof(param), " = ?%d", BLOCK_COMMON_COLUMN_CNT + i + 1);
+		sql_update += ", " + column_names[i] + param;
+	}
+	sql_update += " WHERE rowid = ?1";
+	/* the blocks are read in the order of their end, the reader stops at
+	 * the first block that starts after the range */
+	string sql_read = "SELECT start_ms, count, time";
+	for (uint8_t i = 0; i < column_names.size(); i++)
+		sql_read += ", " + column_names[i];
+	sql_read += " FROM " + table + " WHERE addr64 = ?1 AND end_ms >= ?2 ORDER BY end_ms";
+	CALL_SQLITE(prepare_v2(db, sql_insert.c_str(), -1, &insert_stmt, NULL));
+	CALL_SQLITE(prepare_v2(db, sql_update.c_str(), -1, &update_stmt, NULL));
+	CALL_SQLITE(prepare_v2(db, sql_read.c_str(), -1, &read_stmt, NULL));
+}
+
+Sample_Block_Store::~Sample_Block_Store() {
+	sqlite3_finalize(insert_stmt);
+	sqlite3_finalize(update_stmt);
+	sqlite3_finalize(read_stmt);
+}
+
+void Sample_Block_Store::create_table(sqlite3 *db, const char *sensor_table,
+		const char * const *columns, uint8_t column_cnt) {
+	string table = string(sensor_table) + SAMPLE_BLOCK_TABLE_SUFFIX;
+	string sql_create = "CREATE TABLE IF NOT EXISTS " + table + " (" BLOCK_COMMON_COLUMNS;
+	for (uint8_t i = 0; i < column_cnt; i++)
+		sql_create += string(", ") + columns[i] + " BLOB";
+	sql_create += ")";
+	string sql_index = "CREATE INDEX IF NOT EXISTS " + table + "_ix ON " +
+		table + " (addr64, end_ms)";
+	CALL_SQLITE(exec(db, sql_create.c_str(), 0, 0, 0));
+	CALL_SQLITE(exec(db, sql_index.c_str(), 0, 0, 0));
+}
+
+/* starts a new block, the buffers of the columns are kept */
+void Sample_Block_Store::reset_block(Block &block) {
+	block.rowid = 0;
+	block.start_ms = UINT64_MAX;
+	block.end_ms = 0;
+	block.count = 0;
+	block.dirty = false;
+	for (uint8_t i = 0; i <= column_names.size(); i++) {
+		block.last[i] = 0;
+		block.columns[i].clear();
+	}
+}
+
+bool Sample_Block_Store::append(uint64_t addr64, uint64_t time_ms, const int32_t *values) {
+	std::unordered_map<uint64_t, Block>::iterator it = blocks.find(addr64);
+	if (it == blocks.end()) {
+		it = blocks.insert(std::make_pair(addr64, Block())).first;
+		reset_block(it->second);
+		/* a full block takes about 2 bytes per column and sample */
+		for (uint8_t i = 0; i <= column_names.size(); i++)
+			it->second.columns[i].reserve(2 * block_samples);
+	}
+
+	Block &block = it->second;
+	encode_delta(block.columns[0], time_ms, block.last[0]);
+	block.last[0] = time_ms;
+	for (uint8_t i = 0; i < column_names.size(); i++) {
+		encode_delta(block.columns[i + 1], values[i], block.last[i + 1]);
+		block.last[i + 1] = values[i];
+	}
+	if (time_ms < block.start_ms)
+		block.start_ms = time_ms;
+	if (time_ms > block.end_ms)
+		block.end_ms = time_ms;
+	block.count++;
+	if (!block.dirty) {
+		block.dirty = true;
+		dirty_cnt++;
+	}
+
+	/* a full block that could not be written is kept, and written again
+	 * with the next sample */
+	if (block.count >= block_samples) {
+		if (!write_block(addr64, block))
+			return false;
+		reset_block(block);
+	}
+	return true;
+}
+
+bool Sample_Block_Store::flush_due() const {
+	return dirty_cnt && now_ms() - last_flush_ms >= flush_interval_ms;
+}
+
+bool Sample_Block_Store::flush() {
+	std::unordered_map<uint64_t, Block>::iterator it;
+	bool written = true;
+	for (it = blocks.begin(); dirty_cnt && it != blocks.end(); ++it) {
+		if (it->second.dirty && !write_block(it->first, it->second))
+			written = false;
+	}
+	last_flush_ms = now_ms();
+	return written;
+}
+
+void Sample_Block_Store::invalidate() {
+	std::unordered_map<uint64_t, Block>::iterator it;
+	for (it = blocks.begin(); it != blocks.end(); ++it) {
+		if (it->second.count && !it->second.dirty) {
+			it->second.dirty = true;
+			dirty_cnt++;
+		}
+	}
+}
+
+/* inserts the block when it is written the first time and updates its row
+ * after, the row is up to date after. The block is inserted again if its
+ * row is missing, because the transaction that added it was rolled back */
+bool Sample_Block_Store::write_block(uint64_t addr64, Block &block) {
+	sqlite3_stmt *stmt = block.rowid ? update_stmt : insert_stmt;
+	if (block.rowid)
+		sqlite3_bind_int64(stmt, 1, block.rowid);
+	else
+		sqlite3_bind_int64(stmt, 1, addr64);
+	sqlite3_bind_int64(stmt, 2, block.start_ms);
+	sqlite3_bind_int64(stmt, 3, block.end_ms);
+	sqlite3_bind_int(stmt, 4, block.count);
+	for (uint8_t i = 0; i <= column_names.size(); i++)
+		sqlite3_bind_blob(stmt, BLOCK_COMMON_COLUMN_CNT + i, block.columns[i].data(),
+			block.columns[i].size(), SQLITE_STATIC);
+	if (!step_statement(stmt))
+		return false;
+	if (block.rowid && !sqlite3_changes(db)) {
+		block.rowid = 0;
+		return write_block(addr64, block);
+	}
+
+	if (!block.rowid)
+		block.rowid = sqlite3_last_insert_rowid(db);
+	if (block.dirty) {
+		block.dirty = false;
+		dirty_cnt--;
+	}
+	block_write_cnt++;
+	return true;
+}
+
+uint32_t Sample_Block_Store::read(uint64_t addr64, uint64_t from_ms, uint64_t to_ms,
+		const Sample_Callback &sample_cb) {
+	const uint8_t column_cnt = column_names.size();
+	const uint8_t *pos[SAMPLE_BLOCK_MAX_COLUMNS + 1];
+	const uint8_t *end[SAMPLE_BLOCK_MAX_COLUMNS + 1];
+	int64_t last[SAMPLE_BLOCK_MAX_COLUMNS + 1];
+	int32_t values[SAMPLE_BLOCK_MAX_COLUMNS];
+	uint32_t sample_cnt = 0;
+
+	sqlite3_bind_int64(read_stmt, 1, addr64);
+	sqlite3_bind_int64(read_stmt, 2, from_ms);
+	while (sqlite3_step(read_stmt) == SQLITE_ROW) {
+		if ((uint64_t)sqlite3_column_int64(read_stmt, 0) > to_ms)
+			break;
+		uint32_t count = sqlite3_column_int(read_stmt, 1);
+		for (uint8_t i = 0; i <= column_cnt; i++) {
+			pos[i] = (const uint8_t*) sqlite3_column_blob(read_stmt, 2 + i);
+			end[i] = pos[i] + sqlite3_column_bytes(read_stmt, 2 + i);
+			last[i] = 0;
+		}
+
+		for (uint32_t s = 0; s < count; s++) {
+			bool valid = true;
+			for (uint8_t i = 0; i <= column_cnt; i++)
+				valid = decode_delta(pos[i], end[i], last[i]) && valid;
+			if (!valid) {
+				log_error(LOG_MODULE_STORAGE, "corrupt block in %s", table.c_str());
+				break;
+			}
+			if ((uint64_t)last[0] < from_ms || (uint64_t)last[0] > to_ms)
+				continue;
+			for (uint8_t i = 0; i < column_cnt; i++)
+				values[i] = last[i + 1];
+			sample_cb(last[0], values);
+			sample_cnt++;
+		}
+	}
+	CALL_SQLITE(reset(read_stmt));
+	return sample_cnt;
+}
+
+uint32_t Sample_Block_Store::export_csv(FILE *file, uint64_t addr64, uint64_t from_ms,
+		uint64_t to_ms) {
+	const uint8_t column_cnt = column_names.size();
+	fprintf(file, "time_ms");
+	for (uint8_t i = 0; i < column_cnt; i++)
+		fprintf(file, ",%s", column_names[i].c_str());
+	fprintf(file, "\n");
+
+	return read(addr64, from_ms, to_ms, [file, column_cnt](uint64_t time_ms,
+			const int32_t *values) {
+		fprintf(file, "%" PRIu64, time_ms);
+		for (uint8_t i = 0; i < column_cnt; i++)
+			fprintf(file, ",%d", values[i]);
+		fprintf(file, "\n");
+	});
+}
+
+uint8_t Sample_Block_Store::get_column_cnt() const {
+	return column_names.size();
+}
+
+uint32_t Sample_Block_Store::get_block_write_cnt() const {
+	return block_write_cnt;
+}
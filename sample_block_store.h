@@ -0,0 +1,121 @@
+/* This file is part of Equine Monitor
+ *
+ * Equine Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Equine Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Equine Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Konke Radlow <koradlow@gmail.com>
+ */
+
+#ifndef SAMPLE_BLOCK_STORE_H
+#define SAMPLE_BLOCK_STORE_H
+
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <inttypes.h>
+#include <stdio.h>
+#include <sqlite3.h>
+
+/* the block table of a sensor table is named <sensor table>Blocks */
+#define SAMPLE_BLOCK_TABLE_SUFFIX "Blocks"
+/* max number of integer columns of a sample */
+#define SAMPLE_BLOCK_MAX_COLUMNS 8
+/* default number of samples in one block */
+#define SAMPLE_BLOCK_SAMPLES 2048
+/* default interval for writing the incomplete blocks to the db */
+#define SAMPLE_BLOCK_FLUSH_INTERVAL_MS 10000
+
+/* stores the samples of a high rate sensor in blocks instead of one row per
+ * sample. A row of the block table holds up to block_samples consecutive
+ * samples of one node: the time of the first and last sample, the sample
+ * count and one BLOB per column. Every column (the time in ms and each
+ * sensor column) is encoded as the difference to the previous sample of
+ * the block, zigzag and varint packed, so a slowly changing value takes a
+ * single byte. The blocks are indexed by node and time.
+ * The block of a node is filled in memory and written when it is full,
+ * incomplete blocks are written by flush() and updated while they fill up.
+ * The block store is used by the thread that owns the db connection */
+class Sample_Block_Store {
+public:
+	/* callback for the samples of a range, values has one entry per column */
+	typedef std::function<void(uint64_t time_ms, const int32_t *values)> Sample_Callback;
+
+	/* the columns are read from the block table, it has to exist */
+	Sample_Block_Store(sqlite3 *db, const char *sensor_table,
+			uint16_t block_samples = SAMPLE_BLOCK_SAMPLES,
+			uint32_t flush_interval_ms = SAMPLE_BLOCK_FLUSH_INTERVAL_MS);
+	~Sample_Block_Store();
+
+	/* creates the block table of the sensor table with the given columns */
+	static void create_table(sqlite3 *db, const char *sensor_table,
+			const char * const *columns, uint8_t column_cnt);
+
+	/* appends a sample that was taken at time_ms (unix time in ms), the
+	 * samples of a node are expected in the order they were taken. Returns
+	 * false if the block was full and could not be written */
+	bool append(uint64_t addr64, uint64_t time_ms, const int32_t *values);
+	/* returns true if there are unwritten samples and the flush interval
+	 * has passed since the last flush */
+	bool flush_due() const;
+	/* writes the incomplete blocks that changed since the last flush,
+	 * returns false if a block could not be written */
+	bool flush();
+	/* marks the blocks in memory as changed, they are written again by the
+	 * next flush. Used after the transaction of a write was rolled back */
+	void invalidate();
+
+	/* calls sample_cb for each stored sample of the node between from_ms
+	 * and to_ms (both included) in the order they were stored, returns the
+	 * number of samples. Samples that were not written yet are not read */
+	uint32_t read(uint64_t addr64, uint64_t from_ms, uint64_t to_ms,
+			const Sample_Callback &sample_cb);
+	/* writes the samples of the range as CSV lines to file, starting with a
+	 * header line. Returns the number of samples */
+	uint32_t export_csv(FILE *file, uint64_t addr64, uint64_t from_ms, uint64_t to_ms);
+
+	uint8_t get_column_cnt() const;
+	uint32_t get_block_write_cnt() const;
+private:
+	Sample_Block_Store(const Sample_Block_Store&);
+	Sample_Block_Store& operator=(const Sample_Block_Store&);
+
+	typedef struct {
+		int64_t rowid;		/* row of the block, 0 until it is written */
+		uint64_t start_ms;	/* time of the oldest and newest sample */
+		uint64_t end_ms;
+		uint16_t count;
+		int64_t last[SAMPLE_BLOCK_MAX_COLUMNS + 1];	/* previous sample */
+		/* encoded time column followed by the sensor columns */
+		std::vector<uint8_t> columns[SAMPLE_BLOCK_MAX_COLUMNS + 1];
+		bool dirty;		/* samples added since it was written */
+	} Block;
+
+	void reset_block(Block &block);
+	bool write_block(uint64_t addr64, Block &block);
+
+	sqlite3 *db;
+	std::string table;
+	std::vector<std::string> column_names;
+	sqlite3_stmt *insert_stmt;
+	sqlite3_stmt *update_stmt;
+	sqlite3_stmt *read_stmt;
+	std::unordered_map<uint64_t, Block> blocks;
+	const uint16_t block_samples;
+	const uint32_t flush_interval_ms;
+	uint32_t last_flush_ms;
+	uint32_t dirty_cnt;
+	uint32_t block_write_cnt;
+};
+
+#endif
@@ -0,0 +1,47 @@
+/* This file is part of Equine Monitor
+ *
+ * Equine Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Equine Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Equine Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Konke Radlow <koradlow@gmail.com>
+ */
+
+#include "sensor_registry.h"
+
+/* definitions of the column tables declared in the sensor table structs */
+constexpr const char *Heart_Rate_Table::table;
+constexpr Sensor_Column Heart_Rate_Table::columns[];
+constexpr const char *Temperature_Table::table;
+constexpr Sensor_Column Temperature_Table::columns[];
+constexpr const char *Accelerometer_Table::table;
+constexpr Sensor_Column Accelerometer_Table::columns[];
+constexpr const char *GPS_Table::table;
+constexpr Sensor_Column GPS_Table::columns[];
+constexpr const char *GPS_Alt_Table::table;
+constexpr Sensor_Column GPS_Alt_Table::columns[];
+
+/* conversions of the raw sensor values, used by the sensor table structs */
+GPSPosition calculate_gps_position(const GPSMessage* gps) {
+	GPSPosition position;
+	/* calculate latitude */
+	position.latitude = gps->latitude.degree +  gps->latitude.minute / 60.0 +
+			 gps->latitude.second / 3600.0;
+	position.latitude = (gps->latitudeNorth)? position.latitude : -(position.latitude);
+
+	/* calculte longitude */
+	position.longitude = gps->longitude.degree +  gps->longitude.minute / 60.0 +
+			 gps->longitude.second / 3600.0;
+	position.longitude = (gps->longitudeWest)? -position.longitude : (position.longitude);
+
+	return position;
+}
@@ -0,0 +1,368 @@
+/* This file is part of Equine Monitor
+ *
+ * Equine Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Equine Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Equine Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Konke Radlow <koradlow@gmail.com>
+ */
+
+#ifndef SENSOR_REGISTRY_H
+#define SENSOR_REGISTRY_H
+
+#include "controller.h"
+#include "messagetypes.h"
+#include "packet_view.h"
+#include "sensor_rollup.h"
+#include "sample_block_store.h"
+#include "metrics.h"
+#include "logger.h"
+#include <set>
+#include <string>
+#include <math.h>
+#include <stdio.h>
+#include <sqlite3.h>
+
+#define TABLE_SENSOR_HEART "sensorHeart"
+#define TABLE_SENSOR_TEMP "sensorTemperature"
+#define TABLE_SENSOR_ACCEL "sensorAccelerometer"
+#define TABLE_SENSOR_GPS "sensorGPS"
+#define TABLE_SENSOR_GPS_ALT "sensorGPSAlt"
+
+/* the columns that every sensor table starts with, they are bound by the
+ * registry: source address, absolute timestamp of the latest sample and the
+ * offset of the sample to this timestamp */
+#define SENSOR_COMMON_COLUMNS "addr64 UNSIGNED BIGINT, timestamp UNSIGNED INT, offset_ms UNSIGNED INT"
+#define SENSOR_COMMON_COLUMN_CNT 3
+
+/* storage options of the sensor tables that are set by the configuration */
+struct Sensor_Storage_Options {
+	Sensor_Storage_Options() :
+		rollup_flush_interval_ms(ROLLUP_FLUSH_INTERVAL_MS),
+		block_samples(SAMPLE_BLOCK_SAMPLES),
+		block_flush_interval_ms(SAMPLE_BLOCK_FLUSH_INTERVAL_MS) {}
+
+	uint32_t rollup_flush_interval_ms;
+	/* tables that store their samples in blocks instead of rows */
+	std::set<std::string> block_tables;
+	uint16_t block_samples;
+	uint32_t block_flush_interval_ms;
+};
+
+/* describes one sensor specific column of a sensor table */
+struct Sensor_Column {
+	const char *name;
+	const char *type;
+};
+
+/* base of the sensor table declarations, by default the samples are bound
+ * to the insert statement as they were received and no rollups are kept */
+template <typename S>
+struct Sensor_Table {
+	typedef S Sample;
+	typedef S Value;
+	static constexpr bool rollup = false;
+	static constexpr bool blocks = false;
+
+	static const Value* convert(const Sample *samples, uint8_t count, Value *values) {
+		return samples;
+	}
+	template <typename V>
+	static double rollup_value(const V &value) {
+		return 0;
+	}
+	template <typename V>
+	static void block_values(const V &value, int32_t *values) {}
+};
+
+/*** Sensor table declarations ***/
+/* Each sensor table is described by a struct derived from Sensor_Table,
+ * with the following members:
+ *   Sample		the packed wire struct of one sample in the sensorMsgArray
+ *   Value		the type the samples are converted into (optional)
+ *   type		the DeviceType that identifies messages for this table
+ *   table		the name of the table in the database
+ *   columns[]		the sensor specific columns of the table
+ *   convert()		converts all samples of a message into values at once
+ *			(optional), returns a pointer to the converted values
+ *   bind()		binds one value to the sensor specific parameters of
+ *			the insert statement, starting at first
+ *   rollup		true if the table has a rollup table with the count,
+ *			min, max and mean of the samples per node (optional)
+ *   rollup_value()	reduces one value to the number that is rolled up
+ *   blocks		true if the samples can be stored in sample blocks
+ *			instead of rows, if the table is configured so (optional)
+ *   block_values()	converts one value into one integer per column
+ * More than one table can be registered for the same DeviceType, each of
+ * them receives all samples of a message.
+ * To add a sensor, declare its table here, define the columns in
+ * sensor_registry.cpp and add the table to the Sensor_Registry typedef */
+struct Heart_Rate_Table : Sensor_Table<HeartRateMessage> {
+	static constexpr DeviceType type = typeHeartRate;
+	static constexpr const char *table = TABLE_SENSOR_HEART;
+	static constexpr Sensor_Column columns[] = {
+		{"bmp", "INT"}
+	};
+	static constexpr bool rollup = true;
+	static void bind(sqlite3_stmt *stmt, int first, const Sample &sample) {
+		sqlite3_bind_int(stmt, first, sample.bpm);
+	}
+	static double rollup_value(const Sample &sample) {
+		return sample.bpm;
+	}
+};
+
+/* the raw sensor readings are converted with the batch kernel */
+struct Temperature_Table : Sensor_Table<RawTemperatureMessage> {
+	typedef double Value;
+	static constexpr DeviceType type = typeRawTemperature;
+	static constexpr const char *table = TABLE_SENSOR_TEMP;
+	static constexpr Sensor_Column columns[] = {
+		{"temp", "DOUBLE"}
+	};
+	static const Value* convert(const Sample *samples, uint8_t count, Value *values) {
+		calculate_temperatures(samples, count, values);
+		return values;
+	}
+	static constexpr bool rollup = true;
+	static void bind(sqlite3_stmt *stmt, int first, const Value &temperature) {
+		sqlite3_bind_double(stmt, first, temperature);
+	}
+	static double rollup_value(const Value &temperature) {
+		return temperature;
+	}
+};
+
+/* the rollup is kept of the magnitude of the acceleration vector, the
+ * samples of this high rate sensor can be stored in blocks */
+struct Accelerometer_Table : Sensor_Table<AccelerometerMessage> {
+	static constexpr DeviceType type = typeAccelerometer;
+	static constexpr const char *table = TABLE_SENSOR_ACCEL;
+	static constexpr Sensor_Column columns[] = {
+		{"x", "INT"},
+		{"y", "INT"},
+		{"z", "INT"}
+	};
+	static constexpr bool rollup = true;
+	static constexpr bool blocks = true;
+	static void bind(sqlite3_stmt *stmt, int first, const Sample &sample) {
+		sqlite3_bind_int(stmt, first, sample.x);
+		sqlite3_bind_int(stmt, first + 1, sample.y);
+		sqlite3_bind_int(stmt, first + 2, sample.z);
+	}
+	static double rollup_value(const Sample &sample) {
+		return sqrt((double)sample.x * sample.x + (double)sample.y * sample.y +
+			(double)sample.z * sample.z);
+	}
+	static void block_values(const Sample &sample, int32_t *values) {
+		values[0] = sample.x;
+		values[1] = sample.y;
+		values[2] = sample.z;
+	}
+};
+
+struct GPS_Table : Sensor_Table<GPSMessage> {
+	static constexpr DeviceType type = typeGPS;
+	static constexpr const char *table = TABLE_SENSOR_GPS;
+	static constexpr Sensor_Column columns[] = {
+		{"lat_h", "INT"},
+		{"lat_min", "INT"},
+		{"lat_s", "INT"},
+		{"lat_north", "BOOL"},
+		{"long_h", "INT"},
+		{"long_min", "INT"},
+		{"long_s", "INT"},
+		{"long_west", "BOOL"},
+		{"valid_pos_fix", "BOOL"}
+	};
+	static void bind(sqlite3_stmt *stmt, int first, const Sample &sample) {
+		sqlite3_bind_int(stmt, first, sample.latitude.degree);
+		sqlite3_bind_int(stmt, first + 1, sample.latitude.minute);
+		sqlite3_bind_int(stmt, first + 2, sample.latitude.second);
+		sqlite3_bind_int(stmt, first + 3, sample.latitudeNorth);
+		sqlite3_bind_int(stmt, first + 4, sample.longitude.degree);
+		sqlite3_bind_int(stmt, first + 5, sample.longitude.minute);
+		sqlite3_bind_int(stmt, first + 6, sample.longitude.second);
+		sqlite3_bind_int(stmt, first + 7, sample.longitudeWest);
+		sqlite3_bind_int(stmt, first + 8, sample.validPosFix);
+	}
+};
+
+/* stores the gps samples as latitude and longitude in decimal degrees */
+struct GPS_Alt_Table : Sensor_Table<GPSMessage> {
+	static constexpr DeviceType type = typeGPS;
+	static constexpr const char *table = TABLE_SENSOR_GPS_ALT;
+	static constexpr Sensor_Column columns[] = {
+		{"latitude", "REAL"},
+		{"longitude", "REAL"}
+	};
+	static void bind(sqlite3_stmt *stmt, int first, const Sample &sample) {
+		GPSPosition position = calculate_gps_position(&sample);
+		sqlite3_bind_double(stmt, first, position.latitude);
+		sqlite3_bind_double(stmt, first + 1, position.longitude);
+	}
+};
+
+/* the destinations of the samples of one sensor table: the insert statement
+ * of the table, its rollup and its block store. The samples are either
+ * inserted as rows or appended to the blocks, if a block store exists */
+struct Sensor_Sink {
+	const char *table;
+	sqlite3_stmt *insert;
+	Sensor_Rollup *rollup;
+	Sample_Block_Store *blocks;
+	Metrics_Counter rows;	/* samples stored as rows or in blocks */
+	/* a write failed in the current transaction, it's reset at each begin */
+	bool failed;
+};
+
+/*** Sensor registry ***/
+/* generates the DDL, the insert statements and the dispatch code for a list
+ * of sensor tables at compile time. The dispatch is resolved into a chain of
+ * type comparisons with inlined store loops, there are no virtual calls or
+ * function pointers involved */
+template <typename... Tables>
+struct Sensor_Table_List;
+
+template <>
+struct Sensor_Table_List<> {
+	static const uint8_t size = 0;
+
+	static void create_tables(sqlite3 *db) {}
+	static void prepare(sqlite3 *db, Sensor_Sink *sinks,
+		const Sensor_Storage_Options &options) {}
+	static bool store(Sensor_Sink *sinks, const Packet_View &packet,
+		uint32_t end_timestamp, uint64_t addr64) { return false; }
+};
+
+template <typename Table, typename... Rest>
+struct Sensor_Table_List<Table, Rest...> {
+	typedef Sensor_Table_List<Rest...> Next;
+	static const uint8_t size = 1 + Next::size;
+	static const uint8_t column_cnt = sizeof(Table::columns) / sizeof(Table::columns[0]);
+
+	/* creates the table, its rollup and block table if they do not exist yet */
+	static void create_tables(sqlite3 *db) {
+		std::string sql = std::string("CREATE TABLE IF NOT EXISTS ") + Table::table +
+			"(" SENSOR_COMMON_COLUMNS;
+		for (uint8_t i = 0; i < column_cnt; i++)
+			sql += std::string(", ") + Table::columns[i].name + " " + Table::columns[i].type;
+		sql += ")";
+
+		int error_code = sqlite3_exec(db, sql.c_str(), NULL, NULL, NULL);
+		if (error_code != SQLITE_OK)
+			log_error(LOG_MODULE_STORAGE, "creating table %s failed with status %d: %s",
+				Table::table, error_code, sqlite3_errmsg(db));
+		if (Table::rollup)
+			Sensor_Rollup::create_table(db, Table::table);
+		if (Table::blocks) {
+			const char *names[column_cnt];
+			for (uint8_t i = 0; i < column_cnt; i++)
+				names[i] = Table::columns[i].name;
+			Sample_Block_Store::create_table(db, Table::table, names, column_cnt);
+		}
+		Next::create_tables(db);
+	}
+
+	/* compiles the insert statement of each table and creates its rollup and
+	 * block store, the sinks are stored in the order of the registry */
+	static void prepare(sqlite3 *db, Sensor_Sink *sinks,
+			const Sensor_Storage_Options &options) {
+		std::string sql = std::string("INSERT INTO ") + Table::table + " VALUES(?";
+		for (uint8_t i = 1; i < SENSOR_COMMON_COLUMN_CNT + column_cnt; i++)
+			sql += ", ?";
+		sql += ")";
+
+		sinks[0].table = Table::table;
+		sinks[0].failed = false;
+		int error_code = sqlite3_prepare_v2(db, sql.c_str(), -1, &sinks[0].insert, NULL);
+		if (error_code != SQLITE_OK)
+			log_error(LOG_MODULE_STORAGE, "preparing insert for %s failed with status %d: %s",
+				Table::table, error_code, sqlite3_errmsg(db));
+		sinks[0].rollup = Table::rollup ?
+			new Sensor_Rollup(db, Table::table, options.rollup_flush_interval_ms) : NULL;
+		sinks[0].blocks = Table::blocks && options.block_tables.count(Table::table) ?
+			new Sample_Block_Store(db, Table::table, options.block_samples,
+				options.block_flush_interval_ms) : NULL;
+		Next::prepare(db, sinks + 1, options);
+	}
+
+	/* stores the samples of the packet in all tables registered for its
+	 * sensor type, returns false if no table is registered for the type */
+	static bool store(Sensor_Sink *sinks, const Packet_View &packet,
+			uint32_t end_timestamp, uint64_t addr64) {
+		bool stored = false;
+		if (packet.get_sensor_type() == Table::type) {
+			store_samples(sinks[0], packet, end_timestamp, addr64);
+			stored = true;
+		}
+		return Next::store(sinks + 1, packet, end_timestamp, addr64) || stored;
+	}
+private:
+	static void store_samples(Sensor_Sink &sink, const Packet_View &packet,
+			uint32_t end_timestamp, uint64_t addr64) {
+		Sensor_View<typename Table::Sample> samples(packet);
+		typename Table::Value buffer[UINT8_MAX];
+		uint16_t sample_interval = packet.get_sample_interval();
+		uint64_t end_ms = (uint64_t)end_timestamp * 1000;
+		sqlite3_stmt *stmt = sink.insert;
+		int error_code;
+
+		if ((!stmt && !sink.blocks) || !samples.size())
+			return;
+		/* convert all samples of the message before they are bound */
+		const typename Table::Value *values = Table::convert(samples.begin(),
+			samples.size(), buffer);
+		/* the blocks are filled from the oldest to the newest sample */
+		for (uint8_t i = samples.size(); Table::blocks && sink.blocks && i > 0; i--) {
+			int32_t columns[column_cnt];
+			Table::block_values(values[i - 1], columns);
+			if (!sink.blocks->append(addr64, end_ms - (i - 1) * sample_interval, columns))
+				sink.failed = true;
+		}
+		for (uint8_t i = 0; !sink.blocks && i < samples.size(); i++) {
+			sqlite3_bind_int64(stmt, 1, addr64);
+			sqlite3_bind_int64(stmt, 2, end_timestamp);
+			sqlite3_bind_int(stmt, 3, -i * sample_interval);
+			Table::bind(stmt, SENSOR_COMMON_COLUMN_CNT + 1, values[i]);
+			error_code = sqlite3_step(stmt);
+			if (error_code != SQLITE_DONE) {
+				log_error(LOG_MODULE_STORAGE, "insert into %s failed with status %d: %s",
+					Table::table, error_code, sqlite3_errmsg(sqlite3_db_handle(stmt)));
+				sink.failed = true;
+			}
+			sqlite3_reset(stmt);
+		}
+		/* the samples are rolled up from the newest to the oldest, the
+		 * buckets before the oldest sample are complete after */
+		if (Table::rollup && sink.rollup) {
+			for (uint8_t i = 0; i < samples.size(); i++)
+				sink.rollup->add(addr64, end_ms - i * sample_interval,
+					Table::rollup_value(values[i]));
+			if (!sink.rollup->complete(addr64,
+					end_ms - (samples.size() - 1) * sample_interval))
+				sink.failed = true;
+		}
+		sink.rows.add(samples.size());
+	}
+};
+
+/* all sensor tables known to the base station */
+typedef Sensor_Table_List<
+	Heart_Rate_Table,
+	Temperature_Table,
+	Accelerometer_Table,
+	GPS_Table,
+	GPS_Alt_Table
+> Sensor_Registry;
+
+#endif
@@ -0,0 +1,228 @@
+/* This file is part of Equine Monitor
+ *
+ * Equine Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Equine Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Equine Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Konke Radlow <koradlow@gmail.com>
+ */
+
+#include "sensor_rollup.h"
+#include "sqlite_helper.h"
+#include <time.h>
+
+using std::string;
+
+/* the bucket sizes in seconds */
+static const uint32_t rollup_resolutions[ROLLUP_RESOLUTION_CNT] = {1, 60, 3600};
+
+/* returns a monotonic timestamp in milliseconds */
+static uint32_t now_ms() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/** Sensor_Rollup Class implementation */
+Sensor_Rollup::Sensor_Rollup(sqlite3 *db, const char *sensor_table, uint32_t flush_interval_ms) :
+	db(db),
+	write_stmt(NULL),
+	load_stmt(NULL),
+	last_stmt(NULL),
+	flush_interval_ms(flush_interval_ms),
+	last_flush_ms(now_ms()),
+	bucket_cnt(0),
+	dirty_cnt(0),
+	write_cnt(0)
+{
+	string table = string(sensor_table) + ROLLUP_TABLE_SUFFIX;
+	string sql_write = "INSERT OR REPLACE INTO " + table + " (addr64, resolution, "
+		"timestamp, count, min, max, mean) VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7)";
+	string sql_load = "SELECT count, min, max, mean FROM " + table +
+		" WHERE addr64 = ?1 AND resolution = ?2 AND timestamp = ?3";
+	string sql_last = "SELECT MAX(timestamp) FROM " + table +
+		" WHERE addr64 = ?1 AND resolution = ?2";
+	CALL_SQLITE(prepare_v2(db, sql_write.c_str(), -1, &write_stmt, NULL));
+	CALL_SQLITE(prepare_v2(db, sql_load.c_str(), -1, &load_stmt, NULL));
+	CALL_SQLITE(prepare_v2(db, sql_last.c_str(), -1, &last_stmt, NULL));
+}
+
+Sensor_Rollup::~Sensor_Rollup() {
+	sqlite3_finalize(write_stmt);
+	sqlite3_finalize(load_stmt);
+	sqlite3_finalize(last_stmt);
+}
+
+/* the timestamp is the start of the bucket, the unique index is used by the
+ * INSERT OR REPLACE statement and by the queries of a time range */
+void Sensor_Rollup::create_table(sqlite3 *db, const char *sensor_table) {
+	string table = string(sensor_table) + ROLLUP_TABLE_SUFFIX;
+	string sql_create = "CREATE TABLE IF NOT EXISTS " + table + " (addr64 UNSIGNED BIGINT, "
+		"resolution UNSIGNED INT, timestamp UNSIGNED INT, count UNSIGNED INT, "
+		"min DOUBLE, max DOUBLE, mean DOUBLE)";
+	string sql_index = "CREATE UNIQUE INDEX IF NOT EXISTS " + table + "_ix ON " +
+		table + " (addr64, resolution, timestamp)";
+	CALL_SQLITE(exec(db, sql_create.c_str(), 0, 0, 0));
+	CALL_SQLITE(exec(db, sql_index.c_str(), 0, 0, 0));
+}
+
+/* returns the buckets of the node, for a node that is seen the first time
+ * the newest rows written by an earlier run are looked up, so late samples
+ * for these buckets are merged instead of replacing the rows */
+Sensor_Rollup::Series& Sensor_Rollup::get_series(uint64_t addr64) {
+	std::unordered_map<uint64_t, Series>::iterator it = series.find(addr64);
+	if (it != series.end())
+		return it->second;
+
+	Series &node = series[addr64];
+	for (uint8_t r = 0; r < ROLLUP_RESOLUTION_CNT; r++) {
+		sqlite3_bind_int64(last_stmt, 1, addr64);
+		sqlite3_bind_int(last_stmt, 2, rollup_resolutions[r]);
+		node.written_until[r] = 0;
+		if (sqlite3_step(last_stmt) == SQLITE_ROW)
+			node.written_until[r] = sqlite3_column_int64(last_stmt, 0);
+		CALL_SQLITE(reset(last_stmt));
+	}
+	return node;
+}
+
+void Sensor_Rollup::add(uint64_t addr64, uint64_t time_ms, double value) {
+	Series &node = get_series(addr64);
+	uint32_t time_s = time_ms / 1000;
+
+	for (uint8_t r = 0; r < ROLLUP_RESOLUTION_CNT; r++) {
+		uint32_t start = time_s - time_s % rollup_resolutions[r];
+		std::map<uint32_t, Bucket>::iterator it = node.buckets[r].find(start);
+		if (it == node.buckets[r].end()) {
+			Bucket bucket = {0, value, value, 0, false};
+			if (start <= node.written_until[r])
+				load_bucket(addr64, r, start, bucket);
+			it = node.buckets[r].insert(std::make_pair(start, bucket)).first;
+			bucket_cnt++;
+		}
+
+		Bucket &bucket = it->second;
+		bucket.count++;
+		bucket.sum += value;
+		if (value < bucket.min)
+			bucket.min = value;
+		if (value > bucket.max)
+			bucket.max = value;
+		if (!bucket.dirty) {
+			bucket.dirty = true;
+			dirty_cnt++;
+		}
+	}
+}
+
+bool Sensor_Rollup::complete(uint64_t addr64, uint64_t oldest_ms) {
+	Series &node = get_series(addr64);
+	uint32_t oldest_s = oldest_ms / 1000;
+
+	for (uint8_t r = 0; r < ROLLUP_RESOLUTION_CNT; r++) {
+		std::map<uint32_t, Bucket> &buckets = node.buckets[r];
+		while (!buckets.empty() &&
+		       buckets.begin()->first + rollup_resolutions[r] <= oldest_s) {
+			Bucket &bucket = buckets.begin()->second;
+			if (bucket.dirty &&
+			    !write_bucket(addr64, node, r, buckets.begin()->first, bucket))
+				return false;
+			buckets.erase(buckets.begin());
+			bucket_cnt--;
+		}
+	}
+	return true;
+}
+
+bool Sensor_Rollup::flush_due() const {
+	return dirty_cnt && now_ms() - last_flush_ms >= flush_interval_ms;
+}
+
+bool Sensor_Rollup::flush() {
+	std::unordered_map<uint64_t, Series>::iterator it;
+	bool written = true;
+	for (it = series.begin(); dirty_cnt && it != series.end(); ++it) {
+		for (uint8_t r = 0; r < ROLLUP_RESOLUTION_CNT; r++) {
+			std::map<uint32_t, Bucket>::iterator bucket;
+			for (bucket = it->second.buckets[r].begin();
+			     bucket != it->second.buckets[r].end(); ++bucket) {
+				if (bucket->second.dirty && !write_bucket(it->first, it->second, r,
+						bucket->first, bucket->second))
+					written = false;
+			}
+		}
+	}
+	last_flush_ms = now_ms();
+	return written;
+}
+
+void Sensor_Rollup::invalidate() {
+	std::unordered_map<uint64_t, Series>::iterator it;
+	for (it = series.begin(); it != series.end(); ++it) {
+		for (uint8_t r = 0; r < ROLLUP_RESOLUTION_CNT; r++) {
+			std::map<uint32_t, Bucket>::iterator bucket;
+			for (bucket = it->second.buckets[r].begin();
+			     bucket != it->second.buckets[r].end(); ++bucket) {
+				if (!bucket->second.dirty) {
+					bucket->second.dirty = true;
+					dirty_cnt++;
+				}
+			}
+		}
+	}
+}
+
+/* initializes the bucket with the row that was written before */
+void Sensor_Rollup::load_bucket(uint64_t addr64, uint8_t resolution, uint32_t start,
+		Bucket &bucket) {
+	sqlite3_bind_int64(load_stmt, 1, addr64);
+	sqlite3_bind_int(load_stmt, 2, rollup_resolutions[resolution]);
+	sqlite3_bind_int64(load_stmt, 3, start);
+	if (sqlite3_step(load_stmt) == SQLITE_ROW) {
+		bucket.count = sqlite3_column_int(load_stmt, 0);
+		bucket.min = sqlite3_column_double(load_stmt, 1);
+		bucket.max = sqlite3_column_double(load_stmt, 2);
+		bucket.sum = sqlite3_column_double(load_stmt, 3) * bucket.count;
+	}
+	CALL_SQLITE(reset(load_stmt));
+}
+
+/* writes the complete row of the bucket, the row is up to date after */
+bool Sensor_Rollup::write_bucket(uint64_t addr64, Series &node, uint8_t resolution,
+		uint32_t start, Bucket &bucket) {
+	sqlite3_bind_int64(write_stmt, 1, addr64);
+	sqlite3_bind_int(write_stmt, 2, rollup_resolutions[resolution]);
+	sqlite3_bind_int64(write_stmt, 3, start);
+	sqlite3_bind_int(write_stmt, 4, bucket.count);
+	sqlite3_bind_double(write_stmt, 5, bucket.min);
+	sqlite3_bind_double(write_stmt, 6, bucket.max);
+	sqlite3_bind_double(write_stmt, 7, bucket.sum / bucket.count);
+	if (!step_statement(write_stmt))
+		return false;
+
+	if (start > node.written_until[resolution])
+		node.written_until[resolution] = start;
+	if (bucket.dirty) {
+		bucket.dirty = false;
+		dirty_cnt--;
+	}
+	write_cnt++;
+	return true;
+}
+
+uint32_t Sensor_Rollup::get_bucket_cnt() const {
+	return bucket_cnt;
+}
+
+uint32_t Sensor_Rollup::get_write_cnt() const {
+	return write_cnt;
+}
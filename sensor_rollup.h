@@ -0,0 +1,107 @@
+/* This file is part of Equine Monitor
+ *
+ * Equine Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Equine Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Equine Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Konke Radlow <koradlow@gmail.com>
+ */
+
+#ifndef SENSOR_ROLLUP_H
+#define SENSOR_ROLLUP_H
+
+#include <map>
+#include <unordered_map>
+#include <inttypes.h>
+#include <sqlite3.h>
+
+/* the rollup table of a sensor table is named <sensor table>Rollup */
+#define ROLLUP_TABLE_SUFFIX "Rollup"
+/* number of rollup resolutions, the resolutions are defined in sensor_rollup.cpp */
+#define ROLLUP_RESOLUTION_CNT 3
+/* default interval for writing the open buckets to the db */
+#define ROLLUP_FLUSH_INTERVAL_MS 10000
+
+/* maintains the count, min, max and mean of the samples of one sensor table
+ * per node in buckets of 1s, 1min and 1h. The buckets are updated in memory
+ * while the samples are stored and written to the rollup table of the sensor
+ * once they are complete, so a chart over several days can be drawn from a
+ * few hundred rows instead of the raw samples.
+ * The samples of a node are expected in order: a bucket is complete once a
+ * message of the node only contains samples after the end of the bucket.
+ * Buckets that are still open are written by flush(), samples that arrive
+ * for a bucket that was already written are merged with its row.
+ * The rollup is used by the thread that owns the db connection */
+class Sensor_Rollup {
+public:
+	Sensor_Rollup(sqlite3 *db, const char *sensor_table, uint32_t flush_interval_ms);
+	~Sensor_Rollup();
+
+	/* creates the rollup table of the sensor table */
+	static void create_table(sqlite3 *db, const char *sensor_table);
+
+	/* adds the value of a sample that was taken at time_ms (unix time in ms) */
+	void add(uint64_t addr64, uint64_t time_ms, double value);
+	/* called after the samples of a message were added, oldest_ms is the
+	 * time of the oldest sample. Writes the buckets of the node that end
+	 * before this sample and removes them from memory, returns false if a
+	 * bucket could not be written (it's kept in that case) */
+	bool complete(uint64_t addr64, uint64_t oldest_ms);
+	/* returns true if there are unwritten buckets and the flush interval
+	 * has passed since the last flush */
+	bool flush_due() const;
+	/* writes the open buckets that changed since the last flush, returns
+	 * false if a bucket could not be written */
+	bool flush();
+	/* marks the buckets in memory as changed, they are written again by the
+	 * next flush. Used after the transaction of a write was rolled back */
+	void invalidate();
+
+	uint32_t get_bucket_cnt() const;
+	uint32_t get_write_cnt() const;
+private:
+	Sensor_Rollup(const Sensor_Rollup&);
+	Sensor_Rollup& operator=(const Sensor_Rollup&);
+
+	typedef struct {
+		uint32_t count;
+		double min;
+		double max;
+		double sum;
+		bool dirty;		/* changed since it was written */
+	} Bucket;
+
+	/* the buckets of one node, ordered by their start time */
+	typedef struct {
+		std::map<uint32_t, Bucket> buckets[ROLLUP_RESOLUTION_CNT];
+		/* start of the newest bucket that has a row in the table */
+		uint32_t written_until[ROLLUP_RESOLUTION_CNT];
+	} Series;
+
+	Series& get_series(uint64_t addr64);
+	void load_bucket(uint64_t addr64, uint8_t resolution, uint32_t start, Bucket &bucket);
+	bool write_bucket(uint64_t addr64, Series &node, uint8_t resolution, uint32_t start,
+			Bucket &bucket);
+
+	sqlite3 *db;
+	sqlite3_stmt *write_stmt;
+	sqlite3_stmt *load_stmt;
+	sqlite3_stmt *last_stmt;
+	std::unordered_map<uint64_t, Series> series;
+	const uint32_t flush_interval_ms;
+	uint32_t last_flush_ms;
+	uint32_t bucket_cnt;
+	uint32_t dirty_cnt;
+	uint32_t write_cnt;
+};
+
+#endif
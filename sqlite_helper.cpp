@@ -0,0 +1,390 @@
+/* This file is part of Equine Monitor
+ *
+ * Equine Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Equine Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Equine Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Konke Radlow <koradlow@gmail.com>
+ * Code Based on www.lemoda.net/s/sqlite-insert
+ */
+
+#include "sqlite_helper.h"
+#include "controller.h"
+#include "xbee_if.h"
+#include "message_trace.h"
+#include <chrono>
+#include <stdio.h>
+#include <strings.h>
+#include <time.h>
+
+/* sets the journal mode, synchronous level and mmap size of the db connection.
+ * The values are taken from the config file and are validated before they are
+ * passed on to sqlite. Returns true if the database operates in WAL mode, in
+ * that case the automatic checkpoints are disabled on this connection and
+ * have to be run by a DB_Checkpointer */
+bool configure_db(sqlite3 *db, const string &journal_mode, const string &synchronous,
+		int64_t mmap_size) {
+	const char *journal_modes[] = {"DELETE", "TRUNCATE", "PERSIST", "MEMORY", "WAL", "OFF"};
+	const char *synchronous_levels[] = {"OFF", "NORMAL", "FULL", "EXTRA"};
+	bool wal_mode = false;
+	bool valid = false;
+	sqlite3_stmt *stmt;
+
+	for (uint8_t i = 0; i < sizeof(journal_modes) / sizeof(journal_modes[0]); i++) {
+		if (strcasecmp(journal_mode.c_str(), journal_modes[i]))
+			continue;
+		valid = true;
+		/* the journal mode pragma returns the mode that is actually used */
+		string sql = "PRAGMA journal_mode=" + string(journal_modes[i]);
+		CALL_SQLITE(prepare_v2(db, sql.c_str(), -1, &stmt, NULL));
+		if (sqlite3_step(stmt) == SQLITE_ROW) {
+			const char *mode = (const char *)sqlite3_column_text(stmt, 0);
+			log_info(LOG_MODULE_STORAGE, "db journal mode: %s", mode);
+			wal_mode = mode && !strcasecmp(mode, "wal");
+		}
+		CALL_SQLITE(finalize(stmt));
+		break;
+	}
+	if (!valid)
+		log_error(LOG_MODULE_STORAGE, "Unknown journal mode: %s", journal_mode.c_str());
+
+	valid = false;
+	for (uint8_t i = 0; i < sizeof(synchronous_levels) / sizeof(synchronous_levels[0]); i++) {
+		if (strcasecmp(synchronous.c_str(), synchronous_levels[i]))
+			continue;
+		valid = true;
+		string sql = "PRAGMA synchronous=" + string(synchronous_levels[i]);
+		CALL_SQLITE(exec(db, sql.c_str(), NULL, NULL, NULL));
+		break;
+	}
+	if (!valid)
+		log_error(LOG_MODULE_STORAGE, "Unknown synchronous level: %s", synchronous.c_str());
+
+	char sql_mmap[64];
+	snprintf(sql_mmap, sizeof(sql_mmap), "PRAGMA mmap_size=%lld", (long long)mmap_size);
+	CALL_SQLITE(exec(db, sql_mmap, NULL, NULL, NULL));
+
+	if (wal_mode)
+		sqlite3_wal_autocheckpoint(db, 0);
+	return wal_mode;
+}
+
+/* creates the neccessary tables for storing sensor data, node addresses and
+ * configuration options in the database. The sensor tables are generated
+ * from the declarations in the Sensor_Registry */
+void create_db_tables(sqlite3 *db) {
+	/* define common SQL command substrings */
+	string create = "CREATE TABLE IF NOT EXISTS ";
+	string common_debug_columns = "(addr64 UNSIGNED BIGINT, "
+				"timestamp UNSIGNED INT, ";
+
+	/* create SQL command strings by concatenating the SQL command substrings
+	 * with the table name */
+	string table_debug = create + TABLE_DEBUG_MESSAGES + common_debug_columns;
+	
+	/* append the custom fields of each table to the SQL commands */
+	table_debug +=	"message TEXT)";
+
+	/* try to create the tables */
+	Sensor_Registry::create_tables(db);
+	Node_Registry::create_table(db);
+	CALL_SQLITE(exec(db, table_debug.c_str(), 0, 0, 0));
+}
+
+/** Message_Storage Class implementation */
+/* constructor of Message_Storage, prepares the statements that are used to
+ * group the inserts of one message into a single transaction */
+Message_Storage::Message_Storage(sqlite3 *db, uint32_t node_flush_interval_ms,
+		const Sensor_Storage_Options &options) :
+	db(db),
+	begin_stmt(NULL),
+	commit_stmt(NULL),
+	rollback_stmt(NULL),
+	nodes(db, node_flush_interval_ms),
+	receive_time(0),
+	commit_cnt(0)
+{
+	CALL_SQLITE(prepare_v2(db, "BEGIN TRANSACTION", -1, &begin_stmt, NULL));
+	CALL_SQLITE(prepare_v2(db, "COMMIT TRANSACTION", -1, &commit_stmt, NULL));
+	CALL_SQLITE(prepare_v2(db, "ROLLBACK TRANSACTION", -1, &rollback_stmt, NULL));
+	Sensor_Registry::prepare(db, sensor_sinks, options);
+	nodes.load();
+}
+
+/* destructor of Message_Storage, the cached statements have to be finalized
+ * before the database connection can be closed */
+Message_Storage::~Message_Storage() {
+	/* write the statistics, the open rollup buckets and the incomplete
+	 * sample blocks that changed since the last flush */
+	bool written = begin() && nodes.flush();
+	for (uint8_t i = 0; written && i < Sensor_Registry::size; i++) {
+		if (sensor_sinks[i].rollup && !sensor_sinks[i].rollup->flush())
+			written = false;
+		if (sensor_sinks[i].blocks && !sensor_sinks[i].blocks->flush())
+			written = false;
+	}
+	if (written)
+		commit();
+	else
+		rollback();
+
+	std::map<string, sqlite3_stmt*>::iterator it;
+	for (it = statement_cache.begin(); it != statement_cache.end(); ++it)
+		sqlite3_finalize(it->second);
+	for (uint8_t i = 0; i < Sensor_Registry::size; i++) {
+		sqlite3_finalize(sensor_sinks[i].insert);
+		delete sensor_sinks[i].rollup;
+		delete sensor_sinks[i].blocks;
+	}
+	sqlite3_finalize(begin_stmt);
+	sqlite3_finalize(commit_stmt);
+	sqlite3_finalize(rollback_stmt);
+}
+
+/* returns the compiled statement for the table from the statement cache.
+ * If the table is not cached yet, the SQL command is compiled and added
+ * to the cache */
+sqlite3_stmt* Message_Storage::get_statement(const string &table, const string &sql) {
+	std::map<string, sqlite3_stmt*>::iterator it = statement_cache.find(table);
+	if (it != statement_cache.end())
+		return it->second;
+
+	sqlite3_stmt *stmt = NULL;
+	CALL_SQLITE(prepare_v2(db, sql.c_str(), -1, &stmt, NULL));
+	statement_cache[table] = stmt;
+	return stmt;
+}
+
+/* returns the compiled insert statement for a table with column_cnt columns.
+ * The values are not part of the statement, they have to be bound to the
+ * parameters (numbered 1 to column_cnt) before the statement is executed */
+sqlite3_stmt* Message_Storage::get_insert_statement(const string &table, uint8_t column_cnt) {
+	string sql_insert = "INSERT INTO " + table + " VALUES(?";
+	for (uint8_t i = 1; i < column_cnt; i++)
+		sql_insert += ", ?";
+	sql_insert += ")";
+
+	return get_statement(table, sql_insert);
+}
+
+/* executes a statement with bound parameters and resets it, so it can be
+ * reused for the next row. Returns false if the statement failed */
+bool Message_Storage::execute_statement(sqlite3_stmt *stmt) {
+	return step_statement(stmt);
+}
+
+/* stores a single message, all rows of the message are written in one transaction */
+void Message_Storage::store_msg(XBee_Message *msg) {
+	store_msgs(&msg, 1);
+}
+
+/* stores a batch of messages, all rows of all messages in the batch are
+ * written in one transaction. The batch is only committed if every row was
+ * written, so the senders resend a batch that is not stored completely */
+bool Message_Storage::store_msgs(XBee_Message **msgs, uint16_t count) {
+	bool written = begin();
+	for (uint16_t i = 0; written && i < count; i++)
+		written = store_msg_rows(msgs[i]);
+	/* the node statistics and rollups are written together with the batch */
+	if (written)
+		written = flush_due_rows();
+	return written ? commit() : rollback();
+}
+
+/* writes the node statistics and rollups in their own transaction, this is
+ * used while no messages arrive */
+void Message_Storage::flush() {
+	if (!flush_due())
+		return;
+	if (begin() && flush_due_rows())
+		commit();
+	else
+		rollback();
+}
+
+/* starts the transaction, the failed writes of the sensor tables are
+ * tracked per transaction */
+bool Message_Storage::begin() {
+	for (uint8_t i = 0; i < Sensor_Registry::size; i++)
+		sensor_sinks[i].failed = false;
+	return execute_statement(begin_stmt);
+}
+
+/* the commit waits for the data to be written (and synced, depending on the
+ * synchronous level), which makes it the slowest part of a batch */
+bool Message_Storage::commit() {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	int status = sqlite3_step(commit_stmt);
+	CALL_SQLITE(reset(commit_stmt));
+	commit_latency.record(std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - start).count());
+	if (status != SQLITE_DONE) {
+		log_error(LOG_MODULE_STORAGE, "commit failed with status %d: %s", status,
+			sqlite3_errmsg(db));
+		return rollback();
+	}
+	commit_cnt++;
+	return true;
+}
+
+/* some errors roll back the transaction automatically, the ROLLBACK is only
+ * executed if the transaction is still open. A BEGIN that failed because a
+ * transaction was left open is cleaned up as well */
+bool Message_Storage::rollback() {
+	if (!sqlite3_get_autocommit(db))
+		execute_statement(rollback_stmt);
+	log_warn(LOG_MODULE_STORAGE, "transaction rolled back");
+	nodes.invalidate();
+	for (uint8_t i = 0; i < Sensor_Registry::size; i++) {
+		if (sensor_sinks[i].rollup)
+			sensor_sinks[i].rollup->invalidate();
+		if (sensor_sinks[i].blocks)
+			sensor_sinks[i].blocks->invalidate();
+	}
+	return false;
+}
+
+bool Message_Storage::flush_due() const {
+	for (uint8_t i = 0; i < Sensor_Registry::size; i++) {
+		if (sensor_sinks[i].rollup && sensor_sinks[i].rollup->flush_due())
+			return true;
+		if (sensor_sinks[i].blocks && sensor_sinks[i].blocks->flush_due())
+			return true;
+	}
+	return nodes.flush_due();
+}
+
+/* writes the node statistics, rollups and sample blocks whose flush
+ * interval has passed, returns false if a row could not be written */
+bool Message_Storage::flush_due_rows() {
+	if (nodes.flush_due() && !nodes.flush())
+		return false;
+	for (uint8_t i = 0; i < Sensor_Registry::size; i++) {
+		if (sensor_sinks[i].rollup && sensor_sinks[i].rollup->flush_due() &&
+		    !sensor_sinks[i].rollup->flush())
+			return false;
+		if (sensor_sinks[i].blocks && sensor_sinks[i].blocks->flush_due() &&
+		    !sensor_sinks[i].blocks->flush())
+			return false;
+	}
+	return true;
+}
+
+void Message_Storage::set_receive_time(time_t receive_time) {
+	this->receive_time = receive_time;
+}
+
+void Message_Storage::register_metrics(Metrics_Registry &registry) const {
+	for (uint8_t i = 0; i < Sensor_Registry::size; i++)
+		registry.add_counter("ehm_storage_rows_total", "Samples stored per table",
+			&sensor_sinks[i].rows, string("table=\"") + sensor_sinks[i].table + "\"");
+	registry.add_counter("ehm_storage_rows_total", "Samples stored per table",
+		&debug_rows, "table=\"" TABLE_DEBUG_MESSAGES "\"");
+	registry.add_histogram("ehm_storage_commit_seconds",
+		"Latency of the database commits", &commit_latency, 1e-6);
+}
+
+uint32_t Message_Storage::get_commit_cnt() const {
+	return commit_cnt.load();
+}
+
+/* decodes the type of the network message and passes it on the appropriate 
+ * decoder function. The payload is decoded once, in place, and the view is
+ * handed on to the store functions */
+bool Message_Storage::store_msg_rows(XBee_Message *msg) {
+	uint16_t length;
+	const uint8_t *data = msg->get_payload(&length);
+	trace_stamp(msg->get_trace(), TRACE_STARTED);
+	Packet_View packet(data, length);
+	uint64_t addr64 = msg->get_address().get_addr64();
+
+	bool written = true;
+
+	if (!packet.is_valid()) {
+		log_warn(LOG_MODULE_STORAGE, "dropping malformed message with length %u", length);
+		return true;
+	}
+	trace_stamp(msg->get_trace(), TRACE_DECODED);
+	
+	/* store messages into the appropriate db tables */
+	switch (packet.get_main_type()) {
+	case msgSensorData:
+		log_debug(LOG_MODULE_STORAGE, "storing sensor message");
+		written = store_sensor_msg(packet, addr64);
+		break;
+	case msgSensorConfig:
+		log_debug(LOG_MODULE_STORAGE, "storing config message");
+		written = store_config_msg(packet, addr64);
+		break;
+	case msgDebug:
+		log_debug(LOG_MODULE_STORAGE, "storing debug message");
+		written = store_debug_msg(packet, addr64);
+		break;
+	default: 
+		log_warn(LOG_MODULE_STORAGE, "message with unknown mainType: %u",
+			packet.get_main_type());
+	}
+	/* count the message for the source node, the node table is only
+	 * written if the node is new or its address changed */
+	if (!written || !nodes.update(msg->get_address(), length))
+		return false;
+	trace_stamp(msg->get_trace(), TRACE_STORED);
+	return true;
+}
+
+/* checks the type of sensor messages and passes them on the the tables
+ * registered for this type */
+bool Message_Storage::store_sensor_msg(const Packet_View &packet, uint64_t addr64) {
+	/* the monitoring devices work with a relative timestamp, because
+	 * it cannot be guaranteed that they are synced with a proper RTC.
+	 * Calculate the absolute timestamp of the endTimestampS value */
+	uint32_t absEndTimestampS = (receive_time ? receive_time : time(NULL)) - (packet.get_rel_timestamp() - packet.get_end_timestamp());
+	
+	log_debug(LOG_MODULE_STORAGE, "Sensor Message: %u, %u , %u", absEndTimestampS,
+		packet.get_sample_interval(), packet.get_array_length());
+	/* the registry dispatches the samples to the tables of the sensor type */
+	if (!Sensor_Registry::store(sensor_sinks, packet, absEndTimestampS, addr64))
+		log_warn(LOG_MODULE_STORAGE, "sensor message with unknown sensorType: %u",
+			packet.get_sensor_type());
+	for (uint8_t i = 0; i < Sensor_Registry::size; i++) {
+		if (sensor_sinks[i].failed)
+			return false;
+	}
+	return true;
+}
+
+/* decodes messages containing configuration data */
+bool Message_Storage::store_config_msg(const Packet_View &packet, uint64_t addr64) {
+	return true;
+}
+
+/* decodes messages containing debug strings */
+bool Message_Storage::store_debug_msg(const Packet_View &packet, uint64_t addr64) {
+	uint16_t string_length;
+	const char *debug_string = packet.get_debug_string(&string_length);
+
+	/* the monitoring devices transmit a relative timestamp.
+	 * Calculate the absolute timestamp of the debug message before
+	 * storing it the db */
+	uint32_t timestampS = (receive_time ? receive_time : time(NULL)) - (packet.get_rel_timestamp() - packet.get_debug_timestamp());
+	
+	sqlite3_stmt *stmt = get_insert_statement(TABLE_DEBUG_MESSAGES, 3);
+	sqlite3_bind_int64(stmt, 1, addr64);
+	sqlite3_bind_int64(stmt, 2, timestampS);
+	sqlite3_bind_text(stmt, 3, debug_string, string_length, SQLITE_STATIC);
+	if (!execute_statement(stmt))
+		return false;
+	debug_rows.add();
+	log_info(LOG_MODULE_STORAGE, "debug message from %016llx: %s", (unsigned long long)addr64,
+		Log_Text{debug_string, string_length});
+	return true;
+}
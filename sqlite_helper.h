@@ -20,21 +20,26 @@
 #ifndef SQLITE_HELPER_H
 #define SQLITE_HELPER_H
 
-#define TABLE_SENSOR_HEART "sensorHeart"
-#define TABLE_SENSOR_TEMP "sensorTemperature"
-#define TABLE_SENSOR_ACCEL "sensorAccelerometer"
-#define TABLE_SENSOR_GPS "sensorGPS"
-#define TABLE_SENSOR_GPS_ALT "sensorGPSAlt"
+#include <atomic>
+#include <map>
+#include <string>
+#include <sqlite3.h>
+#include <time.h>
+#include "packet_view.h"
+#include "sensor_registry.h"
+#include "node_registry.h"
+#include "metrics.h"
+#include "logger.h"
+
 #define TABLE_DEBUG_MESSAGES "debugMessages"
-#define TABLE_MONITORING_NODES "monitoringNodes"
 
 #define CALL_SQLITE(FUNC) 						\
 {									\
 	int i; 								\
 	i = sqlite3_ ## FUNC;						\
 	if (i != SQLITE_OK) {						\
-		fprintf (stderr, "%s failed with status %d: %s\n",	\
-		#FUNC, i, sqlite3_errmsg (db));				\
+		log_error(LOG_MODULE_STORAGE, "%s failed with status %d: %s", \
+			#FUNC, i, sqlite3_errmsg (db));			\
 	}								\
 }				\
 
@@ -43,34 +48,96 @@
 	int i;								\
 	i = sqlite3_ ## FUNC;						\
 	if (i != SQLITE_ ## EXPECT) {					\
-		fprintf (stderr, "%s failed with status %d: %s\n",	\
-		#FUNC, i, sqlite3_errmsg (db));				\
+		log_error(LOG_MODULE_STORAGE, "%s failed with status %d: %s", \
+			#FUNC, i, sqlite3_errmsg (db));			\
 	}								\
 }									\
 
+/* executes a statement that writes rows and resets it, so it can be reused
+ * for the next row. Returns false if the statement failed, the error is
+ * logged. The caller has to roll back the transaction in that case */
+inline bool step_statement(sqlite3_stmt *stmt) {
+	int error_code = sqlite3_step(stmt);
+	if (error_code != SQLITE_DONE)
+		log_error(LOG_MODULE_STORAGE, "step failed with status %d: %s", error_code,
+			sqlite3_errmsg(sqlite3_db_handle(stmt)));
+	sqlite3_reset(stmt);
+	return error_code == SQLITE_DONE;
+}
+
 /*** Group of functions to deserialize messages and store the data***/
-/* a class without internal state that hides away the helper functions
- * used do de-serialize messages */
+/* a class that hides away the helper functions used do de-serialize messages.
+ * It keeps a cache of compiled SQL statements (one per destination table),
+ * so the statements only have to be parsed once, and writes all rows that
+ * belong to one XBee_Message (or one batch of messages) in a single transaction */
 class Message_Storage {
 public:
-	void store_msg(sqlite3 *db, XBee_Message *msg);
+	Message_Storage(sqlite3 *db, uint32_t node_flush_interval_ms = NODE_FLUSH_INTERVAL_MS,
+			const Sensor_Storage_Options &options = Sensor_Storage_Options());
+	~Message_Storage();
+
+	void store_msg(XBee_Message *msg);
+	/* returns true if the batch was committed. If a row of the batch, the
+	 * statistics or rollups could not be written, the whole transaction is
+	 * rolled back and false is returned */
+	bool store_msgs(XBee_Message **msgs, uint16_t count);
+	/* writes the node statistics, the open rollup buckets and incomplete
+	 * sample blocks if their flush interval has passed */
+	void flush();
+	/* sets the time of reception the absolute timestamps are calculated
+	 * from, 0 uses the current time. Used for messages from a capture */
+	void set_receive_time(time_t receive_time);
+	/* adds the rows per table and the commit latency to the registry */
+	void register_metrics(Metrics_Registry &registry) const;
+	/* number of committed transactions, including the flushes */
+	uint32_t get_commit_cnt() const;
 private:
-	void store_address(sqlite3 *db, const XBee_Address &addr);
+	Message_Storage(const Message_Storage&);
+	Message_Storage& operator=(const Message_Storage&);
+
+	/* the store functions return false if a row could not be written */
+	bool store_msg_rows(XBee_Message *msg);
 	/* intermediate functions for passing data on to the store functions */
-	void store_sensor_msg(sqlite3 *db, XBee_Message *msg);
-	void store_debug_msg(sqlite3 *db, XBee_Message *msg);
-	void store_config_msg(sqlite3 *db, XBee_Message *msg);
-	
-	/* functions to store the sensor messages */
-	void store_sensor_heart(sqlite3 *db, SensorMessage *sensor_msg, uint64_t addr64);
-	void store_sensor_raw_temperature(sqlite3 *db, SensorMessage *sensor_msg, uint64_t addr64);
-	void store_sensor_accelerometer(sqlite3 *db, SensorMessage *sensor_msg, uint64_t addr64);
-	void store_sensor_gps(sqlite3 *db, SensorMessage *sensor_msg, uint64_t addr64);
-	void store_sensor_gps_alt(sqlite3 *db, SensorMessage *sensor_msg, uint64_t addr64);
+	bool store_sensor_msg(const Packet_View &packet, uint64_t addr64);
+	bool store_debug_msg(const Packet_View &packet, uint64_t addr64);
+	bool store_config_msg(const Packet_View &packet, uint64_t addr64);
+
+	/* functions to manage the statement cache */
+	sqlite3_stmt* get_statement(const string &table, const string &sql);
+	sqlite3_stmt* get_insert_statement(const string &table, uint8_t column_cnt);
+	bool execute_statement(sqlite3_stmt *stmt);
+	bool begin();
+	/* commits the transaction and records its latency, returns false if
+	 * the commit failed (the transaction is rolled back in that case) */
+	bool commit();
+	/* rolls back the open transaction, the rows that the node registry,
+	 * the rollups and the block stores wrote in it are marked for the next
+	 * flush. Always returns false */
+	bool rollback();
+	/* returns true if the node statistics, a rollup or a block store need
+	 * to be written */
+	bool flush_due() const;
+	bool flush_due_rows();
+
+	sqlite3 *db;
+	std::map<string, sqlite3_stmt*> statement_cache;
+	/* insert statements, rollups and block stores of the sensor tables,
+	 * in the order of the registry */
+	Sensor_Sink sensor_sinks[Sensor_Registry::size];
+	sqlite3_stmt *begin_stmt;
+	sqlite3_stmt *commit_stmt;
+	sqlite3_stmt *rollback_stmt;
+	Node_Registry nodes;
+	time_t receive_time;
+	Metrics_Counter debug_rows;
+	Metrics_Histogram commit_latency;	/* in microseconds */
+	std::atomic<uint32_t> commit_cnt;
 };
 
-/* function will try to insert a new row of data into the table */ 
-void insert_into_table(sqlite3 *db, const string &table, const string &values);
+/* this function applies the journal mode, synchronous level and mmap size
+ * to the db connection, returns true if the db is in WAL mode */
+bool configure_db(sqlite3 *db, const string &journal_mode, const string &synchronous,
+		int64_t mmap_size);
 
 /* this function verifies that all tables that we need to store the received
  * data and configuration options exist */
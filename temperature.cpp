@@ -0,0 +1,138 @@
+/* This file is part of Equine Monitor
+ *
+ * Equine Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Equine Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Equine Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Konke Radlow <koradlow@gmail.com>
+ */
+
+#include "controller.h"
+#include <math.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/* coefficients of the TI formula for the object temperature, see
+ * calculate_temperature() for the reference implementation */
+#define TEMP_S0 0.00000000000006
+#define TEMP_A1 0.00175
+#define TEMP_A2 -0.00001678
+#define TEMP_B0 -0.0000294
+#define TEMP_B1 -0.00000057
+#define TEMP_B2 0.00000000463
+#define TEMP_C2 13.4
+#define TEMP_TREF 298.15
+#define TEMP_KELVIN 273.15
+/* scale factors of the raw die temperature and object voltage readings */
+#define TEMP_DIE_SCALE (.03125 / 4)
+#define TEMP_VOBJ_SCALE .00000015625
+
+/* reference implementation of the TI formula, converts one raw sample */
+double calculate_temperature(double tDieUF, double vObjUF)
+{
+	double vObj = 0, tDie = 0;
+	tDie= ( (tDieUF / 4)  * .03125) + 273.15;
+	vObj =  vObjUF * .00000015625;
+
+	// Calculate Tobj, based on data/formula from TI
+	double S0 = 0.00000000000006;       
+	double a1 = 0.00175; 
+	double a2 = -0.00001678; 
+	double b0 = -0.0000294; 
+	double b1 = -0.00000057;  
+	double b2 = 0.00000000463; 
+	double c2 = 13.4;
+	double Tref = 298.15;
+	double S = S0*(1+a1*(tDie - Tref)+a2*pow((tDie - Tref),2));
+	double Vos = b0 + b1*(tDie - Tref) + b2*pow((tDie - Tref),2);
+	double fObj = (vObj - Vos) + c2*pow((vObj - Vos),2);
+	double Tobj = pow(pow(tDie,4) + (fObj/S), (double).25) - 273.15;
+	
+	return Tobj;
+}
+
+/* scalar version of the batch kernel. The powers are evaluated as products
+ * in Horner form, and the fourth root as two square roots, which avoids the
+ * generic pow() calls of the reference implementation */
+static inline double temperature_kernel(double tDieUF, double vObjUF) {
+	double tDie = tDieUF * TEMP_DIE_SCALE + TEMP_KELVIN;
+	double vObj = vObjUF * TEMP_VOBJ_SCALE;
+	double d = tDie - TEMP_TREF;
+	double S = TEMP_S0 * (1 + d * (TEMP_A1 + d * TEMP_A2));
+	double Vos = TEMP_B0 + d * (TEMP_B1 + d * TEMP_B2);
+	double x = vObj - Vos;
+	double fObj = x * (1 + TEMP_C2 * x);
+	double tDie2 = tDie * tDie;
+	return sqrt(sqrt(tDie2 * tDie2 + fObj / S)) - TEMP_KELVIN;
+}
+
+/* converts count raw temperature samples into object temperatures in degree
+ * Celsius. Two samples are processed at once with SSE2 or NEON (AArch64)
+ * double precision vector instructions if they are available, the remaining
+ * samples with the scalar kernel. The results match calculate_temperature()
+ * within a few ULP, check_temperature verifies this */
+void calculate_temperatures(const RawTemperatureMessage *samples, uint16_t count,
+		double *temperatures) {
+	uint16_t i = 0;
+
+#if defined(__SSE2__)
+	const __m128d die_scale = _mm_set1_pd(TEMP_DIE_SCALE);
+	const __m128d vobj_scale = _mm_set1_pd(TEMP_VOBJ_SCALE);
+	const __m128d kelvin = _mm_set1_pd(TEMP_KELVIN);
+	const __m128d tref = _mm_set1_pd(TEMP_TREF);
+	const __m128d one = _mm_set1_pd(1.0);
+	for (; i + 2 <= count; i += 2) {
+		__m128d tDie = _mm_set_pd(samples[i + 1].Tenv, samples[i].Tenv);
+		__m128d vObj = _mm_set_pd(samples[i + 1].Vobj, samples[i].Vobj);
+		tDie = _mm_add_pd(_mm_mul_pd(tDie, die_scale), kelvin);
+		vObj = _mm_mul_pd(vObj, vobj_scale);
+		__m128d d = _mm_sub_pd(tDie, tref);
+		__m128d S = _mm_mul_pd(_mm_set1_pd(TEMP_S0), _mm_add_pd(one, _mm_mul_pd(d,
+			_mm_add_pd(_mm_set1_pd(TEMP_A1), _mm_mul_pd(d, _mm_set1_pd(TEMP_A2))))));
+		__m128d Vos = _mm_add_pd(_mm_set1_pd(TEMP_B0), _mm_mul_pd(d,
+			_mm_add_pd(_mm_set1_pd(TEMP_B1), _mm_mul_pd(d, _mm_set1_pd(TEMP_B2)))));
+		__m128d x = _mm_sub_pd(vObj, Vos);
+		__m128d fObj = _mm_mul_pd(x, _mm_add_pd(one, _mm_mul_pd(_mm_set1_pd(TEMP_C2), x)));
+		__m128d tDie2 = _mm_mul_pd(tDie, tDie);
+		__m128d y = _mm_add_pd(_mm_mul_pd(tDie2, tDie2), _mm_div_pd(fObj, S));
+		_mm_storeu_pd(&temperatures[i], _mm_sub_pd(_mm_sqrt_pd(_mm_sqrt_pd(y)), kelvin));
+	}
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+	const float64x2_t die_scale = vdupq_n_f64(TEMP_DIE_SCALE);
+	const float64x2_t vobj_scale = vdupq_n_f64(TEMP_VOBJ_SCALE);
+	const float64x2_t kelvin = vdupq_n_f64(TEMP_KELVIN);
+	const float64x2_t tref = vdupq_n_f64(TEMP_TREF);
+	const float64x2_t one = vdupq_n_f64(1.0);
+	for (; i + 2 <= count; i += 2) {
+		double raw_die[2] = {(double)samples[i].Tenv, (double)samples[i + 1].Tenv};
+		double raw_obj[2] = {(double)samples[i].Vobj, (double)samples[i + 1].Vobj};
+		float64x2_t tDie = vaddq_f64(vmulq_f64(vld1q_f64(raw_die), die_scale), kelvin);
+		float64x2_t vObj = vmulq_f64(vld1q_f64(raw_obj), vobj_scale);
+		float64x2_t d = vsubq_f64(tDie, tref);
+		float64x2_t S = vmulq_f64(vdupq_n_f64(TEMP_S0), vaddq_f64(one, vmulq_f64(d,
+			vaddq_f64(vdupq_n_f64(TEMP_A1), vmulq_f64(d, vdupq_n_f64(TEMP_A2))))));
+		float64x2_t Vos = vaddq_f64(vdupq_n_f64(TEMP_B0), vmulq_f64(d,
+			vaddq_f64(vdupq_n_f64(TEMP_B1), vmulq_f64(d, vdupq_n_f64(TEMP_B2)))));
+		float64x2_t x = vsubq_f64(vObj, Vos);
+		float64x2_t fObj = vmulq_f64(x, vaddq_f64(one, vmulq_f64(vdupq_n_f64(TEMP_C2), x)));
+		float64x2_t tDie2 = vmulq_f64(tDie, tDie);
+		float64x2_t y = vaddq_f64(vmulq_f64(tDie2, tDie2), vdivq_f64(fObj, S));
+		vst1q_f64(&temperatures[i], vsubq_f64(vsqrtq_f64(vsqrtq_f64(y)), kelvin));
+	}
+#endif
+	for (; i < count; i++)
+		temperatures[i] = temperature_kernel(samples[i].Tenv, samples[i].Vobj);
+}
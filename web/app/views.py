@@ -18,6 +18,10 @@ TABLENAMES = { 'heart': 'sensorHeart',
 		'debug' : 'debugMessages',
 		'nodes' : 'monitoringNodes' }
 TABLE_LENGTH = '40'
+# the controller keeps rollups of these tables in <table>Rollup, with
+# buckets of 1s, 1min and 1h
+ROLLUP_TABLES = ['sensorHeart', 'sensorTemperature', 'sensorAccelerometer']
+ROLLUP_RESOLUTIONS = ['1', '60', '3600']
 
 # Display URL functions
 @app.route("/index")
@@ -45,10 +49,17 @@ def display_sensor_data(horse_id, sensor_id):
 	# the sensor data table is split into several pages, with equal length
 	# the page argument can be used to select the displayed page
 	page = int(request.args.get('page', 1))
+	# the resolution argument selects the rollup of the table instead of
+	# the raw samples
+	resolution = request.args.get('resolution', None)
 	table = TABLENAMES[sensor_id] if TABLENAMES.has_key(sensor_id) else None
+	if resolution in ROLLUP_RESOLUTIONS and table in ROLLUP_TABLES:
+		tables = get_rollup_table(table, resolution, page, horse_id)
+	else:
+		tables = get_table(table, page, horse_id)
 	return render_template("data.html", title = horse_id, menu = get_main_menu(),
 		sensor_menu = get_sensor_menu(horse_id), horse_id = horse_id,
-		tables = get_table(table, page, horse_id), google_gps_url = gps_url,
+		tables = tables, google_gps_url = gps_url,
 		table_page = page)
 
 @app.route('/status')
@@ -125,6 +136,23 @@ def get_table(tablename, page = 1, horse_id=None):
 
 	return table
 
+# returns the rollup rows of the table with the resolution in seconds, the
+# newest buckets first. The rows are found through the unique index of the
+# rollup table (addr64, resolution, timestamp)
+def get_rollup_table(tablename, resolution, page = 1, horse_id=None):
+	table = []
+	rollup_table = tablename + 'Rollup'
+	if(horse_id):
+		sql_table = query_db('SELECT * FROM ' + rollup_table +
+		' WHERE addr64=' + get_addr64(horse_id) +
+		' AND resolution=' + resolution +
+		' ORDER BY timestamp DESC' +
+		' LIMIT ' + TABLE_LENGTH +
+		' OFFSET ' + str((page - 1) * int(TABLE_LENGTH)))
+		if (sql_table):
+			table.append([rollup_table, sql_table[0].keys(), replace_timestamp(sql_table)])
+	return table
+
 def replace_timestamp(table):
 	for row in table:
 		row['timestamp'] = time.ctime(int(row['timestamp']))
@@ -0,0 +1,238 @@
+/* This file is part of Equine Monitor
+ *
+ * Equine Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Equine Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Equine Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Konke Radlow <koradlow@gmail.com>
+ */
+
+/* benchmark of the API frame receive path: a burst of RxPacket frames is
+ * written into a pseudo terminal, either paced to the byte rate of a
+ * 115200 baud link or as fast as possible, and received with
+ * 	- libgbee: one gbeeReceive call per frame
+ * 	- XBee_Frame_Parser: chunked reads into the frame slots
+ * The CPU time of the receiving thread, the read calls and the lost frames
+ * are reported for both paths.
+ * usage: bench [-n frame_cnt] [-m (max speed)] [-e (escaped mode, parser only)] */
+
+#include "xbee_if.h"
+#include "xbee_frame_parser.h"
+#include <gbee.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <termios.h>
+#include <time.h>
+#include <vector>
+
+/* 10 bits per byte on the serial line (start, 8 data, stop bit) */
+#define BENCH_BYTES_PER_S (115200 / 10)
+#define BENCH_FRAME_CNT 2000
+#define BENCH_TIMEOUT_MS 500
+
+typedef struct {
+	int fd;
+	const std::vector<uint8_t> *stream;
+	bool max_speed;
+} Writer_Args;
+
+static double now_s(clockid_t clock) {
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* appends a byte to the stream, escapes it if required */
+static void put_byte(std::vector<uint8_t> &stream, uint8_t byte, bool escaped) {
+	if (escaped && (byte == XBEE_FRAME_DELIMITER || byte == XBEE_FRAME_ESCAPE ||
+	    byte == XBEE_FRAME_XON || byte == XBEE_FRAME_XOFF)) {
+		stream.push_back(XBEE_FRAME_ESCAPE);
+		byte ^= XBEE_FRAME_ESCAPE_XOR;
+	}
+	stream.push_back(byte);
+}
+
+/* appends a RxPacket frame with a full message part as payload */
+static void put_rx_frame(std::vector<uint8_t> &stream, uint16_t seq, bool escaped) {
+	uint8_t data[XBEE_RX_PACKET_OVERHEAD + XBEE_MSG_LENGTH];
+	uint8_t checksum = 0;
+
+	data[0] = GBEE_RX_PACKET;
+	for (int i = 1; i < XBEE_RX_PACKET_OVERHEAD; i++)
+		data[i] = 0x10 + i;
+	for (int i = XBEE_RX_PACKET_OVERHEAD; i < (int)sizeof(data); i++)
+		data[i] = (seq + i) & 0xFF;
+
+	stream.push_back(XBEE_FRAME_DELIMITER);
+	put_byte(stream, sizeof(data) >> 8, escaped);
+	put_byte(stream, sizeof(data) & 0xFF, escaped);
+	for (unsigned i = 0; i < sizeof(data); i++) {
+		put_byte(stream, data[i], escaped);
+		checksum += data[i];
+	}
+	put_byte(stream, 0xFF - checksum, escaped);
+}
+
+/* writes the stream into the pty, paced in 10ms steps for the baud rate */
+static void* writer_thread(void *arg) {
+	Writer_Args *args = (Writer_Args*) arg;
+	const uint8_t *data = &(*args->stream)[0];
+	size_t remaining = args->stream->size();
+	size_t step = args->max_speed ? XBEE_FRAME_READ_CHUNK : BENCH_BYTES_PER_S / 100;
+
+	while (remaining > 0) {
+		ssize_t written = write(args->fd, data, remaining < step ? remaining : step);
+		if (written < 0)
+			break;
+		data += written;
+		remaining -= written;
+		if (!args->max_speed)
+			usleep(10000);
+	}
+	return NULL;
+}
+
+/* opens a pty pair in raw mode, the name of the slave side is returned */
+static int open_pty(char *slave_name, size_t length) {
+	struct termios tio;
+	int master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (master < 0 || grantpt(master) || unlockpt(master) ||
+	    ptsname_r(master, slave_name, length)) {
+		perror("Error creating pty");
+		return -1;
+	}
+	tcgetattr(master, &tio);
+	cfmakeraw(&tio);
+	tcsetattr(master, TCSANOW, &tio);
+	return master;
+}
+
+static void print_result(const char *name, uint32_t frames, uint32_t frame_cnt,
+		uint32_t reads, double wall_s, double cpu_s) {
+	printf("%-10s frames: %5u/%u, reads: %6u, wall: %7.3f s, cpu: %7.3f ms (%6.2f us/frame)\n",
+		name, frames, frame_cnt, reads, wall_s, cpu_s * 1e3,
+		frames ? cpu_s * 1e6 / frames : 0.0);
+}
+
+/* receives frames with one gbeeReceive call per frame */
+static void run_gbee(const std::vector<uint8_t> &stream, uint32_t frame_cnt, bool max_speed) {
+	char slave_name[64];
+	GBeeFrameData frame;
+	uint16_t length;
+	uint32_t timeout, frames = 0;
+	pthread_t writer;
+
+	int master = open_pty(slave_name, sizeof(slave_name));
+	if (master < 0)
+		return;
+	GBee *gbee = gbeeCreate(slave_name);
+	if (!gbee) {
+		printf("Error creating libgbee handle for %s\n", slave_name);
+		close(master);
+		return;
+	}
+	Writer_Args args = { master, &stream, max_speed };
+	double wall = now_s(CLOCK_MONOTONIC);
+	double cpu = now_s(CLOCK_THREAD_CPUTIME_ID);
+	pthread_create(&writer, NULL, writer_thread, &args);
+
+	while (frames < frame_cnt) {
+		timeout = BENCH_TIMEOUT_MS;
+		if (gbeeReceive(gbee, &frame, &length, &timeout) == GBEE_TIMEOUT_ERROR)
+			break;
+		if (frame.ident == GBEE_RX_PACKET)
+			frames++;
+	}
+	cpu = now_s(CLOCK_THREAD_CPUTIME_ID) - cpu;
+	wall = now_s(CLOCK_MONOTONIC) - wall;
+	pthread_join(writer, NULL);
+	/* libgbee reads each frame with several read calls, they aren't counted */
+	print_result("libgbee", frames, frame_cnt, 0, wall, cpu);
+	gbeeDestroy(gbee);
+	close(master);
+}
+
+/* receives frames with the chunked frame parser */
+static void run_parser(const std::vector<uint8_t> &stream, uint32_t frame_cnt,
+		bool max_speed, bool escaped) {
+	char slave_name[64];
+	XBee_Frame frame;
+	struct pollfd pfd;
+	uint32_t frames = 0;
+	pthread_t writer;
+
+	int master = open_pty(slave_name, sizeof(slave_name));
+	if (master < 0)
+		return;
+	pfd.fd = open(slave_name, O_RDWR | O_NOCTTY);
+	pfd.events = POLLIN;
+	XBee_Frame_Parser parser(sizeof(GBeeFrameData), XBEE_FRAME_SLOTS, escaped);
+
+	Writer_Args args = { master, &stream, max_speed };
+	double wall = now_s(CLOCK_MONOTONIC);
+	double cpu = now_s(CLOCK_THREAD_CPUTIME_ID);
+	pthread_create(&writer, NULL, writer_thread, &args);
+
+	while (frames < frame_cnt) {
+		if (!parser.next_frame(&frame)) {
+			if (poll(&pfd, 1, BENCH_TIMEOUT_MS) <= 0 || parser.read_from(pfd.fd) <= 0)
+				break;
+			continue;
+		}
+		if (frame.data[0] == GBEE_RX_PACKET)
+			frames++;
+	}
+	cpu = now_s(CLOCK_THREAD_CPUTIME_ID) - cpu;
+	wall = now_s(CLOCK_MONOTONIC) - wall;
+	pthread_join(writer, NULL);
+	print_result(escaped ? "parser/AP2" : "parser", frames, frame_cnt,
+		parser.get_stats().reads, wall, cpu);
+	if (parser.get_stats().checksum_errors || parser.get_stats().framing_errors)
+		printf("parser errors: checksum %u, framing %u\n",
+			parser.get_stats().checksum_errors, parser.get_stats().framing_errors);
+	close(pfd.fd);
+	close(master);
+}
+
+int main(int argc, char **argv) {
+	uint32_t frame_cnt = BENCH_FRAME_CNT;
+	bool max_speed = false;
+	bool escaped = false;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:me")) != -1) {
+		switch (opt) {
+		case 'n': frame_cnt = strtoul(optarg, NULL, 0); break;
+		case 'm': max_speed = true; break;
+		case 'e': escaped = true; break;
+		default:
+			printf("usage: %s [-n frame_cnt] [-m] [-e]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	std::vector<uint8_t> stream;
+	for (uint32_t i = 0; i < frame_cnt; i++)
+		put_rx_frame(stream, i, escaped);
+	printf("%u frames, %zu bytes, %s\n", frame_cnt, stream.size(),
+		max_speed ? "max speed" : "paced to 115200 baud");
+
+	if (!escaped)
+		run_gbee(stream, frame_cnt, max_speed);
+	run_parser(stream, frame_cnt, max_speed, escaped);
+	return 0;
+}
@@ -0,0 +1,386 @@
+/* This file is part of Equine Monitor
+ *
+ * Equine Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Equine Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Equine Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Konke Radlow <koradlow@gmail.com>
+ */
+
+#include "logger.h"
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <stdio.h>
+#include <strings.h>
+#include <time.h>
+
+std::atomic<uint8_t> log_levels[LOG_MODULE_CNT] = {
+	{LOG_LEVEL_INFO}, {LOG_LEVEL_INFO}, {LOG_LEVEL_INFO}
+};
+
+static const char *level_names[] = {"OFF", "ERROR", "WARN", "INFO", "DEBUG"};
+static const char *module_names[LOG_MODULE_CNT] = {"controller", "storage", "xbee"};
+
+/* a record of the log buffer, the sequence tells the producers and the
+ * writer whether the slot is free or filled (bounded multi producer queue
+ * after D. Vyukov): a free slot for position pos has the sequence pos, a
+ * filled one pos + 1 */
+struct Log_Slot {
+	Log_Record record;	/* first member, so a record can be cast to its slot */
+	std::atomic<uint32_t> sequence;
+};
+
+static Log_Slot *slots;
+static uint32_t capacity;
+static uint32_t mask;
+alignas(64) static std::atomic<uint32_t> enqueue_pos;
+alignas(64) static std::atomic<uint32_t> dequeue_pos;
+static std::atomic<bool> writer_running(false);
+static std::atomic<uint64_t> written_cnt(0);
+static std::atomic<uint64_t> dropped_cnt(0);
+static std::thread writer;
+static std::mutex wakeup_mutex;
+static std::condition_variable wakeup;
+/* the log file, stdout if no file is given */
+static FILE *output;
+/* records of the log calls while the writer thread is not running */
+static thread_local Log_Record sync_record;
+static std::mutex sync_mutex;
+
+/** Log_Record implementation */
+void Log_Record::init(Log_Module module, Log_Level level, const char *format) {
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	time_ns = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+	this->format = format;
+	this->module = module;
+	this->level = level;
+	arg_cnt = 0;
+	data_length = 0;
+}
+
+void Log_Record::put_text(const char *text, size_t length) {
+	if (arg_cnt >= LOG_MAX_ARGS || data_length + 1u > sizeof(data))
+		return;
+	size_t space = sizeof(data) - data_length - 1;
+	if (length > space)
+		length = space;
+	if (length > UINT8_MAX)
+		length = UINT8_MAX;
+	data[data_length] = length;
+	memcpy(&data[data_length + 1], text, length);
+	data_length += 1 + length;
+	types[arg_cnt++] = LOG_ARG_STRING;
+}
+
+/*** Formatting ***/
+typedef struct {
+	uint8_t type;
+	int64_t int_value;
+	uint64_t uint_value;
+	double double_value;
+	char text[UINT8_MAX + 1];
+} Log_Arg;
+
+/* reads the next argument of the record, returns false if there is none */
+static bool next_arg(const Log_Record &record, uint8_t &index, uint16_t &offset, Log_Arg &arg) {
+	if (index >= record.arg_cnt)
+		return false;
+	arg.type = record.types[index++];
+	if (arg.type == LOG_ARG_STRING) {
+		uint8_t length = record.data[offset];
+		memcpy(arg.text, &record.data[offset + 1], length);
+		arg.text[length] = '\0';
+		offset += 1 + length;
+		return true;
+	}
+	switch (arg.type) {
+	case LOG_ARG_INT:
+		memcpy(&arg.int_value, &record.data[offset], 8);
+		arg.uint_value = arg.int_value;
+		arg.double_value = arg.int_value;
+		break;
+	case LOG_ARG_DOUBLE:
+		memcpy(&arg.double_value, &record.data[offset], 8);
+		arg.int_value = arg.double_value;
+		arg.uint_value = arg.double_value;
+		break;
+	default:
+		memcpy(&arg.uint_value, &record.data[offset], 8);
+		arg.int_value = arg.uint_value;
+		arg.double_value = arg.uint_value;
+	}
+	offset += 8;
+	return true;
+}
+
+/* formats one conversion, the widths and precisions given by '*' are
+ * passed before the value */
+template <typename T>
+static int format_value(char *out, size_t size, const char *spec, const int *stars,
+		uint8_t star_cnt, T value) {
+	switch (star_cnt) {
+	case 0: return snprintf(out, size, spec, value);
+	case 1: return snprintf(out, size, spec, stars[0], value);
+	default: return snprintf(out, size, spec, stars[0], stars[1], value);
+	}
+}
+
+/* formats the message of the record like printf. The length modifiers of
+ * the format are replaced, because the numbers are stored with 64 bits */
+static size_t format_message(const Log_Record &record, char *out, size_t size) {
+	const char *pos = record.format;
+	uint8_t index = 0;
+	uint16_t offset = 0;
+	size_t length = 0;
+	Log_Arg arg;
+
+	while (*pos && length < size - 1) {
+		if (*pos != '%' || pos[1] == '%') {
+			out[length++] = *pos;
+			pos += *pos == '%' ? 2 : 1;
+			continue;
+		}
+		char spec[32] = "%";
+		uint8_t spec_length = 1;
+		int stars[2];
+		uint8_t star_cnt = 0;
+		pos++;
+		while (*pos && strchr("-+ #0123456789.*", *pos) && spec_length < sizeof(spec) - 4) {
+			if (*pos == '*' && star_cnt < 2)
+				stars[star_cnt++] = next_arg(record, index, offset, arg) ? arg.int_value : 0;
+			spec[spec_length++] = *pos++;
+		}
+		while (*pos && strchr("hlLqjzt", *pos))
+			pos++;
+		char conversion = *pos;
+		if (!conversion)
+			break;
+		pos++;
+
+		int written = -1;
+		bool valid = next_arg(record, index, offset, arg);
+		if (strchr("di", conversion)) {
+			strcpy(&spec[spec_length], "lld");
+			if (valid && arg.type != LOG_ARG_STRING)
+				written = format_value(&out[length], size - length, spec, stars,
+					star_cnt, (long long) arg.int_value);
+		} else if (strchr("uoxX", conversion)) {
+			spec[spec_length++] = 'l';
+			spec[spec_length++] = 'l';
+			spec[spec_length++] = conversion;
+			spec[spec_length] = '\0';
+			if (valid && arg.type != LOG_ARG_STRING)
+				written = format_value(&out[length], size - length, spec, stars,
+					star_cnt, (unsigned long long) arg.uint_value);
+		} else if (strchr("fFeEgGaAc", conversion)) {
+			spec[spec_length++] = conversion;
+			spec[spec_length] = '\0';
+			if (valid && arg.type != LOG_ARG_STRING && conversion == 'c')
+				written = format_value(&out[length], size - length, spec, stars,
+					star_cnt, (int) arg.int_value);
+			else if (valid && arg.type != LOG_ARG_STRING)
+				written = format_value(&out[length], size - length, spec, stars,
+					star_cnt, arg.double_value);
+		} else if (conversion == 's' || conversion == 'p') {
+			spec[spec_length++] = conversion;
+			spec[spec_length] = '\0';
+			if (valid && arg.type == LOG_ARG_STRING && conversion == 's')
+				written = format_value(&out[length], size - length, spec, stars,
+					star_cnt, (const char*) arg.text);
+			else if (valid && arg.type == LOG_ARG_POINTER)
+				written = format_value(&out[length], size - length, spec, stars,
+					star_cnt, (void*) (uintptr_t) arg.uint_value);
+		}
+		/* missing or mismatching arguments are marked in the output */
+		if (written < 0)
+			written = snprintf(&out[length], size - length, "<?>");
+		length += written;
+		if (length > size - 1)
+			length = size - 1;
+	}
+	/* the line ending is added by the writer */
+	while (length && (out[length - 1] == '\n' || out[length - 1] == ' '))
+		length--;
+	out[length] = '\0';
+	return length;
+}
+
+/* writes the record as one line with time, level and module */
+static void write_record(FILE *file, const Log_Record &record) {
+	char line[LOG_LINE_LENGTH];
+	struct tm local;
+	time_t seconds = record.time_ns / 1000000000ULL;
+	localtime_r(&seconds, &local);
+	size_t length = strftime(line, sizeof(line), "%Y-%m-%d %H:%M:%S", &local);
+	length += snprintf(&line[length], sizeof(line) - length, ".%03u %-5s %s: ",
+		(unsigned)(record.time_ns / 1000000 % 1000), level_names[record.level],
+		module_names[record.module]);
+	format_message(record, &line[length], sizeof(line) - length);
+	fputs(line, file);
+	fputc('\n', file);
+}
+
+/*** Log buffer ***/
+Log_Record* log_reserve() {
+	if (!writer_running.load(std::memory_order_acquire))
+		return &sync_record;
+
+	uint32_t pos = enqueue_pos.load(std::memory_order_relaxed);
+	for (;;) {
+		Log_Slot &slot = slots[pos & mask];
+		int32_t diff = (int32_t)(slot.sequence.load(std::memory_order_acquire) - pos);
+		if (diff == 0) {
+			if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				return &slot.record;
+		} else if (diff < 0) {
+			/* the writer did not catch up, the message is dropped */
+			dropped_cnt.fetch_add(1, std::memory_order_relaxed);
+			return NULL;
+		} else {
+			pos = enqueue_pos.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+void log_commit(Log_Record *record) {
+	if (record == &sync_record) {
+		std::lock_guard<std::mutex> lock(sync_mutex);
+		write_record(output ? output : stdout, *record);
+		fflush(output ? output : stdout);
+		written_cnt.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	Log_Slot *slot = reinterpret_cast<Log_Slot*>(record);
+	uint32_t pos = slot->sequence.load(std::memory_order_relaxed);
+	slot->sequence.store(pos + 1, std::memory_order_release);
+	/* errors are written right away, the writer is also woken up before
+	 * the buffer runs full */
+	if (record->level == LOG_LEVEL_ERROR ||
+	    pos - dequeue_pos.load(std::memory_order_relaxed) == capacity / 2)
+		wakeup.notify_one();
+}
+
+/* writes the filled records to the log, returns the number of records */
+static uint32_t drain() {
+	uint32_t pos = dequeue_pos.load(std::memory_order_relaxed);
+	uint32_t cnt = 0;
+	for (;;) {
+		Log_Slot &slot = slots[pos & mask];
+		if (slot.sequence.load(std::memory_order_acquire) != pos + 1)
+			break;
+		write_record(output, slot.record);
+		slot.sequence.store(pos + capacity, std::memory_order_release);
+		dequeue_pos.store(++pos, std::memory_order_relaxed);
+		cnt++;
+	}
+	if (cnt) {
+		fflush(output);
+		written_cnt.fetch_add(cnt, std::memory_order_relaxed);
+	}
+	return cnt;
+}
+
+/* main function of the writer thread, the records are written in batches */
+static void run() {
+	while (writer_running.load()) {
+		drain();
+		std::unique_lock<std::mutex> lock(wakeup_mutex);
+		wakeup.wait_for(lock, std::chrono::milliseconds(LOG_FLUSH_INTERVAL_MS));
+	}
+	drain();
+}
+
+bool log_start(const std::string &path, uint32_t buffer_size) {
+	if (writer_running.load())
+		return true;
+
+	bool opened = true;
+	output = stdout;
+	if (!path.empty()) {
+		output = fopen(path.c_str(), "a");
+		if (!output) {
+			fprintf(stderr, "Error opening log file %s\n", path.c_str());
+			output = stdout;
+			opened = false;
+		}
+	}
+
+	/* the capacity is a power of two, so the position can be masked. The
+	 * buffer is kept after log_stop(), a log call that reserved a record
+	 * before the writer stopped can still commit it */
+	if (!slots) {
+		capacity = 1;
+		while (capacity < buffer_size)
+			capacity <<= 1;
+		mask = capacity - 1;
+		slots = new Log_Slot[capacity];
+	}
+	for (uint32_t i = 0; i < capacity; i++)
+		slots[i].sequence.store(i, std::memory_order_relaxed);
+	enqueue_pos.store(0);
+	dequeue_pos.store(0);
+
+	writer_running.store(true);
+	writer = std::thread(run);
+	return opened;
+}
+
+void log_stop() {
+	if (!writer_running.load())
+		return;
+	writer_running.store(false);
+	wakeup.notify_one();
+	writer.join();
+
+	if (output != stdout)
+		fclose(output);
+	output = NULL;
+}
+
+void log_set_level(Log_Module module, Log_Level level) {
+	log_levels[module].store(level, std::memory_order_relaxed);
+}
+
+void log_set_level(Log_Level level) {
+	for (uint8_t i = 0; i < LOG_MODULE_CNT; i++)
+		log_set_level((Log_Module) i, level);
+}
+
+bool log_parse_level(const char *name, Log_Level *level) {
+	for (uint8_t i = 0; i < sizeof(level_names) / sizeof(level_names[0]); i++) {
+		if (!strcasecmp(name, level_names[i])) {
+			*level = (Log_Level) i;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool log_parse_module(const char *name, Log_Module *module) {
+	for (uint8_t i = 0; i < LOG_MODULE_CNT; i++) {
+		if (!strcasecmp(name, module_names[i])) {
+			*module = (Log_Module) i;
+			return true;
+		}
+	}
+	return false;
+}
+
+Log_Stats log_get_stats() {
+	Log_Stats stats;
+	stats.written = written_cnt.load(std::memory_order_relaxed);
+	stats.dropped = dropped_cnt.load(std::memory_order_relaxed);
+	return stats;
+}
@@ -0,0 +1,187 @@
+/* This file is part of Equine Monitor
+ *
+ * Equine Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Equine Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Equine Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Konke Radlow <koradlow@gmail.com>
+ */
+
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <atomic>
+#include <string>
+#include <type_traits>
+#include <inttypes.h>
+#include <string.h>
+
+/* default number of log records that can wait for the writer thread */
+#define LOG_BUFFER_SIZE 1024
+/* the writer thread writes the queued records at least every x ms */
+#define LOG_FLUSH_INTERVAL_MS 100
+/* size of a log record, the arguments are stored after the header */
+#define LOG_RECORD_SIZE 256
+#define LOG_MAX_ARGS 12
+/* max length of a formatted log line */
+#define LOG_LINE_LENGTH 1024
+
+typedef enum {
+	LOG_LEVEL_OFF = 0,
+	LOG_LEVEL_ERROR,
+	LOG_LEVEL_WARN,
+	LOG_LEVEL_INFO,
+	LOG_LEVEL_DEBUG
+} Log_Level;
+
+/* the modules have their own levels, which can be changed at runtime */
+typedef enum {
+	LOG_MODULE_CONTROLLER = 0,
+	LOG_MODULE_STORAGE,
+	LOG_MODULE_XBEE,
+	LOG_MODULE_CNT
+} Log_Module;
+
+typedef struct {
+	uint64_t written;	/* records written to the log */
+	uint64_t dropped;	/* records dropped because the buffer was full */
+} Log_Stats;
+
+/* a string that is not zero terminated, e.g. for "%s" */
+struct Log_Text {
+	const char *text;
+	size_t length;
+};
+
+/* levels of the modules, read by every log site */
+extern std::atomic<uint8_t> log_levels[LOG_MODULE_CNT];
+
+/* returns true if messages of the level are logged for the module, this is
+ * all a disabled log site costs: the arguments are not evaluated */
+static inline bool log_enabled(Log_Module module, Log_Level level) {
+	return level <= log_levels[module].load(std::memory_order_relaxed);
+}
+
+/* the log macros take a printf format string literal and its arguments.
+ * The arguments are copied into a record of the log buffer, the message is
+ * formatted and written by the writer thread. Before log_start() is called
+ * (and after log_stop()) messages are formatted and written immediately */
+#define LOG(module, level, ...) \
+	do { \
+		if (log_enabled(module, level)) \
+			log_write(module, level, __VA_ARGS__); \
+	} while (0)
+#define log_error(module, ...) LOG(module, LOG_LEVEL_ERROR, __VA_ARGS__)
+#define log_warn(module, ...) LOG(module, LOG_LEVEL_WARN, __VA_ARGS__)
+#define log_info(module, ...) LOG(module, LOG_LEVEL_INFO, __VA_ARGS__)
+#define log_debug(module, ...) LOG(module, LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+/* starts the writer thread, the log is appended to the file at path, or
+ * written to stdout if path is empty. Returns false if the file cannot be
+ * opened, messages are written to stdout in that case */
+bool log_start(const std::string &path, uint32_t buffer_size = LOG_BUFFER_SIZE);
+/* writes the queued records and stops the writer thread */
+void log_stop();
+void log_set_level(Log_Module module, Log_Level level);
+/* sets the level of all modules */
+void log_set_level(Log_Level level);
+/* parses a level (off, error, warn, info, debug) or module name (controller,
+ * storage, xbee), returns false if the name is unknown */
+bool log_parse_level(const char *name, Log_Level *level);
+bool log_parse_module(const char *name, Log_Module *module);
+Log_Stats log_get_stats();
+
+/*** Log record implementation ***/
+typedef enum {
+	LOG_ARG_INT = 1,
+	LOG_ARG_UINT,
+	LOG_ARG_DOUBLE,
+	LOG_ARG_STRING,
+	LOG_ARG_POINTER
+} Log_Arg_Type;
+
+/* a message with its arguments: numbers are stored with 8 bytes, strings
+ * are copied with a length byte and truncated if the record is full */
+struct Log_Record {
+	uint64_t time_ns;	/* CLOCK_REALTIME of the log call */
+	const char *format;
+	uint8_t module;
+	uint8_t level;
+	uint8_t arg_cnt;
+	uint8_t data_length;
+	uint8_t types[LOG_MAX_ARGS];
+	uint8_t data[LOG_RECORD_SIZE - 16 - 4 - LOG_MAX_ARGS];
+
+	void init(Log_Module module, Log_Level level, const char *format);
+
+	template <typename T>
+	typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type
+	put(T value) {
+		if (std::is_signed<T>::value)
+			put_number(LOG_ARG_INT, (int64_t) value);
+		else
+			put_number(LOG_ARG_UINT, (uint64_t) value);
+	}
+	template <typename T>
+	typename std::enable_if<std::is_floating_point<T>::value>::type
+	put(T value) {
+		double number = value;
+		put_number(LOG_ARG_DOUBLE, number);
+	}
+	template <typename T>
+	void put(const T *pointer) {
+		put_number(LOG_ARG_POINTER, (uintptr_t) pointer);
+	}
+	void put(const char *text) {
+		put_text(text ? text : "(null)", text ? strlen(text) : 6);
+	}
+	void put(const std::string &text) {
+		put_text(text.data(), text.length());
+	}
+	void put(const Log_Text &text) {
+		put_text(text.text, text.length);
+	}
+
+	void capture() {}
+	template <typename T, typename... Args>
+	void capture(const T &arg, const Args&... args) {
+		put(arg);
+		capture(args...);
+	}
+private:
+	template <typename T>
+	void put_number(Log_Arg_Type type, T value) {
+		if (arg_cnt >= LOG_MAX_ARGS || data_length + sizeof(value) > sizeof(data))
+			return;
+		memcpy(&data[data_length], &value, sizeof(value));
+		data_length += sizeof(value);
+		types[arg_cnt++] = type;
+	}
+	void put_text(const char *text, size_t length);
+};
+
+/* returns a free record of the log buffer, or NULL if it is full */
+Log_Record* log_reserve();
+/* passes a filled record to the writer thread */
+void log_commit(Log_Record *record);
+
+template <typename... Args>
+void log_write(Log_Module module, Log_Level level, const char *format, const Args&... args) {
+	Log_Record *record = log_reserve();
+	if (!record)
+		return;
+	record->init(module, level, format);
+	record->capture(args...);
+	log_commit(record);
+}
+
+#endif
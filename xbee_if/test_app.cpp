@@ -30,7 +30,11 @@ void speed_measurement(XBee* interface, const std::string &dest, uint16_t size,
 int main(int argc, char **argv) {
 	uint8_t pan_id[8] = {0x00, 0x00, 0x00, 0x00, 0x00, 0xAB, 0xBC, 0xCD};
 	uint8_t error_code;
-	XBee_Config config("/dev/ttyUSB0", "denver", false, pan_id, 500, B115200, 1);
+	/* the serial port and destination can be changed to run the test
+	 * against the simulator, e.g. test /tmp/ttyXBEE node0 */
+	const char *port = argc > 1 ? argv[1] : "/dev/ttyUSB0";
+	const std::string dest = argc > 2 ? argv[2] : "coordinator";
+	XBee_Config config(port, "denver", false, pan_id, 500, B115200, 1);
 	
 	XBee interface(config);
 	error_code = interface.xbee_init();
@@ -39,7 +43,7 @@ int main(int argc, char **argv) {
 		return 0;
 	}
 	interface.xbee_status();
-	speed_measurement(&interface, "coordinator", 1024, 10);
+	speed_measurement(&interface, dest, 1024, 10);
 
 	XBee_Message *rcv_msg = NULL;
 	uint16_t length = 0;
@@ -54,7 +58,7 @@ int main(int argc, char **argv) {
 				payload = rcv_msg->get_payload(&length);
 				printf("content: %s\n", hex_str(payload, length));
 			}
-			delete rcv_msg;
+			xbee_free_message(rcv_msg);
 		}
 		usleep(200);
 	}
@@ -90,23 +94,30 @@ void speed_measurement(XBee* interface, const std::string &dest, uint16_t size,
 	long mtime, seconds, useconds;
 	uint8_t error_code;  
 	XBee_Message test_msg = get_message(interface, dest, size);
+	/* compare the throughput for different numbers of parts in flight */
+	const uint8_t windows[] = {1, 2, 4, 8};
 
-	gettimeofday(&start, NULL);
-	for (int i = 0; i < iterations; i++) {
-		if ((error_code = interface->xbee_send_data(test_msg))!= 0x00) {
-			printf("Error transmitting: %u\n", error_code);
-			break;
+	for (unsigned w = 0; w < sizeof(windows); w++) {
+		interface->xbee_set_tx_window(windows[w]);
+		printf("Transmit window: %u\n", windows[w]);
+
+		gettimeofday(&start, NULL);
+		for (int i = 0; i < iterations; i++) {
+			if ((error_code = interface->xbee_send_data(test_msg))!= 0x00) {
+				printf("Error transmitting: %u\n", error_code);
+				break;
+			}
+			printf("Successfully transmitted msg %u with \n", i+1);
 		}
-		printf("Successfully transmitted msg %u with \n", i+1);
-	}
-	gettimeofday(&end, NULL);
+		gettimeofday(&end, NULL);
 
-	seconds  = end.tv_sec  - start.tv_sec;
-	useconds = end.tv_usec - start.tv_usec;
+		seconds  = end.tv_sec  - start.tv_sec;
+		useconds = end.tv_usec - start.tv_usec;
 
-	mtime = ((seconds) * 1000 + useconds/1000.0) + 0.5;
+		mtime = ((seconds) * 1000 + useconds/1000.0) + 0.5;
 
-	printf("Elapsed time: %ld milliseconds\n", mtime);
-	printf("Data throughput: %.1f kB/s\n", (iterations * size) / (float) mtime);
+		printf("Elapsed time: %ld milliseconds\n", mtime);
+		printf("Data throughput: %.1f kB/s\n", (iterations * size) / (float) mtime);
+	}
+	interface->xbee_set_tx_window(XBEE_TX_WINDOW);
 }
-
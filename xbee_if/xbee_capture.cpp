@@ -0,0 +1,253 @@
+/* This file is part of Equine Monitor
+ *
+ * Equine Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Equine Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Equine Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Konke Radlow <koradlow@gmail.com>
+ */
+
+#include "xbee_capture.h"
+#include "logger.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using std::string;
+
+static uint64_t now_ns(clockid_t clock) {
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+string xbee_capture_segment_path(const string &path, uint32_t segment) {
+	char suffix[16];
+	snprintf(suffix, sizeof(suffix), ".%06u", segment);
+	return path + suffix;
+}
+
+/** XBee_Capture Class implementation */
+/* constructor of XBee_Capture, an existing capture at the path is continued
+ * with the next free segment number. The first segment is created with the
+ * first frame */
+XBee_Capture::XBee_Capture(const string &path, uint32_t segment_size) :
+	path(path),
+	segment_size(segment_size > sizeof(XBee_Capture_Header) + sizeof(XBee_Capture_Record) ?
+		segment_size : XBEE_CAPTURE_SEGMENT_SIZE),
+	segment(0),
+	start_mono_ns(now_ns(CLOCK_MONOTONIC)),
+	start_real_ns(now_ns(CLOCK_REALTIME)),
+	fd(-1),
+	map(NULL),
+	used(0)
+{
+	memset(&stats, 0, sizeof(stats));
+	while (access(xbee_capture_segment_path(path, segment).c_str(), F_OK) == 0)
+		segment++;
+}
+
+XBee_Capture::~XBee_Capture() {
+	close_segment();
+}
+
+/* creates the next segment file with its full size and maps it */
+bool XBee_Capture::open_segment() {
+	string name = xbee_capture_segment_path(path, segment);
+	fd = open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (fd < 0) {
+		log_error(LOG_MODULE_XBEE, "Error creating capture segment %s: %s",
+			name.c_str(), strerror(errno));
+		return false;
+	}
+	if (ftruncate(fd, segment_size) < 0) {
+		log_error(LOG_MODULE_XBEE, "Error resizing capture segment %s: %s",
+			name.c_str(), strerror(errno));
+		close(fd);
+		fd = -1;
+		return false;
+	}
+	map = (uint8_t*) mmap(NULL, segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		log_error(LOG_MODULE_XBEE, "Error mapping capture segment %s: %s",
+			name.c_str(), strerror(errno));
+		map = NULL;
+		close(fd);
+		fd = -1;
+		return false;
+	}
+
+	XBee_Capture_Header header;
+	memcpy(header.magic, XBEE_CAPTURE_MAGIC, sizeof(header.magic));
+	header.segment = segment;
+	header.reserved = 0;
+	header.start_mono_ns = start_mono_ns;
+	header.start_real_ns = start_real_ns;
+	memcpy(map, &header, sizeof(header));
+	used = sizeof(header);
+	segment++;
+	stats.segments++;
+	return true;
+}
+
+/* truncates the current segment to its used size and unmaps it */
+void XBee_Capture::close_segment() {
+	if (!map)
+		return;
+	munmap(map, segment_size);
+	if (ftruncate(fd, used) < 0)
+		log_error(LOG_MODULE_XBEE, "Error truncating capture segment: %s",
+			strerror(errno));
+	close(fd);
+	map = NULL;
+	fd = -1;
+}
+
+bool XBee_Capture::append(const uint8_t *frame, uint16_t length) {
+	XBee_Capture_Record record;
+	uint32_t record_len = sizeof(record) + length;
+
+	if (!length || record_len > segment_size - sizeof(XBee_Capture_Header)) {
+		stats.errors++;
+		return false;
+	}
+	if (map && used + record_len > segment_size)
+		close_segment();
+	if (!map && !open_segment()) {
+		stats.errors++;
+		return false;
+	}
+
+	record.time_ns = now_ns(CLOCK_MONOTONIC);
+	record.length = length;
+	/* the length is written last, a reader stops at a length of 0 */
+	memcpy(&map[used + sizeof(record)], frame, length);
+	memcpy(&map[used], &record.time_ns, sizeof(record.time_ns));
+	__sync_synchronize();
+	memcpy(&map[used + sizeof(record.time_ns)], &record.length, sizeof(record.length));
+	used += record_len;
+	stats.frames++;
+	stats.bytes += record_len;
+	return true;
+}
+
+const XBee_Capture_Stats& XBee_Capture::get_stats() const {
+	return stats;
+}
+
+/** XBee_Capture_Reader Class implementation */
+/* constructor of XBee_Capture_Reader, counts the segments of the capture */
+XBee_Capture_Reader::XBee_Capture_Reader(const string &path) :
+	path(path),
+	segment(0),
+	segment_cnt(0),
+	start_mono_ns(0),
+	start_real_ns(0),
+	map(NULL),
+	map_size(0),
+	pos(0)
+{
+	while (access(xbee_capture_segment_path(path, segment_cnt).c_str(), R_OK) == 0)
+		segment_cnt++;
+}
+
+XBee_Capture_Reader::~XBee_Capture_Reader() {
+	close_segment();
+}
+
+/* maps a segment and checks its header */
+bool XBee_Capture_Reader::open_segment(uint32_t segment) {
+	string name = xbee_capture_segment_path(path, segment);
+	struct stat st;
+	XBee_Capture_Header header;
+
+	int fd = open(name.c_str(), O_RDONLY);
+	if (fd < 0) {
+		log_error(LOG_MODULE_XBEE, "Error opening capture segment %s: %s",
+			name.c_str(), strerror(errno));
+		return false;
+	}
+	if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(header)) {
+		log_error(LOG_MODULE_XBEE, "Capture segment %s is too short", name.c_str());
+		close(fd);
+		return false;
+	}
+	map = (uint8_t*) mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		log_error(LOG_MODULE_XBEE, "Error mapping capture segment %s: %s",
+			name.c_str(), strerror(errno));
+		map = NULL;
+		return false;
+	}
+	map_size = st.st_size;
+
+	memcpy(&header, map, sizeof(header));
+	if (memcmp(header.magic, XBEE_CAPTURE_MAGIC, sizeof(header.magic))) {
+		log_error(LOG_MODULE_XBEE, "%s is not a capture segment", name.c_str());
+		close_segment();
+		return false;
+	}
+	start_mono_ns = header.start_mono_ns;
+	start_real_ns = header.start_real_ns;
+	pos = sizeof(header);
+	return true;
+}
+
+void XBee_Capture_Reader::close_segment() {
+	if (map)
+		munmap(map, map_size);
+	map = NULL;
+	map_size = 0;
+	pos = 0;
+}
+
+bool XBee_Capture_Reader::next_frame(XBee_Frame *frame, uint64_t *time_ns) {
+	XBee_Capture_Record record;
+
+	while (1) {
+		if (!map) {
+			/* segments that can't be read are skipped */
+			while (segment < segment_cnt && !open_segment(segment))
+				segment++;
+			if (segment >= segment_cnt)
+				return false;
+			segment++;
+		}
+		if (pos + sizeof(record) <= map_size) {
+			memcpy(&record, &map[pos], sizeof(record));
+			if (record.length && pos + sizeof(record) + record.length <= map_size)
+				break;
+		}
+		/* end of the segment */
+		close_segment();
+	}
+
+	frame->data = &map[pos + sizeof(record)];
+	frame->length = record.length;
+	*time_ns = record.time_ns;
+	pos += sizeof(record) + record.length;
+	return true;
+}
+
+uint64_t XBee_Capture_Reader::get_real_time_ns(uint64_t time_ns) const {
+	return start_real_ns + (time_ns - start_mono_ns);
+}
+
+uint32_t XBee_Capture_Reader::get_segment_cnt() const {
+	return segment_cnt;
+}
@@ -0,0 +1,123 @@
+/* This file is part of Equine Monitor
+ *
+ * Equine Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Equine Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Equine Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Konke Radlow <koradlow@gmail.com>
+ */
+
+#ifndef XBEE_CAPTURE
+#define XBEE_CAPTURE
+
+#include "xbee_frame_parser.h"
+#include <inttypes.h>
+#include <string>
+
+/* default size of a capture segment file */
+#define XBEE_CAPTURE_SEGMENT_SIZE (16 * 1024 * 1024)
+#define XBEE_CAPTURE_MAGIC "XBEECAP1"
+
+/* layout of a capture segment file. Each segment starts with a header,
+ * followed by the records. A record is the receive time and the length of
+ * a frame, followed by the frame data (starting with the API identifier).
+ * The unused end of a segment is zero, a record with length 0 ends it.
+ * The segments of a capture are numbered: <path>.000000, <path>.000001, .. */
+typedef struct __attribute__((packed)) {
+	char magic[8];
+	uint32_t segment;	/* number of the segment */
+	uint32_t reserved;
+	uint64_t start_mono_ns;	/* CLOCK_MONOTONIC at the creation of the capture */
+	uint64_t start_real_ns;	/* CLOCK_REALTIME at the creation of the capture */
+} XBee_Capture_Header;
+
+typedef struct __attribute__((packed)) {
+	uint64_t time_ns;	/* CLOCK_MONOTONIC when the frame was received */
+	uint16_t length;
+} XBee_Capture_Record;
+
+/* counters of the capture */
+typedef struct {
+	uint32_t frames;
+	uint64_t bytes;		/* bytes of the records, including headers */
+	uint32_t segments;
+	uint32_t errors;	/* frames that couldn't be written */
+} XBee_Capture_Stats;
+
+/* appends received API frames to a capture. The current segment is created
+ * with its full size and memory mapped, so appending a frame is a copy into
+ * the mapping without a system call. If a frame doesn't fit into the
+ * segment, the segment is truncated to its used size and the next one is
+ * created */
+class XBee_Capture {
+public:
+	XBee_Capture(const std::string &path, uint32_t segment_size = XBEE_CAPTURE_SEGMENT_SIZE);
+	~XBee_Capture();
+
+	/* appends the frame with the current time, returns false on error */
+	bool append(const uint8_t *frame, uint16_t length);
+	/* closes the current segment, the next frame starts a new one */
+	void close_segment();
+
+	const XBee_Capture_Stats& get_stats() const;
+private:
+	XBee_Capture(const XBee_Capture&);
+	XBee_Capture& operator=(const XBee_Capture&);
+
+	bool open_segment();
+
+	const std::string path;
+	const uint32_t segment_size;
+	uint32_t segment;	/* number of the next segment */
+	uint64_t start_mono_ns;
+	uint64_t start_real_ns;
+	int fd;
+	uint8_t *map;
+	uint32_t used;
+	XBee_Capture_Stats stats;
+};
+
+/* reads the frames of a capture, segment by segment. The segments are
+ * memory mapped, the returned frames are views into the mapping and stay
+ * valid until the next call of next_frame() */
+class XBee_Capture_Reader {
+public:
+	XBee_Capture_Reader(const std::string &path);
+	~XBee_Capture_Reader();
+
+	/* returns the next frame and its receive time (CLOCK_MONOTONIC of the
+	 * capture), returns false at the end of the capture */
+	bool next_frame(XBee_Frame *frame, uint64_t *time_ns);
+	/* converts a receive time into the wall clock time of the capture */
+	uint64_t get_real_time_ns(uint64_t time_ns) const;
+	uint32_t get_segment_cnt() const;
+private:
+	XBee_Capture_Reader(const XBee_Capture_Reader&);
+	XBee_Capture_Reader& operator=(const XBee_Capture_Reader&);
+
+	bool open_segment(uint32_t segment);
+	void close_segment();
+
+	const std::string path;
+	uint32_t segment;
+	uint32_t segment_cnt;
+	uint64_t start_mono_ns;
+	uint64_t start_real_ns;
+	uint8_t *map;
+	size_t map_size;
+	size_t pos;
+};
+
+/* returns the name of a segment file of the capture */
+std::string xbee_capture_segment_path(const std::string &path, uint32_t segment);
+
+#endif
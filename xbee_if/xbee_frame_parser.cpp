@@ -0,0 +1,226 @@
+/* This file is part of Equine Monitor
+ *
+ * Equine Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Equine Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Equine Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Konke Radlow <koradlow@gmail.com>
+ */
+
+#include "xbee_frame_parser.h"
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+/** XBee_Frame_Parser Class implementation */
+/* constructor of XBee_Frame_Parser, allocates slot_cnt slots, that can hold
+ * frames with a length of max_frame_len bytes. One slot is always kept free
+ * for the frame that is currently received */
+XBee_Frame_Parser::XBee_Frame_Parser(uint16_t max_frame_len, uint16_t slot_cnt, bool escaped) :
+	max_frame_len(max_frame_len),
+	slot_cnt(slot_cnt < 2 ? 2 : slot_cnt),
+	escaped(escaped),
+	read_idx(0),
+	write_idx(0),
+	frame_out(false),
+	pending_bytes(0),
+	state(WAIT_DELIMITER),
+	escape_next(false),
+	discard(false),
+	frame_len(0),
+	frame_pos(0),
+	frame_sum(0),
+	frame_data(NULL),
+	backlog_pos(0),
+	backlog_len(0)
+{
+	/* keep the slots 8 byte aligned, the frame data is accessed through
+	 * the libgbee frame structures */
+	slot_size = (max_frame_len + 7) & ~7;
+	slots = new uint8_t[this->slot_cnt * slot_size];
+	slot_len = new uint16_t[this->slot_cnt];
+	memset(&stats, 0, sizeof(stats));
+}
+
+XBee_Frame_Parser::~XBee_Frame_Parser() {
+	delete[] slots;
+	delete[] slot_len;
+}
+
+ssize_t XBee_Frame_Parser::read_from(int fd) {
+	/* the chunk is only reused once it was parsed completely */
+	parse_backlog();
+	if (backlog_pos < backlog_len)
+		return backlog_len - backlog_pos;
+
+	ssize_t bytes_read = read(fd, chunk, sizeof(chunk));
+	if (bytes_read < 0)
+		return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+
+	stats.reads++;
+	stats.bytes += bytes_read;
+	backlog_len = bytes_read;
+	backlog_pos = feed(chunk, bytes_read);
+	return bytes_read;
+}
+
+/* parses the rest of the chunk, as far as the slots allow */
+void XBee_Frame_Parser::parse_backlog() {
+	if (backlog_pos < backlog_len)
+		backlog_pos += feed(&chunk[backlog_pos], backlog_len - backlog_pos);
+}
+
+/* returns true if no slot is left for the next frame, the slot after the
+ * buffered frames is the one that is filled */
+bool XBee_Frame_Parser::slots_full() const {
+	return write_idx - read_idx >= (uint32_t)slot_cnt - 1;
+}
+
+/* runs the bytes through the frame state machine. In escaped mode an
+ * escaped byte is restored before it's processed, and an unescaped
+ * delimiter always starts a new frame (the current frame is incomplete).
+ * Parsing stops after a frame that filled the last free slot */
+size_t XBee_Frame_Parser::feed(const uint8_t *data, size_t length) {
+	const uint8_t *start = data;
+	const uint8_t *end = data + length;
+
+	while (data < end) {
+		if (state == WAIT_DELIMITER && slots_full()) {
+			stats.stalls++;
+			break;
+		}
+		uint8_t byte = *data++;
+
+		if (escaped) {
+			if (byte == XBEE_FRAME_DELIMITER) {
+				if (state != WAIT_DELIMITER)
+					stats.framing_errors++;
+				escape_next = false;
+				state = LENGTH_MSB;
+				continue;
+			}
+			if (byte == XBEE_FRAME_ESCAPE) {
+				escape_next = true;
+				continue;
+			}
+			if (escape_next) {
+				byte ^= XBEE_FRAME_ESCAPE_XOR;
+				escape_next = false;
+			}
+		}
+
+		switch (state) {
+		case WAIT_DELIMITER:
+			if (byte == XBEE_FRAME_DELIMITER)
+				state = LENGTH_MSB;
+			break;
+		case LENGTH_MSB:
+			frame_len = byte << 8;
+			state = LENGTH_LSB;
+			break;
+		case LENGTH_LSB:
+			frame_len |= byte;
+			start_frame();
+			break;
+		case FRAME_DATA:
+			frame_sum += byte;
+			if (!discard)
+				frame_data[frame_pos] = byte;
+			frame_pos++;
+			/* copy the following plain bytes of the frame without going
+			 * through the state machine for each byte */
+			while (frame_pos < frame_len && data < end) {
+				byte = *data;
+				if (escaped && (byte == XBEE_FRAME_DELIMITER || byte == XBEE_FRAME_ESCAPE))
+					break;
+				frame_sum += byte;
+				if (!discard)
+					frame_data[frame_pos] = byte;
+				frame_pos++;
+				data++;
+			}
+			if (frame_pos == frame_len)
+				state = CHECKSUM;
+			break;
+		case CHECKSUM:
+			end_frame(byte);
+			break;
+		}
+	}
+	return data - start;
+}
+
+/* prepares the free slot for the frame, whose length was just received */
+void XBee_Frame_Parser::start_frame() {
+	if (frame_len == 0) {
+		stats.framing_errors++;
+		state = WAIT_DELIMITER;
+		return;
+	}
+	/* frames that don't fit into a slot are parsed, but not stored */
+	discard = frame_len > max_frame_len;
+	frame_data = &slots[(write_idx % slot_cnt) * slot_size];
+	frame_pos = 0;
+	frame_sum = 0;
+	state = FRAME_DATA;
+}
+
+/* validates the checksum of the received frame and makes it available, the
+ * sum of the frame data and the checksum has to be 0xFF */
+void XBee_Frame_Parser::end_frame(uint8_t checksum) {
+	state = WAIT_DELIMITER;
+
+	if ((uint8_t)(frame_sum + checksum) != 0xFF) {
+		stats.checksum_errors++;
+		return;
+	}
+	if (discard) {
+		stats.framing_errors++;
+		return;
+	}
+	slot_len[write_idx % slot_cnt] = frame_len;
+	write_idx++;
+	pending_bytes += frame_len;
+	stats.frames++;
+}
+
+bool XBee_Frame_Parser::next_frame(XBee_Frame *frame) {
+	/* release the frame that was handed out before */
+	if (frame_out) {
+		read_idx++;
+		frame_out = false;
+		parse_backlog();
+	}
+	if (read_idx == write_idx)
+		return false;
+
+	frame->data = &slots[(read_idx % slot_cnt) * slot_size];
+	frame->length = slot_len[read_idx % slot_cnt];
+	pending_bytes -= frame->length;
+	frame_out = true;
+	return true;
+}
+
+/* returns the number of complete frames that were not handed out yet */
+uint16_t XBee_Frame_Parser::get_pending_cnt() const {
+	return write_idx - read_idx - (frame_out ? 1 : 0);
+}
+
+/* returns the number of frame data bytes that were not handed out yet, and
+ * the bytes of the chunk that were not parsed yet */
+uint32_t XBee_Frame_Parser::get_pending_bytes() const {
+	return pending_bytes + backlog_len - backlog_pos;
+}
+
+const XBee_Frame_Parser_Stats& XBee_Frame_Parser::get_stats() const {
+	return stats;
+}
@@ -0,0 +1,132 @@
+/* This file is part of Equine Monitor
+ *
+ * Equine Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Equine Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Equine Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Konke Radlow <koradlow@gmail.com>
+ */
+
+#ifndef XBEE_FRAME_PARSER
+#define XBEE_FRAME_PARSER
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/* special bytes of the XBee API frame format */
+#define XBEE_FRAME_DELIMITER 0x7E
+#define XBEE_FRAME_ESCAPE 0x7D
+#define XBEE_FRAME_XON 0x11
+#define XBEE_FRAME_XOFF 0x13
+#define XBEE_FRAME_ESCAPE_XOR 0x20
+/* number of bytes that are read from the serial device at once */
+#define XBEE_FRAME_READ_CHUNK 1024
+/* default number of parsed frames that can be buffered */
+#define XBEE_FRAME_SLOTS 32
+/* escaped API mode (AP=2) of the device */
+#define XBEE_API_ESCAPED false
+
+/* view on a parsed frame. data points to the frame data (starting with the
+ * API identifier) without delimiter, length, escaping and checksum. The
+ * layout matches the libgbee frame structures */
+typedef struct {
+	const uint8_t *data;
+	uint16_t length;
+} XBee_Frame;
+
+/* counters of the frame parser */
+typedef struct {
+	uint32_t frames;		/* frames with a valid checksum */
+	uint32_t checksum_errors;	/* frames with a wrong checksum */
+	uint32_t framing_errors;	/* frames that were interrupted or too long */
+	uint32_t stalls;		/* parses that stopped because all slots were full */
+	uint64_t bytes;			/* bytes that were read from the device */
+	uint32_t reads;			/* read calls on the device */
+} XBee_Frame_Parser_Stats;
+
+/* incremental parser for XBee API frames. The bytes are read from the serial
+ * device in chunks of whatever is available, and decoded byte by byte into
+ * a ring of preallocated frame slots, so frames can be split across reads
+ * and several frames can arrive in one read. Escaping (API mode 2) and the
+ * checksum are handled while the bytes are copied, complete frames are
+ * handed out as views into their slot without copying them again.
+ * If all slots are full the parser stops at the end of a frame, the rest of
+ * the chunk is parsed when next_frame() released a slot. No frame is lost,
+ * the device buffers the following bytes in the meantime.
+ * A frame returned by next_frame() stays valid until the next call of
+ * next_frame() */
+class XBee_Frame_Parser {
+public:
+	XBee_Frame_Parser(uint16_t max_frame_len, uint16_t slot_cnt = XBEE_FRAME_SLOTS,
+		bool escaped = XBEE_API_ESCAPED);
+	~XBee_Frame_Parser();
+
+	/* reads the available bytes (at most one chunk) from the file descriptor
+	 * and parses them, returns the number of bytes read or -1 on error. If
+	 * bytes of the last chunk were not parsed yet nothing is read, and their
+	 * number is returned */
+	ssize_t read_from(int fd);
+	/* parses the given bytes, returns the number of parsed bytes. It is
+	 * less than length if all slots are full */
+	size_t feed(const uint8_t *data, size_t length);
+	/* returns the next complete frame and releases the previous one,
+	 * returns false if no complete frame is buffered */
+	bool next_frame(XBee_Frame *frame);
+
+	uint16_t get_pending_cnt() const;
+	uint32_t get_pending_bytes() const;
+	const XBee_Frame_Parser_Stats& get_stats() const;
+private:
+	XBee_Frame_Parser(const XBee_Frame_Parser&);
+	XBee_Frame_Parser& operator=(const XBee_Frame_Parser&);
+
+	typedef enum {
+		WAIT_DELIMITER,
+		LENGTH_MSB,
+		LENGTH_LSB,
+		FRAME_DATA,
+		CHECKSUM
+	} State;
+
+	void start_frame();
+	void end_frame(uint8_t checksum);
+	bool slots_full() const;
+	void parse_backlog();
+
+	const uint16_t max_frame_len;
+	const uint16_t slot_cnt;
+	const bool escaped;
+	size_t slot_size;
+	uint8_t *slots;
+	uint16_t *slot_len;
+	uint32_t read_idx;	/* oldest buffered frame */
+	uint32_t write_idx;	/* slot that is currently filled */
+	bool frame_out;		/* frame at read_idx was handed out */
+	uint32_t pending_bytes;
+
+	State state;
+	bool escape_next;
+	bool discard;		/* current frame is too long, skip it */
+	uint16_t frame_len;
+	uint16_t frame_pos;
+	uint8_t frame_sum;
+	uint8_t *frame_data;
+
+	uint8_t chunk[XBEE_FRAME_READ_CHUNK];
+	/* bytes of the chunk that were not parsed because all slots were full */
+	uint16_t backlog_pos;
+	uint16_t backlog_len;
+	XBee_Frame_Parser_Stats stats;
+};
+
+#endif
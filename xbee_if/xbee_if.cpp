@@ -17,11 +17,16 @@
  */
 
 #include "xbee_if.h"
-#include "debug_output_control.h"
+#include "logger.h"
+#include "messagestorage.h"
 #include <gbee.h>
 #include <gbee-util.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
+#include <poll.h>
+#include <errno.h>
+#include <time.h>
+#include <utility>
 
 using std::string;
 
@@ -81,13 +86,25 @@ XBee_Address::XBee_Address(const string &node, const uint8_t *payload) :
  /* TODO: find a good way to set baud rate for xbees */
 XBee_Config::XBee_Config(const string &port, const string &node, bool mode,
 			const uint8_t *pan, uint32_t timeout,
-			xbee_baud_rate baud, uint8_t max_unicast_hops):
+			xbee_baud_rate baud, uint8_t max_unicast_hops,
+			uint16_t reassembly_slots, uint32_t reassembly_timeout_ms,
+			uint8_t tx_window, uint16_t address_cache_size,
+			uint32_t address_cache_ttl_ms, uint16_t message_pool_size,
+			uint8_t header_version, uint32_t nack_delay_ms):
 		serial_port(port),
 		node(node),
 		coordinator_mode(mode),
 		timeout(timeout),
 		baud(baud),
-		max_unicast_hops(max_unicast_hops)
+		max_unicast_hops(max_unicast_hops),
+		reassembly_slots(reassembly_slots ? reassembly_slots : 1),
+		reassembly_timeout_ms(reassembly_timeout_ms),
+		tx_window(tx_window ? tx_window : 1),
+		address_cache_size(address_cache_size ? address_cache_size : 1),
+		address_cache_ttl_ms(address_cache_ttl_ms),
+		message_pool_size(message_pool_size),
+		header_version(header_version),
+		nack_delay_ms(nack_delay_ms)
 {
 	memcpy(pan_id, pan, 8);
 }
@@ -189,18 +206,23 @@ void XBee_At_Command::append_data(const uint8_t *new_data, uint8_t cmd_length, u
 
 /** XBee_Message Class implementation */
 /* constructor for a XBee message - used to create messages for transmission */
-// TODO: Make message part in Header 2 bytes long
 XBee_Message::XBee_Message(const XBee_Address &addr, const uint8_t *msg_payload, uint16_t msg_length):
 		address(addr),
 		payload_len(msg_length),
+		payload_capacity(msg_length),
 		message_part(1),	/* message part numbers start with 1 */
-		message_complete(true)	/* messages created by this constructor
+		sequence(0),
+		sequence_set(false),
+		header_version(MSG_HEADER_V1),
+		message_complete(true),	/* messages created by this constructor
 					 * are complete at construction time */
+		pool(NULL),
+		receive_us(0),
+		trace(NULL)
 {
-	/* calculate the number of parts required to transmit this message */
+	/* calculate the number of parts required to transmit this message,
+	 * the limit depends on the header version and is checked when sending */
 	message_part_cnt = payload_len / (XBEE_MSG_LENGTH - MSG_HEADER_LENGTH) + 1;
-	if (message_part_cnt > 255)
-		module_debug_xbee("Error: Message size > 20kB not supported\n");
 	/* allocate memory to copy the payload into the object */
 	payload = new uint8_t[payload_len];
 	if (msg_payload != NULL)
@@ -213,8 +235,15 @@ XBee_Message::XBee_Message(const XBee_Address &addr, const uint8_t *msg_payload,
 XBee_Message::XBee_Message(const GBeeRxPacket *message):
 		message_buffer(NULL),	/* this message type will not use the buffer */
 		payload_len(message->data[MSG_PAYLOAD_LENGTH]),
+		payload_capacity(payload_len),
 		message_part(message->data[MSG_PART]),
-		message_part_cnt(message->data[MSG_PART_CNT])
+		message_part_cnt(message->data[MSG_PART_CNT]),
+		sequence(message->data[MSG_SEQUENCE]),
+		sequence_set(true),
+		header_version(MSG_HEADER_V1),
+		pool(NULL),
+		receive_us(0),
+		trace(NULL)
 {
 	/* deserialize the source address */
 	address = XBee_Address(message);
@@ -237,9 +266,16 @@ XBee_Message::XBee_Message():
 	message_buffer(NULL),
 	payload(NULL),
 	payload_len(0),
+	payload_capacity(0),
 	message_part(0),
 	message_part_cnt(0),
-	message_complete(false)
+	sequence(0),
+	sequence_set(false),
+	header_version(MSG_HEADER_V1),
+	message_complete(false),
+	pool(NULL),
+	receive_us(0),
+	trace(NULL)
 {}
 
 /* copy constructor, performs a deep copy */
@@ -247,9 +283,16 @@ XBee_Message::XBee_Message(const XBee_Message& msg) :
 	address(msg.address),
 	message_buffer(NULL),
 	payload_len(msg.payload_len),
+	payload_capacity(msg.payload_len),
 	message_part(msg.message_part),
 	message_part_cnt(msg.message_part_cnt),
-	message_complete(msg.message_complete)
+	sequence(msg.sequence),
+	sequence_set(msg.sequence_set),
+	header_version(msg.header_version),
+	message_complete(msg.message_complete),
+	pool(NULL),	/* the copy is not part of the pool */
+	receive_us(msg.receive_us),
+	trace(NULL)	/* the trace stays with the original message */
 {
 	/* allocate memory space for the payload and copy the data from msg */
 	payload = new uint8_t[payload_len];
@@ -262,18 +305,22 @@ XBee_Message::XBee_Message(const XBee_Message& msg) :
 
 /* assignment operator, performs deep copy for pointer members */
 XBee_Message& XBee_Message::operator=(const XBee_Message& msg) {
+	if (this == &msg)
+		return *this;
 	address = msg.address;
 	payload_len = msg.payload_len;
+	payload_capacity = msg.payload_len;
 	message_part = msg.message_part;
 	message_part_cnt = msg.message_part_cnt;
+	sequence = msg.sequence;
+	sequence_set = msg.sequence_set;
+	header_version = msg.header_version;
 	message_complete = msg.message_complete;
+	receive_us = msg.receive_us;
 
 	/* take care of pointer members */
 	/* if memory was allocated in the object, free the memory */
-	if (payload)
-		delete[] payload;
-	if (message_buffer)
-		delete[] message_buffer;
+	release();
 
 	/* allocate memory space for the payload and copy the data from msg */
 	payload = new uint8_t[payload_len];
@@ -286,11 +333,69 @@ XBee_Message& XBee_Message::operator=(const XBee_Message& msg) {
 	return *this;
 }
 
+/* move constructor, takes over the buffers of msg and leaves it empty */
+XBee_Message::XBee_Message(XBee_Message&& msg) noexcept :
+	address(std::move(msg.address)),
+	message_buffer(msg.message_buffer),
+	payload(msg.payload),
+	payload_len(msg.payload_len),
+	payload_capacity(msg.payload_capacity),
+	message_part(msg.message_part),
+	message_part_cnt(msg.message_part_cnt),
+	sequence(msg.sequence),
+	sequence_set(msg.sequence_set),
+	header_version(msg.header_version),
+	message_complete(msg.message_complete),
+	pool(NULL),	/* the copy is not part of the pool */
+	receive_us(msg.receive_us),
+	trace(msg.trace)
+{
+	msg.trace = NULL;
+	msg.message_buffer = NULL;
+	msg.payload = NULL;
+	msg.payload_len = 0;
+	msg.payload_capacity = 0;
+}
+
+/* move assignment operator, frees the own buffers and takes over the
+ * buffers of msg */
+XBee_Message& XBee_Message::operator=(XBee_Message&& msg) noexcept {
+	if (this == &msg)
+		return *this;
+	release();
+	address = std::move(msg.address);
+	message_buffer = msg.message_buffer;
+	payload = msg.payload;
+	payload_len = msg.payload_len;
+	payload_capacity = msg.payload_capacity;
+	message_part = msg.message_part;
+	message_part_cnt = msg.message_part_cnt;
+	sequence = msg.sequence;
+	sequence_set = msg.sequence_set;
+	header_version = msg.header_version;
+	message_complete = msg.message_complete;
+	receive_us = msg.receive_us;
+	trace = msg.trace;
+	msg.trace = NULL;
+	msg.message_buffer = NULL;
+	msg.payload = NULL;
+	msg.payload_len = 0;
+	msg.payload_capacity = 0;
+	return *this;
+}
+
 XBee_Message::~XBee_Message() {
+	release();
+}
+
+/* frees the payload and the message buffer */
+void XBee_Message::release() {
 	if (payload)
 		delete[] payload;
 	if (message_buffer)
 		delete[] message_buffer;
+	payload = NULL;
+	message_buffer = NULL;
 }
 
 const XBee_Address& XBee_Message::get_address() const {
@@ -306,54 +411,109 @@ bool XBee_Message::is_complete() const {
 	return message_complete;
 }
 
+uint8_t XBee_Message::get_sequence() const {
+	return sequence;
+}
+
+void XBee_Message::set_sequence(uint8_t sequence) {
+	this->sequence = sequence;
+	sequence_set = true;
+}
+
+uint8_t XBee_Message::get_header_version() const {
+	return header_version;
+}
+
+/* the version 2 header is longer, the parts carry less payload */
+void XBee_Message::set_header_version(uint8_t version) {
+	header_version = version;
+	message_part_cnt = payload_len / get_part_payload_len() + 1;
+}
+
+uint16_t XBee_Message::get_header_len() const {
+	return header_version == MSG_HEADER_V2 ? MSG_V2_HEADER_LENGTH : MSG_HEADER_LENGTH;
+}
+
+uint16_t XBee_Message::get_part_payload_len() const {
+	return XBEE_MSG_LENGTH - get_header_len();
+}
+
+int64_t XBee_Message::get_receive_time_us() const {
+	return receive_us;
+}
+
+Message_Trace* XBee_Message::get_trace() const {
+	return trace;
+}
+
+void XBee_Message::set_trace(Message_Trace *trace) {
+	this->trace = trace;
+}
+
 /* reconstructs messages that consist of multiple parts, returns true if
  * the message was successfully appended and false, if the operation failed
  * due to failed validity check */
 bool XBee_Message::append_msg(const XBee_Message &msg) {
-	uint8_t *new_payload;
-	uint16_t new_payload_len;
+	return append_part(msg.address, msg.message_part, msg.message_part_cnt,
+		msg.sequence, msg.payload, msg.payload_len);
+}
 
+/* appends a received part, the header and payload are taken directly from
+ * the frame */
+bool XBee_Message::append_msg(const GBeeRxPacket *msg) {
+	return append_part(XBee_Address(msg), msg->data[MSG_PART], msg->data[MSG_PART_CNT],
+		msg->data[MSG_SEQUENCE], &msg->data[MSG_HEADER_LENGTH], msg->data[MSG_PAYLOAD_LENGTH]);
+}
+
+/* copies the payload of a part to its position in the message. The payload
+ * buffer is allocated once, with the first part: all parts except the last
+ * one are full, so the part count of the header gives the maximal length
+ * of the message */
+bool XBee_Message::append_part(const XBee_Address &addr, uint8_t part, uint8_t part_cnt,
+		uint8_t sequence, const uint8_t *part_payload, uint16_t part_len) {
 	/* check if it's possible to append the given message */
 	// TODO: Compare addresses, only possible if they are equal
-	if (msg.message_part != message_part+1)
+	if (part != message_part+1 || part > part_cnt || part_len > MSG_PART_PAYLOAD_LENGTH)
 		return false;
 
 	/* if it's the first part of a message, copy the total part count
 	 * and the source address */
-	if (msg.message_part == 1) {
-		message_part_cnt = msg.message_part_cnt;
-		address = msg.address;
+	if (part == 1) {
+		message_part_cnt = part_cnt;
+		this->sequence = sequence;
+		sequence_set = true;
+		address = addr;
+		payload_len = 0;
+	}
+	/* allocate the buffer for the whole message, this is only required for
+	 * the first part or if the message was created from a single part */
+	if (payload_len + part_len > payload_capacity) {
+		uint16_t capacity = message_part_cnt * MSG_PART_PAYLOAD_LENGTH;
+		if (payload_len + part_len > capacity)
+			return false;
+		uint8_t *new_payload = new uint8_t[capacity];
+		if (payload_len)
+			memcpy(new_payload, payload, payload_len);
+		if (payload)
+			delete[] payload;
+		payload = new_payload;
+		payload_capacity = capacity;
 	}
-	/* given message passed validity check -> allocate memory */
-	new_payload_len = payload_len + msg.payload_len;
-	new_payload = new uint8_t[new_payload_len];
-
-	/* copy the existing payload into the new memory space */
-	memcpy(new_payload, payload, payload_len);
-	/* append the new payload to the memory */
-	memcpy(&new_payload[payload_len], msg.payload, msg.payload_len);
 
-	/* update internal variables to match new data */
-	if (payload)
-		delete[] payload;
-	payload = new_payload;
-	payload_len += msg.payload_len;
+	/* append the new payload in place */
+	memcpy(&payload[payload_len], part_payload, part_len);
+	payload_len += part_len;
 	message_part += 1;
 
 	/* determine if the message is complete */
 	if (message_part == message_part_cnt) {
-		module_debug_xbee("Complete message received \n");
+		log_debug(LOG_MODULE_XBEE, "Complete message received");
 		message_complete = true;
 	}
 
 	return true;
 }
 
-bool XBee_Message::append_msg(const GBeeRxPacket *msg) {
-	XBee_Message tmp_msg(msg);
-	return append_msg(tmp_msg);
-}
-
 /* returns a pointer to a message buffer that includes a header and a payload.
  * The message_buffer is constructed on the fly into a preallocated and fixed
  * memory space.
@@ -373,19 +533,31 @@ uint8_t* XBee_Message::get_msg(uint16_t part = 1) {
 
 	if (message_part_cnt > 1) {
 		/* calculate the length of the payload in last message part */
-		overhead_len = length - (message_part_cnt - 1) * (XBEE_MSG_LENGTH - MSG_HEADER_LENGTH);
+		overhead_len = length - (message_part_cnt - 1) * get_part_payload_len();
 		/* payload length depends on the part number of the message ->
 		 * last message part is an exception */
-		length = (part == message_part_cnt)? overhead_len : (XBEE_MSG_LENGTH - MSG_HEADER_LENGTH);
+		length = (part == message_part_cnt)? overhead_len : get_part_payload_len();
 		/* offset in the payload data based on message part */
-		offset = (part - 1) * (XBEE_MSG_LENGTH - MSG_HEADER_LENGTH);
+		offset = (part - 1) * get_part_payload_len();
 	}
 	/* create the header of the message */
-	message_buffer[MSG_PART] = part;
-	message_buffer[MSG_PART_CNT] = message_part_cnt;
-	message_buffer[MSG_PAYLOAD_LENGTH] = length;
+	if (header_version == MSG_HEADER_V2) {
+		message_buffer[MSG_PART] = MSG_V2_MARKER;
+		message_buffer[MSG_V2_VERSION] = MSG_HEADER_V2;
+		message_buffer[MSG_V2_PART] = part >> 8;
+		message_buffer[MSG_V2_PART + 1] = part & 0xFF;
+		message_buffer[MSG_V2_PART_CNT] = message_part_cnt >> 8;
+		message_buffer[MSG_V2_PART_CNT + 1] = message_part_cnt & 0xFF;
+		message_buffer[MSG_V2_SEQUENCE] = sequence;
+		message_buffer[MSG_V2_PAYLOAD_LENGTH] = length;
+	} else {
+		message_buffer[MSG_PART] = part;
+		message_buffer[MSG_PART_CNT] = message_part_cnt;
+		message_buffer[MSG_SEQUENCE] = sequence;
+		message_buffer[MSG_PAYLOAD_LENGTH] = length;
+	}
 	/* copy payload into message body */
-	memcpy(&message_buffer[MSG_HEADER_LENGTH], &payload[offset], length);
+	memcpy(&message_buffer[get_header_len()], &payload[offset], length);
 
 	return message_buffer;
 }
@@ -399,7 +571,7 @@ uint16_t XBee_Message::get_msg_len(uint16_t part = 1) {
 
 	/* message consists of one part? */
 	if (message_part_cnt == 1)
-		return (MSG_HEADER_LENGTH + payload_len);
+		return (get_header_len() + payload_len);
 
 	/* message consists of multiple parts, part in the middle requested.
 	 * Parts in the middle always have the maximal possible message length
@@ -408,8 +580,8 @@ uint16_t XBee_Message::get_msg_len(uint16_t part = 1) {
 		return XBEE_MSG_LENGTH;
 
 	/* message consists of multiple parts, last part requested */
-	uint16_t transmitted_len = (message_part_cnt - 1) * (XBEE_MSG_LENGTH - MSG_HEADER_LENGTH);
-	return MSG_HEADER_LENGTH + payload_len - transmitted_len;
+	uint16_t transmitted_len = (message_part_cnt - 1) * get_part_payload_len();
+	return get_header_len() + payload_len - transmitted_len;
 }
 
 /* allocates memory in for the message buffer in a XBee_Message object.
@@ -427,24 +599,586 @@ uint8_t* XBee_Message::allocate_msg_buffer(uint16_t payload_len) {
 		 * single part will not be larger thatn the maximal msg lengh */
 		message_buffer = new uint8_t[XBEE_MSG_LENGTH];
 	} else {
-		/* message fits into one transmission */
-		message_buffer = new uint8_t[payload_len + MSG_HEADER_LENGTH];
+		/* message fits into one transmission, the header version can
+		 * be changed after construction */
+		message_buffer = new uint8_t[payload_len + MSG_V2_HEADER_LENGTH];
 	}
 
 	return message_buffer;
 }
 
+/** XBee_Message_Pool Class implementation */
+/* constructor of XBee_Message_Pool, allocates the messages. The payload
+ * buffers are allocated with the first messages that use them */
+XBee_Message_Pool::XBee_Message_Pool(uint16_t size) :
+	size(size)
+{
+	memset(&stats, 0, sizeof(stats));
+	free_msgs.reserve(size);
+	for (uint16_t i = 0; i < size; i++) {
+		XBee_Message *msg = new XBee_Message;
+		msg->pool = this;
+		free_msgs.push_back(msg);
+	}
+}
+
+/* frees the messages in the pool, messages that were not released yet are
+ * not owned by the pool */
+XBee_Message_Pool::~XBee_Message_Pool() {
+	for (size_t i = 0; i < free_msgs.size(); i++)
+		delete free_msgs[i];
+}
+
+XBee_Message* XBee_Message_Pool::acquire() {
+	XBee_Message *msg;
+	std::lock_guard<std::mutex> guard(lock);
+
+	stats.acquired++;
+	if (free_msgs.empty()) {
+		stats.heap_allocs++;
+		msg = new XBee_Message;
+		msg->pool = this;
+		return msg;
+	}
+	msg = free_msgs.back();
+	free_msgs.pop_back();
+	return msg;
+}
+
+XBee_Message* XBee_Message_Pool::acquire(const XBee_Address &address,
+		const uint8_t *payload, uint16_t length) {
+	XBee_Message *msg = acquire();
+
+	/* the buffer only grows, a message keeps it when it's released */
+	if (length > msg->payload_capacity) {
+		if (msg->payload)
+			delete[] msg->payload;
+		msg->payload = new uint8_t[length];
+		msg->payload_capacity = length;
+		std::lock_guard<std::mutex> guard(lock);
+		stats.buffer_allocs++;
+	}
+	memcpy(msg->payload, payload, length);
+	msg->address = address;
+	msg->payload_len = length;
+	msg->message_part = 1;
+	msg->message_part_cnt = length / MSG_PART_PAYLOAD_LENGTH + 1;
+	msg->message_complete = true;
+	return msg;
+}
+
+void XBee_Message_Pool::release(XBee_Message *msg) {
+	/* reset the message to the state of an empty message */
+	msg->payload_len = 0;
+	msg->message_part = 0;
+	msg->message_part_cnt = 0;
+	msg->sequence = 0;
+	msg->sequence_set = false;
+	msg->header_version = MSG_HEADER_V1;
+	msg->message_complete = false;
+	msg->receive_us = 0;
+	msg->trace = NULL;
+
+	std::lock_guard<std::mutex> guard(lock);
+	stats.released++;
+	if (free_msgs.size() >= size) {
+		delete msg;
+		return;
+	}
+	free_msgs.push_back(msg);
+}
+
+uint16_t XBee_Message_Pool::get_free_cnt() const {
+	std::lock_guard<std::mutex> guard(lock);
+	return free_msgs.size();
+}
+
+XBee_Message_Pool_Stats XBee_Message_Pool::get_stats() const {
+	std::lock_guard<std::mutex> guard(lock);
+	return stats;
+}
+
+void xbee_free_message(XBee_Message *msg) {
+	if (!msg)
+		return;
+	if (msg->pool)
+		msg->pool->release(msg);
+	else
+		delete msg;
+}
+
+/** XBee_Reassembly Class implementation */
+/* constructor of XBee_Reassembly, allocates the slots and the buffers for
+ * the maximal message size */
+XBee_Reassembly::XBee_Reassembly(uint16_t slot_cnt, uint32_t timeout_ms,
+		XBee_Message_Pool *pool, uint32_t nack_delay_ms) :
+	slot_cnt(slot_cnt),
+	timeout_ms(timeout_ms),
+	nack_delay_ms(nack_delay_ms),
+	pool(pool),
+	pending_cnt(0),
+	completed_cnt(0),
+	completed_next(0)
+{
+	memset(&stats, 0, sizeof(stats));
+	slots = new Slot[slot_cnt];
+	for (uint16_t i = 0; i < slot_cnt; i++) {
+		slots[i].used = false;
+		slots[i].buffer = new uint8_t[MSG_MAX_LENGTH];
+	}
+}
+
+XBee_Reassembly::~XBee_Reassembly() {
+	for (uint16_t i = 0; i < slot_cnt; i++)
+		delete[] slots[i].buffer;
+	delete[] slots;
+}
+
+/* returns a monotonic timestamp in milliseconds */
+uint32_t XBee_Reassembly::now_ms() {
+	return now_us() / 1000;
+}
+
+/* returns a monotonic timestamp in microseconds */
+int64_t XBee_Reassembly::now_us() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/* returns the slot of the message with the sequence number from addr64, or NULL */
+XBee_Reassembly::Slot* XBee_Reassembly::find_slot(uint64_t addr64, uint8_t sequence) {
+	for (uint16_t i = 0; i < slot_cnt; i++) {
+		if (slots[i].used && slots[i].sequence == sequence &&
+		    slots[i].address.get_addr64() == addr64)
+			return &slots[i];
+	}
+	return NULL;
+}
+
+/* returns an unused slot for a new message from addr64. The parts of version 1
+ * messages are sent in order, so the incomplete version 1 messages of the
+ * sender are discarded. If the sender already uses XBEE_REASSEMBLY_SLOTS_PER_SENDER
+ * slots its oldest message is discarded, and if all slots are in use the
+ * message that was not updated for the longest time */
+XBee_Reassembly::Slot* XBee_Reassembly::allocate_slot(uint64_t addr64, uint8_t version,
+		uint32_t now) {
+	Slot *unused = NULL;
+	Slot *oldest = NULL;
+	Slot *sender_oldest = NULL;
+	uint16_t sender_cnt = 0;
+
+	for (uint16_t i = 0; i < slot_cnt; i++) {
+		Slot *slot = &slots[i];
+		if (slot->used && slot->address.get_addr64() == addr64) {
+			if (version == MSG_HEADER_V1 && slot->version == MSG_HEADER_V1) {
+				log_warn(LOG_MODULE_XBEE, "Discarding incomplete message from %08x%08x",
+					slot->address.addr64h, slot->address.addr64l);
+				discard_message(slot);
+			} else {
+				sender_cnt++;
+				if (!sender_oldest ||
+				    now - slot->last_update_ms > now - sender_oldest->last_update_ms)
+					sender_oldest = slot;
+			}
+		}
+		if (!slot->used) {
+			if (!unused)
+				unused = slot;
+		} else if (!oldest || now - slot->last_update_ms > now - oldest->last_update_ms) {
+			oldest = slot;
+		}
+	}
+
+	if (sender_cnt >= XBEE_REASSEMBLY_SLOTS_PER_SENDER) {
+		log_warn(LOG_MODULE_XBEE, "Too many incomplete messages from %08x%08x, "
+			"discarding oldest message", sender_oldest->address.addr64h,
+			sender_oldest->address.addr64l);
+		stats.expired++;
+		return sender_oldest;
+	}
+	if (unused) {
+		pending_cnt++;
+		return unused;
+	}
+	log_warn(LOG_MODULE_XBEE, "Reassembly table full, discarding oldest message");
+	stats.expired++;
+	return oldest;
+}
+
+/* releases the slot of an incomplete message */
+void XBee_Reassembly::discard_message(Slot *slot) {
+	slot->used = false;
+	pending_cnt--;
+	stats.expired++;
+}
+
+/* returns true if the message with the sequence number from addr64 was
+ * completed within the timeout */
+bool XBee_Reassembly::recently_completed(uint64_t addr64, uint8_t sequence,
+		uint32_t now) const {
+	for (uint16_t i = 0; i < completed_cnt; i++) {
+		if (completed[i].addr64 == addr64 && completed[i].sequence == sequence &&
+		    now - completed[i].completed_ms < timeout_ms)
+			return true;
+	}
+	return false;
+}
+
+/* adds a completed message to the ring, the oldest entry is overwritten */
+void XBee_Reassembly::remember_completed(uint64_t addr64, uint8_t sequence, uint32_t now) {
+	completed[completed_next].addr64 = addr64;
+	completed[completed_next].sequence = sequence;
+	completed[completed_next].completed_ms = now;
+	completed_next = (completed_next + 1) % XBEE_REASSEMBLY_COMPLETED_CNT;
+	if (completed_cnt < XBEE_REASSEMBLY_COMPLETED_CNT)
+		completed_cnt++;
+}
+
+/* returns a complete message with a copy of the payload */
+XBee_Message* XBee_Reassembly::create_message(const XBee_Address &address,
+		const uint8_t *payload, uint16_t length, uint8_t sequence, int64_t receive_us) {
+	XBee_Message *msg;
+	if (pool)
+		msg = pool->acquire(address, payload, length);
+	else
+		msg = new XBee_Message(address, payload, length);
+	msg->sequence = sequence;
+	msg->sequence_set = true;
+	msg->receive_us = receive_us;
+	return msg;
+}
+
+/* resets the slot for a new message */
+void XBee_Reassembly::start_message(Slot *slot, const XBee_Address &address,
+		const Part_Header &header, int64_t now_us) {
+	slot->used = true;
+	slot->address = address;
+	slot->version = header.version;
+	slot->part_cnt = header.part_cnt;
+	slot->sequence = header.sequence;
+	slot->received_cnt = 0;
+	slot->last_part_len = 0;
+	slot->nack_cnt = 0;
+	slot->last_nack_ms = now_us / 1000;
+	slot->last_update_ms = now_us / 1000;
+	slot->first_part_us = now_us;
+	memset(slot->received, 0, sizeof(slot->received));
+}
+
+/* reads the header of a part, version 1 headers start with the part number
+ * (1..255) and version 2 headers with the marker 0. Returns false if the
+ * header is invalid or doesn't fit the length of the frame data */
+bool XBee_Reassembly::parse_header(const uint8_t *data, uint16_t length, Part_Header *header) {
+	if (length < MSG_HEADER_LENGTH)
+		return false;
+	if (data[MSG_PART] != MSG_V2_MARKER) {
+		header->version = MSG_HEADER_V1;
+		header->part = data[MSG_PART];
+		header->part_cnt = data[MSG_PART_CNT];
+		header->sequence = data[MSG_SEQUENCE];
+		header->payload_len = data[MSG_PAYLOAD_LENGTH];
+		header->header_len = MSG_HEADER_LENGTH;
+		header->part_payload_len = MSG_PART_PAYLOAD_LENGTH;
+	} else {
+		if (length < MSG_V2_HEADER_LENGTH || data[MSG_V2_VERSION] != MSG_HEADER_V2)
+			return false;
+		header->version = MSG_HEADER_V2;
+		header->part = (data[MSG_V2_PART] << 8) | data[MSG_V2_PART + 1];
+		header->part_cnt = (data[MSG_V2_PART_CNT] << 8) | data[MSG_V2_PART_CNT + 1];
+		header->sequence = data[MSG_V2_SEQUENCE];
+		header->payload_len = data[MSG_V2_PAYLOAD_LENGTH];
+		header->header_len = MSG_V2_HEADER_LENGTH;
+		header->part_payload_len = MSG_V2_PART_PAYLOAD_LENGTH;
+		if (header->part_cnt > MSG_V2_MAX_PART_CNT)
+			return false;
+	}
+	return header->header_len + header->payload_len <= length &&
+		header->part != 0 && header->part <= header->part_cnt &&
+		header->payload_len <= header->part_payload_len &&
+		(header->part == header->part_cnt ||
+		 header->payload_len == header->part_payload_len);
+}
+
+XBee_Message* XBee_Reassembly::add_part(const GBeeRxPacket *rx, uint16_t length) {
+	const uint8_t *data = rx->data;
+	Part_Header header;
+	XBee_Address address(rx);
+	/* the time of the first part is kept for the latency of the message */
+	int64_t receive_us = now_us();
+	uint32_t now = receive_us / 1000;
+
+	/* validate the header against the length of the received frame */
+	if (length < XBEE_RX_PACKET_OVERHEAD ||
+	    !parse_header(data, length - XBEE_RX_PACKET_OVERHEAD, &header)) {
+		log_warn(LOG_MODULE_XBEE, "Rejecting invalid message part with length %u", length);
+		stats.rejected++;
+		return NULL;
+	}
+	uint16_t part = header.part;
+
+	/* single part messages do not need to be reassembled */
+	if (header.part_cnt == 1) {
+		stats.completed++;
+		return create_message(address, &data[header.header_len], header.payload_len,
+			header.sequence, receive_us);
+	}
+
+	/* each part carries the sequence number of its message, a sender can
+	 * have several incomplete messages with a version 2 header */
+	Slot *slot = find_slot(address.get_addr64(), header.sequence);
+	if (slot && (slot->part_cnt != header.part_cnt || slot->version != header.version ||
+	    (header.version == MSG_HEADER_V1 && part == 1 && (slot->received[0] & 0x01)))) {
+		/* the sender reused the sequence number before the last
+		 * message with it was completed */
+		log_warn(LOG_MODULE_XBEE, "Discarding incomplete message from %08x%08x",
+			address.addr64h, address.addr64l);
+		stats.expired++;
+		start_message(slot, address, header, receive_us);
+	} else if (!slot) {
+		/* parts of version 2 messages can be sent again after the
+		 * message was completed, if the NACK crossed the missing part */
+		if (recently_completed(address.get_addr64(), header.sequence, now)) {
+			stats.rejected++;
+			return NULL;
+		}
+		slot = allocate_slot(address.get_addr64(), header.version, now);
+		start_message(slot, address, header, receive_us);
+	}
+
+	/* parts that were already received are ignored */
+	uint32_t bit = 1u << ((part - 1) % 32);
+	if (slot->received[(part - 1) / 32] & bit) {
+		stats.rejected++;
+		return NULL;
+	}
+	slot->received[(part - 1) / 32] |= bit;
+	slot->received_cnt++;
+	slot->last_update_ms = now;
+	slot->nack_cnt = 0;
+	/* the 16bit address of the sender might have changed */
+	slot->address = address;
+	if (part == header.part_cnt)
+		slot->last_part_len = header.payload_len;
+
+	/* copy the part to its final position in the buffer */
+	memcpy(&slot->buffer[(part - 1) * header.part_payload_len],
+		&data[header.header_len], header.payload_len);
+
+	if (slot->received_cnt < slot->part_cnt)
+		return NULL;
+
+	/* all parts received -> hand out the message and release the slot */
+	log_debug(LOG_MODULE_XBEE, "Complete message received");
+	uint16_t total_len = (slot->part_cnt - 1) * header.part_payload_len + slot->last_part_len;
+	XBee_Message *msg = create_message(slot->address, slot->buffer, total_len,
+		slot->sequence, slot->first_part_us);
+	slot->used = false;
+	pending_cnt--;
+	remember_completed(slot->address.get_addr64(), slot->sequence, now);
+	stats.completed++;
+	return msg;
+}
+
+void XBee_Reassembly::expire() {
+	uint32_t now = now_ms();
+	for (uint16_t i = 0; i < slot_cnt; i++) {
+		if (!slots[i].used || now - slots[i].last_update_ms < timeout_ms)
+			continue;
+		log_warn(LOG_MODULE_XBEE, "Incomplete message from %08x%08x timed out (%u of %u parts)",
+			slots[i].address.addr64h, slots[i].address.addr64l,
+			slots[i].received_cnt, slots[i].part_cnt);
+		discard_message(&slots[i]);
+	}
+}
+
+/* a NACK is due for a version 2 message if no part arrived for nack_delay_ms
+ * since the last part or NACK. The bitmap starts at the first missing part,
+ * parts that don't fit into it are requested by the next NACK */
+uint16_t XBee_Reassembly::collect_nacks(std::vector<XBee_Nack> &nacks) {
+	uint32_t now = now_ms();
+	uint16_t nack_cnt = 0;
+
+	if (!nack_delay_ms)
+		return 0;
+	for (uint16_t i = 0; i < slot_cnt; i++) {
+		Slot &slot = slots[i];
+		if (!slot.used || slot.version != MSG_HEADER_V2 ||
+		    slot.nack_cnt >= XBEE_NACK_RETRIES ||
+		    now - slot.last_update_ms < nack_delay_ms ||
+		    now - slot.last_nack_ms < nack_delay_ms)
+			continue;
+
+		XBee_Nack nack;
+		nack.address = slot.address;
+		nack.sequence = slot.sequence;
+		nack.first_part = 0;
+		nack.bitmap_len = 0;
+		memset(nack.bitmap, 0, sizeof(nack.bitmap));
+		for (uint16_t part = 1; part <= slot.part_cnt; part++) {
+			if (slot.received[(part - 1) / 32] & (1u << ((part - 1) % 32)))
+				continue;
+			if (!nack.first_part)
+				nack.first_part = part;
+			uint16_t index = part - nack.first_part;
+			if (index >= MSG_MAX_NACK_BITMAP * 8)
+				break;
+			nack.bitmap[index / 8] |= 1 << (index % 8);
+			nack.bitmap_len = index / 8 + 1;
+			stats.nacked_parts++;
+		}
+		slot.nack_cnt++;
+		slot.last_nack_ms = now;
+		stats.nacks++;
+		nacks.push_back(nack);
+		nack_cnt++;
+	}
+	return nack_cnt;
+}
+
+uint16_t XBee_Reassembly::get_pending_cnt() const {
+	return pending_cnt;
+}
+
+const XBee_Reassembly_Stats& XBee_Reassembly::get_stats() const {
+	return stats;
+}
+
+/** XBee_Address_Cache Class implementation */
+/* constructor of XBee_Address_Cache, allocates the entries for all addresses */
+XBee_Address_Cache::XBee_Address_Cache(uint16_t capacity, uint32_t ttl_ms) :
+	capacity(capacity ? capacity : 1),	/* insert() needs room for one entry */
+	ttl_ms(ttl_ms),
+	size(0),
+	use_seq(0)
+{
+	memset(&stats, 0, sizeof(stats));
+	entries = new Entry[this->capacity];
+	node_index.reserve(this->capacity);
+	addr64_index.reserve(this->capacity);
+}
+
+XBee_Address_Cache::~XBee_Address_Cache() {
+	delete[] entries;
+}
+
+/* returns a monotonic timestamp in milliseconds */
+uint32_t XBee_Address_Cache::now_ms() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+const XBee_Address* XBee_Address_Cache::find(const string &node) {
+	uint32_t now = now_ms();
+	std::unordered_map<string, uint16_t>::iterator it = node_index.find(node);
+	if (it == node_index.end()) {
+		stats.misses++;
+		return NULL;
+	}
+	Entry &entry = entries[it->second];
+	if (ttl_ms && now - entry.resolved_ms > ttl_ms) {
+		stats.expired++;
+		stats.misses++;
+		remove(it->second);
+		return NULL;
+	}
+	stats.hits++;
+	entry.used_seq = ++use_seq;
+	return &entry.address;
+}
+
+const XBee_Address* XBee_Address_Cache::insert(const XBee_Address &address) {
+	uint32_t now = now_ms();
+	std::unordered_map<string, uint16_t>::iterator it = node_index.find(address.node);
+	uint16_t index;
+
+	/* a node that was discovered again replaces its old entry, otherwise
+	 * the least recently used entry is replaced if the cache is full */
+	if (it != node_index.end()) {
+		remove(it->second);
+	} else if (size == capacity) {
+		uint16_t oldest = 0;
+		for (uint16_t i = 1; i < size; i++) {
+			if ((int32_t)(entries[i].used_seq - entries[oldest].used_seq) < 0)
+				oldest = i;
+		}
+		stats.evicted++;
+		remove(oldest);
+	}
+	/* a different node with the same 64bit address is outdated */
+	std::unordered_map<uint64_t, uint16_t>::iterator addr_it = addr64_index.find(address.get_addr64());
+	if (addr_it != addr64_index.end())
+		remove(addr_it->second);
+
+	index = size++;
+	entries[index].address = address;
+	entries[index].resolved_ms = now;
+	entries[index].used_seq = ++use_seq;
+	node_index[address.node] = index;
+	addr64_index[address.get_addr64()] = index;
+	return &entries[index].address;
+}
+
+void XBee_Address_Cache::update(uint64_t addr64, uint16_t addr16) {
+	std::unordered_map<uint64_t, uint16_t>::iterator it = addr64_index.find(addr64);
+	if (it == addr64_index.end())
+		return;
+	Entry &entry = entries[it->second];
+	if (entry.address.addr16 != addr16) {
+		log_info(LOG_MODULE_XBEE, "Node %s changed its address from %04x to %04x",
+			entry.address.node.c_str(), entry.address.addr16, addr16);
+		entry.address.addr16 = addr16;
+		stats.updated++;
+	}
+	/* the node is reachable with this address at the moment */
+	entry.resolved_ms = now_ms();
+}
+
+/* removes an entry, the last entry is moved into its place to keep the
+ * used entries continuous */
+void XBee_Address_Cache::remove(uint16_t index) {
+	uint16_t last = --size;
+	node_index.erase(entries[index].address.node);
+	addr64_index.erase(entries[index].address.get_addr64());
+	if (index != last) {
+		entries[index] = entries[last];
+		node_index[entries[index].address.node] = index;
+		addr64_index[entries[index].address.get_addr64()] = index;
+	}
+}
+
+uint16_t XBee_Address_Cache::get_size() const {
+	return size;
+}
+
+const XBee_Address_Cache_Stats& XBee_Address_Cache::get_stats() const {
+	return stats;
+}
+
 /** XBee Class implementation */
 XBee::XBee(XBee_Config& config) :
 	config(config),
-	address_cache_size(0)
-{}
+	address_cache(config.address_cache_size, config.address_cache_ttl_ms),
+	gbee_handle(NULL),
+	message_pool(config.message_pool_size),
+	reassembly(config.reassembly_slots, config.reassembly_timeout_ms, &message_pool,
+		config.nack_delay_ms),
+	frame_parser(sizeof(GBeeFrameData)),
+	tx_window(config.tx_window),
+	tx_frame_id(0),
+	capture(NULL)
+{
+	memset(&tx_stats, 0, sizeof(tx_stats));
+}
 
 XBee::~XBee() {
+	for (size_t i = 0; i < received.size(); i++)
+		xbee_free_message(received[i]);
+	for (size_t i = 0; i < retransmit_cache.size(); i++)
+		delete retransmit_cache[i];
 	if (gbee_handle)
 		gbeeDestroy(gbee_handle);
-	for (int i = 0; i < address_cache_size; i++)
-		delete address_cache[i];
 }
 
 /* the init function initializes the internally used libgbee library by creating
@@ -452,7 +1186,7 @@ XBee::~XBee() {
 uint8_t XBee::xbee_init() {
 	gbee_handle = gbeeCreate(config.serial_port.c_str());
 	if (!gbee_handle) {
-		module_debug_xbee("Error creating handle for XBee device\n");
+		log_error(LOG_MODULE_XBEE, "Error creating handle for XBee device");
 		return GBEE_RS232_ERROR;
 	}
 
@@ -473,7 +1207,7 @@ uint8_t XBee::xbee_configure_device() {
 	uint8_t error_code;
 	bool register_updated = false;
 
-	module_debug_xbee("Validating device configuration \n");
+	log_info(LOG_MODULE_XBEE, "Validating device configuration");
 
 	/* check the 64bit PAN ID */
 	XBee_At_Command cmd("ID");
@@ -481,7 +1215,7 @@ uint8_t XBee::xbee_configure_device() {
 	if (error_code != GBEE_NO_ERROR)
 		return error_code;
 	if (memcmp(cmd.data, config.pan_id, 8)) {
-		module_debug_xbee("Setting PAN ID\n");
+		log_info(LOG_MODULE_XBEE, "Setting PAN ID");
 		XBee_At_Command cmd_pan("ID", config.pan_id, 8);
 		xbee_send_at_command(cmd_pan);
 		register_updated = true;
@@ -493,7 +1227,7 @@ uint8_t XBee::xbee_configure_device() {
 	if (error_code != GBEE_NO_ERROR)
 		return error_code;
 	if (memcmp(cmd.data, config.node.c_str(), config.node.length())) {
-		module_debug_xbee("Setting Node Identifier\n");
+		log_info(LOG_MODULE_XBEE, "Setting Node Identifier");
 		XBee_At_Command cmd_ni("NI", config.node);
 		xbee_send_at_command(cmd_ni);
 		register_updated = true;
@@ -507,7 +1241,8 @@ uint8_t XBee::xbee_configure_device() {
 	/* NH returns 1 byte, with a range of 0x00 - 0xFF. Value defines the
 	 * unicast timeout: 50*NH + 100ms */
 	if (cmd.data[0] != config.max_unicast_hops) {
-		module_debug_xbee("Setting Unicast Hops from %02x to %02x\n",cmd.data[0], config.max_unicast_hops);
+		log_info(LOG_MODULE_XBEE, "Setting Unicast Hops from %02x to %02x", cmd.data[0],
+			config.max_unicast_hops);
 		XBee_At_Command cmd_nh("NH", &config.max_unicast_hops, 1);
 		xbee_send_at_command(cmd_nh);
 		register_updated = true;
@@ -526,7 +1261,7 @@ uint8_t XBee::xbee_configure_device() {
 		 * 0x04 - cyclic sleep enabled
 		 * 0x05 - cyclic sleep, pin wake */
 		if (cmd.data[0] != sleep_mode) {
-			module_debug_xbee("Enabling to pin sleep mode");
+			log_info(LOG_MODULE_XBEE, "Enabling to pin sleep mode");
 			XBee_At_Command cmd_sm("SM", &sleep_mode, 1);
 			xbee_send_at_command(cmd_sm);
 			register_updated = true;
@@ -541,7 +1276,8 @@ uint8_t XBee::xbee_configure_device() {
 	/* BD returns 4 bytes, this program only supports predefined baud rates,
 	 * which have a range from 0-7 and are found in the last byte */
 	if (cmd.data[3] != (uint8_t)config.baud) {
-		module_debug_xbee("Setting Baud Rate from %02x to %02x\n",cmd.data[0], (uint8_t)config.baud);
+		log_info(LOG_MODULE_XBEE, "Setting Baud Rate from %02x to %02x", cmd.data[0],
+			(uint8_t)config.baud);
 		XBee_At_Command cmd_bd("BD", (const uint8_t*)&config.baud, 1);
 		xbee_send_at_command(cmd_bd);
 		register_updated = true;
@@ -565,7 +1301,7 @@ uint8_t XBee::xbee_configure_device() {
 
 /* xbee_status requests, decodes and prints the current status of the XBee module */
 uint8_t XBee::xbee_status() {
-	GBeeFrameData *frame;
+	const GBeeFrameData *frame;
 	GBeeError error_code;
 	uint16_t length = 0;
 	uint32_t timeout = config.timeout;
@@ -575,20 +1311,18 @@ uint8_t XBee::xbee_status() {
 	/* query the current network status and print the response in cleartext */
 	error_code = gbeeSendAtCommand(gbee_handle, frame_id, at_cmd_str("AI"), NULL, 0);
 	if (error_code != GBEE_NO_ERROR) {
-		module_debug_xbee("Error requesting XBee status: %s\n", gbeeUtilCodeToString(error_code));
+		log_error(LOG_MODULE_XBEE, "Error requesting XBee status: %s", gbeeUtilCodeToString(error_code));
 		return status;
 	}
 	/* wait for the response to the command */
-	frame = new GBeeFrameData;
-	error_code = gbeeReceive(gbee_handle, frame, &length, &timeout);
+	error_code = xbee_receive_frame(&frame, &length, &timeout);
 	if (error_code != GBEE_NO_ERROR)
 		status = error_code;
 	else if (frame->ident == GBEE_AT_COMMAND_RESPONSE) {
-		GBeeAtCommandResponse *at_frame = (GBeeAtCommandResponse*) frame;
+		const GBeeAtCommandResponse *at_frame = (const GBeeAtCommandResponse*) frame;
 		status = at_frame->value[0];
-		module_debug_xbee("Status: %s\n", gbeeUtilStatusCodeToString(status));
+		log_info(LOG_MODULE_XBEE, "Status: %s", gbeeUtilStatusCodeToString(status));
 	}
-	delete frame;
 
 	return status;
 }
@@ -596,7 +1330,7 @@ uint8_t XBee::xbee_status() {
 /* sends out the requested AT command, receives & stores the register value
  * in the XBee_At_Command object */
 uint8_t XBee::xbee_send_at_command(XBee_At_Command& cmd){
-	GBeeFrameData *frame;
+	const GBeeFrameData *frame;
 	GBeeError error_code;
 	uint8_t response_cnt = 0;
 	uint16_t length = 0;
@@ -607,23 +1341,21 @@ uint8_t XBee::xbee_send_at_command(XBee_At_Command& cmd){
 	frame_id = (frame_id % 255) + 1;	/* give each frame a unique ID */
 	error_code = gbeeSendAtCommand(gbee_handle, frame_id, at_cmd_str(cmd.at_command), cmd.data, cmd.length);
 	if (error_code != GBEE_NO_ERROR) {
-		module_debug_xbee("Error sending XBee AT (%s) command : %s\n", cmd.at_command.c_str(),
+		log_error(LOG_MODULE_XBEE, "Error sending XBee AT (%s) command : %s", cmd.at_command.c_str(),
 		gbeeUtilCodeToString(error_code));
 		return error_code;
 	}
 	/* try to receive the response and copy it into the XBee_At_Command object*/
-	frame = new GBeeFrameData;
 	while (1) {
-		memset(frame, 0, sizeof(*frame));
-		error_code = gbeeReceive(gbee_handle, frame, &length, &timeout);
+		error_code = xbee_receive_frame(&frame, &length, &timeout);
 		if (error_code != GBEE_NO_ERROR)
 			break;
 
 		/* check if the received frame is a AT Command Response frame */
 		if (frame->ident == GBEE_AT_COMMAND_RESPONSE) {
-			GBeeAtCommandResponse *at_frame = (GBeeAtCommandResponse*) frame;
+			const GBeeAtCommandResponse *at_frame = (const GBeeAtCommandResponse*) frame;
 			if (at_frame->frameId != frame_id) {
-				module_debug_xbee("Problem: Frame IDs not matching\n (%i : %i)\n",
+				log_warn(LOG_MODULE_XBEE, "Problem: Frame IDs not matching (%i : %i)",
 				frame_id, at_frame->frameId);
 				error_code = GBEE_RESPONSE_ERROR;
 				/* if the frameId is larger than expected nothing can be done */
@@ -642,14 +1374,13 @@ uint8_t XBee::xbee_send_at_command(XBee_At_Command& cmd){
 				cmd.append_data(at_frame->value, length - 5, at_frame->status);
 			break;
 		} else {
-			module_debug_xbee("Received frame with ident %02x\n", frame->ident);
+			log_debug(LOG_MODULE_XBEE, "Received frame with ident %02x", frame->ident);
 			break;
 		}
 	}
 
 	/* in case there was an unexpected error, the function returned early
 	 * the only way we get this far, is if everything worked*/
-	delete frame;
 	return error_code;
 }
 
@@ -668,47 +1399,71 @@ uint8_t XBee::xbee_send_data(const string &destination, const uint8_t *data, uin
 	return status;
 }
 
+/* passes a received RxPacket frame to the reassembly, the source address
+ * keeps the address cache up to date. Returns the message if it's complete */
+XBee_Message* XBee::xbee_receive_part(const GBeeFrameData *frame, uint16_t length) {
+	const GBeeRxPacket *rx = (const GBeeRxPacket*) frame;
+	address_cache.update(((uint64_t)GBEE_ULONG(rx->srcAddr64h) << 32) |
+		GBEE_ULONG(rx->srcAddr64l), GBEE_USHORT(rx->srcAddr16));
+	return reassembly.add_part(rx, length);
+}
+
+/* returns the first queued message that is not a NACK, or NULL. The NACKs
+ * are handled, messages that arrive meanwhile are appended to the queue */
+XBee_Message* XBee::xbee_take_received() {
+	while (!received.empty()) {
+		XBee_Message *msg = received.front();
+		received.pop_front();
+		if (!xbee_receive_nack(*msg))
+			return msg;
+		xbee_free_message(msg);
+	}
+	return NULL;
+}
+
 /* checks the buffer for (parts of) messages, puts together a complete message
- * from the parts
+ * from the parts. Parts of messages from different senders can be interleaved,
+ * they are collected in the reassembly table until a message is complete.
+ * Messages that were completed while a message was sent are handed out
+ * first. The function reads frames while data is available, and returns as
+ * soon as a message was completed. If no message was completed, an empty
+ * (incomplete) message is returned.
  * !caller is responsible for freeing the memory occupied by the XBee_Message object */
 XBee_Message* XBee::xbee_receive_message() {
 	GBeeError error_code;
-	GBeeFrameData *frame = new GBeeFrameData;
-	XBee_Message *msg = new XBee_Message;
-	XBee_Address src_addr;
+	const GBeeFrameData *frame;
+	XBee_Message *msg = NULL;
 	uint16_t length = 0;
 	uint32_t timeout = config.timeout;
 
-	/* try to receive a message, it might consist of several parts */
-	uint8_t retry_cnt = 3;
+	xbee_housekeeping();
+	msg = xbee_take_received();
+	if (msg)
+		return msg;
+
 	do {
-		while (--retry_cnt > 0 && !msg->is_complete()) {
-			memset(frame, 0, sizeof(*frame));
-			error_code = gbeeReceive(gbee_handle, frame, &length, &timeout);
-			if (error_code != GBEE_NO_ERROR) {
-				module_debug_xbee("Error receiving message: length=%d, error= %s\n",
-				length, gbeeUtilCodeToString(error_code));
-				usleep(50000);
-				continue;
-			}
-			/* check if the received frame is a RxPacket frame */
-			if (frame->ident == GBEE_RX_PACKET) {
-				GBeeRxPacket *rx_frame = (GBeeRxPacket*) frame;
-				/* try to append the data to the message
-				 * if it fails, give up and assume an faulty transmission */
-				if (!msg->append_msg(rx_frame))
-					retry_cnt = 0;
-				else
-					retry_cnt = 3;
-				break;
-			} else {
-				module_debug_xbee("Received unexpected message frame: ident=%02x\n",frame->ident);
+		error_code = xbee_receive_frame(&frame, &length, &timeout);
+		if (error_code != GBEE_NO_ERROR) {
+			log_error(LOG_MODULE_XBEE, "Error receiving message: length=%d, error= %s",
+			length, gbeeUtilCodeToString(error_code));
+			break;
+		}
+		/* check if the received frame is a RxPacket frame */
+		if (frame->ident == GBEE_RX_PACKET) {
+			msg = xbee_receive_part(frame, length);
+			/* NACKs for sent messages are handled here, messages
+			 * received while the parts are sent again are queued */
+			if (msg && xbee_receive_nack(*msg)) {
+				xbee_free_message(msg);
+				msg = xbee_take_received();
 			}
 		}
-	} while (!msg->is_complete() && retry_cnt > 0);
+		else
+			log_warn(LOG_MODULE_XBEE, "Received unexpected message frame: ident=%02x", frame->ident);
+		timeout = config.timeout;
+	} while (!msg && xbee_bytes_available() > 0);
 
-	delete frame;
-	return msg;
+	return msg ? msg : message_pool.acquire();
 }
 
 /* returns a pointer to an address object, that contains the current network
@@ -717,36 +1472,191 @@ const XBee_Address* XBee::xbee_get_address(const string &node) {
 	uint8_t error_code;
 
 	/* check for cached addresses */
-	for (int i = 0; i < address_cache_size; i++) {
-		if (address_cache[i]->node == node) {
-			return address_cache[i];
-		}
-	}
+	const XBee_Address *address = address_cache.find(node);
+	if (address)
+		return address;
+
 	/* address not cached -> do a destination node lookup */
 	XBee_At_Command cmd("DN", node);
 	error_code = xbee_send_at_command(cmd);
 	if (error_code != GBEE_NO_ERROR) {
-		module_debug_xbee("Node discovery failed, error: %s\n", gbeeUtilCodeToString((gbeeError)error_code));
+		log_error(LOG_MODULE_XBEE, "Node discovery failed, error: %s",
+			gbeeUtilCodeToString((gbeeError)error_code));
 		return NULL;
 	}
 	/* decode the returned data and add the address to the cache */
-	XBee_Address *new_address = new XBee_Address(node, cmd.data);
-	address_cache[address_cache_size++] = new_address;
+	return address_cache.insert(XBee_Address(node, cmd.data));
+}
 
-	return new_address;
+/* returns the counters of the address cache */
+const XBee_Address_Cache_Stats& XBee::xbee_address_cache_stats() const {
+	return address_cache.get_stats();
+}
+
+/* returns the counters of the message pool of the receive path */
+XBee_Message_Pool_Stats XBee::xbee_message_pool_stats() const {
+	return message_pool.get_stats();
+}
+
+/* returns the counters of the transmit path */
+const XBee_Tx_Stats& XBee::xbee_tx_stats() const {
+	return tx_stats;
+}
+
+/* returns the counters of the multipart message reassembly */
+const XBee_Reassembly_Stats& XBee::xbee_reassembly_stats() const {
+	return reassembly.get_stats();
+}
+
+/* returns the counters of the API frame parser */
+const XBee_Frame_Parser_Stats& XBee::xbee_frame_stats() const {
+	return frame_parser.get_stats();
 }
 
 /* checks the buffer of the serial device for available data, and returns the
- * number of pending bytes */
+ * number of pending bytes. Frames that were already read from the device,
+ * but not processed yet, and the payload of the messages that were completed
+ * while sending are counted as well */
 int XBee::xbee_bytes_available() const {
 	int bytes_available;
 	ioctl(gbee_handle->serialDevice, FIONREAD, &bytes_available);
 
-	return bytes_available;
+	for (size_t i = 0; i < received.size(); i++)
+		bytes_available += received[i]->payload_len;
+	return bytes_available + frame_parser.get_pending_bytes();
+}
+
+/* returns the next API frame received from the device. The frame points into
+ * the buffer of the frame parser, and stays valid until the next call.
+ * New data is read from the device in chunks of whatever is available, until
+ * a frame is complete or the timeout (in ms) expires. On return timeout
+ * contains the remaining time, like it's done by gbeeReceive */
+GBeeError XBee::xbee_receive_frame(const GBeeFrameData **frame, uint16_t *length, uint32_t *timeout) {
+	XBee_Frame raw_frame;
+	struct pollfd pfd;
+	struct timespec start, now;
+	uint32_t initial_timeout = *timeout;
+	uint32_t elapsed_ms;
+	int ret;
+
+	pfd.fd = gbee_handle->serialDevice;
+	pfd.events = POLLIN;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while (!frame_parser.next_frame(&raw_frame)) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		elapsed_ms = (now.tv_sec - start.tv_sec) * 1000 +
+			(now.tv_nsec - start.tv_nsec) / 1000000;
+		*timeout = elapsed_ms < initial_timeout ? initial_timeout - elapsed_ms : 0;
+		if (*timeout == 0)
+			return GBEE_TIMEOUT_ERROR;
+
+		ret = poll(&pfd, 1, *timeout);
+		if (ret < 0 && errno != EINTR)
+			return GBEE_RS232_ERROR;
+		/* a readable device without data was closed */
+		if (ret > 0 && frame_parser.read_from(pfd.fd) <= 0)
+			return GBEE_RS232_ERROR;
+	}
+	if (capture)
+		capture->append(raw_frame.data, raw_frame.length);
+	*frame = (const GBeeFrameData*) raw_frame.data;
+	*length = raw_frame.length;
+	return GBEE_NO_ERROR;
+}
+
+/* returns the file descriptor of the serial device, it can be used to wait
+ * for incoming data with select/poll/epoll instead of polling
+ * xbee_bytes_available() */
+int XBee::xbee_get_fd() const {
+	return gbee_handle ? gbee_handle->serialDevice : -1;
+}
+
+/* sets the number of message parts that are sent without waiting for their
+ * transmit status */
+void XBee::xbee_set_tx_window(uint8_t window) {
+	tx_window = window ? window : 1;
+}
+
+/* sets the capture that all received frames are appended to, NULL disables
+ * the capture. The capture is owned by the caller */
+void XBee::xbee_set_capture(XBee_Capture *capture) {
+	this->capture = capture;
 }
 
+/* returns a frame id for a transmit request, that is not used by a part which
+ * is still waiting for its transmit status. Frame id 0 disables the status */
+uint8_t XBee::next_tx_frame_id(const uint16_t *in_flight) {
+	do {
+		tx_frame_id = (tx_frame_id % 255) + 1;
+	} while (in_flight[tx_frame_id]);
+	return tx_frame_id;
+}
+
+/* sends the message, by splitting it up into parts that have the correct
+ * length for transmission over ZigBee, see xbee_send_parts. Messages with a
+ * version 2 header are kept in the retransmit cache afterwards, even if a
+ * part failed: the receiver requests the missing parts with a NACK, and only
+ * these are sent again. Returns 0x00 if all parts were delivered, the
+ * delivery status of the failed part, or 0xFF if the status is unknown */
 uint8_t XBee::xbee_send_data(XBee_Message& msg) {
-	GBeeFrameData *frame = new GBeeFrameData;
+	uint16_t parts[MSG_V2_MAX_PART_CNT];
+	uint64_t addr64 = msg.address.get_addr64();
+	uint8_t status;
+
+	if (config.header_version == MSG_HEADER_V2) {
+		msg.set_header_version(MSG_HEADER_V2);
+		/* the receiver tells version 2 messages apart by their sequence
+		 * number, a message without one gets the next sequence number of
+		 * the destination. The number of a cached message can't be reused,
+		 * its parts would be mixed with the parts of the new message */
+		if (!msg.sequence_set) {
+			uint8_t &sequence = tx_sequences[addr64];
+			while (xbee_cached_message(addr64, sequence))
+				sequence++;
+			msg.sequence = sequence++;
+		} else if (msg.message_part_cnt > 1 && xbee_cached_message(addr64, msg.sequence)) {
+			log_error(LOG_MODULE_XBEE, "Error: message %u to %08x%08x was sent recently",
+				msg.sequence, msg.address.addr64h, msg.address.addr64l);
+			tx_stats.failed++;
+			return 0xFF;
+		}
+	}
+	if (msg.message_part_cnt >
+	    (msg.header_version == MSG_HEADER_V2 ? MSG_V2_MAX_PART_CNT : MSG_MAX_PART_CNT)) {
+		log_error(LOG_MODULE_XBEE, "Error: Message size %u not supported", msg.payload_len);
+		tx_stats.failed++;
+		return 0xFF;
+	}
+	for (uint16_t part = 1; part <= msg.message_part_cnt; part++)
+		parts[part - 1] = part;
+	status = xbee_send_parts(msg, parts, msg.message_part_cnt);
+	if (status == 0x00)
+		tx_stats.messages++;
+	else
+		tx_stats.failed++;
+
+	if (msg.header_version == MSG_HEADER_V2 && msg.message_part_cnt > 1) {
+		if (retransmit_cache.size() >= XBEE_RETRANSMIT_CACHE_SIZE) {
+			delete retransmit_cache.front();
+			retransmit_cache.erase(retransmit_cache.begin());
+		}
+		retransmit_cache.push_back(new XBee_Message(msg));
+	}
+	return status;
+}
+
+/* sends the given parts of the message. Up to tx_window parts are sent
+ * without waiting for their transmit status, the status frames are matched
+ * to the parts by their frame id. Parts that failed, or whose status did not
+ * arrive within the timeout, are sent again up to XBEE_TX_RETRIES times.
+ * Retransmitted parts can arrive after later parts, a window of 1 keeps
+ * the parts in order. Parts received while waiting are reassembled, the
+ * completed messages are queued for xbee_receive_message(). Returns 0x00 if
+ * all parts were delivered, the delivery status of the failed part, or 0xFF
+ * if the status is unknown */
+uint8_t XBee::xbee_send_parts(XBee_Message &msg, const uint16_t *parts, uint16_t part_cnt) {
+	const GBeeFrameData *frame;
 	GBeeError error_code;
 	const XBee_Address &addr = msg.get_address();
 	const uint8_t bcast_radius = 0;	/* -> max hops for bcast transmission */
@@ -754,50 +1664,248 @@ uint8_t XBee::xbee_send_data(XBee_Message& msg) {
 				 * encryption (if EE=1), 0x04 = Send packet
 				 * with Broadcast Pan ID.
 				 * All other bits must be set to 0. */
-	uint8_t tx_status = 0xFF;	/* -> Unknown Tx Status */
+	uint16_t in_flight[256] = {0};	/* frame id -> part waiting for status */
+	uint8_t attempts[MSG_V2_MAX_PART_CNT + 1] = {0};
+	uint16_t retry_queue[MSG_V2_MAX_PART_CNT + 1];
+	uint16_t retry_head = 0, retry_tail = 0;
+	uint16_t next_index = 0, delivered_cnt = 0, in_flight_cnt = 0;
 	uint16_t length;
 	uint32_t timeout = config.timeout;
-	/* send the message, by splitting it up into parts that have the
-	 * correct length for transmission over ZigBee */
-	for (uint16_t i = 1; i <= msg.message_part_cnt; i++) {
-		uint8_t *message = msg.get_msg(i);
-		/* send out one part of the message, use the message part as frame id */
-		error_code = gbeeSendTxRequest(gbee_handle, i, addr.addr64h, addr.addr64l,
-		addr.addr16, bcast_radius, options, message, msg.get_msg_len(i));
-		module_debug_xbee("Sending message part %u of %u with length %u\n",
-			i, msg.message_part_cnt, msg.get_msg_len(i));
-		if (error_code != GBEE_NO_ERROR) {
-			module_debug_xbee("Error sending message part %u of %u: %s\n",
-			i, msg.message_part_cnt, gbeeUtilCodeToString(error_code));
-			tx_status = 0xFF;	/* -> Unknown Tx Status */
-			break;
-		}
 
-		/* wait for the acknowledgement for the message frame */
-		uint8_t retry_cnt = 3;
-		while (--retry_cnt > 0) {
-			memset(frame, 0, sizeof(*frame));
-			error_code = gbeeReceive(gbee_handle, frame, &length, &timeout);
+	while (delivered_cnt < part_cnt) {
+		/* fill the window with parts that need to be sent again first,
+		 * followed by the parts that were not sent yet */
+		while (in_flight_cnt < tx_window &&
+		       (retry_head != retry_tail || next_index < part_cnt)) {
+			uint16_t part;
+			if (retry_head != retry_tail) {
+				part = retry_queue[retry_head];
+				retry_head = (retry_head + 1) % (MSG_V2_MAX_PART_CNT + 1);
+			} else {
+				part = parts[next_index++];
+			}
+			uint8_t frame_id = next_tx_frame_id(in_flight);
+			uint8_t *message = msg.get_msg(part);
+			error_code = gbeeSendTxRequest(gbee_handle, frame_id, addr.addr64h, addr.addr64l,
+			addr.addr16, bcast_radius, options, message, msg.get_msg_len(part));
+			log_debug(LOG_MODULE_XBEE, "Sending message part %u of %u with length %u",
+				part, msg.message_part_cnt, msg.get_msg_len(part));
 			if (error_code != GBEE_NO_ERROR) {
-				module_debug_xbee("Error receiving transmission status, status message: error= %s\n",
-				gbeeUtilCodeToString(error_code));
-				tx_status = 0xFF;	/* -> Unknown Tx Status */
-			/* check if the received frame is a TxStatus frame */
-			} else if (frame->ident == GBEE_TX_STATUS_NEW) {
-				GBeeTxStatusNew *tx_frame = (GBeeTxStatusNew*) frame;
-				tx_status = tx_frame->deliveryStatus;
-				if (tx_status != 0x00)	/* 0x00 = success */
+				log_error(LOG_MODULE_XBEE, "Error sending message part %u of %u: %s",
+				part, msg.message_part_cnt, gbeeUtilCodeToString(error_code));
+				return 0xFF;	/* -> Unknown Tx Status */
+			}
+			in_flight[frame_id] = part;
+			if (attempts[part]++)
+				tx_stats.retries++;
+			tx_stats.parts++;
+			in_flight_cnt++;
+		}
+
+		/* wait for the transmit status of one of the parts in flight */
+		error_code = xbee_receive_frame(&frame, &length, &timeout);
+		if (error_code != GBEE_NO_ERROR) {
+			log_error(LOG_MODULE_XBEE, "Error receiving transmission status, status message: error= %s",
+			gbeeUtilCodeToString(error_code));
+			/* the status of the parts in flight is unknown -> send them again */
+			for (uint16_t id = 1; id < 256; id++) {
+				uint16_t part = in_flight[id];
+				if (!part)
 					continue;
-				break;
+				if (attempts[part] >= XBEE_TX_RETRIES)
+					return 0xFF;	/* -> Unknown Tx Status */
+				in_flight[id] = 0;
+				retry_queue[retry_tail] = part;
+				retry_tail = (retry_tail + 1) % (MSG_V2_MAX_PART_CNT + 1);
 			}
+			in_flight_cnt = 0;
+			timeout = config.timeout;
+			continue;
 		}
-		/* reset timeout to initial value (it's modified by gbeeReceive fckt */
+		/* parts of received messages are not dropped, the completed
+		 * messages are handed out by xbee_receive_message() */
+		if (frame->ident == GBEE_RX_PACKET) {
+			XBee_Message *received_msg = xbee_receive_part(frame, length);
+			if (received_msg)
+				received.push_back(received_msg);
+			continue;
+		}
+		/* check if the received frame is a TxStatus frame of a part in flight */
+		if (frame->ident != GBEE_TX_STATUS_NEW)
+			continue;
+		const GBeeTxStatusNew *tx_frame = (const GBeeTxStatusNew*) frame;
+		uint16_t part = in_flight[tx_frame->frameId];
+		if (!part)
+			continue;
+		in_flight[tx_frame->frameId] = 0;
+		in_flight_cnt--;
+		/* reset timeout to initial value (it's modified by xbee_receive_frame fckt */
 		timeout = config.timeout;
-		if (retry_cnt == 0)
-			break;
+
+		if (tx_frame->deliveryStatus == 0x00) {	/* 0x00 = success */
+			delivered_cnt++;
+		} else if (attempts[part] < XBEE_TX_RETRIES) {
+			log_warn(LOG_MODULE_XBEE, "Message part %u failed with status %02x, retrying",
+				part, tx_frame->deliveryStatus);
+			retry_queue[retry_tail] = part;
+			retry_tail = (retry_tail + 1) % (MSG_V2_MAX_PART_CNT + 1);
+		} else {
+			return tx_frame->deliveryStatus;
+		}
+	}
+	return 0x00;
+}
+
+/* the NACK is sent like an acknowledgement, without waiting for its
+ * transmit status. If it's lost, the parts are requested again after the
+ * nack delay */
+uint8_t XBee::xbee_send_nack(const XBee_Nack &nack) {
+	uint8_t data[XBEE_MSG_LENGTH];
+	NackMessage nack_msg;
+	MessagePacket packet;
+	GBeeError error_code;
+
+	nack_msg.sequence = nack.sequence;
+	nack_msg.firstPart = nack.first_part;
+	nack_msg.arrayLength = nack.bitmap_len;
+	nack_msg.bitmap = (uint8_t*) nack.bitmap;
+	packet.mainType = msgNack;
+	packet.relTimestampS = 0;
+	packet.payload = (uint8_t*) &nack_msg;
+	uint16_t length = MessageStorage::serialize(&packet, &data[MSG_HEADER_LENGTH]);
+
+	data[MSG_PART] = 1;
+	data[MSG_PART_CNT] = 1;
+	data[MSG_SEQUENCE] = 0;
+	data[MSG_PAYLOAD_LENGTH] = length;
+	error_code = gbeeSendTxRequest(gbee_handle, 0, nack.address.addr64h, nack.address.addr64l,
+		nack.address.addr16, 0, 0x00, data, MSG_HEADER_LENGTH + length);
+	if (error_code != GBEE_NO_ERROR) {
+		log_error(LOG_MODULE_XBEE, "Error sending NACK to %08x%08x: %s",
+			nack.address.addr64h, nack.address.addr64l, gbeeUtilCodeToString(error_code));
+		return error_code;
+	}
+	log_debug(LOG_MODULE_XBEE, "Requested parts of message %u from %08x%08x, starting at %u",
+		nack.sequence, nack.address.addr64h, nack.address.addr64l, nack.first_part);
+	return GBEE_NO_ERROR;
+}
+
+void XBee::xbee_housekeeping() {
+	/* discard messages that were not completed in time, and request the
+	 * missing parts of version 2 messages */
+	reassembly.expire();
+	xbee_send_nacks();
+}
+
+void XBee::xbee_send_nacks() {
+	nacks.clear();
+	reassembly.collect_nacks(nacks);
+	for (size_t i = 0; i < nacks.size(); i++)
+		xbee_send_nack(nacks[i]);
+}
+
+/* returns the message with the sequence number that was sent to the node, if
+ * it's in the retransmit cache */
+XBee_Message* XBee::xbee_cached_message(uint64_t addr64, uint8_t sequence) {
+	for (size_t i = 0; i < retransmit_cache.size(); i++) {
+		if (retransmit_cache[i]->sequence == sequence &&
+		    retransmit_cache[i]->address.get_addr64() == addr64)
+			return retransmit_cache[i];
+	}
+	return NULL;
+}
+
+/* sends the parts requested by a NACK again, if the message is still in the
+ * retransmit cache. Returns false if the message is not a NACK */
+bool XBee::xbee_receive_nack(XBee_Message &msg) {
+	uint16_t length;
+	const uint8_t *data = msg.get_payload(&length);
+	/* serialized MessagePacket header (mainType, relTimestampS) and the
+	 * fields of the NackMessage before the bitmap */
+	const uint16_t bitmap_offset = 1 + sizeof(uint32_t) + sizeof(NackMessage) - sizeof(void*);
+	NackMessage nack;
+
+	if (!msg.is_complete() || length < bitmap_offset || data[0] != msgNack)
+		return false;
+	memcpy(&nack, &data[1 + sizeof(uint32_t)], sizeof(NackMessage) - sizeof(void*));
+	if (nack.arrayLength > MSG_MAX_NACK_BITMAP || length < bitmap_offset + nack.arrayLength) {
+		log_warn(LOG_MODULE_XBEE, "Rejecting invalid NACK with length %u", length);
+		return true;
+	}
+
+	XBee_Message *sent = xbee_cached_message(msg.address.get_addr64(), nack.sequence);
+	if (!sent) {
+		log_warn(LOG_MODULE_XBEE, "NACK for message %u, which is not cached anymore",
+			nack.sequence);
+		return true;
+	}
+
+	uint16_t parts[MSG_MAX_NACK_BITMAP * 8];
+	uint16_t part_cnt = 0;
+	for (uint16_t i = 0; i < nack.arrayLength * 8; i++) {
+		uint16_t part = nack.firstPart + i;
+		if ((data[bitmap_offset + i / 8] & (1 << (i % 8))) &&
+		    part >= 1 && part <= sent->message_part_cnt)
+			parts[part_cnt++] = part;
+	}
+	log_info(LOG_MODULE_XBEE, "Sending %u parts of message %u again", part_cnt, nack.sequence);
+	tx_stats.nacked_parts += part_cnt;
+	xbee_send_parts(*sent, parts, part_cnt);
+	return true;
+}
+
+/* the acknowledgement is sent as a single part message with frame id 0, the
+ * XBee doesn't return a transmit status for it. Waiting for the status would
+ * block the receive path; if an acknowledgement is lost the node sends the
+ * messages again, and they are acknowledged again after they were stored */
+uint8_t XBee::xbee_send_ackn(const XBee_Address &addr, const AckRange *ranges, uint8_t range_cnt) {
+	uint8_t data[XBEE_MSG_LENGTH];
+	AckMessage ack;
+	MessagePacket packet;
+	GBeeError error_code;
+
+	if (range_cnt > MSG_MAX_ACK_RANGES)
+		range_cnt = MSG_MAX_ACK_RANGES;
+	ack.arrayLength = range_cnt;
+	ack.ackArray = (AckRange*) ranges;
+	packet.mainType = msgAck;
+	packet.relTimestampS = 0;
+	packet.payload = (uint8_t*) &ack;
+	uint16_t length = MessageStorage::serialize(&packet, &data[MSG_HEADER_LENGTH]);
+
+	data[MSG_PART] = 1;
+	data[MSG_PART_CNT] = 1;
+	data[MSG_SEQUENCE] = 0;
+	data[MSG_PAYLOAD_LENGTH] = length;
+	error_code = gbeeSendTxRequest(gbee_handle, 0, addr.addr64h, addr.addr64l,
+		addr.addr16, 0, 0x00, data, MSG_HEADER_LENGTH + length);
+	if (error_code != GBEE_NO_ERROR) {
+		log_error(LOG_MODULE_XBEE, "Error sending acknowledgement to %08x%08x: %s",
+			addr.addr64h, addr.addr64l, gbeeUtilCodeToString(error_code));
+		return error_code;
+	}
+	log_debug(LOG_MODULE_XBEE, "Sent acknowledgement with %u ranges to %08x%08x",
+		range_cnt, addr.addr64h, addr.addr64l);
+	return GBEE_NO_ERROR;
+}
+
+uint8_t XBee::xbee_receive_acknowledge(XBee_Message &msg, AckRange *ranges) {
+	uint16_t length;
+	const uint8_t *data = msg.get_payload(&length);
+	/* serialized MessagePacket header (mainType, relTimestampS) and the
+	 * arrayLength of the AckMessage */
+	const uint16_t array_offset = 1 + sizeof(uint32_t) + sizeof(AckMessage) - sizeof(void*);
+
+	if (!msg.is_complete() || length < array_offset || data[0] != msgAck)
+		return 0;
+	uint8_t range_cnt = data[array_offset - 1];
+	if (range_cnt > MSG_MAX_ACK_RANGES ||
+	    length < array_offset + range_cnt * sizeof(AckRange)) {
+		log_warn(LOG_MODULE_XBEE, "Rejecting invalid acknowledgement with length %u", length);
+		return 0;
 	}
-	delete frame;
-	return tx_status;
+	memcpy(ranges, &data[array_offset], range_cnt * sizeof(AckRange));
+	return range_cnt;
 }
 
 /* converts a string into a ASCII coded byte array - the length of
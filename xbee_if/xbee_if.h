@@ -20,18 +20,80 @@
 #define XBEE_IF
 
 #include "messagetypes.h"
+#include "xbee_frame_parser.h"
+#include "xbee_capture.h"
 #include <gbee.h>
+#include <deque>
 #include <string>
+#include <unordered_map>
+#include <mutex>
+#include <vector>
 #include <inttypes.h>
 
 #define XBEE_MSG_LENGTH 84
-#define XBEE_ADDR_CACHE_SIZE 4
+/* default number of cached node addresses, and time after which a cached
+ * address is looked up again (0 = never) */
+#define XBEE_ADDR_CACHE_SIZE 256
+#define XBEE_ADDR_CACHE_TTL_MS 3600000
+/* default number of messages that can be reassembled at the same time, and
+ * time after which an incomplete message is discarded */
+#define XBEE_REASSEMBLY_SLOTS 32
+#define XBEE_REASSEMBLY_TIMEOUT_MS 5000
+/* number of incomplete messages of one sender, a sender can retransmit the
+ * parts of as many messages as it keeps in its retransmit cache */
+#define XBEE_REASSEMBLY_SLOTS_PER_SENDER XBEE_RETRANSMIT_CACHE_SIZE
+/* number of completed messages that are remembered, so parts that arrive
+ * again after their message was completed are dropped */
+#define XBEE_REASSEMBLY_COMPLETED_CNT 64
+/* default number of message parts that are sent without waiting for their
+ * transmit status, and number of transmissions of a part before it fails */
+#define XBEE_TX_WINDOW 4
+#define XBEE_TX_RETRIES 3
+/* default number of preallocated messages for the receive path, this should
+ * be larger than the number of messages that wait to be stored */
+#define XBEE_MESSAGE_POOL_SIZE 320
+/* default time a message with a version 2 header can be incomplete before
+ * the missing parts are requested, and number of requests without progress */
+#define XBEE_NACK_DELAY_MS 500
+#define XBEE_NACK_RETRIES 3
+/* number of sent messages with a version 2 header that are kept for
+ * retransmissions */
+#define XBEE_RETRANSMIT_CACHE_SIZE 4
+/* overhead of a GBeeRxPacket frame (ident, addr64, addr16, options) */
+#define XBEE_RX_PACKET_OVERHEAD 12
 
 #define MSG_HEADER_LENGTH 4
-/* define position of values in the header */
+/* define position of values in the header (version 1) */
 #define MSG_PART 0x00
 #define MSG_PART_CNT 0x01
+/* message sequence number of the sender, it identifies the message in the
+ * acknowledgements of the base station */
+#define MSG_SEQUENCE 0x02
 #define MSG_PAYLOAD_LENGTH 0x03
+/* payload length of each part of a multipart message, except the last one */
+#define MSG_PART_PAYLOAD_LENGTH (XBEE_MSG_LENGTH - MSG_HEADER_LENGTH)
+#define MSG_MAX_PART_CNT 255
+/* the version 2 header starts with a part number of 0, which is invalid in
+ * a version 1 header. It has 16bit part numbers (big endian), the message
+ * sequence number identifies the message in the NACKs of the receiver */
+#define MSG_V2_HEADER_LENGTH 8
+#define MSG_V2_MARKER 0x00
+#define MSG_V2_VERSION 0x01
+#define MSG_V2_PART 0x02
+#define MSG_V2_PART_CNT 0x04
+#define MSG_V2_SEQUENCE 0x06
+#define MSG_V2_PAYLOAD_LENGTH 0x07
+#define MSG_V2_PART_PAYLOAD_LENGTH (XBEE_MSG_LENGTH - MSG_V2_HEADER_LENGTH)
+/* the length of a message is limited by its 16bit payload length */
+#define MSG_V2_MAX_PART_CNT (UINT16_MAX / MSG_V2_PART_PAYLOAD_LENGTH)
+#define MSG_HEADER_V1 1
+#define MSG_HEADER_V2 2
+/* maximal length of a message with either header */
+#define MSG_MAX_LENGTH (MSG_V2_MAX_PART_CNT * MSG_V2_PART_PAYLOAD_LENGTH)
+/* maximal number of AckRanges in one acknowledgement, and of bytes in the
+ * bitmap of a NACK, they fit into a single part */
+#define MSG_MAX_ACK_RANGES 32
+#define MSG_MAX_NACK_BITMAP 64
 
 using std::string;
 
@@ -52,6 +114,8 @@ uint16_t serialize(const MessagePacket *msg, uint8_t *data);
 void deserialize(const uint8_t *data, MessagePacket *msg);
 
 class XBee_Message;
+/* timestamps of a traced message, see message_trace.h of the controller */
+struct Message_Trace;
 
 class XBee_Address {
 public:
@@ -72,7 +136,15 @@ class XBee_Config {
 public:
 	XBee_Config(const string &port, const string &node, bool mode, 
 		const uint8_t *pan, uint32_t timeout,
-		xbee_baud_rate baud, uint8_t max_unicast_hops);
+		xbee_baud_rate baud, uint8_t max_unicast_hops,
+		uint16_t reassembly_slots = XBEE_REASSEMBLY_SLOTS,
+		uint32_t reassembly_timeout_ms = XBEE_REASSEMBLY_TIMEOUT_MS,
+		uint8_t tx_window = XBEE_TX_WINDOW,
+		uint16_t address_cache_size = XBEE_ADDR_CACHE_SIZE,
+		uint32_t address_cache_ttl_ms = XBEE_ADDR_CACHE_TTL_MS,
+		uint16_t message_pool_size = XBEE_MESSAGE_POOL_SIZE,
+		uint8_t header_version = MSG_HEADER_V1,
+		uint32_t nack_delay_ms = XBEE_NACK_DELAY_MS);
 
 	const string serial_port;
 	const string node;
@@ -81,6 +153,14 @@ public:
 	const uint32_t timeout;
 	const xbee_baud_rate baud;
 	const uint8_t max_unicast_hops;
+	const uint16_t reassembly_slots;
+	const uint32_t reassembly_timeout_ms;
+	const uint8_t tx_window;
+	const uint16_t address_cache_size;
+	const uint32_t address_cache_ttl_ms;
+	const uint16_t message_pool_size;
+	const uint8_t header_version;	/* header of the sent messages */
+	const uint32_t nack_delay_ms;	/* 0 disables the NACKs */
 };
 
 class XBee_At_Command {
@@ -103,6 +183,226 @@ private:
 
 };
 
+/* counters of the message pool */
+typedef struct {
+	uint32_t acquired;
+	uint32_t released;
+	uint32_t heap_allocs;	/* messages that were allocated because the pool was empty */
+	uint32_t buffer_allocs;	/* payload buffers that had to be allocated or enlarged */
+} XBee_Message_Pool_Stats;
+
+/* pool of the XBee_Message objects that are handed out by the receive path.
+ * The messages are acquired by the receiving thread and released by the
+ * thread that stored them, the free list is protected by a mutex. Released
+ * messages keep their payload buffer, so after the buffers have grown to the
+ * size of the received messages no heap allocations are required anymore.
+ * If the pool is empty a message is allocated, released messages that don't
+ * fit into the pool are freed */
+class XBee_Message_Pool {
+public:
+	XBee_Message_Pool(uint16_t size);
+	~XBee_Message_Pool();
+
+	/* returns an empty message */
+	XBee_Message* acquire();
+	/* returns a complete message with a copy of the payload */
+	XBee_Message* acquire(const XBee_Address &address, const uint8_t *payload, uint16_t length);
+	/* returns a message to the pool, use xbee_free_message() for messages
+	 * that might not be pooled */
+	void release(XBee_Message *msg);
+
+	uint16_t get_free_cnt() const;
+	XBee_Message_Pool_Stats get_stats() const;
+private:
+	XBee_Message_Pool(const XBee_Message_Pool&);
+	XBee_Message_Pool& operator=(const XBee_Message_Pool&);
+
+	const uint16_t size;
+	std::vector<XBee_Message*> free_msgs;
+	mutable std::mutex lock;
+	XBee_Message_Pool_Stats stats;
+};
+
+/* frees a message that was returned by the receive path, pooled messages
+ * are returned to their pool */
+void xbee_free_message(XBee_Message *msg);
+
+/* counters of the multipart message reassembly */
+typedef struct {
+	uint32_t completed;	/* messages that were put together completely */
+	uint32_t expired;	/* incomplete messages that were discarded */
+	uint32_t rejected;	/* parts that did not fit into a message */
+	uint32_t nacks;		/* NACKs for missing parts of version 2 messages */
+	uint32_t nacked_parts;	/* parts that were requested again */
+} XBee_Reassembly_Stats;
+
+/* missing parts of a message, see NackMessage */
+typedef struct {
+	XBee_Address address;
+	uint8_t sequence;
+	uint16_t first_part;
+	uint8_t bitmap_len;
+	uint8_t bitmap[MSG_MAX_NACK_BITMAP];
+} XBee_Nack;
+
+/* reassembles multipart messages of several senders at the same time.
+ * Each message (identified by the 64bit address of its sender and its
+ * sequence number) gets a slot with a buffer that is large enough for a
+ * message with the maximum length, a sender can use up to
+ * XBEE_REASSEMBLY_SLOTS_PER_SENDER slots. The slots
+ * and buffers are allocated once at construction. The parts of a message
+ * can arrive in any order, each part is copied to its final position in the
+ * buffer. Messages that are not completed within the timeout are discarded,
+ * if all slots are in use the least recently updated message is discarded.
+ * Parts with a version 2 header can be requested again: if such a message
+ * is incomplete and no part arrived for nack_delay_ms, a NACK with the
+ * missing parts is due. Parts of a message that was completed within the
+ * timeout are dropped, they were sent again before the NACK arrived */
+class XBee_Reassembly {
+public:
+	/* the completed messages are taken from the pool, or allocated if no
+	 * pool is given */
+	XBee_Reassembly(uint16_t slot_cnt, uint32_t timeout_ms, XBee_Message_Pool *pool = NULL,
+		uint32_t nack_delay_ms = 0);
+	~XBee_Reassembly();
+
+	/* adds a received part, returns the complete message if this was the
+	 * last missing part or NULL otherwise. The caller is responsible for
+	 * freeing the returned XBee_Message object with xbee_free_message() */
+	XBee_Message* add_part(const GBeeRxPacket *rx, uint16_t length);
+	/* discards all messages that were not updated within the timeout */
+	void expire();
+	/* appends the NACKs that are due, returns their number */
+	uint16_t collect_nacks(std::vector<XBee_Nack> &nacks);
+
+	uint16_t get_pending_cnt() const;
+	const XBee_Reassembly_Stats& get_stats() const;
+private:
+	XBee_Reassembly(const XBee_Reassembly&);
+	XBee_Reassembly& operator=(const XBee_Reassembly&);
+
+	/* the fields of a version 1 or 2 header */
+	typedef struct {
+		uint8_t version;
+		uint16_t part;
+		uint16_t part_cnt;
+		uint8_t sequence;
+		uint8_t payload_len;
+		uint8_t header_len;
+		uint8_t part_payload_len;	/* of all parts except the last one */
+	} Part_Header;
+
+	typedef struct {
+		bool used;
+		XBee_Address address;
+		uint8_t version;
+		uint16_t part_cnt;
+		uint16_t received_cnt;
+		uint32_t received[(MSG_V2_MAX_PART_CNT + 32) / 32];	/* bitmap of received parts */
+		uint16_t last_part_len;
+		uint8_t sequence;
+		uint8_t nack_cnt;	/* NACKs sent since the last new part */
+		uint32_t last_nack_ms;
+		uint32_t last_update_ms;
+		int64_t first_part_us;	/* monotonic time the first part arrived */
+		uint8_t *buffer;
+	} Slot;
+
+	/* a completed message, see recently_completed() */
+	typedef struct {
+		uint64_t addr64;
+		uint8_t sequence;
+		uint32_t completed_ms;
+	} Completed_Message;
+
+	Slot* find_slot(uint64_t addr64, uint8_t sequence);
+	Slot* allocate_slot(uint64_t addr64, uint8_t version, uint32_t now_ms);
+	void discard_message(Slot *slot);
+	bool recently_completed(uint64_t addr64, uint8_t sequence, uint32_t now_ms) const;
+	void remember_completed(uint64_t addr64, uint8_t sequence, uint32_t now_ms);
+	XBee_Message* create_message(const XBee_Address &address, const uint8_t *payload,
+		uint16_t length, uint8_t sequence, int64_t receive_us);
+	void start_message(Slot *slot, const XBee_Address &address, const Part_Header &header,
+		int64_t now_us);
+	static bool parse_header(const uint8_t *data, uint16_t length, Part_Header *header);
+	static uint32_t now_ms();
+	static int64_t now_us();
+
+	Slot *slots;
+	const uint16_t slot_cnt;
+	const uint32_t timeout_ms;
+	const uint32_t nack_delay_ms;
+	XBee_Message_Pool *pool;
+	uint16_t pending_cnt;
+	/* ring of the last completed messages */
+	Completed_Message completed[XBEE_REASSEMBLY_COMPLETED_CNT];
+	uint16_t completed_cnt;
+	uint16_t completed_next;
+	XBee_Reassembly_Stats stats;
+};
+
+/* counters of the address cache */
+typedef struct {
+	uint32_t hits;
+	uint32_t misses;	/* lookups that required a node discovery */
+	uint32_t evicted;	/* addresses removed to make room */
+	uint32_t expired;	/* addresses that were too old to be used */
+	uint32_t updated;	/* 16bit addresses changed by received frames */
+} XBee_Address_Cache_Stats;
+
+/* caches the addresses of nodes, so they don't need to be discovered for
+ * each transmission. The entries are allocated once at construction, and
+ * indexed by the node identifier and the 64bit address. If the cache is
+ * full the least recently used address is replaced, addresses that are
+ * older than the ttl are discovered again. The 16bit address of a node
+ * changes when it rejoins the network, it's updated from received frames.
+ * The returned addresses are valid until the next find or insert */
+class XBee_Address_Cache {
+public:
+	XBee_Address_Cache(uint16_t capacity, uint32_t ttl_ms);
+	~XBee_Address_Cache();
+
+	/* returns the cached address of the node, or NULL */
+	const XBee_Address* find(const string &node);
+	/* adds the address of a discovered node, replaces an older entry */
+	const XBee_Address* insert(const XBee_Address &address);
+	/* updates the 16bit address of a known node */
+	void update(uint64_t addr64, uint16_t addr16);
+
+	uint16_t get_size() const;
+	const XBee_Address_Cache_Stats& get_stats() const;
+private:
+	XBee_Address_Cache(const XBee_Address_Cache&);
+	XBee_Address_Cache& operator=(const XBee_Address_Cache&);
+
+	typedef struct {
+		XBee_Address address;
+		uint32_t resolved_ms;	/* time of the discovery */
+		uint32_t used_seq;	/* order of the last lookup */
+	} Entry;
+
+	void remove(uint16_t index);
+	static uint32_t now_ms();
+
+	Entry *entries;
+	const uint16_t capacity;
+	const uint32_t ttl_ms;
+	uint16_t size;
+	uint32_t use_seq;
+	std::unordered_map<string, uint16_t> node_index;
+	std::unordered_map<uint64_t, uint16_t> addr64_index;
+	XBee_Address_Cache_Stats stats;
+};
+
+/* counters of the transmit path */
+typedef struct {
+	uint32_t messages;	/* messages that were delivered completely */
+	uint32_t failed;	/* messages that could not be delivered */
+	uint32_t parts;		/* message parts that were sent, including retries */
+	uint32_t retries;	/* message parts that were sent again */
+	uint32_t nacked_parts;	/* message parts that were sent again on a NACK */
+} XBee_Tx_Stats;
+
 class XBee {
 public:
 	XBee(XBee_Config& config);
@@ -116,48 +416,122 @@ public:
 	XBee_Message* xbee_receive_message();
 	const XBee_Address* xbee_get_address(const std::string &node);
 	int xbee_bytes_available() const;
+	int xbee_get_fd() const;
+	const XBee_Reassembly_Stats& xbee_reassembly_stats() const;
+	const XBee_Frame_Parser_Stats& xbee_frame_stats() const;
+	const XBee_Address_Cache_Stats& xbee_address_cache_stats() const;
+	XBee_Message_Pool_Stats xbee_message_pool_stats() const;
+	const XBee_Tx_Stats& xbee_tx_stats() const;
+	void xbee_set_tx_window(uint8_t window);
+	void xbee_set_capture(XBee_Capture *capture);
+	/* sends an acknowledgement of the given ranges of message sequence
+	 * numbers to the node. It is sent without waiting for the transmit
+	 * status, the node sends messages again that were not acknowledged */
+	uint8_t xbee_send_ackn(const XBee_Address &addr, const AckRange *ranges, uint8_t range_cnt);
+	/* returns the number of AckRanges if the received message is an
+	 * acknowledgement of the base station and copies them to ranges
+	 * (MSG_MAX_ACK_RANGES), or 0 for other messages */
+	uint8_t xbee_receive_acknowledge(XBee_Message &msg, AckRange *ranges);
+	/* discards the multipart messages that timed out and requests the
+	 * missing parts that are due. This is done by xbee_receive_message(),
+	 * and has to be called periodically while nothing is received */
+	void xbee_housekeeping();
 private:
 	XBee(const XBee&);
 	XBee& operator=(const XBee&);
 
-	uint8_t xbee_send_ackn(const XBee_Address *addr);
-	uint8_t xbee_receive_acknowledge();
 	uint8_t xbee_configure_device();
+	uint8_t xbee_send_parts(XBee_Message &msg, const uint16_t *parts, uint16_t part_cnt);
+	uint8_t xbee_send_nack(const XBee_Nack &nack);
+	void xbee_send_nacks();
+	bool xbee_receive_nack(XBee_Message &msg);
+	XBee_Message* xbee_cached_message(uint64_t addr64, uint8_t sequence);
+	XBee_Message* xbee_take_received();
+	XBee_Message* xbee_receive_part(const GBeeFrameData *frame, uint16_t length);
+	GBeeError xbee_receive_frame(const GBeeFrameData **frame, uint16_t *length, uint32_t *timeout);
 	uint8_t* at_cmd_str(const string at_cmd_str);
+	uint8_t next_tx_frame_id(const uint16_t *in_flight);
 
 	XBee_Config config;
-	XBee_Address *address_cache[XBEE_ADDR_CACHE_SIZE];
-	uint8_t address_cache_size;
+	XBee_Address_Cache address_cache;
 	GBee *gbee_handle;
+	XBee_Message_Pool message_pool;
+	XBee_Reassembly reassembly;
+	XBee_Frame_Parser frame_parser;
+	uint8_t tx_window;
+	uint8_t tx_frame_id;
+	XBee_Tx_Stats tx_stats;
+	XBee_Capture *capture;
+	std::vector<XBee_Nack> nacks;
+	/* messages that were completed while waiting for a transmit status,
+	 * they are handed out by the next xbee_receive_message() calls */
+	std::deque<XBee_Message*> received;
+	/* the last sent messages with a version 2 header, oldest first */
+	std::vector<XBee_Message*> retransmit_cache;
+	/* next sequence number of version 2 messages, by 64bit address of
+	 * the destination */
+	std::unordered_map<uint64_t, uint8_t> tx_sequences;
 };
 
 class XBee_Message {
 friend class XBee;
+friend class XBee_Message_Pool;
+friend class XBee_Reassembly;
+friend void xbee_free_message(XBee_Message *msg);
 public:
 	XBee_Message(const XBee_Address& addr, const uint8_t *payload, uint16_t length);
 	XBee_Message(const GBeeRxPacket *message);
 	XBee_Message();
 	XBee_Message(const XBee_Message& msg);
 	XBee_Message& operator=(const XBee_Message &msg);
+	/* moving a message hands over its buffers without copying them */
+	XBee_Message(XBee_Message&& msg) noexcept;
+	XBee_Message& operator=(XBee_Message &&msg) noexcept;
 	~XBee_Message();
 
 	const XBee_Address& get_address() const;
 	uint8_t* get_payload(uint16_t *length);
 	bool is_complete() const;
+	/* sequence number of the message in the header of its parts. A version
+	 * 2 message without one gets the next number of its destination when
+	 * it's sent */
+	uint8_t get_sequence() const;
+	void set_sequence(uint8_t sequence);
+	/* header the parts are sent with, MSG_HEADER_V1 or MSG_HEADER_V2 */
+	uint8_t get_header_version() const;
+	void set_header_version(uint8_t version);
+	/* monotonic time (CLOCK_MONOTONIC) the first part of a received
+	 * message arrived, in microseconds */
+	int64_t get_receive_time_us() const;
+	/* the trace of a sampled message, the message does not own it */
+	Message_Trace* get_trace() const;
+	void set_trace(Message_Trace *trace);
 private:
 	bool append_msg(const XBee_Message &msg);
 	bool append_msg(const GBeeRxPacket *message);
+	bool append_part(const XBee_Address &addr, uint8_t part, uint8_t part_cnt,
+		uint8_t sequence, const uint8_t *part_payload, uint16_t part_len);
+	void release();
 	uint8_t* get_msg(uint16_t part);
 	uint16_t get_msg_len(uint16_t part);
+	uint16_t get_header_len() const;
+	uint16_t get_part_payload_len() const;
 	uint8_t* allocate_msg_buffer(uint16_t payload_length);
 
 	XBee_Address address;
 	uint8_t *message_buffer;
 	uint8_t *payload;
 	uint16_t payload_len;
-	uint8_t message_part;
+	uint16_t payload_capacity;	/* allocated size of the payload buffer */
+	uint16_t message_part;
 	uint16_t message_part_cnt;
+	uint8_t sequence;
+	bool sequence_set;	/* by the sender, or from the received header */
+	uint8_t header_version;
 	bool message_complete;
+	XBee_Message_Pool *pool;	/* pool the message belongs to, or NULL */
+	int64_t receive_us;
+	Message_Trace *trace;
 };
 
 
@@ -0,0 +1,905 @@
+/* This file is part of Equine Monitor
+ *
+ * Equine Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Equine Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Equine Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Author: Konke Radlow <koradlow@gmail.com>
+ */
+
+/* simulator of a XBee radio in API mode, for running the controller and the
+ * test app without hardware. It opens a pseudo terminal and speaks the API
+ * frame protocol on it:
+ * 	- AT commands (ID, NI, NH, BD, AI, SM, DN, WR, AC) are answered from a
+ * 	  register set, DN resolves the simulated nodes
+ * 	- TX requests are answered with a TX status, a share of them can fail.
+ * 	  Each part occupies the radio for the airtime, and its status is sent
+ * 	  after the status delay (time for the ack of the destination)
+ * 	- RX packets are injected for a number of simulated nodes, that send
+ * 	  sensor messages at a fixed interval, or as described by a script
+ * 	- as load generator it simulates a herd of monitoring devices. Each
+ * 	  device samples heart rate, temperature, accelerometer and GPS with
+ * 	  the given rates, and sends the samples of each sensor once per
+ * 	  message period. The offered load is reported every second, together
+ * 	  with the ingest rate of the controller, if the path of its db is given
+ * 	- the parts can be sent with the version 2 header, and a share of them
+ * 	  can be lost. NACKs of the host are answered with the missing parts
+ * Messages are serialized with MessageStorage::serialize and split into
+ * parts like XBee_Message does it. Injection starts a second after the first
+ * frame received from the host, so no data is queued before it's connected
+ * and the host can configure the device without interruption.
+ * usage: sim [-l link] [-n node_cnt] [-i interval_ms] [-s script] [-f fail_pct]
+ * 	[-a airtime_ms] [-t status_delay_ms] [-d duration_s] [-e (escaped mode)]
+ * 	[-H herd_size] [-r heart,temp,accel,gps (rates in Hz)] [-p period_ms] [-D db]
+ * 	[-2 (version 2 header)] [-L loss_pct]
+ * The script has one message per line: <time_ms> <node> <type> <sample_cnt | text>
+ * with type heart, temp, accel, gps or debug */
+
+#include "xbee_if.h"
+#include "xbee_frame_parser.h"
+#include "messagetypes.h"
+#include "messagestorage.h"
+#include <sqlite3.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <map>
+#include <string>
+#include <vector>
+
+/* first addresses of the simulated nodes */
+#define SIM_ADDR64_BASE 0x0013A20040000000ULL
+#define SIM_ADDR16_BASE 0x1000
+/* AT command status codes */
+#define SIM_AT_OK 0x00
+#define SIM_AT_ERROR 0x01
+#define SIM_AT_INVALID_COMMAND 0x02
+/* TX status codes */
+#define SIM_TX_SUCCESS 0x00
+#define SIM_TX_NO_ACK 0x21
+/* max samples of a random sensor message */
+#define SIM_MAX_SAMPLES 60
+/* max time the main loop sleeps */
+#define SIM_POLL_MS 100
+/* time between the first frame of the host and the first injected message */
+#define SIM_START_DELAY_MS 1000
+/* load generator: default sample rates (Hz) of the sensors, indexed by
+ * DeviceType, message period and report interval */
+#define SIM_RATE_GPS 1.0
+#define SIM_RATE_ACCELEROMETER 10.0
+#define SIM_RATE_TEMPERATURE 0.2
+#define SIM_RATE_HEART_RATE 1.0
+#define SIM_SENSOR_CNT 4
+#define SIM_PERIOD_MS 1000
+#define SIM_REPORT_MS 1000
+/* bytes per second of a 115200 baud serial link */
+#define SIM_SERIAL_BYTES_PER_S (115200 / 10)
+/* sent messages per node, whose parts can be requested by a NACK */
+#define SIM_RECENT_MSGS 8
+
+static volatile sig_atomic_t running = 1;
+
+static void signal_handler(int sig) {
+	running = 0;
+}
+
+static uint32_t now_ms() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/* a message that is injected at a given time */
+typedef struct {
+	uint32_t time_ms;
+	std::string node;
+	DeviceType type;
+	bool debug;
+	uint8_t sample_cnt;
+	std::string text;
+} Sim_Event;
+
+typedef struct {
+	std::string name;
+	uint64_t addr64;
+	uint16_t addr16;
+	uint32_t next_ms;	/* time of the next random message or period */
+	bool herd;		/* node is a monitoring device of the herd */
+	double pending[SIM_SENSOR_CNT];	/* samples not sent yet */
+	uint32_t sent_msgs;
+	uint32_t received_parts;
+	uint8_t next_sequence;	/* sequence number of the next message */
+	uint32_t acked_msgs;	/* messages acknowledged by the controller */
+	/* serialized recent messages, indexed by sequence % SIM_RECENT_MSGS */
+	std::vector<uint8_t> recent[SIM_RECENT_MSGS];
+} Sim_Node;
+
+/* a TX status that is sent when the transmission is done */
+typedef struct {
+	uint32_t time_ms;
+	uint8_t frame[7];
+} Sim_Status;
+
+typedef struct {
+	uint32_t frames_in;
+	uint32_t at_commands;
+	uint32_t tx_requests;
+	uint32_t tx_failed;
+	uint32_t acks;
+	uint32_t nacks;
+	uint32_t messages_out;
+	uint32_t parts_out;
+	uint32_t parts_lost;
+	uint32_t parts_resent;
+	uint64_t bytes_out;
+	uint64_t samples_out;
+} Sim_Stats;
+
+class XBee_Sim {
+public:
+	XBee_Sim(bool escaped, uint8_t fail_pct, uint32_t airtime_ms, uint32_t status_delay_ms,
+		uint8_t header_version, uint8_t loss_pct);
+	~XBee_Sim();
+
+	bool open_pty(const char *link);
+	void add_random_nodes(uint16_t node_cnt, uint32_t interval_ms);
+	void add_herd(uint16_t herd_size, const double *rates, uint32_t period_ms);
+	void set_ingest_db(const char *path);
+	bool load_script(const char *path);
+	void run(uint32_t duration_ms);
+	void print_stats() const;
+private:
+	Sim_Node& get_node(const std::string &name);
+	void handle_frame(const XBee_Frame &frame);
+	void handle_at_command(const uint8_t *data, uint16_t length);
+	void handle_tx_request(const uint8_t *data, uint16_t length);
+	void count_acks(Sim_Node &node, const uint8_t *msg, uint16_t length);
+	void handle_nack(Sim_Node &node, const uint8_t *msg, uint16_t length);
+	void send_due_status();
+	void inject_due(uint32_t now);
+	void inject_herd(Sim_Node &node);
+	void inject_message(Sim_Node &node, const Sim_Event &event);
+	void inject_part(const Sim_Node &node, uint8_t sequence, uint16_t part);
+	uint16_t count_parts(uint16_t length) const;
+	int64_t count_stored_samples();
+	void report(uint32_t now);
+	void send_frame(const uint8_t *data, uint16_t length);
+	void put_byte(uint8_t byte);
+
+	int master;
+	int slave;		/* kept open, so the master never sees a hangup */
+	bool escaped;
+	uint8_t fail_pct;
+	const uint32_t airtime_ms;
+	const uint32_t status_delay_ms;
+	const uint8_t header_version;	/* MSG_HEADER_V1 or MSG_HEADER_V2 */
+	const uint8_t loss_pct;		/* share of the injected parts that is lost */
+	uint32_t radio_free_ms;	/* end of the last transmission */
+	bool host_seen;
+	uint32_t start_ms;
+	uint32_t interval_ms;	/* interval of the random messages, 0 = off */
+	uint32_t period_ms;	/* message period of the herd, 0 = off */
+	double rates[SIM_SENSOR_CNT];
+
+	/* ingest measurement, reads the db of the controller */
+	std::string db_path;
+	sqlite3 *db;
+	uint32_t last_report_ms;
+	Sim_Stats last_stats;
+	int64_t last_stored;
+
+	XBee_Frame_Parser parser;
+	std::vector<Sim_Node> nodes;
+	std::vector<Sim_Event> script;
+	std::vector<Sim_Status> pending_status;
+	size_t script_pos;
+	std::map<std::string, std::vector<uint8_t> > registers;
+	std::vector<uint8_t> out;
+	Sim_Stats stats;
+};
+
+XBee_Sim::XBee_Sim(bool escaped, uint8_t fail_pct, uint32_t airtime_ms, uint32_t status_delay_ms,
+		uint8_t header_version, uint8_t loss_pct) :
+	master(-1),
+	slave(-1),
+	escaped(escaped),
+	fail_pct(fail_pct),
+	airtime_ms(airtime_ms),
+	status_delay_ms(status_delay_ms),
+	header_version(header_version),
+	loss_pct(loss_pct),
+	radio_free_ms(0),
+	host_seen(false),
+	start_ms(0),
+	interval_ms(0),
+	period_ms(0),
+	db(NULL),
+	last_report_ms(0),
+	last_stored(-1),
+	parser(UINT8_MAX + 1, XBEE_FRAME_SLOTS, escaped),
+	script_pos(0)
+{
+	const uint8_t pan_id[8] = {0};
+	const uint8_t baud[4] = {0, 0, 0, B115200};
+	const std::string node_id = "coordinator";
+
+	memset(&stats, 0, sizeof(stats));
+	memset(&last_stats, 0, sizeof(last_stats));
+	memset(rates, 0, sizeof(rates));
+	registers["ID"] = std::vector<uint8_t>(pan_id, pan_id + sizeof(pan_id));
+	registers["NI"] = std::vector<uint8_t>(node_id.begin(), node_id.end());
+	registers["NH"] = std::vector<uint8_t>(1, 0x1E);
+	registers["BD"] = std::vector<uint8_t>(baud, baud + sizeof(baud));
+	registers["AI"] = std::vector<uint8_t>(1, 0x00);	/* joined network */
+	registers["SM"] = std::vector<uint8_t>(1, 0x00);
+}
+
+XBee_Sim::~XBee_Sim() {
+	if (db)
+		sqlite3_close(db);
+	if (slave >= 0)
+		close(slave);
+	if (master >= 0)
+		close(master);
+}
+
+/* opens the pty pair, the slave side is the serial port of the host. If
+ * link is given, a symlink to the slave is created for the config file */
+bool XBee_Sim::open_pty(const char *link) {
+	char slave_name[64];
+	master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (master < 0 || grantpt(master) || unlockpt(master) ||
+	    ptsname_r(master, slave_name, sizeof(slave_name))) {
+		perror("Error creating pty");
+		return false;
+	}
+	slave = open(slave_name, O_RDWR | O_NOCTTY);
+	if (link) {
+		unlink(link);
+		if (symlink(slave_name, link)) {
+			perror("Error creating link");
+			return false;
+		}
+	}
+	printf("XBee simulator listening on %s%s%s\n", slave_name,
+		link ? " -> " : "", link ? link : "");
+	return true;
+}
+
+/* returns the node with the name, it's created if it doesn't exist */
+Sim_Node& XBee_Sim::get_node(const std::string &name) {
+	for (size_t i = 0; i < nodes.size(); i++) {
+		if (nodes[i].name == name)
+			return nodes[i];
+	}
+	Sim_Node node;
+	node.name = name;
+	node.addr64 = SIM_ADDR64_BASE + nodes.size();
+	node.addr16 = SIM_ADDR16_BASE + nodes.size();
+	node.next_ms = 0;
+	node.herd = false;
+	memset(node.pending, 0, sizeof(node.pending));
+	node.sent_msgs = 0;
+	node.received_parts = 0;
+	node.next_sequence = 0;
+	node.acked_msgs = 0;
+	nodes.push_back(node);
+	return nodes.back();
+}
+
+/* adds nodes that send a random sensor message every interval. The start
+ * times are spread over the interval */
+void XBee_Sim::add_random_nodes(uint16_t node_cnt, uint32_t interval_ms) {
+	char name[21];
+	this->interval_ms = interval_ms;
+	for (uint16_t i = 0; i < node_cnt; i++) {
+		snprintf(name, sizeof(name), "node%u", i);
+		get_node(name).next_ms = interval_ms * i / node_cnt;
+	}
+}
+
+/* adds the monitoring devices of the herd. The start of their message
+ * periods is spread over the period */
+void XBee_Sim::add_herd(uint16_t herd_size, const double *rates, uint32_t period_ms) {
+	char name[21];
+	this->period_ms = period_ms;
+	memcpy(this->rates, rates, sizeof(this->rates));
+	for (uint16_t i = 0; i < herd_size; i++) {
+		snprintf(name, sizeof(name), "horse%u", i);
+		Sim_Node &node = get_node(name);
+		node.herd = true;
+		node.next_ms = period_ms * i / herd_size;
+	}
+}
+
+/* sets the db of the controller, the stored samples are counted for the
+ * ingest rate in the reports */
+void XBee_Sim::set_ingest_db(const char *path) {
+	db_path = path;
+}
+
+bool XBee_Sim::load_script(const char *path) {
+	static const char *types[] = {"gps", "accel", "temp", "heart"};
+	char line[256], node[32], type[16], arg[200];
+	FILE *file = fopen(path, "r");
+	if (!file) {
+		perror("Error opening script");
+		return false;
+	}
+	while (fgets(line, sizeof(line), file)) {
+		Sim_Event event;
+		if (line[0] == '#' || sscanf(line, "%u %31s %15s %199[^\n]", &event.time_ms,
+		    node, type, arg) != 4)
+			continue;
+		event.node = node;
+		event.debug = !strcmp(type, "debug");
+		event.type = typeHeartRate;
+		event.sample_cnt = 0;
+		if (event.debug) {
+			event.text = arg;
+		} else {
+			for (int i = 0; i < 4; i++) {
+				if (!strcmp(type, types[i]))
+					event.type = (DeviceType) i;
+			}
+			event.sample_cnt = strtoul(arg, NULL, 0);
+		}
+		get_node(event.node);
+		script.push_back(event);
+	}
+	fclose(file);
+	return true;
+}
+
+void XBee_Sim::run(uint32_t duration_ms) {
+	struct pollfd pfd;
+	XBee_Frame frame;
+
+	pfd.fd = master;
+	pfd.events = POLLIN;
+	while (running) {
+		/* wake up in time for the next TX status */
+		int timeout = SIM_POLL_MS;
+		for (size_t i = 0; i < pending_status.size(); i++) {
+			int32_t due = pending_status[i].time_ms - now_ms();
+			timeout = due < 0 ? 0 : (due < timeout ? due : timeout);
+		}
+		if (poll(&pfd, 1, timeout) > 0 && parser.read_from(master) < 0) {
+			perror("Error reading from pty");
+			break;
+		}
+		while (parser.next_frame(&frame))
+			handle_frame(frame);
+		send_due_status();
+
+		if (!host_seen || (int32_t)(now_ms() - start_ms) < 0)
+			continue;
+		uint32_t now = now_ms() - start_ms;
+		if (duration_ms && now >= duration_ms)
+			break;
+		inject_due(now);
+		if ((period_ms || !db_path.empty()) && now - last_report_ms >= SIM_REPORT_MS)
+			report(now);
+	}
+}
+
+void XBee_Sim::handle_frame(const XBee_Frame &frame) {
+	stats.frames_in++;
+	if (!host_seen) {
+		host_seen = true;
+		start_ms = now_ms() + SIM_START_DELAY_MS;
+	}
+	switch (frame.data[0]) {
+	case GBEE_AT_COMMAND:
+		handle_at_command(frame.data, frame.length);
+		break;
+	case GBEE_TX_REQUEST:
+		handle_tx_request(frame.data, frame.length);
+		break;
+	default:
+		printf("Ignoring frame with ident %02x\n", frame.data[0]);
+	}
+}
+
+/* AT command frame: ident, frame id, command (2), value. Commands with a
+ * value set the register, the others read it */
+void XBee_Sim::handle_at_command(const uint8_t *data, uint16_t length) {
+	uint8_t response[UINT8_MAX + 1];
+	uint16_t response_len = 5;
+	std::string command((const char*) &data[2], 2);
+	uint8_t status = SIM_AT_OK;
+
+	stats.at_commands++;
+	if (length < 4)
+		return;
+	if (command == "WR" || command == "AC") {
+		/* nothing to write or apply */
+	} else if (command == "DN") {
+		/* the response contains the 16bit and 64bit address, big endian */
+		std::string name((const char*) &data[4], length - 4);
+		status = SIM_AT_ERROR;
+		for (size_t i = 0; i < nodes.size(); i++) {
+			if (nodes[i].name != name)
+				continue;
+			response[response_len++] = nodes[i].addr16 >> 8;
+			response[response_len++] = nodes[i].addr16 & 0xFF;
+			for (int b = 7; b >= 0; b--)
+				response[response_len++] = (nodes[i].addr64 >> (b * 8)) & 0xFF;
+			status = SIM_AT_OK;
+		}
+	} else if (registers.count(command)) {
+		std::vector<uint8_t> &value = registers[command];
+		if (length > 4)
+			value.assign(&data[4], &data[length]);
+		else if (!value.empty())
+			memcpy(&response[response_len], &value[0], value.size());
+		response_len += length > 4 ? 0 : value.size();
+	} else {
+		status = SIM_AT_INVALID_COMMAND;
+	}
+
+	response[0] = GBEE_AT_COMMAND_RESPONSE;
+	response[1] = data[1];
+	response[2] = data[2];
+	response[3] = data[3];
+	response[4] = status;
+	/* frame id 0 disables the response */
+	if (data[1])
+		send_frame(response, response_len);
+}
+
+/* TX request frame: ident, frame id, addr64 (8), addr16 (2), radius,
+ * options, data. The status reports the 16bit address of the destination */
+void XBee_Sim::handle_tx_request(const uint8_t *data, uint16_t length) {
+	uint8_t response[7];
+	uint64_t addr64 = 0;
+	uint16_t addr16 = 0xFFFE;
+
+	stats.tx_requests++;
+	if (length < 14)
+		return;
+	for (int b = 0; b < 8; b++)
+		addr64 = (addr64 << 8) | data[2 + b];
+	for (size_t i = 0; i < nodes.size(); i++) {
+		if (nodes[i].addr64 == addr64) {
+			addr16 = nodes[i].addr16;
+			nodes[i].received_parts++;
+			count_acks(nodes[i], &data[14], length - 14);
+			handle_nack(nodes[i], &data[14], length - 14);
+		}
+	}
+
+	response[0] = GBEE_TX_STATUS_NEW;
+	response[1] = data[1];
+	response[2] = addr16 >> 8;
+	response[3] = addr16 & 0xFF;
+	response[4] = 0;	/* retry count */
+	response[5] = SIM_TX_SUCCESS;
+	response[6] = 0;	/* discovery status */
+	if (addr16 == 0xFFFE || (uint32_t)(rand() % 100) < fail_pct) {
+		response[5] = SIM_TX_NO_ACK;
+		stats.tx_failed++;
+	}
+	if (!data[1])
+		return;
+
+	/* the parts are transmitted one after the other */
+	Sim_Status status;
+	uint32_t now = now_ms();
+	if ((int32_t)(radio_free_ms - now) < 0)
+		radio_free_ms = now;
+	radio_free_ms += airtime_ms;
+	status.time_ms = radio_free_ms + status_delay_ms;
+	memcpy(status.frame, response, sizeof(response));
+	pending_status.push_back(status);
+	send_due_status();
+}
+
+/* counts the messages acknowledged by an acknowledgement of the controller,
+ * the payload is the XBee message with its header */
+void XBee_Sim::count_acks(Sim_Node &node, const uint8_t *msg, uint16_t length) {
+	/* serialized MessagePacket header and the arrayLength of the AckMessage */
+	const uint16_t array_offset = MSG_HEADER_LENGTH + 1 + sizeof(uint32_t) + 1;
+
+	if (length < array_offset || msg[MSG_PART_CNT] != 1 || msg[MSG_HEADER_LENGTH] != msgAck)
+		return;
+	uint8_t range_cnt = msg[array_offset - 1];
+	if (length < array_offset + range_cnt * sizeof(AckRange))
+		return;
+	const AckRange *ranges = (const AckRange*) &msg[array_offset];
+	for (uint8_t i = 0; i < range_cnt; i++)
+		node.acked_msgs += ranges[i].count;
+	stats.acks++;
+}
+
+/* injects the parts requested by a NACK of the controller again, if the
+ * message is one of the recent messages of the node */
+void XBee_Sim::handle_nack(Sim_Node &node, const uint8_t *msg, uint16_t length) {
+	/* serialized MessagePacket header and the NackMessage without the bitmap */
+	const uint16_t bitmap_offset = MSG_HEADER_LENGTH + 1 + sizeof(uint32_t) +
+		sizeof(NackMessage) - sizeof(void*);
+	NackMessage nack;
+
+	if (length < bitmap_offset || msg[MSG_PART_CNT] != 1 || msg[MSG_HEADER_LENGTH] != msgNack)
+		return;
+	memcpy(&nack, &msg[MSG_HEADER_LENGTH + 1 + sizeof(uint32_t)],
+		sizeof(NackMessage) - sizeof(void*));
+	if (length < bitmap_offset + nack.arrayLength)
+		return;
+	stats.nacks++;
+	/* the message was overwritten by a newer one */
+	if ((uint8_t)(node.next_sequence - nack.sequence - 1) >= SIM_RECENT_MSGS)
+		return;
+	for (uint16_t i = 0; i < nack.arrayLength * 8; i++) {
+		if (msg[bitmap_offset + i / 8] & (1 << (i % 8))) {
+			inject_part(node, nack.sequence, nack.firstPart + i);
+			stats.parts_resent++;
+		}
+	}
+}
+
+/* sends the TX status frames of the transmissions that are done */
+void XBee_Sim::send_due_status() {
+	uint32_t now = now_ms();
+	for (size_t i = 0; i < pending_status.size();) {
+		if ((int32_t)(pending_status[i].time_ms - now) > 0) {
+			i++;
+			continue;
+		}
+		send_frame(pending_status[i].frame, sizeof(pending_status[i].frame));
+		pending_status.erase(pending_status.begin() + i);
+	}
+}
+
+/* injects the scripted messages and the random messages that are due */
+void XBee_Sim::inject_due(uint32_t now) {
+	while (script_pos < script.size() && script[script_pos].time_ms <= now) {
+		const Sim_Event &event = script[script_pos++];
+		inject_message(get_node(event.node), event);
+	}
+	for (size_t i = 0; i < nodes.size(); i++) {
+		if (nodes[i].next_ms > now)
+			continue;
+		if (nodes[i].herd) {
+			inject_herd(nodes[i]);
+			nodes[i].next_ms += period_ms;
+			continue;
+		}
+		if (!interval_ms)
+			continue;
+		Sim_Event event;
+		event.time_ms = now;
+		event.node = nodes[i].name;
+		event.debug = false;
+		event.type = (DeviceType)(rand() % 4);
+		event.sample_cnt = 1 + rand() % SIM_MAX_SAMPLES;
+		inject_message(nodes[i], event);
+		nodes[i].next_ms += interval_ms;
+	}
+}
+
+/* sends the samples of each sensor of a herd device, that were taken during
+ * the last message period. Fractions of samples are carried over to the next
+ * period, a message holds at most UINT8_MAX samples */
+void XBee_Sim::inject_herd(Sim_Node &node) {
+	for (int type = 0; type < SIM_SENSOR_CNT; type++) {
+		node.pending[type] += rates[type] * period_ms / 1000.0;
+		while (node.pending[type] >= 1.0) {
+			Sim_Event event;
+			event.time_ms = node.next_ms;
+			event.node = node.name;
+			event.debug = false;
+			event.type = (DeviceType) type;
+			event.sample_cnt = node.pending[type] > UINT8_MAX ? UINT8_MAX : (uint8_t) node.pending[type];
+			node.pending[type] -= event.sample_cnt;
+			inject_message(node, event);
+		}
+	}
+}
+
+/* returns the number of samples in the sensor tables of the controller db,
+ * or -1 if it can't be read (yet). The rowid of the tables only grows, the
+ * max rowid is used instead of counting the rows */
+int64_t XBee_Sim::count_stored_samples() {
+	static const char *tables[] = {"sensorHeart", "sensorTemperature",
+		"sensorAccelerometer", "sensorGPS"};
+	int64_t stored = 0;
+
+	if (!db) {
+		if (sqlite3_open_v2(db_path.c_str(), &db, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK) {
+			sqlite3_close(db);
+			db = NULL;
+			return -1;
+		}
+		sqlite3_busy_timeout(db, 100);
+	}
+	for (unsigned i = 0; i < sizeof(tables) / sizeof(tables[0]); i++) {
+		sqlite3_stmt *stmt = NULL;
+		string sql = "SELECT COALESCE(MAX(rowid), 0) FROM " + string(tables[i]);
+		if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, NULL) != SQLITE_OK ||
+		    sqlite3_step(stmt) != SQLITE_ROW) {
+			sqlite3_finalize(stmt);
+			return -1;
+		}
+		stored += sqlite3_column_int64(stmt, 0);
+		sqlite3_finalize(stmt);
+	}
+	return stored;
+}
+
+/* prints the offered load since the last report, and the ingest rate */
+void XBee_Sim::report(uint32_t now) {
+	double interval_s = (now - last_report_ms) / 1000.0;
+	double bytes_s = (stats.bytes_out - last_stats.bytes_out) / interval_s;
+	double offered_s = (stats.samples_out - last_stats.samples_out) / interval_s;
+
+	printf("%6.1f s offered: %6.1f msg/s %8.1f samples/s %7.1f kB/s (%3.0f%% of 115200 baud)",
+		now / 1000.0, (stats.messages_out - last_stats.messages_out) / interval_s,
+		offered_s, bytes_s / 1000, 100.0 * bytes_s / SIM_SERIAL_BYTES_PER_S);
+	if (!db_path.empty()) {
+		int64_t stored = count_stored_samples();
+		if (stored >= 0 && last_stored >= 0)
+			printf(" | stored: %8.1f samples/s (%3.0f%%)", (stored - last_stored) / interval_s,
+				offered_s ? 100.0 * (stored - last_stored) / interval_s / offered_s : 0.0);
+		last_stored = stored;
+	}
+	printf("\n");
+	fflush(stdout);
+	last_stats = stats;
+	last_report_ms = now;
+}
+
+/* serializes a message with random samples and sends it as RX packets, split
+ * into parts of XBEE_MSG_LENGTH bytes with the message header. The message is
+ * kept for NACKs, lost parts are not sent */
+void XBee_Sim::inject_message(Sim_Node &node, const Sim_Event &event) {
+	uint8_t samples[UINT8_MAX * sizeof(AccelerometerMessage)];
+	uint8_t header[sizeof(SensorMessage)];
+	uint8_t data[sizeof(samples) + 64];
+	MessagePacket packet;
+	uint16_t length;
+	uint32_t now_s = (now_ms() - start_ms) / 1000;
+
+	packet.relTimestampS = now_s;
+	packet.payload = header;
+	if (event.debug) {
+		DebugMessage *debug = (DebugMessage*) header;
+		packet.mainType = msgDebug;
+		debug->timestampS = now_s;
+		debug->debugData = (uint8_t*) event.text.c_str();
+	} else {
+		SensorMessage *sensor = (SensorMessage*) header;
+		packet.mainType = msgSensorData;
+		sensor->sensorType = event.type;
+		sensor->endTimestampS = now_s;
+		sensor->sampleIntervalMs = 1000;
+		sensor->arrayLength = event.sample_cnt;
+		sensor->sensorMsgArray = samples;
+		for (uint8_t i = 0; i < event.sample_cnt; i++) {
+			switch (event.type) {
+			case typeHeartRate:
+				((HeartRateMessage*) samples)[i].bpm = 60 + rand() % 20;
+				break;
+			case typeRawTemperature:
+				((RawTemperatureMessage*) samples)[i].Vobj = rand() % 400 - 200;
+				((RawTemperatureMessage*) samples)[i].Tenv = 11000 + rand() % 2000;
+				break;
+			case typeAccelerometer:
+				((AccelerometerMessage*) samples)[i].x = rand() % 1024 - 512;
+				((AccelerometerMessage*) samples)[i].y = rand() % 1024 - 512;
+				((AccelerometerMessage*) samples)[i].z = rand() % 1024 - 512;
+				break;
+			default: {
+				GPSMessage *gps = &((GPSMessage*) samples)[i];
+				memset(gps, 0, sizeof(*gps));
+				gps->latitude.degree = 52;
+				gps->latitude.minute = rand() % 60;
+				gps->latitudeNorth = true;
+				gps->longitude.degree = 13;
+				gps->longitude.minute = rand() % 60;
+				gps->validPosFix = true;
+			}
+			}
+		}
+	}
+	length = MessageStorage::serialize(&packet, data);
+	node.recent[node.next_sequence % SIM_RECENT_MSGS].assign(data, data + length);
+
+	uint16_t part_cnt = count_parts(length);
+	for (uint16_t part = 1; part <= part_cnt; part++) {
+		if ((uint32_t)(rand() % 100) < loss_pct) {
+			stats.parts_lost++;
+			continue;
+		}
+		inject_part(node, node.next_sequence, part);
+	}
+	node.sent_msgs++;
+	node.next_sequence++;
+	stats.messages_out++;
+	stats.samples_out += event.debug ? 0 : event.sample_cnt;
+}
+
+/* returns the number of parts of a serialized message */
+uint16_t XBee_Sim::count_parts(uint16_t length) const {
+	uint8_t payload_len = header_version == MSG_HEADER_V2 ?
+		MSG_V2_PART_PAYLOAD_LENGTH : MSG_PART_PAYLOAD_LENGTH;
+	return (length + payload_len - 1) / payload_len;
+}
+
+/* sends a part of a recent message as RX packet, with the message header of
+ * the configured version */
+void XBee_Sim::inject_part(const Sim_Node &node, uint8_t sequence, uint16_t part) {
+	const std::vector<uint8_t> &data = node.recent[sequence % SIM_RECENT_MSGS];
+	uint8_t frame[XBEE_RX_PACKET_OVERHEAD + XBEE_MSG_LENGTH];
+	uint8_t *msg = &frame[XBEE_RX_PACKET_OVERHEAD];
+	uint8_t header_len = header_version == MSG_HEADER_V2 ?
+		MSG_V2_HEADER_LENGTH : MSG_HEADER_LENGTH;
+	uint16_t part_cnt = count_parts(data.size());
+
+	if (part < 1 || part > part_cnt)
+		return;
+	uint16_t offset = (part - 1) * (XBEE_MSG_LENGTH - header_len);
+	uint8_t part_len = part == part_cnt ? data.size() - offset : XBEE_MSG_LENGTH - header_len;
+
+	/* RX packet header: ident, addr64, addr16, options */
+	frame[0] = GBEE_RX_PACKET;
+	for (int b = 0; b < 8; b++)
+		frame[1 + b] = (node.addr64 >> ((7 - b) * 8)) & 0xFF;
+	frame[9] = node.addr16 >> 8;
+	frame[10] = node.addr16 & 0xFF;
+	frame[11] = 0x01;	/* packet acknowledged */
+
+	if (header_version == MSG_HEADER_V2) {
+		msg[MSG_PART] = MSG_V2_MARKER;
+		msg[MSG_V2_VERSION] = MSG_HEADER_V2;
+		msg[MSG_V2_PART] = part >> 8;
+		msg[MSG_V2_PART + 1] = part & 0xFF;
+		msg[MSG_V2_PART_CNT] = part_cnt >> 8;
+		msg[MSG_V2_PART_CNT + 1] = part_cnt & 0xFF;
+		msg[MSG_V2_SEQUENCE] = sequence;
+		msg[MSG_V2_PAYLOAD_LENGTH] = part_len;
+	} else {
+		msg[MSG_PART] = part;
+		msg[MSG_PART_CNT] = part_cnt;
+		msg[MSG_SEQUENCE] = sequence;
+		msg[MSG_PAYLOAD_LENGTH] = part_len;
+	}
+	memcpy(&msg[header_len], &data[offset], part_len);
+	send_frame(frame, XBEE_RX_PACKET_OVERHEAD + header_len + part_len);
+	stats.parts_out++;
+}
+
+/* appends a byte to the output buffer, escapes it if required */
+void XBee_Sim::put_byte(uint8_t byte) {
+	if (escaped && (byte == XBEE_FRAME_DELIMITER || byte == XBEE_FRAME_ESCAPE ||
+	    byte == XBEE_FRAME_XON || byte == XBEE_FRAME_XOFF)) {
+		out.push_back(XBEE_FRAME_ESCAPE);
+		byte ^= XBEE_FRAME_ESCAPE_XOR;
+	}
+	out.push_back(byte);
+}
+
+void XBee_Sim::send_frame(const uint8_t *data, uint16_t length) {
+	uint8_t checksum = 0;
+
+	out.clear();
+	out.push_back(XBEE_FRAME_DELIMITER);
+	put_byte(length >> 8);
+	put_byte(length & 0xFF);
+	for (uint16_t i = 0; i < length; i++) {
+		put_byte(data[i]);
+		checksum += data[i];
+	}
+	put_byte(0xFF - checksum);
+
+	size_t written = 0;
+	while (written < out.size()) {
+		ssize_t ret = write(master, &out[written], out.size() - written);
+		if (ret < 0) {
+			perror("Error writing to pty");
+			return;
+		}
+		written += ret;
+	}
+	stats.bytes_out += out.size();
+}
+
+void XBee_Sim::print_stats() const {
+	printf("Frames received: %u (%u AT commands, %u TX requests, %u failed, %u acks)\n",
+		stats.frames_in, stats.at_commands, stats.tx_requests, stats.tx_failed, stats.acks);
+	printf("Injected: %u messages in %u parts, %llu samples, %llu bytes\n", stats.messages_out,
+		stats.parts_out, (unsigned long long) stats.samples_out,
+		(unsigned long long) stats.bytes_out);
+	printf("Lost: %u parts, %u NACKs received, %u parts sent again\n", stats.parts_lost,
+		stats.nacks, stats.parts_resent);
+	for (size_t i = 0; i < nodes.size(); i++)
+		printf("  %-20s %04x %u messages sent, %u acknowledged, %u parts received\n",
+			nodes[i].name.c_str(), nodes[i].addr16, nodes[i].sent_msgs, nodes[i].acked_msgs,
+			nodes[i].received_parts);
+}
+
+int main(int argc, char **argv) {
+	const char *link = NULL;
+	const char *script = NULL;
+	int node_cnt = -1;
+	uint32_t interval_ms = 1000;
+	uint32_t duration_s = 0;
+	uint8_t fail_pct = 0;
+	uint32_t airtime_ms = 0;
+	uint32_t status_delay_ms = 0;
+	uint16_t herd_size = 0;
+	double rates[SIM_SENSOR_CNT] = {SIM_RATE_GPS, SIM_RATE_ACCELEROMETER,
+		SIM_RATE_TEMPERATURE, SIM_RATE_HEART_RATE};
+	uint32_t period_ms = SIM_PERIOD_MS;
+	const char *db_path = NULL;
+	bool escaped = false;
+	uint8_t header_version = MSG_HEADER_V1;
+	uint8_t loss_pct = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "l:n:i:s:f:a:t:d:eH:r:p:D:2L:")) != -1) {
+		switch (opt) {
+		case 'l': link = optarg; break;
+		case 'n': node_cnt = strtol(optarg, NULL, 0); break;
+		case 'i': interval_ms = strtoul(optarg, NULL, 0); break;
+		case 's': script = optarg; break;
+		case 'f': fail_pct = strtoul(optarg, NULL, 0); break;
+		case 'a': airtime_ms = strtoul(optarg, NULL, 0); break;
+		case 't': status_delay_ms = strtoul(optarg, NULL, 0); break;
+		case 'd': duration_s = strtoul(optarg, NULL, 0); break;
+		case 'e': escaped = true; break;
+		case 'H': herd_size = strtoul(optarg, NULL, 0); break;
+		case 'r':
+			/* the rates are given in the order heart, temp, accel, gps */
+			sscanf(optarg, "%lf,%lf,%lf,%lf", &rates[typeHeartRate],
+				&rates[typeRawTemperature], &rates[typeAccelerometer], &rates[typeGPS]);
+			break;
+		case 'p': period_ms = strtoul(optarg, NULL, 0); break;
+		case 'D': db_path = optarg; break;
+		case '2': header_version = MSG_HEADER_V2; break;
+		case 'L': loss_pct = strtoul(optarg, NULL, 0); break;
+		default:
+			printf("usage: %s [-l link] [-n node_cnt] [-i interval_ms] [-s script] "
+				"[-f fail_pct] [-a airtime_ms] [-t status_delay_ms] [-d duration_s] [-e] "
+				"[-H herd_size] [-r heart,temp,accel,gps] [-p period_ms] [-D db] [-2] [-L loss_pct]\n", argv[0]);
+			return 1;
+		}
+	}
+	signal(SIGINT, signal_handler);
+	signal(SIGTERM, signal_handler);
+
+	XBee_Sim sim(escaped, fail_pct, airtime_ms, status_delay_ms, header_version, loss_pct);
+	if (!sim.open_pty(link))
+		return 1;
+	if (script && !sim.load_script(script))
+		return 1;
+	/* a script or herd replaces the random nodes, unless they are
+	 * requested as well */
+	if (node_cnt < 0)
+		node_cnt = (script || herd_size) ? 0 : 10;
+	if (node_cnt > 0)
+		sim.add_random_nodes(node_cnt, interval_ms);
+	if (herd_size)
+		sim.add_herd(herd_size, rates, period_ms ? period_ms : SIM_PERIOD_MS);
+	if (db_path)
+		sim.set_ingest_db(db_path);
+	sim.run(duration_s * 1000);
+	sim.print_stats();
+	if (link)
+		unlink(link);
+	return 0;
+}